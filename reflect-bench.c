@@ -0,0 +1,163 @@
+#include "reflect.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct position
+{
+    double latitude;
+    double longitude;
+};
+
+struct order
+{
+    long id;
+    const char* customer;
+    const char* note;
+    int quantity;
+    unsigned flags;
+    double price;
+    struct position origin;
+    char currency[4];
+};
+
+static void usage(const char* program)
+{
+    fprintf(stderr,
+            "usage: %s [-n COUNT] [-t THREADS]\n"
+            "\n"
+            "Times serializing COUNT orders to JSON on one thread, then in parallel with 1, 2, 4,\n"
+            "... THREADS threads. The output goes to /dev/null.\n"
+            "\n"
+            "  -n COUNT    The number of orders, 1000000 by default.\n"
+            "  -t THREADS  The most threads to try, the number of online CPUs by default.\n",
+            program);
+}
+
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// Returns the best of three runs in seconds, or a negative number on error. threads is 0 for
+// reflect_serialize_array().
+static double measure(struct order* orders, size_t count, reflect_type_t* type, size_t threads)
+{
+    FILE* output = fopen("/dev/null", "w");
+    if (output == NULL)
+    {
+        return -1;
+    }
+
+    double best = -1;
+    for (int run = 0; run < 3; run++)
+    {
+        double start = now();
+        FILE* result =
+            threads == 0
+                ? reflect_serialize_array(REFLECT_SERIALIZER_JSON, orders, count, type, output)
+                : reflect_serialize_array_parallel(
+                      REFLECT_SERIALIZER_JSON, orders, count, type, output, threads);
+        fflush(output);
+        double elapsed = now() - start;
+
+        if (result == NULL)
+        {
+            best = -1;
+            break;
+        }
+        if (best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+
+    fclose(output);
+    return best;
+}
+
+int main(int argc, const char** argv)
+{
+    size_t count = 1000000;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = cpus > 0 ? cpus : 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            count = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            max_threads = strtoull(argv[++i], NULL, 10);
+        }
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (reflect_init(argc, argv) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    reflect_type_t type;
+    struct order* orders = calloc(count, sizeof(struct order));
+    if (reflect_type(&type, "order") == NULL || orders == NULL)
+    {
+        free(orders);
+        reflect_fini();
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        orders[i] = (struct order){
+            .id = i,
+            .customer = i % 2 ? "Ada \"The Countess\" Lovelace" : "Charles Babbage",
+            .note = i % 7 ? NULL : "leave at the\tback door",
+            .quantity = i % 100,
+            .flags = i & 0xff,
+            .price = i * 0.25,
+            .origin = {51.5 + i % 10, -0.12 - i % 5},
+            .currency = "GBP",
+        };
+    }
+
+    int status = EXIT_SUCCESS;
+    double sequential = measure(orders, count, &type, 0);
+    if (sequential < 0)
+    {
+        status = EXIT_FAILURE;
+    }
+    else
+    {
+        printf("%8s %10s %8s\n", "threads", "seconds", "speedup");
+        printf("%8s %10.3f %8.2f\n", "-", sequential, 1.0);
+    }
+
+    for (size_t threads = 1; status == EXIT_SUCCESS && threads <= max_threads;
+         threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2)
+    {
+        double elapsed = measure(orders, count, &type, threads);
+        if (elapsed < 0)
+        {
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        printf("%8zu %10.3f %8.2f\n", threads, elapsed, sequential / elapsed);
+    }
+
+    free(orders);
+    reflect_fini();
+    return status;
+}
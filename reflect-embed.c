@@ -0,0 +1,54 @@
+#include "reflect.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static void usage(const char* program)
+{
+    fprintf(stderr,
+            "usage: %s BINARY OUTPUT [TYPE...]\n"
+            "\n"
+            "Writes compact descriptors of the types, global variables and functions of BINARY to\n"
+            "OUTPUT, for every named type or only for each TYPE and the types it refers to. Add\n"
+            "them to a stripped copy of BINARY with\n"
+            "\n"
+            "  objcopy --add-section .reflect=OUTPUT STRIPPED\n",
+            program);
+}
+
+int main(int argc, const char** argv)
+{
+    if (argc < 3)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // The library reflects on the binary named by argv[0].
+    if (reflect_init(1, &argv[1]) != 0)
+    {
+        fprintf(stderr, "%s: cannot read debugging information\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    FILE* output = fopen(argv[2], "wb");
+    if (output == NULL)
+    {
+        perror(argv[2]);
+        reflect_fini();
+        return EXIT_FAILURE;
+    }
+
+    const char** types = argc > 3 ? &argv[3] : NULL;
+    size_t size = reflect_write_descriptors(output, types, argc - 3);
+
+    int status = EXIT_SUCCESS;
+    if (fclose(output) != 0 || size == 0)
+    {
+        fprintf(stderr, "%s: cannot write descriptors\n", argv[2]);
+        status = EXIT_FAILURE;
+    }
+
+    reflect_fini();
+    return status;
+}
@@ -0,0 +1,107 @@
+#include "reflect.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void usage(const char* program)
+{
+    fprintf(stderr,
+            "usage: %s [-f FORMAT] PID VARIABLE...\n"
+            "\n"
+            "Prints global variables of the running process PID and what they point to, without\n"
+            "stopping it. The caller must be allowed to ptrace PID.\n"
+            "\n"
+            "  -f FORMAT  json (the default), xml or c.\n",
+            program);
+}
+
+static const reflect_serializer_t* serializer_by_name(const char* name)
+{
+    if (strcmp(name, "json") == 0)
+    {
+        return REFLECT_SERIALIZER_JSON;
+    }
+    if (strcmp(name, "xml") == 0)
+    {
+        return REFLECT_SERIALIZER_XML;
+    }
+    if (strcmp(name, "c") == 0)
+    {
+        return REFLECT_SERIALIZER_C;
+    }
+    return NULL;
+}
+
+static int print_variables(const reflect_serializer_t* serializer,
+                           pid_t pid,
+                           const char** names,
+                           int count)
+{
+    int status = EXIT_SUCCESS;
+
+    for (int i = 0; i < count; i++)
+    {
+        reflect_var_t var;
+        reflect_type_t type;
+        uintptr_t address;
+        if (reflect_try_var(&var, names[i]) != 0 || reflect_var_type(&var, &type) == NULL ||
+            (address = reflect_var_remote_address(&var, pid)) == 0)
+        {
+            fprintf(stderr, "%s: no such variable\n", names[i]);
+            status = EXIT_FAILURE;
+            continue;
+        }
+
+        printf("%s = ", names[i]);
+        if (reflect_serialize_remote(serializer, pid, address, &type, stdout) == NULL)
+        {
+            printf("?");
+            status = EXIT_FAILURE;
+        }
+        printf("\n");
+    }
+
+    return status;
+}
+
+int main(int argc, const char** argv)
+{
+    const reflect_serializer_t* serializer = REFLECT_SERIALIZER_JSON;
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc &&
+            (serializer = serializer_by_name(argv[++i])) != NULL)
+        {
+            continue;
+        }
+
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (argc - i < 2)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    pid_t pid = strtol(argv[i], NULL, 10);
+
+    // The library reflects on the binary named by argv[0], here that of the process.
+    char exe[64];
+    snprintf(exe, sizeof(exe), "/proc/%d/exe", (int)pid);
+    const char* binary = exe;
+    if (pid <= 0 || reflect_init(1, &binary) != 0)
+    {
+        fprintf(stderr, "%s: cannot read debugging information\n", exe);
+        return EXIT_FAILURE;
+    }
+
+    int status = print_variables(serializer, pid, &argv[i + 1], argc - i - 1);
+
+    reflect_fini();
+    return status;
+}
@@ -0,0 +1,118 @@
+#include "reflect.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void usage(const char* program)
+{
+    fprintf(stderr,
+            "usage: %s [-n COUNT] [-v] BINARY [STRUCT...]\n"
+            "\n"
+            "Prints the layout of each STRUCT in BINARY, or ranks all structs by wasted bytes.\n"
+            "\n"
+            "  -n COUNT  Rank only the COUNT structs that waste the most.\n"
+            "  -v        Print the full layout of each ranked struct.\n",
+            program);
+}
+
+static int print_structs(const char** names, int count)
+{
+    int status = EXIT_SUCCESS;
+
+    for (int i = 0; i < count; i++)
+    {
+        reflect_type_t type;
+        reflect_layout_report_t report;
+        if (reflect_type(&type, names[i]) == NULL || reflect_layout_analyze(&type, &report) == NULL)
+        {
+            fprintf(stderr, "%s: no such struct\n", names[i]);
+            status = EXIT_FAILURE;
+            continue;
+        }
+
+        reflect_layout_print(&report, stdout);
+        reflect_layout_report_free(&report);
+    }
+
+    return status;
+}
+
+static int rank_structs(size_t limit, bool verbose)
+{
+    size_t count;
+    reflect_layout_report_t* reports = reflect_layout_rank(&count);
+    if (reports == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (!verbose)
+    {
+        printf("%8s %8s %8s %6s %6s  %s\n", "wasted", "size", "packed", "holes", "lines", "struct");
+    }
+
+    for (size_t i = 0; i < count && i < limit && reports[i].wasted != 0; i++)
+    {
+        reflect_layout_report_t* report = &reports[i];
+        if (verbose)
+        {
+            reflect_layout_print(report, stdout);
+            continue;
+        }
+
+        printf("%8zu %8zu %8zu %6zu %6zu  %s\n",
+               report->wasted,
+               report->size,
+               report->optimal_size,
+               report->holes,
+               report->cache_lines,
+               report->name);
+    }
+
+    reflect_layout_rank_free(reports, count);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, const char** argv)
+{
+    size_t limit = SIZE_MAX;
+    bool verbose = false;
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            limit = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-v") == 0)
+        {
+            verbose = true;
+        }
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (i == argc)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // The library reflects on the binary named by argv[0].
+    if (reflect_init(1, &argv[i]) != 0)
+    {
+        fprintf(stderr, "%s: cannot read debugging information\n", argv[i]);
+        return EXIT_FAILURE;
+    }
+
+    int status = i + 1 < argc ? print_structs(&argv[i + 1], argc - i - 1)
+                              : rank_structs(limit, verbose);
+
+    reflect_fini();
+    return status;
+}
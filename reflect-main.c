@@ -2,6 +2,8 @@
 
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 struct point
 {
@@ -23,28 +25,6 @@ struct person
     float weight;
 };
 
-#define print(x) reflect_pretty_print(&x, __func__, #x)
-
-#define new_a(T)                                                                                   \
-    (T[1])                                                                                         \
-    {                                                                                              \
-        {                                                                                          \
-        }                                                                                          \
-    }
-
-void reflect_pretty_print(const void* object, const char* func_name, const char* var_name)
-{
-    reflect_fn_t* fn = reflect_fn(new_a(reflect_fn_t), func_name);
-    reflect_var_t* var = reflect_fn_var_by_name(fn, var_name, new_a(reflect_var_t));
-    reflect_type_t* type = reflect_var_type(var, new_a(reflect_type_t));
-
-    // fprintf(stderr, "struct %s ", reflect_type_name(type));
-
-    reflect_serialize(REFLECT_SERIALIZER_XML, (void*)object, type, stdout);
-    // fputc('\n', stdout);
-    (void)object;
-}
-
 typedef struct person person_t;
 
 int main(int argc, const char** argv)
@@ -60,9 +40,12 @@ int main(int argc, const char** argv)
         .z = 3,
     };
 
+    // On the heap, so that sanitized builds check that the serializers read only the string.
+    char* last_name = strdup("Doe");
+
     struct person p = {
         .first_name = "John \"The Reaper\"",
-        .last_name = "Doe",
+        .last_name = last_name,
         .age = 69,
         .date_born = 33647585969,
         .obj_data = NULL,
@@ -71,7 +54,9 @@ int main(int argc, const char** argv)
         .cords = &point,
     };
 
-    print(p);
+    reflect_pretty_print(p);
+    reflect_pretty_print_to(p, REFLECT_SERIALIZER_JSON, stdout);
 
+    free(last_name);
     reflect_fini();
 }
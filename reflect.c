@@ -1,12 +1,26 @@
+#define _GNU_SOURCE
+
 #include "reflect.h"
 
 #include <dwarf.h>
+#include <elf.h>
 #include <elfutils/libdw.h>
 #include <fcntl.h>
+#include <float.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <link.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef LIBREFLECT_USE_EXCEPTIONS
@@ -35,40 +49,16 @@
 
 #define DIE_TO_REFLECT_OBJ(self, die, out)                                                         \
     out->_impl.domain = self->_impl.domain;                                                        \
-    out->_impl.offset = dwarf_dieoffset(die);                                                      \
+    out->_impl.offset = domain_dieoffset(self->_impl.domain, die);                                 \
     return out;
 
 #define REFLECT_OBJ_TO_DIE(self, die)                                                              \
-    if (dwarf_offdie((Dwarf*)self->_impl.domain, self->_impl.offset, die) == NULL)                 \
+    if (domain_offdie(self->_impl.domain, self->_impl.offset, die) == NULL)                        \
     {                                                                                              \
         REFLECT_RAISE(EINVAL);                                                                     \
     }
 
-#define OBJ_BY_NAME(self, dom, tag, name)                                                          \
-    NOT_NULL(self);                                                                                \
-    NOT_NULL(dom);                                                                                 \
-    NOT_NULL(name);                                                                                \
-    Dwarf_Die cu_die;                                                                              \
-    Dwarf_Die die;                                                                                 \
-    Dwarf_CU* cu = NULL;                                                                           \
-    while (dwarf_get_units((Dwarf*)dom, cu, &cu, NULL, NULL, &cu_die, NULL) == 0)                  \
-    {                                                                                              \
-        if (dwarf_child(&cu_die, &die) != 0)                                                       \
-        {                                                                                          \
-            REFLECT_RAISE(ENODATA);                                                                \
-        }                                                                                          \
-        while (dwarf_siblingof(&die, &die) == 0)                                                   \
-        {                                                                                          \
-            const char* die_name = dwarf_diename(&die);                                            \
-            if ((dwarf_tag(&die) == tag) && die_name != NULL && strcmp(die_name, name) == 0)       \
-            {                                                                                      \
-                self->_impl.domain = dom;                                                          \
-                self->_impl.offset = dwarf_dieoffset(&die);                                        \
-                return self;                                                                       \
-            }                                                                                      \
-        }                                                                                          \
-    }                                                                                              \
-    REFLECT_RAISE(ESRCH)
+#define DOMAIN_BLOB(dom)  (((struct domain*)(dom))->blob)
 
 void __libreflect_report_error(int error, const char* func)
 {
@@ -94,6 +84,9 @@ void __libreflect_report_error(int error, const char* func)
     case EFAULT:
         msg = "NULL argument would cause access violation";
         break;
+    case ENOMEM:
+        msg = "Out of memory";
+        break;
     default:
         return;
     }
@@ -101,353 +94,879 @@ void __libreflect_report_error(int error, const char* func)
     fprintf(stderr, "libreflect: %s at %s()\n", msg, func);
 }
 
-static bool obj_is(reflect_obj_t* self, int tag)
+/*
+ * Arenas
+ *
+ * All metadata owned by a domain (layouts, indexes, the domain itself) is bump-allocated from
+ * large chunks obtained from the allocator, mmap(2) by default. Nothing is freed individually;
+ * reflect_fini() releases whole chunks.
+ */
+
+#define ARENA_ALIGNMENT      16
+#define ARENA_MIN_CHUNK_SIZE (64 * 1024)
+#define ARENA_MAX_CHUNK_SIZE (1024 * 1024)
+
+enum arena_use
 {
-    Dwarf_Die die;
-    if (dwarf_offdie((Dwarf*)self->domain, self->offset, &die) == NULL)
-    {
-        return false;
-    }
-    return dwarf_tag(&die) == tag;
+    ARENA_USE_DOMAIN = 0,
+    ARENA_USE_LAYOUTS,
+    ARENA_USE_INDEXES,
+
+    // Caller data in a reflect_arena_t. Always overwritten by its owner, so it is not zeroed.
+    ARENA_USE_OBJECTS,
+    ARENA_USE_COUNT,
+};
+
+struct arena_chunk
+{
+    struct arena_chunk* next;
+    size_t size;
+    size_t used;
+    _Alignas(ARENA_ALIGNMENT) uint8_t data[];
+};
+
+struct arena
+{
+    reflect_allocator_t allocator;
+    struct arena_chunk* chunks;
+    size_t chunk_count;
+    size_t reserved;
+    size_t used[ARENA_USE_COUNT];
+};
+
+static void* allocator_mmap(size_t size, void* context)
+{
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    (void)context;
+    return memory == MAP_FAILED ? NULL : memory;
 }
 
-static Dwarf_Die* die_type(Dwarf_Die* die, Dwarf_Die* out)
+static void allocator_munmap(void* memory, size_t size, void* context)
 {
-    Dwarf_Attribute attr;
-    if (dwarf_attr(die, DW_AT_type, &attr) == NULL)
+    munmap(memory, size);
+    (void)context;
+}
+
+static const reflect_allocator_t libreflect_default_allocator = {
+    .allocate = allocator_mmap,
+    .release = allocator_munmap,
+};
+
+static reflect_allocator_t libreflect_allocator = {
+    .allocate = allocator_mmap,
+    .release = allocator_munmap,
+};
+
+// Returns zeroed memory, except for ARENA_USE_OBJECTS. The alignment must be a power of two no
+// larger than ARENA_ALIGNMENT.
+static void* arena_alloc_aligned(struct arena* self,
+                                 size_t size,
+                                 size_t alignment,
+                                 enum arena_use use)
+{
+    struct arena_chunk* chunk = self->chunks;
+    size_t start = chunk == NULL ? 0 : (chunk->used + alignment - 1) & ~(alignment - 1);
+
+    if (chunk == NULL || chunk->size < start || chunk->size - start < size)
     {
-        return NULL;
+        // Chunks grow with the arena so that big domains need few of them.
+        size_t chunk_size = self->reserved < ARENA_MIN_CHUNK_SIZE ? ARENA_MIN_CHUNK_SIZE
+                            : self->reserved < ARENA_MAX_CHUNK_SIZE ? self->reserved
+                                                                    : ARENA_MAX_CHUNK_SIZE;
+        if (chunk_size < size + sizeof(struct arena_chunk))
+        {
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            chunk_size = (size + sizeof(struct arena_chunk) + page - 1) & ~(page - 1);
+        }
+
+        chunk = self->allocator.allocate(chunk_size, self->allocator.context);
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+
+        // A fresh mapping is already zeroed, but user allocators need not be.
+        memset(chunk, 0, sizeof(struct arena_chunk));
+        chunk->size = chunk_size - sizeof(struct arena_chunk);
+
+        // Keep filling the current chunk if this one only serves a big allocation.
+        if (self->chunks != NULL && chunk->size - size < self->chunks->size - self->chunks->used)
+        {
+            chunk->next = self->chunks->next;
+            self->chunks->next = chunk;
+        }
+        else
+        {
+            chunk->next = self->chunks;
+            self->chunks = chunk;
+        }
+
+        self->chunk_count++;
+        self->reserved += chunk_size;
+        start = 0;
     }
 
-    if (dwarf_formref_die(&attr, out) == NULL)
+    void* memory = chunk->data + start;
+    self->used[use] += start + size - chunk->used;
+    chunk->used = start + size;
+
+    if (self->allocator.allocate != allocator_mmap && use != ARENA_USE_OBJECTS)
     {
-        return NULL;
+        memset(memory, 0, size);
     }
 
-    return out;
+    return memory;
 }
 
-static bool die_is_type(Dwarf_Die* die)
+static void* arena_alloc(struct arena* self, size_t size, enum arena_use use)
 {
-    switch (dwarf_tag(die))
-    {
-    case DW_TAG_base_type:
-    case DW_TAG_array_type:
-    case DW_TAG_union_type:
-    case DW_TAG_structure_type:
-    case DW_TAG_enumeration_type:
-    case DW_TAG_subroutine_type:
-    case DW_TAG_pointer_type:
-        return true;
-    default:
-        return false;
-    };
+    return arena_alloc_aligned(self, size, ARENA_ALIGNMENT, use);
 }
 
-static reflect_type_t* peel_type(reflect_type_t* type)
+static void arena_free(struct arena* self)
 {
-    if (type == NULL)
+    // The arena may live in one of its own chunks.
+    struct arena arena = *self;
+
+    struct arena_chunk* chunk = arena.chunks;
+    while (chunk != NULL)
     {
-        return NULL;
+        struct arena_chunk* next = chunk->next;
+        arena.allocator.release(
+            chunk, chunk->size + sizeof(struct arena_chunk), arena.allocator.context);
+        chunk = next;
     }
+}
 
-    Dwarf_Die die;
-    if (dwarf_offdie((Dwarf*)type->_impl.domain, type->_impl.offset, &die) == NULL)
+/*
+ * A minimal open addressing hash table keyed by non-zero 64 bit integers.
+ *
+ * Lookups take no locks and may run concurrently with a single writer: the slots and their
+ * capacity are published together, values are written before their keys, and slots replaced by a
+ * resize stay valid because they live in an arena.
+ */
+
+struct table_entry
+{
+    uint64_t key;
+    void* value;
+};
+
+struct table_slots
+{
+    size_t capacity;
+    struct table_entry entries[];
+};
+
+struct table
+{
+    struct table_slots* slots;
+    size_t count;
+};
+
+static size_t table_hash(uint64_t key)
+{
+    return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 17);
+}
+
+static void* table_get(struct table* self, uint64_t key)
+{
+    struct table_slots* slots = __atomic_load_n(&self->slots, __ATOMIC_ACQUIRE);
+    if (slots == NULL)
     {
         return NULL;
     }
 
-    Dwarf_Die result;
-    if (dwarf_peel_type(&die, &result) == -1)
+    for (size_t i = table_hash(key);; i++)
     {
-        return NULL;
+        struct table_entry* entry = &slots->entries[i & (slots->capacity - 1)];
+        uint64_t entry_key = __atomic_load_n(&entry->key, __ATOMIC_ACQUIRE);
+        if (entry_key == key)
+        {
+            return __atomic_load_n(&entry->value, __ATOMIC_RELAXED);
+        }
+        if (entry_key == 0)
+        {
+            return NULL;
+        }
     }
-
-    type->_impl.offset = dwarf_dieoffset(&result);
-    return type;
 }
 
-static const char* get_name(reflect_obj_t* obj)
+// The old slots are left in the arena when the table grows, which wastes at most as much as the
+// table itself uses.
+static bool table_put(struct table* self, struct arena* arena, uint64_t key, void* value)
 {
-    Dwarf_Die die;
-    if (dwarf_offdie((Dwarf*)obj->domain, obj->offset, &die) == NULL)
+    struct table_slots* slots = self->slots;
+    size_t capacity = slots == NULL ? 0 : slots->capacity;
+
+    if ((self->count + 1) * 4 > capacity * 3)
     {
-        return NULL;
+        size_t new_capacity = capacity == 0 ? 64 : capacity * 2;
+        struct table_slots* new_slots =
+            arena_alloc(arena,
+                        sizeof(struct table_slots) + new_capacity * sizeof(struct table_entry),
+                        ARENA_USE_INDEXES);
+        if (new_slots == NULL)
+        {
+            return false;
+        }
+
+        new_slots->capacity = new_capacity;
+
+        for (size_t i = 0; i < capacity; i++)
+        {
+            struct table_entry* old = &slots->entries[i];
+            if (old->key == 0)
+            {
+                continue;
+            }
+
+            size_t j = table_hash(old->key);
+            while (new_slots->entries[j & (new_capacity - 1)].key != 0)
+            {
+                j++;
+            }
+            new_slots->entries[j & (new_capacity - 1)] = *old;
+        }
+
+        __atomic_store_n(&self->slots, new_slots, __ATOMIC_RELEASE);
+        slots = new_slots;
+        capacity = new_capacity;
     }
 
-    const char* name = dwarf_diename(&die);
-    if (name == NULL)
+    for (size_t i = table_hash(key);; i++)
     {
-        return NULL;
+        struct table_entry* entry = &slots->entries[i & (capacity - 1)];
+        if (entry->key == 0 || entry->key == key)
+        {
+            self->count += entry->key == 0;
+            __atomic_store_n(&entry->value, value, __ATOMIC_RELAXED);
+            __atomic_store_n(&entry->key, key, __ATOMIC_RELEASE);
+            return true;
+        }
     }
-
-    return name;
 }
 
-static reflect_obj_t* get_type(reflect_obj_t* self, reflect_obj_t* out)
+/*
+ * Compact descriptors
+ *
+ * A stripped binary can carry the layouts of its types, its global variables and its functions in
+ * a .reflect section written by reflect_write_descriptors(). When a binary has no DWARF,
+ * reflect_init() loads that section instead and objects are identified by blob ids rather than
+ * DIE offsets. All offsets in the blob are from its start, names are offsets into the string
+ * table, and type ids are indexes into the type table plus one, 0 meaning none.
+ */
+
+#define BLOB_SECTION ".reflect"
+#define BLOB_MAGIC   "REFLECT1"
+
+// Blob ids carry the kind of record in their top bits. The payload is the index of the record plus
+// one, except for enumerators, which are identified by the offset of their record.
+#define BLOB_ID(kind, payload) (((uint64_t)(kind) << 40) | (payload))
+#define BLOB_ID_KIND(id)       ((id) >> 40)
+#define BLOB_ID_PAYLOAD(id)    ((id) & ((UINT64_C(1) << 40) - 1))
+
+#define BLOB_NO_NAME UINT32_MAX
+
+enum blob_kind
 {
-    Dwarf_Die obj_die;
-    if (dwarf_offdie((Dwarf*)self->domain, self->offset, &obj_die) == NULL)
+    BLOB_TYPE = 0,
+    BLOB_VARIABLE,
+    BLOB_FUNCTION,
+    BLOB_ENUMERATOR,
+};
+
+struct blob_header
+{
+    char magic[8];
+    uint32_t type_count;
+    uint32_t name_count;
+    uint32_t variable_count;
+    uint32_t function_count;
+    uint32_t types;
+    uint32_t names;
+    uint32_t variables;
+    uint32_t functions;
+    uint32_t strings;
+    uint32_t strings_size;
+};
+
+// Every record starts with its name. A type record is followed by its fields, enumerators or
+// dimensions, depending on its kind.
+struct blob_type
+{
+    uint32_t name;
+    uint8_t kind;
+    uint8_t repr;
+    uint16_t tag;
+    uint32_t target;
+    uint32_t count;
+    uint64_t size;
+};
+
+struct blob_field
+{
+    uint32_t name;
+    uint32_t type;
+    uint64_t offset;
+    uint64_t mask;
+    uint8_t bit_size;
+    uint8_t load_size;
+    uint8_t shift;
+    uint8_t sign_shift;
+    uint32_t reserved;
+};
+
+struct blob_enumerator
+{
+    uint32_t name;
+    uint32_t reserved;
+    int64_t value;
+};
+
+struct blob_variable
+{
+    uint32_t name;
+    uint32_t type;
+    uint64_t address;
+    uint64_t size;
+};
+
+struct blob_function
+{
+    uint32_t name;
+    uint32_t reserved;
+    uint64_t low;
+    uint64_t high;
+};
+
+// Sorted by name, then by id.
+struct blob_name
+{
+    uint32_t name;
+    uint32_t reserved;
+    uint64_t id;
+};
+
+// A .debug_gnu_pubnames or .debug_gnu_pubtypes section and the sorted offsets of the units it
+// covers. See pubnames_find().
+struct pubnames
+{
+    const uint8_t* data;
+    size_t size;
+    Dwarf_Off* units;
+    size_t unit_count;
+};
+
+struct domain
+{
+    Dwarf* dwarf;
+    struct arena arena;
+
+    // Serializes everything that builds metadata: libdw is not thread safe and neither are
+    // arenas. Lookups of metadata that already exists do not lock.
+    pthread_mutex_t lock;
+
+    // Layouts by type DIE offset, see layout_get().
+    struct table layouts;
+    size_t layout_count;
+
+    // Address indexes, see addr_index_get().
+    struct addr_index* functions;
+    struct addr_index* variables;
+    struct addr_index* units;
+
+    // Line table units by compilation unit DIE offset, and the resident line tables from the most
+    // to the least recently used. See line_table_get().
+    struct table lines;
+    struct line_table* lines_newest;
+    struct line_table* lines_oldest;
+    size_t lines_resident;
+    size_t lines_count;
+    size_t lines_evictions;
+    size_t lines_redecodes;
+
+    // The handle line programs are decoded with, the bytes of tables decoded through it so far,
+    // and the file names of their rows. See line_unit_die().
+    Dwarf* lines_dwarf;
+    size_t lines_dwarf_size;
+    struct table lines_files;
+
+    // Conversions from the headers of record streams, see record_plan_get().
+    struct record_plan** record_plans;
+    uint64_t record_plans_clock;
+
+    // The difference between runtime and link-time addresses, non-zero for PIE.
+    uintptr_t bias;
+    bool bias_known;
+
+    // Results of lookups by name, see name_lookup().
+    struct table names;
+    size_t name_misses;
+    struct pubnames pubnames;
+    struct pubnames pubtypes;
+
+    // Files of split units opened so far, and their numbers by Dwarf handle. See
+    // domain_offdie().
+    Dwarf** files;
+    size_t file_count;
+    size_t file_capacity;
+    struct table file_numbers;
+
+    // Compact descriptors, only when the binary has no DWARF. See blob_load().
+    const struct blob_header* blob;
+    size_t blob_size;
+};
+
+static const void* blob_at(const struct domain* domain, uint64_t offset, uint64_t size)
+{
+    if (offset > domain->blob_size || size > domain->blob_size - offset)
     {
         return NULL;
     }
 
-    Dwarf_Die type;
-    if (die_type(&obj_die, &type) == NULL)
+    return (const uint8_t*)domain->blob + offset;
+}
+
+static const char* blob_string(const struct domain* domain, uint32_t offset)
+{
+    const struct blob_header* header = domain->blob;
+    if (offset >= header->strings_size)
     {
         return NULL;
     }
 
-    out->domain = self->domain;
-    out->offset = dwarf_dieoffset(&type);
-    return out;
+    // blob_load() checked that the string table ends with a NUL.
+    return (const char*)header + header->strings + offset;
 }
 
-static reflect_obj_t* child_by_name(reflect_obj_t* obj,
-                                    int tag,
-                                    const char* name,
-                                    reflect_obj_t* out)
+static const void* blob_record(const struct domain* domain, uint64_t id)
 {
-    // Extract DWARF DIE from object.
-    Dwarf_Die obj_die;
-    if (dwarf_offdie((Dwarf*)obj->domain, obj->offset, &obj_die) == NULL)
+    const struct blob_header* header = domain->blob;
+    const uint8_t* base = (const uint8_t*)header;
+    uint64_t index = BLOB_ID_PAYLOAD(id) - 1;
+
+    switch (BLOB_ID_KIND(id))
     {
+    case BLOB_TYPE: {
+        const uint32_t* types = (const uint32_t*)(base + header->types);
+        return index < header->type_count ? blob_at(domain, types[index], sizeof(struct blob_type))
+                                          : NULL;
+    }
+    case BLOB_VARIABLE:
+        return index < header->variable_count
+                   ? (const struct blob_variable*)(base + header->variables) + index
+                   : NULL;
+    case BLOB_FUNCTION:
+        return index < header->function_count
+                   ? (const struct blob_function*)(base + header->functions) + index
+                   : NULL;
+    case BLOB_ENUMERATOR:
+        return BLOB_ID_PAYLOAD(id) % 8 == 0
+                   ? blob_at(domain, BLOB_ID_PAYLOAD(id), sizeof(struct blob_enumerator))
+                   : NULL;
+    default:
         return NULL;
     }
+}
 
-    // Extract child DIE.
-    Dwarf_Die child;
-    if (dwarf_child(&obj_die, &child) != 0)
+static const struct blob_type* blob_type_record(const struct domain* domain, uint64_t id)
+{
+    return BLOB_ID_KIND(id) == BLOB_TYPE ? blob_record(domain, id) : NULL;
+}
+
+static const char* blob_name(const struct domain* domain, uint64_t id)
+{
+    const uint32_t* name = blob_record(domain, id);
+    return name == NULL ? NULL : blob_string(domain, *name);
+}
+
+// Finds the first object of a kind with the given name.
+static uint64_t blob_find(const struct domain* domain, enum blob_kind kind, const char* name)
+{
+    const struct blob_header* header = domain->blob;
+    const struct blob_name* names =
+        (const struct blob_name*)((const uint8_t*)header + header->names);
+
+    size_t low = 0;
+    size_t high = header->name_count;
+    while (low < high)
     {
-        return NULL;
+        size_t middle = low + (high - low) / 2;
+        const char* middle_name = blob_string(domain, names[middle].name);
+        if (middle_name != NULL && strcmp(middle_name, name) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
     }
 
-    // Search
-    do
+    for (; low < header->name_count; low++)
     {
-        if (dwarf_tag(&child) == tag && strcmp(dwarf_diename(&child), name) == 0)
+        const char* found = blob_string(domain, names[low].name);
+        if (found == NULL || strcmp(found, name) != 0)
         {
-            out->domain = obj->domain;
-            out->offset = dwarf_dieoffset(&child);
-            return out;
+            break;
         }
-    } while (dwarf_siblingof(&child, &child) == 0);
 
-    return NULL;
+        if (BLOB_ID_KIND(names[low].id) == (uint64_t)kind)
+        {
+            return names[low].id;
+        }
+    }
+
+    return 0;
 }
 
-static reflect_obj_t* child_by_index(reflect_obj_t* obj, int tag, size_t index, reflect_obj_t* out)
+// The blob is checked once when it is loaded: the header, the bounds and alignment of every table
+// and the string table. Type records are checked as they are read.
+static bool blob_check(const struct domain* domain)
 {
-    // Extract DWARF DIE from object.
-    Dwarf_Die obj_die;
-    if (dwarf_offdie((Dwarf*)obj->domain, obj->offset, &obj_die) == NULL)
+    const struct blob_header* header = domain->blob;
+    if (domain->blob_size < sizeof(struct blob_header) ||
+        memcmp(header->magic, BLOB_MAGIC, sizeof(header->magic)) != 0)
     {
-        return NULL;
+        return false;
     }
 
-    // Extract child DIE.
-    Dwarf_Die child;
-    if (dwarf_child(&obj_die, &child) != 0)
+    const uint32_t* types =
+        blob_at(domain, header->types, (uint64_t)header->type_count * sizeof(uint32_t));
+    if (types == NULL || header->types % sizeof(uint32_t) != 0 || header->names % 8 != 0 ||
+        header->variables % 8 != 0 || header->functions % 8 != 0 ||
+        blob_at(domain, header->names, (uint64_t)header->name_count * sizeof(struct blob_name)) ==
+            NULL ||
+        blob_at(domain,
+                header->variables,
+                (uint64_t)header->variable_count * sizeof(struct blob_variable)) == NULL ||
+        blob_at(domain,
+                header->functions,
+                (uint64_t)header->function_count * sizeof(struct blob_function)) == NULL)
     {
-        return NULL;
+        return false;
     }
 
-    // Search
-    if (dwarf_tag(&child) == tag && index == 0)
+    const char* strings = blob_at(domain, header->strings, header->strings_size);
+    if (strings == NULL || header->strings_size == 0 || strings[header->strings_size - 1] != '\0')
     {
-        out->domain = obj->domain;
-        out->offset = dwarf_dieoffset(&child);
-        return out;
+        return false;
     }
 
-    for (size_t i = 1; dwarf_siblingof(&child, &child) == 0; i++)
+    for (size_t i = 0; i < header->type_count; i++)
     {
-        if (dwarf_tag(&child) == tag && index == i)
+        if (types[i] % 8 != 0)
         {
-            out->domain = obj->domain;
-            out->offset = dwarf_dieoffset(&child);
-            return out;
+            return false;
         }
     }
 
-    return NULL;
+    return true;
 }
 
-reflect_location_t* reflect_location(reflect_location_t* self, reflect_obj_t* target)
+// Reads the section with the given name into the arena, or returns NULL. Sections larger than
+// max_size or than the file are refused before anything is allocated.
+static void* elf_section_load(struct arena* arena,
+                              int fd,
+                              const char* name,
+                              size_t max_size,
+                              size_t* size)
 {
-    NOT_NULL(self);
-    NOT_NULL(target);
-
-    Dwarf_Die die;
-    if (dwarf_offdie((Dwarf*)target->domain, target->offset, &die) == NULL)
+    Elf64_Ehdr elf;
+    struct stat file;
+    if (fstat(fd, &file) != 0 || pread(fd, &elf, sizeof(elf), 0) != sizeof(elf) ||
+        memcmp(elf.e_ident, ELFMAG, SELFMAG) != 0 || elf.e_ident[EI_CLASS] != ELFCLASS64 ||
+        elf.e_shentsize != sizeof(Elf64_Shdr) || elf.e_shstrndx >= elf.e_shnum)
     {
-        REFLECT_RAISE(EINVAL);
+        return NULL;
     }
 
-    self->file = dwarf_decl_file(&die);
+    Elf64_Shdr names;
+    if (pread(fd, &names, sizeof(names), elf.e_shoff + elf.e_shstrndx * sizeof(Elf64_Shdr)) !=
+        sizeof(names))
+    {
+        return NULL;
+    }
 
-    if (self->file == NULL || dwarf_decl_line(&die, &self->line) != 0 ||
-        dwarf_decl_column(&die, &self->column) != 0)
+    size_t name_size = strlen(name) + 1;
+    char section_name[32];
+    if (name_size > sizeof(section_name))
     {
-        REFLECT_RAISE(ENODATA);
+        return NULL;
     }
 
-    return self;
-}
+    for (size_t i = 0; i < elf.e_shnum; i++)
+    {
+        Elf64_Shdr section;
+        if (pread(fd, &section, sizeof(section), elf.e_shoff + i * sizeof(Elf64_Shdr)) !=
+                sizeof(section) ||
+            section.sh_name >= names.sh_size || section.sh_type == SHT_NOBITS ||
+            pread(fd, section_name, name_size, names.sh_offset + section.sh_name) !=
+                (ssize_t)name_size ||
+            memcmp(section_name, name, name_size) != 0)
+        {
+            continue;
+        }
 
-// TODO: There should be a linked list of Dwarf* representing each loaded shared object.
-static Dwarf* libreflect_domain;
+        if (section.sh_size > max_size || section.sh_offset > (uint64_t)file.st_size ||
+            section.sh_size > (uint64_t)file.st_size - section.sh_offset)
+        {
+            return NULL;
+        }
 
-int reflect_init(int argc, const char* argv[])
-{
-    (void)argc;
+        void* data = arena_alloc(arena, section.sh_size, ARENA_USE_INDEXES);
+        if (data == NULL ||
+            pread(fd, data, section.sh_size, section.sh_offset) != (ssize_t)section.sh_size)
+        {
+            return NULL;
+        }
 
-    int fd = open(argv[0], O_RDONLY);
-    if (fd == -1)
-    {
-        REFLECT_RAISE(EBADF);
+        *size = section.sh_size;
+        return data;
     }
 
-    libreflect_domain = dwarf_begin(fd, DWARF_C_READ);
-    close(fd);
+    return NULL;
+}
 
-    if (libreflect_domain == NULL)
+static int blob_load(struct domain* domain, struct arena* arena, int fd)
+{
+    size_t size = 0;
+    void* blob = elf_section_load(arena, fd, BLOB_SECTION, UINT32_MAX, &size);
+    if (blob == NULL)
     {
-        REFLECT_RAISE(EMEDIUMTYPE);
+        return -1;
     }
 
-    return 0;
+    domain->blob = blob;
+    domain->blob_size = size;
+    return blob_check(domain) ? 0 : -1;
 }
 
-void reflect_fini()
+/*
+ * Split DWARF and type units
+ *
+ * With -gsplit-dwarf the program only holds skeleton units. The content of each unit is in a .dwo
+ * file or a .dwp package, which libdw opens when the split unit is first asked for. DIE offsets
+ * are only unique within one section of one file, so DIEs of split units carry the number of
+ * their file above DIE_FILE_SHIFT, numbered from 1 in the order the files are opened, and DIEs of
+ * DWARF 4 type units carry DIE_TYPES_SECTION. Blob ids use the same bits, but a domain has either
+ * DWARF or a blob.
+ */
+
+#define DIE_FILE_SHIFT    40
+#define DIE_FILE_MASK     ((UINT64_C(1) << 23) - 1)
+#define DIE_OFFSET_MASK   ((UINT64_C(1) << DIE_FILE_SHIFT) - 1)
+#define DIE_TYPES_SECTION (UINT64_C(1) << 63)
+
+static Dwarf_Die* domain_offdie(struct domain* domain, Dwarf_Off offset, Dwarf_Die* die)
 {
-    dwarf_end(libreflect_domain);
-}
+    Dwarf* dwarf = domain->dwarf;
 
-bool reflect_type_is_typedef(reflect_type_t* self)
-{
-    NOT_NULL(self);
-    return obj_is(&self->_impl, DW_TAG_typedef);
-}
+    size_t file = (offset >> DIE_FILE_SHIFT) & DIE_FILE_MASK;
+    if (file != 0)
+    {
+        // Files are published before their count, see domain_file_number().
+        size_t count = __atomic_load_n(&domain->file_count, __ATOMIC_ACQUIRE);
+        Dwarf** files = __atomic_load_n(&domain->files, __ATOMIC_ACQUIRE);
+        if (file > count)
+        {
+            return NULL;
+        }
+        dwarf = files[file - 1];
+    }
 
-bool reflect_type_is_array(reflect_type_t* self)
-{
-    NOT_NULL(self);
-    return obj_is(&self->_impl, DW_TAG_array_type);
-}
+    if (offset & DIE_TYPES_SECTION)
+    {
+        return dwarf_offdie_types(dwarf, offset & DIE_OFFSET_MASK, die);
+    }
 
-bool reflect_type_is_builtin(reflect_type_t* self)
-{
-    NOT_NULL(self);
-    return obj_is(&self->_impl, DW_TAG_base_type);
+    return dwarf_offdie(dwarf, offset & DIE_OFFSET_MASK, die);
 }
 
-bool reflect_type_is_union(reflect_type_t* self)
+// Returns the number of a split file, numbering it if it is new, or 0 on error.
+static size_t domain_file_number(struct domain* domain, Dwarf* dwarf)
 {
-    NOT_NULL(self);
-    return obj_is(&self->_impl, DW_TAG_union_type);
-}
+    size_t number = (uintptr_t)table_get(&domain->file_numbers, (uintptr_t)dwarf);
+    if (number != 0)
+    {
+        return number;
+    }
 
-bool reflect_type_is_struct(reflect_type_t* self)
-{
-    NOT_NULL(self);
-    return obj_is(&self->_impl, DW_TAG_structure_type);
-}
+    pthread_mutex_lock(&domain->lock);
 
-bool reflect_type_is_enum(reflect_type_t* self)
-{
-    NOT_NULL(self);
-    return obj_is(&self->_impl, DW_TAG_enumeration_type);
-}
+    number = (uintptr_t)table_get(&domain->file_numbers, (uintptr_t)dwarf);
+    if (number == 0 && domain->file_count < DIE_FILE_MASK)
+    {
+        // Readers may still use the old array, it stays in the arena.
+        if (domain->file_count == domain->file_capacity)
+        {
+            size_t capacity = domain->file_capacity == 0 ? 16 : domain->file_capacity * 2;
+            Dwarf** files =
+                arena_alloc(&domain->arena, capacity * sizeof(Dwarf*), ARENA_USE_INDEXES);
+            if (files != NULL)
+            {
+                if (domain->file_count != 0)
+                {
+                    memcpy(files, domain->files, domain->file_count * sizeof(Dwarf*));
+                }
+                __atomic_store_n(&domain->files, files, __ATOMIC_RELEASE);
+                domain->file_capacity = capacity;
+            }
+        }
 
-bool reflect_type_is_pointer(reflect_type_t* self)
-{
-    NOT_NULL(self);
-    return obj_is(&self->_impl, DW_TAG_pointer_type);
+        if (domain->file_count < domain->file_capacity)
+        {
+            domain->files[domain->file_count] = dwarf;
+            __atomic_store_n(&domain->file_count, domain->file_count + 1, __ATOMIC_RELEASE);
+            number = domain->file_count;
+            table_put(&domain->file_numbers, &domain->arena, (uintptr_t)dwarf, (void*)number);
+        }
+    }
+
+    pthread_mutex_unlock(&domain->lock);
+    return number;
 }
 
-bool reflect_type_is_c_string(reflect_type_t* self)
+static Dwarf_Off domain_dieoffset(struct domain* domain, Dwarf_Die* die)
 {
-    NOT_NULL(self);
-
-    Dwarf_Die type;
-    REFLECT_OBJ_TO_DIE(self, &type);
+    Dwarf_Off offset = dwarf_dieoffset(die);
 
-    if (die_type(&type, &type) == NULL)
+    Dwarf_Half version;
+    uint8_t unit_type;
+    if (dwarf_cu_info(die->cu, &version, &unit_type, NULL, NULL, NULL, NULL, NULL) == 0 &&
+        version < 5 && (unit_type == DW_UT_type || unit_type == DW_UT_split_type))
     {
-        return false;
+        offset |= DIE_TYPES_SECTION;
     }
 
-    if (dwarf_tag(&type) == DW_TAG_const_type)
+    Dwarf* dwarf = dwarf_cu_getdwarf(die->cu);
+    if (dwarf != domain->dwarf)
     {
-        if (die_type(&type, &type) == NULL)
-        {
-            return false;
-        }
-
-        return dwarf_tag(&type) == DW_TAG_base_type && strcmp(dwarf_diename(&type), "char") == 0;
+        offset |= (Dwarf_Off)domain_file_number(domain, dwarf) << DIE_FILE_SHIFT;
     }
 
-    return false;
+    return offset;
 }
 
-size_t reflect_type_size(reflect_type_t* self)
+// The unit DIE with the content of a unit. For a skeleton unit that is the split unit, which may
+// open its file. Without the file, the skeleton unit itself.
+static Dwarf_Die* unit_content(struct domain* domain, Dwarf_Die* unit, Dwarf_Die* out)
 {
-    NOT_NULL(self);
+    *out = *unit;
 
-    Dwarf_Die type;
-    REFLECT_OBJ_TO_DIE(self, &type);
+    uint8_t unit_type;
+    if (dwarf_cu_info(unit->cu, NULL, &unit_type, NULL, NULL, NULL, NULL, NULL) != 0 ||
+        unit_type != DW_UT_skeleton)
+    {
+        return out;
+    }
 
-    Dwarf_Word size;
-    if (dwarf_aggregate_size(&type, &size) != 0)
+    pthread_mutex_lock(&domain->lock);
+
+    Dwarf_Die split;
+    if (dwarf_cu_info(unit->cu, NULL, NULL, NULL, &split, NULL, NULL, NULL) == 0 &&
+        split.cu != NULL && domain_file_number(domain, dwarf_cu_getdwarf(split.cu)) != 0)
     {
-        REFLECT_RAISE(ENODATA);
+        *out = split;
     }
 
-    return (size_t)size;
+    pthread_mutex_unlock(&domain->lock);
+    return out;
 }
 
-const char* reflect_type_name(reflect_type_t* self)
+// The offset of the header of the unit of a DIE in its file.
+static Dwarf_Off unit_offset(Dwarf_Die* die)
 {
-    NOT_NULL(self);
+    return dwarf_dieoffset(die) - dwarf_cuoffset(die);
+}
 
-    if (reflect_type_is_c_string(self))
+// Like dwarf_get_units(), but yields the content of each unit, see unit_content().
+static int unit_next(struct domain* domain, Dwarf_CU** cu, Dwarf_Die* content)
+{
+    Dwarf_Die unit;
+    int result = dwarf_get_units(domain->dwarf, *cu, cu, NULL, NULL, &unit, NULL);
+    if (result == 0)
     {
-        return "const char*";
+        unit_content(domain, &unit, content);
     }
+    return result;
+}
 
-    // TODO: very generic
-    if (reflect_type_is_pointer(self))
+static bool obj_is(reflect_obj_t* self, int tag)
+{
+    if (DOMAIN_BLOB(self->domain) != NULL)
     {
-        return "void*";
+        const struct blob_type* type = blob_type_record(self->domain, self->offset);
+        return type != NULL && type->tag == tag;
     }
 
-    // TODO: very generic
-    if (reflect_type_is_array(self))
+    Dwarf_Die die;
+    if (domain_offdie(self->domain, self->offset, &die) == NULL)
     {
-        return "void[]";
+        return false;
+    }
+    return dwarf_tag(&die) == tag;
+}
+
+// A type moved to a type unit is declared in the units using it by a stub with its signature.
+static Dwarf_Die* die_definition(Dwarf_Die* die)
+{
+    Dwarf_Attribute attr;
+    if (dwarf_attr(die, DW_AT_signature, &attr) != NULL && dwarf_formref_die(&attr, die) == NULL)
+    {
+        return NULL;
     }
 
-    CHECK_NULL(get_name(&self->_impl));
+    return die;
 }
 
-reflect_repr_t reflect_type_repr(reflect_type_t* self)
+static Dwarf_Die* die_type(Dwarf_Die* die, Dwarf_Die* out)
 {
-    NOT_NULL(self);
+    // Definitions that complete a declaration leave the type to the declaration.
+    Dwarf_Attribute attr;
+    if (dwarf_attr_integrate(die, DW_AT_type, &attr) == NULL)
+    {
+        return NULL;
+    }
 
-    Dwarf_Die type;
-    REFLECT_OBJ_TO_DIE(self, &type);
+    if (dwarf_formref_die(&attr, out) == NULL)
+    {
+        return NULL;
+    }
+
+    return die_definition(out);
+}
+
+static bool die_is_type(Dwarf_Die* die)
+{
+    switch (dwarf_tag(die))
+    {
+    case DW_TAG_base_type:
+    case DW_TAG_array_type:
+    case DW_TAG_union_type:
+    case DW_TAG_structure_type:
+    case DW_TAG_enumeration_type:
+    case DW_TAG_subroutine_type:
+    case DW_TAG_pointer_type:
+        return true;
+    default:
+        return false;
+    };
+}
 
+static reflect_repr_t die_repr(Dwarf_Die* type)
+{
     Dwarf_Attribute attr;
-    if (dwarf_attr(&type, DW_AT_encoding, &attr) == NULL)
+    if (dwarf_attr(type, DW_AT_encoding, &attr) == NULL)
     {
-        REFLECT_RAISE(ENODATA);
+        return REFLECT_REPR_UNKNOWN;
     }
 
     Dwarf_Word encoding;
     if (dwarf_formudata(&attr, &encoding) != 0)
     {
-        REFLECT_RAISE(ENODATA);
+        return REFLECT_REPR_UNKNOWN;
     }
 
     switch (encoding)
@@ -487,572 +1006,12158 @@ reflect_repr_t reflect_type_repr(reflect_type_t* self)
     }
 }
 
-reflect_type_t* reflect_type(reflect_type_t* self, const char* name)
-{
-    OBJ_BY_NAME(self, libreflect_domain, DW_TAG_typedef || die_is_type(&die), name);
-}
-
-reflect_member_t* reflect_type_member_by_index(reflect_type_t* self,
-                                               size_t index,
-                                               reflect_member_t* out)
-{
-    NOT_NULL(self);
-    NOT_NULL(out);
-
-    CHECK_NULL(child_by_index(&self->_impl, DW_TAG_member, index, &out->_impl));
-}
-
-reflect_member_t* reflect_type_member_by_name(reflect_type_t* self,
-                                              const char* name,
-                                              reflect_member_t* out)
+static reflect_type_t* peel_type(reflect_type_t* type)
 {
-    NOT_NULL(self);
-    NOT_NULL(out);
-
-    CHECK_NULL(child_by_name(&self->_impl, DW_TAG_member, name, &out->_impl));
-}
+    if (type == NULL)
+    {
+        return NULL;
+    }
 
-reflect_type_t* reflect_member_type(reflect_member_t* self, reflect_type_t* out)
-{
-    NOT_NULL(self);
-    NOT_NULL(out);
+    // Blob ids always refer to peeled types.
+    if (DOMAIN_BLOB(type->_impl.domain) != NULL)
+    {
+        return type;
+    }
 
-    CHECK_NULL(peel_type((reflect_type_t*)get_type(&self->_impl, &out->_impl)));
-}
+    Dwarf_Die die;
+    if (domain_offdie(type->_impl.domain, type->_impl.offset, &die) == NULL)
+    {
+        return NULL;
+    }
 
-const char* reflect_member_name(reflect_member_t* self)
-{
-    NOT_NULL(self);
+    Dwarf_Die result;
+    if (dwarf_peel_type(&die, &result) == -1)
+    {
+        return NULL;
+    }
 
-    CHECK_NULL(get_name(&self->_impl));
+    type->_impl.offset = domain_dieoffset(type->_impl.domain, &result);
+    return type;
 }
 
-ptrdiff_t reflect_member_offset(reflect_member_t* self)
+static const char* get_name(reflect_obj_t* obj)
 {
-    NOT_NULL(self);
+    if (DOMAIN_BLOB(obj->domain) != NULL)
+    {
+        return blob_name(obj->domain, obj->offset);
+    }
 
     Dwarf_Die die;
-    REFLECT_OBJ_TO_DIE(self, &die);
-
-    Dwarf_Attribute attr;
-    if (dwarf_attr(&die, DW_AT_data_member_location, &attr) == NULL)
+    if (domain_offdie(obj->domain, obj->offset, &die) == NULL)
     {
-        REFLECT_RAISE(ENODATA) - 1;
+        return NULL;
     }
 
-    Dwarf_Word offset;
-
-    switch (dwarf_whatform(&attr))
+    const char* name = dwarf_diename(&die);
+    if (name == NULL)
     {
-    case DW_FORM_data1:
-    case DW_FORM_data2:
-    case DW_FORM_data4:
-    case DW_FORM_data8:
-    case DW_FORM_udata:
-        if (dwarf_formudata(&attr, &offset) != 0)
-        {
-            REFLECT_RAISE(ENODATA) - 1;
-        }
-        return offset;
-    default:
-        REFLECT_RAISE(ENODATA) - 1;
+        return NULL;
     }
-}
-
-reflect_type_t* reflect_typedef_type(reflect_type_t* self, reflect_type_t* out)
-{
-    NOT_NULL(self);
-    NOT_NULL(out);
 
-    CHECK_NULL(peel_type((reflect_type_t*)get_type(&self->_impl, &out->_impl)));
+    return name;
 }
 
-bool reflect_fn_is_extern(reflect_fn_t* self)
+static reflect_obj_t* get_type(reflect_obj_t* self, reflect_obj_t* out)
 {
-    NOT_NULL(self);
-
-    Dwarf_Die fn;
-    REFLECT_OBJ_TO_DIE(self, &fn);
+    // Only variables have a type in a blob.
+    if (DOMAIN_BLOB(self->domain) != NULL)
+    {
+        const struct blob_variable* variable = BLOB_ID_KIND(self->offset) == BLOB_VARIABLE
+                                                   ? blob_record(self->domain, self->offset)
+                                                   : NULL;
+        if (variable == NULL || variable->type == 0)
+        {
+            return NULL;
+        }
 
-    Dwarf_Attribute attr;
-    bool value;
+        out->domain = self->domain;
+        out->offset = variable->type;
+        return out;
+    }
 
-    if (dwarf_attr(&fn, DW_AT_external, &attr) == NULL)
+    Dwarf_Die obj_die;
+    if (domain_offdie(self->domain, self->offset, &obj_die) == NULL)
     {
-        REFLECT_RAISE(ENODATA);
+        return NULL;
     }
 
-    if (dwarf_formflag(&attr, &value) != 0)
+    Dwarf_Die type;
+    if (die_type(&obj_die, &type) == NULL)
     {
-        REFLECT_RAISE(ENODATA);
+        return NULL;
     }
 
-    return value;
+    out->domain = self->domain;
+    out->offset = domain_dieoffset(self->domain, &type);
+    return out;
 }
 
-reflect_var_t* reflect_fn_var_by_index(reflect_fn_t* self, size_t index, reflect_var_t* out)
+static reflect_obj_t* child_by_name(reflect_obj_t* obj,
+                                    int tag,
+                                    const char* name,
+                                    reflect_obj_t* out)
 {
-    NOT_NULL(self);
-    NOT_NULL(out);
-
-    CHECK_NULL(child_by_index(&self->_impl, DW_TAG_variable, index, &out->_impl));
-}
+    // Extract DWARF DIE from object.
+    Dwarf_Die obj_die;
+    if (domain_offdie(obj->domain, obj->offset, &obj_die) == NULL)
+    {
+        return NULL;
+    }
 
-reflect_var_t* reflect_fn_var_by_name(reflect_fn_t* self, const char* name, reflect_var_t* out)
-{
-    NOT_NULL(self);
-    NOT_NULL(out);
-
-    CHECK_NULL(child_by_name(&self->_impl, DW_TAG_variable, name, &out->_impl));
-}
-
-reflect_var_t* reflect_fn_param_by_index(reflect_fn_t* self, size_t index, reflect_var_t* out)
-{
-    NOT_NULL(self);
-    NOT_NULL(out);
-
-    CHECK_NULL(child_by_index(&self->_impl, DW_TAG_formal_parameter, index, &out->_impl));
-}
+    // Extract child DIE.
+    Dwarf_Die child;
+    if (dwarf_child(&obj_die, &child) != 0)
+    {
+        return NULL;
+    }
 
-reflect_var_t* reflect_fn_param_by_name(reflect_fn_t* self, const char* name, reflect_var_t* out)
-{
-    NOT_NULL(self);
-    NOT_NULL(out);
+    // Search
+    do
+    {
+        if (dwarf_tag(&child) == tag && strcmp(dwarf_diename(&child), name) == 0)
+        {
+            out->domain = obj->domain;
+            out->offset = domain_dieoffset(obj->domain, &child);
+            return out;
+        }
+    } while (dwarf_siblingof(&child, &child) == 0);
 
-    CHECK_NULL(child_by_name(&self->_impl, DW_TAG_formal_parameter, name, &out->_impl));
+    return NULL;
 }
 
-reflect_type_t* reflect_fn_ret_type(reflect_fn_t* self, reflect_type_t* out)
+static reflect_obj_t* child_by_index(reflect_obj_t* obj, int tag, size_t index, reflect_obj_t* out)
 {
-    NOT_NULL(self);
-    NOT_NULL(out);
-
-    CHECK_NULL(peel_type((reflect_type_t*)get_type(&self->_impl, &out->_impl)));
-}
+    // Extract DWARF DIE from object.
+    Dwarf_Die obj_die;
+    if (domain_offdie(obj->domain, obj->offset, &obj_die) == NULL)
+    {
+        return NULL;
+    }
 
-reflect_type_t* reflect_var_type(reflect_var_t* self, reflect_type_t* out)
-{
-    NOT_NULL(self);
-    NOT_NULL(out);
+    // Extract child DIE.
+    Dwarf_Die child;
+    if (dwarf_child(&obj_die, &child) != 0)
+    {
+        return NULL;
+    }
 
-    CHECK_NULL(peel_type((reflect_type_t*)get_type(&self->_impl, &out->_impl)));
-}
+    // Search
+    if (dwarf_tag(&child) == tag && index == 0)
+    {
+        out->domain = obj->domain;
+        out->offset = domain_dieoffset(obj->domain, &child);
+        return out;
+    }
 
-const char* reflect_var_name(reflect_var_t* self)
-{
-    NOT_NULL(self);
+    for (size_t i = 1; dwarf_siblingof(&child, &child) == 0; i++)
+    {
+        if (dwarf_tag(&child) == tag && index == i)
+        {
+            out->domain = obj->domain;
+            out->offset = domain_dieoffset(obj->domain, &child);
+            return out;
+        }
+    }
 
-    CHECK_NULL(get_name(&self->_impl));
+    return NULL;
 }
 
-reflect_fn_t* reflect_fn(reflect_fn_t* self, const char* name)
+static int die_udata(Dwarf_Die* die, unsigned int name, Dwarf_Word* out)
 {
-    OBJ_BY_NAME(self, libreflect_domain, DW_TAG_subprogram, name);
-}
+    Dwarf_Attribute attr;
+    if (dwarf_attr(die, name, &attr) == NULL)
+    {
+        return -1;
+    }
 
-reflect_var_t* reflect_var(reflect_var_t* self, const char* name)
-{
-    OBJ_BY_NAME(self, libreflect_domain, DW_TAG_variable, name);
+    return dwarf_formudata(&attr, out);
 }
 
-static FILE* reflect_serialize_inner(const reflect_serializer_t* self,
-                                     void* object,
-                                     reflect_type_t* type,
-                                     FILE* output)
+// Computes the position of a member relative to the start of its parent in bits. For members that
+// are not bitfields bit_size is set to 0.
+static int member_bit_location(Dwarf_Die* member, Dwarf_Word* bit_offset, Dwarf_Word* bit_size)
 {
-    if (reflect_type_is_typedef(type))
-    {
-        reflect_type_t typedef_type;
-        reflect_typedef_type(type, &typedef_type);
-        reflect_serialize_inner(self, object, &typedef_type, output);
-        return output;
-    }
+    *bit_size = 0;
+    *bit_offset = 0;
 
-    if (reflect_type_is_builtin(type))
+    // DWARF 4 and later.
+    if (die_udata(member, DW_AT_data_bit_offset, bit_offset) == 0)
     {
-        self->serialize(object, reflect_type_repr(type), reflect_type_size(type), output);
-        return output;
+        return die_udata(member, DW_AT_bit_size, bit_size);
     }
 
-    if (reflect_type_is_enum(type))
-    {
-        self->serialize(object, REFLECT_REPR_INT, sizeof(int), output);
-        return output;
-    }
+    Dwarf_Attribute attr;
+    Dwarf_Word offset = 0;
 
-    if (reflect_type_is_pointer(type))
+    // Union members and members at offset 0 may omit the location altogether.
+    if (dwarf_attr(member, DW_AT_data_member_location, &attr) != NULL)
     {
-        if (*(void**)object == NULL)
+        switch (dwarf_whatform(&attr))
         {
-            self->serialize(object, REFLECT_REPR_POINTER, sizeof(void*), output);
+        case DW_FORM_data1:
+        case DW_FORM_data2:
+        case DW_FORM_data4:
+        case DW_FORM_data8:
+        case DW_FORM_udata:
+        case DW_FORM_implicit_const:
+            if (dwarf_formudata(&attr, &offset) != 0)
+            {
+                return -1;
+            }
+            break;
+        default: {
+            // Older producers emit a location expression of the form DW_OP_plus_uconst N.
+            Dwarf_Op* expr;
+            size_t len;
+            if (dwarf_getlocation(&attr, &expr, &len) != 0 || len != 1 ||
+                (expr[0].atom != DW_OP_plus_uconst && expr[0].atom != DW_OP_constu))
+            {
+                return -1;
+            }
+            offset = expr[0].number;
+            break;
         }
-        else if (reflect_type_is_c_string(type))
-        {
-            self->serialize(object, REFLECT_REPR_STRING, sizeof(void*), output);
         }
-        else
-        {
-            const char* reflect_var_name(reflect_var_t * self);
-
-            Dwarf_Die inner_type;
-            dwarf_offdie((Dwarf*)type->_impl.domain, type->_impl.offset, &inner_type);
-            die_type(&inner_type, &inner_type);
-
-            dwarf_peel_type(&inner_type, &inner_type);
-
-            reflect_type_t type2 = {
-                ._impl.domain = type->_impl.domain,
-                ._impl.offset = dwarf_dieoffset(&inner_type),
-            };
+    }
 
-            reflect_serialize_inner(self, *(void**)object, &type2, output);
-        }
+    *bit_offset = offset * 8;
 
-        return output;
+    if (die_udata(member, DW_AT_bit_size, bit_size) != 0)
+    {
+        *bit_size = 0;
+        return 0;
     }
 
-    if (reflect_type_is_struct(type))
+    // DWARF 2/3 bitfields count DW_AT_bit_offset from the most significant bit of a storage unit
+    // of DW_AT_byte_size bytes. Convert that to a little-endian offset from the start of the
+    // parent.
+    Dwarf_Word storage_size;
+    Dwarf_Word msb_offset;
+    if (die_udata(member, DW_AT_bit_offset, &msb_offset) == 0)
     {
-        // TODO: error
-        const char* type_name = reflect_type_name(type);
-
-        self->begin_struct(type_name, output);
-
-        for (size_t i = 0; i < SIZE_MAX; i++)
+        if (die_udata(member, DW_AT_byte_size, &storage_size) != 0)
         {
-            reflect_member_t member;
-            if (child_by_index(&type->_impl, DW_TAG_member, i, &member._impl) == NULL)
+            Dwarf_Die type;
+            int size = die_type(member, &type) == NULL ? -1 : dwarf_bytesize(&type);
+            if (size <= 0)
             {
-                break;
+                return -1;
             }
+            storage_size = size;
+        }
 
-            // TODO: error
-            const char* member_name = reflect_member_name(&member);
-
-            reflect_type_t member_type;
-            reflect_member_type(&member, &member_type);
-
-            self->begin_member(member_name, output);
+        *bit_offset += storage_size * 8 - msb_offset - *bit_size;
+    }
 
-            // TODO: error
-            ptrdiff_t offset = reflect_member_offset(&member);
+    return 0;
+}
 
-            reflect_serialize_inner(self, ((uint8_t*)object) + offset, &member_type, output);
+/*
+ * Lookups by name
+ *
+ * Finding a name in DWARF means walking the top level of every unit, which for split units means
+ * opening every file. Units covered by .debug_gnu_pubnames or .debug_gnu_pubtypes (the default
+ * with -gsplit-dwarf) are searched through those instead, and only the units listed for the name
+ * are opened. Results are remembered per domain, so repeated lookups of the same name cost a hash
+ * probe. Every name found is remembered, since the debugging info bounds them, but only the first
+ * NAMES_MAX_MISSES names that do not exist are, since callers may ask for any string. Compact
+ * descriptors have a sorted name table and need no cache.
+ */
 
-            // This is really dumb. Some formats, cough cough JSON, need special handling for the
-            // last member. We have to provide this info to the user.
-            reflect_member_t dummy;
-            self->end_member(member_name,
-                             output,
-                             child_by_index(&type->_impl, DW_TAG_member, i + 1, &dummy._impl) ==
-                                 NULL);
-        }
+#define NAMES_MAX_MISSES 4096
 
-        self->end_struct(type_name, output);
+static uint64_t hash_bytes(uint64_t hash, const uint8_t* data, size_t size);
 
-        return output;
-    }
+// Names whose keys collide are chained, later ones are appended under the domain lock.
+struct name_entry
+{
+    struct name_entry* next;
+    enum blob_kind kind;
 
-    // TODO
-    return NULL;
-}
+    // The DIE offset, 0 if there is no such name.
+    Dwarf_Off offset;
+    char name[];
+};
 
-static void serialize_int(void* object, size_t size, FILE* output)
+static bool die_has_kind(Dwarf_Die* die, enum blob_kind kind)
 {
-    switch (size)
+    switch (kind)
     {
-    case 1:
-        fprintf(output, "%" PRIi8, *(int8_t*)object);
-        break;
-    case 2:
-        fprintf(output, "%" PRIi16, *(int16_t*)object);
-        break;
-    case 4:
-        fprintf(output, "%" PRIi32, *(int32_t*)object);
-        break;
-    case 8:
-        fprintf(output, "%" PRIi64, *(int64_t*)object);
-        break;
+    case BLOB_TYPE:
+        return dwarf_tag(die) == DW_TAG_typedef || die_is_type(die);
+    case BLOB_VARIABLE:
+        return dwarf_tag(die) == DW_TAG_variable;
+    case BLOB_FUNCTION:
+        return dwarf_tag(die) == DW_TAG_subprogram;
     default:
-        // TODO
-        break;
+        return false;
     }
 }
 
-static void serialize_uint(void* object, size_t size, FILE* output)
+// Looks for the name among the top level DIEs of a unit. Declarations, such as those of extern
+// variables or incomplete structs, are only remembered in *declaration in case there is nothing
+// better.
+static Dwarf_Off unit_find_by_name(struct domain* domain,
+                                   Dwarf_Die* unit,
+                                   enum blob_kind kind,
+                                   const char* name,
+                                   Dwarf_Off* declaration)
 {
-    switch (size)
+    Dwarf_Die die;
+    if (dwarf_child(unit, &die) != 0)
     {
-    case 1:
-        fprintf(output, "%" PRIu8, *(uint8_t*)object);
-        break;
-    case 2:
-        fprintf(output, "%" PRIu16, *(uint16_t*)object);
-        break;
-    case 4:
-        fprintf(output, "%" PRIu32, *(uint32_t*)object);
-        break;
-    case 8:
-        fprintf(output, "%" PRIu64, *(uint64_t*)object);
-        break;
-    default:
-        // TODO
-        break;
+        return 0;
     }
+
+    do
+    {
+        const char* die_name = dwarf_diename(&die);
+        if (die_name == NULL || strcmp(die_name, name) != 0 || !die_has_kind(&die, kind))
+        {
+            continue;
+        }
+
+        if (!dwarf_hasattr(&die, DW_AT_declaration))
+        {
+            return domain_dieoffset(domain, &die);
+        }
+
+        if (*declaration == 0)
+        {
+            *declaration = domain_dieoffset(domain, &die);
+        }
+    } while (dwarf_siblingof(&die, &die) == 0);
+
+    return 0;
 }
 
-static void serialize_float(void* object, size_t size, FILE* output)
+// Looks for a type among the type units of a file.
+static Dwarf_Off type_units_find_by_name(struct domain* domain,
+                                         Dwarf* dwarf,
+                                         const char* name,
+                                         Dwarf_Off* declaration)
 {
-    switch (size)
+    Dwarf_Die unit;
+    uint8_t unit_type;
+    Dwarf_CU* cu = NULL;
+    while (dwarf_get_units(dwarf, cu, &cu, NULL, &unit_type, &unit, NULL) == 0)
     {
-    case 4:
-        fprintf(output, "%f", *(float*)object);
-        break;
-    case 8:
-        fprintf(output, "%lf", *(double*)object);
-        break;
-    case 16:
-        fprintf(output, "%Lf", *(long double*)object);
-    default:
-        // TODO
-        break;
+        Dwarf_Off offset = unit_type == DW_UT_type || unit_type == DW_UT_split_type
+                               ? unit_find_by_name(domain, &unit, BLOB_TYPE, name, declaration)
+                               : 0;
+        if (offset != 0)
+        {
+            return offset;
+        }
     }
+
+    return 0;
 }
 
-static void json_serialize(void* object, reflect_repr_t repr, size_t size, FILE* output)
+// Reads the header of the set of names at *position, leaving *entries and *end around its entries.
+static bool pubnames_set_next(const struct pubnames* self,
+                              size_t* position,
+                              Dwarf_Off* unit,
+                              const uint8_t** entries,
+                              const uint8_t** end)
 {
-    switch (repr)
+    // Only 32 bit DWARF: the length, the version, the unit offset and the unit size.
+    const size_t header_size = 4 + 2 + 4 + 4;
+
+    uint32_t length;
+    uint16_t version;
+    uint32_t offset;
+    if (self->data == NULL || self->size - *position < header_size)
     {
-    case REFLECT_REPR_FLOAT:
-        serialize_float(object, size, output);
-        break;
-    case REFLECT_REPR_INT:
-        serialize_int(object, size, output);
-        break;
-    case REFLECT_REPR_UINT:
-        serialize_uint(object, size, output);
-        break;
-    case REFLECT_REPR_POINTER:
-        serialize_uint(object, sizeof(void*), output);
-        break;
-    case REFLECT_REPR_BOOLEAN:
-        fputs((*(bool*)object) ? "true" : "false", output);
-        break;
-    case REFLECT_REPR_SCHAR:
-    case REFLECT_REPR_UCHAR:
-        fputc(*(char*)object, output);
-        break;
-    case REFLECT_REPR_STRING: {
-        fputc('"', output);
-        const char* s = *(const char**)object;
-        size_t len = strlen(s);
-        for (size_t i = 0; i < len; i++)
-        {
-            if (s[i] == '"')
-            {
-                fputc('\\', output);
-            }
-            fputc(s[i], output);
-        }
-        fputc('"', output);
-        break;
+        return false;
     }
-    default:
-        // TODO
-        break;
+
+    const uint8_t* header = self->data + *position;
+    memcpy(&length, header, 4);
+    memcpy(&version, header + 4, 2);
+    memcpy(&offset, header + 6, 4);
+    if (length < header_size - 4 || length > self->size - *position - 4 || version != 2)
+    {
+        return false;
     }
+
+    *unit = offset;
+    *entries = header + header_size;
+    *end = header + 4 + length;
+    *position += 4 + length;
+    return true;
 }
 
-static void json_begin_member(const char* name, FILE* output)
+static int pubnames_unit_compare(const void* a, const void* b)
 {
-    fprintf(output, "\"%s\":", name);
+    Dwarf_Off x = *(const Dwarf_Off*)a;
+    Dwarf_Off y = *(const Dwarf_Off*)b;
+    return x < y ? -1 : x > y;
 }
 
-static void json_end_member(const char* name, FILE* output, bool is_last_member)
+// Loads an index section, leaving self empty if the binary has none or it cannot be read.
+static void pubnames_load(struct pubnames* self, struct arena* arena, int fd, const char* section)
 {
-    if (!is_last_member)
+    self->data = elf_section_load(arena, fd, section, SIZE_MAX, &self->size);
+
+    size_t position = 0;
+    Dwarf_Off unit;
+    const uint8_t* entries;
+    const uint8_t* end;
+    size_t count = 0;
+    while (pubnames_set_next(self, &position, &unit, &entries, &end))
     {
-        fprintf(output, ",");
+        count++;
     }
 
-    (void)name;
+    // A malformed set hides the ones after it, so the index would be incomplete.
+    self->units = position == self->size && count != 0
+                      ? arena_alloc(arena, count * sizeof(Dwarf_Off), ARENA_USE_INDEXES)
+                      : NULL;
+    if (self->units == NULL)
+    {
+        self->data = NULL;
+        return;
+    }
+
+    position = 0;
+    while (pubnames_set_next(self, &position, &unit, &entries, &end))
+    {
+        self->units[self->unit_count++] = unit;
+    }
+    qsort(self->units, self->unit_count, sizeof(Dwarf_Off), pubnames_unit_compare);
 }
 
-static void json_begin_struct(const char* name, FILE* output)
+static bool pubnames_covers(const struct pubnames* self, Dwarf_Off unit)
 {
-    fprintf(output, "{");
-    (void)name;
+    return self->units != NULL && bsearch(&unit,
+                                          self->units,
+                                          self->unit_count,
+                                          sizeof(Dwarf_Off),
+                                          pubnames_unit_compare) != NULL;
 }
 
-static void json_end_struct(const char* name, FILE* output)
+// Entry offsets are relative to the header of the unit with the content.
+static Dwarf_Die* pubnames_die(struct domain* domain,
+                               Dwarf_Off unit,
+                               Dwarf_Off offset,
+                               Dwarf_Die* out)
 {
-    fprintf(output, "}");
-    (void)name;
+    Dwarf_Off next;
+    size_t header_size;
+    Dwarf_Die unit_die;
+    Dwarf_Die content;
+    if (dwarf_next_unit(
+            domain->dwarf, unit, &next, &header_size, NULL, NULL, NULL, NULL, NULL, NULL) != 0 ||
+        dwarf_offdie(domain->dwarf, unit + header_size, &unit_die) == NULL)
+    {
+        return NULL;
+    }
+
+    unit_content(domain, &unit_die, &content);
+    return dwarf_offdie(dwarf_cu_getdwarf(content.cu), unit_offset(&content) + offset, out);
 }
 
-static void xml_serialize(void* object, reflect_repr_t repr, size_t size, FILE* output)
+static Dwarf_Off pubnames_find(struct domain* domain, enum blob_kind kind, const char* name)
 {
-    switch (repr)
-    {
-    case REFLECT_REPR_FLOAT:
-        serialize_float(object, size, output);
-        break;
-    case REFLECT_REPR_INT:
-        serialize_int(object, size, output);
-        break;
-    case REFLECT_REPR_UINT:
-        serialize_uint(object, size, output);
-        break;
-    case REFLECT_REPR_POINTER:
-        serialize_uint(object, sizeof(void*), output);
-        break;
-    case REFLECT_REPR_BOOLEAN:
-        fputs((*(bool*)object) ? "true" : "false", output);
-        break;
-    case REFLECT_REPR_SCHAR:
-    case REFLECT_REPR_UCHAR:
-        fputc(*(char*)object, output);
-        break;
-    case REFLECT_REPR_STRING: {
-        const char* s = *(const char**)object;
-        size_t len = strlen(s);
-        for (size_t i = 0; i < len; i++)
+    // The symbol kind in bits 4 to 6 of the flags of each entry.
+    static const uint8_t symbol_kinds[] = {
+        [BLOB_TYPE] = 1,
+        [BLOB_VARIABLE] = 2,
+        [BLOB_FUNCTION] = 3,
+    };
+
+    const struct pubnames* self = kind == BLOB_TYPE ? &domain->pubtypes : &domain->pubnames;
+    size_t position = 0;
+    Dwarf_Off unit;
+    const uint8_t* entries;
+    const uint8_t* end;
+    while (pubnames_set_next(self, &position, &unit, &entries, &end))
+    {
+        // Each entry is a DIE offset, the flags and the name. An offset of 0 ends the set.
+        while (end - entries > 5)
         {
-            switch (s[i])
+            uint32_t offset;
+            memcpy(&offset, entries, 4);
+            if (offset == 0)
             {
-            case '<':
-                fputs("&#60;", output);
-                break;
-            case '&':
-                fputs("&#38;", output);
-                break;
-            case '>':
-                fputs("&#62;", output);
-                break;
-            case '\'':
-                fputs("&#39;", output);
                 break;
-            case '"':
-                fputs("&#34;", output);
-                break;
-            default:
-                fputc(s[i], output);
+            }
+
+            uint8_t flags = entries[4];
+            const char* entry_name = (const char*)entries + 5;
+            const uint8_t* nul = memchr(entry_name, '\0', end - entries - 5);
+            if (nul == NULL)
+            {
                 break;
             }
+            entries = nul + 1;
+
+            Dwarf_Die die;
+            if ((flags >> 4 & 7) != symbol_kinds[kind] || strcmp(entry_name, name) != 0 ||
+                pubnames_die(domain, unit, offset, &die) == NULL)
+            {
+                continue;
+            }
+
+            // Types moved to type units are listed at the unit DIE of the unit using them.
+            Dwarf_Off found = 0;
+            if (kind == BLOB_TYPE && dwarf_tag(&die) == DW_TAG_compile_unit)
+            {
+                Dwarf_Off declaration = 0;
+                found = type_units_find_by_name(
+                    domain, dwarf_cu_getdwarf(die.cu), name, &declaration);
+            }
+            else if (die_has_kind(&die, kind) && dwarf_diename(&die) != NULL &&
+                     strcmp(dwarf_diename(&die), name) == 0)
+            {
+                found = domain_dieoffset(domain, &die);
+            }
+            if (found != 0)
+            {
+                return found;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Walks the units the index of the kind does not cover, and the type units of their split files.
+// The first definition wins over declarations wherever they are.
+static Dwarf_Off die_find_by_name(struct domain* domain, enum blob_kind kind, const char* name)
+{
+    const struct pubnames* index = kind == BLOB_TYPE ? &domain->pubtypes : &domain->pubnames;
+
+    Dwarf_Die unit;
+    Dwarf_Die content;
+    Dwarf_Off declaration = 0;
+    Dwarf_CU* cu = NULL;
+    while (dwarf_get_units(domain->dwarf, cu, &cu, NULL, NULL, &unit, NULL) == 0)
+    {
+        if (pubnames_covers(index, unit_offset(&unit)))
+        {
+            continue;
+        }
+
+        unit_content(domain, &unit, &content);
+        Dwarf_Off offset = unit_find_by_name(domain, &content, kind, name, &declaration);
+        Dwarf* file = dwarf_cu_getdwarf(content.cu);
+        if (offset == 0 && kind == BLOB_TYPE && file != domain->dwarf)
+        {
+            offset = type_units_find_by_name(domain, file, name, &declaration);
+        }
+        if (offset != 0)
+        {
+            return offset;
+        }
+    }
+
+    return declaration;
+}
+
+static uint64_t name_key(enum blob_kind kind, const char* name)
+{
+    uint64_t key = hash_bytes(kind, (const uint8_t*)name, strlen(name));
+    return key == 0 ? 1 : key;
+}
+
+static struct name_entry* name_entry_get(struct domain* domain,
+                                         uint64_t key,
+                                         enum blob_kind kind,
+                                         const char* name)
+{
+    struct name_entry* entry = table_get(&domain->names, key);
+    while (entry != NULL && (entry->kind != kind || strcmp(entry->name, name) != 0))
+    {
+        entry = __atomic_load_n(&entry->next, __ATOMIC_ACQUIRE);
+    }
+    return entry;
+}
+
+// Remembers the result of a lookup. The caller holds the domain lock.
+static void name_entry_put(struct domain* domain,
+                           uint64_t key,
+                           enum blob_kind kind,
+                           const char* name,
+                           Dwarf_Off offset)
+{
+    if (offset == 0 && domain->name_misses >= NAMES_MAX_MISSES)
+    {
+        return;
+    }
+
+    size_t length = strlen(name);
+    struct name_entry* entry =
+        arena_alloc(&domain->arena, sizeof(struct name_entry) + length + 1, ARENA_USE_INDEXES);
+    if (entry == NULL)
+    {
+        return;
+    }
+
+    entry->kind = kind;
+    entry->offset = offset;
+    memcpy(entry->name, name, length + 1);
+
+    struct name_entry* last = table_get(&domain->names, key);
+    while (last != NULL && last->next != NULL)
+    {
+        last = last->next;
+    }
+
+    // Lookups walk the chain without the lock, the entry is complete before it is linked.
+    if (last != NULL)
+    {
+        __atomic_store_n(&last->next, entry, __ATOMIC_RELEASE);
+    }
+    else if (!table_put(&domain->names, &domain->arena, key, entry))
+    {
+        return;
+    }
+
+    domain->name_misses += offset == 0;
+}
+
+// Returns 0 and fills out, or the error code. Never reports errors.
+static int name_lookup(struct domain* domain,
+                       enum blob_kind kind,
+                       const char* name,
+                       reflect_obj_t* out)
+{
+    if (domain == NULL || name == NULL || out == NULL)
+    {
+        return EFAULT;
+    }
+
+    uint64_t offset;
+    if (domain->blob != NULL)
+    {
+        offset = blob_find(domain, kind, name);
+    }
+    else
+    {
+        uint64_t key = name_key(kind, name);
+        struct name_entry* entry = name_entry_get(domain, key, kind, name);
+        if (entry != NULL)
+        {
+            offset = entry->offset;
+        }
+        else
+        {
+            pthread_mutex_lock(&domain->lock);
+
+            entry = name_entry_get(domain, key, kind, name);
+            if (entry != NULL)
+            {
+                offset = entry->offset;
+            }
+            else
+            {
+                offset = pubnames_find(domain, kind, name);
+                if (offset == 0)
+                {
+                    offset = die_find_by_name(domain, kind, name);
+                }
+
+                name_entry_put(domain, key, kind, name, offset);
+            }
+
+            pthread_mutex_unlock(&domain->lock);
+        }
+    }
+
+    if (offset == 0)
+    {
+        return ESRCH;
+    }
+
+    out->domain = domain;
+    out->offset = offset;
+    return 0;
+}
+
+/*
+ * Layouts
+ *
+ * A layout is the flattened description of a type that the serializers need: its kind, size and
+ * representation and, for structs, the location of every member. Building one requires walking
+ * the DWARF tree, so layouts are built once per type and cached by DIE offset. Member and pointee
+ * layouts are resolved lazily, which also takes care of self-referential types.
+ */
+
+enum layout_kind
+{
+    LAYOUT_UNKNOWN = 0,
+    LAYOUT_SCALAR,
+    LAYOUT_ENUM,
+    LAYOUT_STRING,
+    LAYOUT_POINTER,
+    LAYOUT_STRUCT,
+    LAYOUT_ARRAY,
+};
+
+struct layout_field
+{
+    const char* name;
+    Dwarf_Off type;
+    struct layout* layout;
+
+    // Byte offset of the member, or of the first byte containing a bitfield.
+    size_t offset;
+
+    // Bitfields only, see field_load().
+    uint8_t bit_size;
+    uint8_t load_size;
+    uint8_t shift;
+    uint8_t sign_shift;
+    uint64_t mask;
+};
+
+struct layout_enumerator
+{
+    int64_t value;
+    const char* name;
+    Dwarf_Off offset;
+};
+
+struct layout
+{
+    struct domain* domain;
+    Dwarf_Off offset;
+    const char* name;
+    enum layout_kind kind;
+    reflect_repr_t repr;
+    size_t size;
+
+    // Pointee type for LAYOUT_POINTER (0 for void*), element type for LAYOUT_ARRAY.
+    Dwarf_Off target;
+    struct layout* target_layout;
+
+    // LAYOUT_ARRAY only. The element count of each dimension, 0 when unknown.
+    size_t dim_count;
+    size_t* dims;
+
+    // Set by layout_warm() once every layout reachable from this one has been resolved.
+    bool warm;
+
+    // LAYOUT_ENUM only. Enumerators are sorted by value. When the values are close together
+    // dense maps value - dense_base directly to an enumerator.
+    size_t enumerator_count;
+    struct layout_enumerator* enumerators;
+    struct layout_enumerator** dense;
+    int64_t dense_base;
+    size_t dense_count;
+
+    // Built on first use, see compare_plan_get().
+    struct compare_plan* equality_plan;
+    struct compare_plan* order_plan;
+
+    // Upper bounds on the output of each built-in serializer plus one, see measure_bound().
+    size_t serialized_bounds[3];
+
+    // The size of a reflect_log() entry before strings, and what its copy of an object needs fixed
+    // up. See log_entry_size().
+    size_t log_size;
+    unsigned log_captures;
+
+    size_t field_count;
+    struct layout_field fields[];
+};
+
+static bool die_is_c_string(Dwarf_Die* pointer)
+{
+    Dwarf_Die type;
+    if (die_type(pointer, &type) == NULL || dwarf_tag(&type) != DW_TAG_const_type)
+    {
+        return false;
+    }
+
+    if (die_type(&type, &type) == NULL)
+    {
+        return false;
+    }
+
+    const char* name = dwarf_diename(&type);
+    return dwarf_tag(&type) == DW_TAG_base_type && name != NULL && strcmp(name, "char") == 0;
+}
+
+static size_t die_child_count(Dwarf_Die* die, int tag)
+{
+    Dwarf_Die child;
+    if (dwarf_child(die, &child) != 0)
+    {
+        return 0;
+    }
+
+    size_t count = 0;
+    do
+    {
+        count += dwarf_tag(&child) == tag;
+    } while (dwarf_siblingof(&child, &child) == 0);
+
+    return count;
+}
+
+// GCC and Clang use DW_FORM_sdata for negative enumerators and unsigned forms for everything else.
+static int die_const_value(Dwarf_Die* die, int64_t* value)
+{
+    Dwarf_Attribute attr;
+    if (dwarf_attr(die, DW_AT_const_value, &attr) == NULL)
+    {
+        return -1;
+    }
+
+    if (dwarf_whatform(&attr) == DW_FORM_sdata)
+    {
+        Dwarf_Sword svalue;
+        if (dwarf_formsdata(&attr, &svalue) != 0)
+        {
+            return -1;
+        }
+        *value = svalue;
+        return 0;
+    }
+
+    Dwarf_Word uvalue;
+    if (dwarf_formudata(&attr, &uvalue) != 0)
+    {
+        return -1;
+    }
+    *value = (int64_t)uvalue;
+    return 0;
+}
+
+// Returns the representation of the values of a type, looking through enums to their underlying
+// integer type.
+static reflect_repr_t die_value_repr(Dwarf_Die* type)
+{
+    reflect_repr_t repr = die_repr(type);
+    if (repr != REFLECT_REPR_UNKNOWN || dwarf_tag(type) != DW_TAG_enumeration_type)
+    {
+        return repr;
+    }
+
+    Dwarf_Die underlying;
+    if (die_type(type, &underlying) != NULL && dwarf_peel_type(&underlying, &underlying) == 0)
+    {
+        repr = die_repr(&underlying);
+    }
+
+    return repr == REFLECT_REPR_UNKNOWN ? REFLECT_REPR_INT : repr;
+}
+
+// Record streams load values at offsets from their header, so object need not be aligned.
+static int64_t load_int(const void* object, size_t size, bool is_signed)
+{
+    switch (size)
+    {
+    case 1: {
+        uint8_t value;
+        memcpy(&value, object, sizeof(value));
+        return is_signed ? (int64_t)(int8_t)value : (int64_t)value;
+    }
+    case 2: {
+        uint16_t value;
+        memcpy(&value, object, sizeof(value));
+        return is_signed ? (int64_t)(int16_t)value : (int64_t)value;
+    }
+    case 4: {
+        uint32_t value;
+        memcpy(&value, object, sizeof(value));
+        return is_signed ? (int64_t)(int32_t)value : (int64_t)value;
+    }
+    case 8: {
+        int64_t value;
+        memcpy(&value, object, sizeof(value));
+        return value;
+    }
+    default:
+        return 0;
+    }
+}
+
+static size_t align_up(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static int enumerator_compare(const void* a, const void* b)
+{
+    const struct layout_enumerator* x = a;
+    const struct layout_enumerator* y = b;
+
+    if (x->value != y->value)
+    {
+        return x->value < y->value ? -1 : 1;
+    }
+
+    // Aliases resolve to the enumerator declared first.
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static struct layout_enumerator* layout_enumerator_by_value(struct layout* self, int64_t value)
+{
+    if (self->dense != NULL)
+    {
+        uint64_t index = (uint64_t)value - (uint64_t)self->dense_base;
+        return index < self->dense_count ? self->dense[index] : NULL;
+    }
+
+    size_t low = 0;
+    size_t high = self->enumerator_count;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (self->enumerators[mid].value < value)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    if (low < self->enumerator_count && self->enumerators[low].value == value)
+    {
+        return &self->enumerators[low];
+    }
+
+    return NULL;
+}
+
+static struct layout_enumerator* layout_enumerator_by_name(struct layout* self, const char* name)
+{
+    for (size_t i = 0; i < self->enumerator_count; i++)
+    {
+        if (strcmp(self->enumerators[i].name, name) == 0)
+        {
+            return &self->enumerators[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Sorts the enumerators of an enum layout and builds its dense index. There is room for count * 4
+// entries in the index.
+static void layout_index_enum(struct layout* self, size_t count)
+{
+    if (self->enumerator_count == 0)
+    {
+        self->dense = NULL;
+        return;
+    }
+
+    qsort(self->enumerators,
+          self->enumerator_count,
+          sizeof(struct layout_enumerator),
+          enumerator_compare);
+
+    // Most enums are a contiguous range starting at 0, which gets an O(1) lookup table.
+    uint64_t range = (uint64_t)self->enumerators[self->enumerator_count - 1].value -
+                     (uint64_t)self->enumerators[0].value;
+    if (range >= count * 4)
+    {
+        self->dense = NULL;
+        return;
+    }
+
+    self->dense_base = self->enumerators[0].value;
+    self->dense_count = range + 1;
+
+    for (size_t i = self->enumerator_count; i-- > 0;)
+    {
+        self->dense[(uint64_t)self->enumerators[i].value - (uint64_t)self->dense_base] =
+            &self->enumerators[i];
+    }
+}
+
+// Fills in the enumerator table of an enum layout. The storage is allocated by layout_alloc()
+// right after the layout itself.
+static void layout_build_enum(struct layout* self, Dwarf_Die* die, size_t count)
+{
+    Dwarf_Die child;
+    if (count == 0 || dwarf_child(die, &child) != 0)
+    {
+        self->dense = NULL;
+        return;
+    }
+
+    do
+    {
+        struct layout_enumerator* enumerator = &self->enumerators[self->enumerator_count];
+        if (dwarf_tag(&child) != DW_TAG_enumerator || dwarf_diename(&child) == NULL ||
+            die_const_value(&child, &enumerator->value) != 0)
+        {
+            continue;
+        }
+
+        enumerator->name = dwarf_diename(&child);
+        enumerator->offset = domain_dieoffset(self->domain, &child);
+        self->enumerator_count++;
+    } while (dwarf_siblingof(&child, &child) == 0);
+
+    layout_index_enum(self, count);
+}
+
+// A bitfield of up to 64 bits that starts mid-byte, as in packed structs, spans 9 bytes.
+#define BITS_MAX_LOAD (sizeof(uint64_t) + 1)
+
+// Returns size bytes, at most BITS_MAX_LOAD, shifted right by shift bits. Little-endian only, like
+// the bit offsets computed by member_bit_location().
+static uint64_t bits_load(const uint8_t* bytes, size_t size, unsigned shift)
+{
+    uint64_t word = 0;
+    if (size <= sizeof(word))
+    {
+        memcpy(&word, bytes, size);
+        return word >> shift;
+    }
+
+    memcpy(&word, bytes, sizeof(word));
+    word >>= shift;
+    return shift == 0 ? word : word | (uint64_t)bytes[sizeof(word)] << (64 - shift);
+}
+
+// Replaces the bit_size bits that start shift bits into size bytes with the low bits of value.
+static void bits_store(uint8_t* bytes,
+                       size_t size,
+                       unsigned shift,
+                       unsigned bit_size,
+                       uint64_t value)
+{
+    uint64_t mask = bit_size == 64 ? UINT64_MAX : (UINT64_C(1) << bit_size) - 1;
+    value &= mask;
+
+    uint64_t word = 0;
+    size_t low = size < sizeof(word) ? size : sizeof(word);
+    memcpy(&word, bytes, low);
+    word = (word & ~(mask << shift)) | value << shift;
+    memcpy(bytes, &word, low);
+
+    if (size > sizeof(word) && shift != 0)
+    {
+        uint8_t high = mask >> (64 - shift);
+        bytes[sizeof(word)] = (bytes[sizeof(word)] & ~high) | (uint8_t)(value >> (64 - shift));
+    }
+}
+
+// Precomputes the shift and masks needed to extract a bitfield with bits_load().
+static bool field_set_bits(struct layout_field* field,
+                           Dwarf_Word bit_offset,
+                           Dwarf_Word bit_size,
+                           bool is_signed)
+{
+    Dwarf_Word shift = bit_offset % 8;
+    if (bit_size == 0 || bit_size > 64)
+    {
+        return false;
+    }
+
+    field->offset = bit_offset / 8;
+    field->bit_size = bit_size;
+    field->shift = shift;
+    field->load_size = (shift + bit_size + 7) / 8;
+    field->mask = bit_size == 64 ? UINT64_MAX : (UINT64_C(1) << bit_size) - 1;
+    field->sign_shift = is_signed ? 64 - bit_size : 0;
+    return true;
+}
+
+// Extracts a bitfield.
+static uint64_t field_load(const struct layout_field* field, const void* object)
+{
+    const uint8_t* bytes = (const uint8_t*)object + field->offset;
+    uint64_t word = bits_load(bytes, field->load_size, field->shift) & field->mask;
+    return (uint64_t)((int64_t)(word << field->sign_shift) >> field->sign_shift);
+}
+
+static struct layout* layout_alloc(struct domain* domain,
+                                   size_t field_count,
+                                   size_t enumerator_count,
+                                   size_t dim_count)
+{
+    // The enumerator table, the dense index (at most 4 entries per enumerator) and the array
+    // dimensions share the allocation of the layout.
+    size_t alloc_size = sizeof(struct layout) + field_count * sizeof(struct layout_field) +
+                        enumerator_count * sizeof(struct layout_enumerator) +
+                        enumerator_count * 4 * sizeof(struct layout_enumerator*) +
+                        dim_count * sizeof(size_t);
+
+    struct layout* self = arena_alloc(&domain->arena, alloc_size, ARENA_USE_LAYOUTS);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+
+    self->enumerators = (struct layout_enumerator*)&self->fields[field_count];
+    self->dense = (struct layout_enumerator**)&self->enumerators[enumerator_count];
+    self->dims = (size_t*)&self->dense[enumerator_count * 4];
+    self->domain = domain;
+    return self;
+}
+
+static struct layout* layout_build(struct domain* domain, Dwarf_Die* die)
+{
+    int tag = dwarf_tag(die);
+    size_t field_count = tag == DW_TAG_structure_type ? die_child_count(die, DW_TAG_member) : 0;
+    size_t enumerator_count =
+        tag == DW_TAG_enumeration_type ? die_child_count(die, DW_TAG_enumerator) : 0;
+    size_t dim_count = tag == DW_TAG_array_type ? die_child_count(die, DW_TAG_subrange_type) : 0;
+
+    struct layout* self = layout_alloc(domain, field_count, enumerator_count, dim_count);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+
+    self->offset = domain_dieoffset(domain, die);
+    self->name = dwarf_diename(die);
+
+    Dwarf_Word size;
+    if (dwarf_aggregate_size(die, &size) == 0)
+    {
+        self->size = size;
+    }
+
+    switch (tag)
+    {
+    case DW_TAG_base_type:
+        self->kind = LAYOUT_SCALAR;
+        self->repr = die_repr(die);
+        break;
+    case DW_TAG_enumeration_type:
+        self->kind = LAYOUT_ENUM;
+        self->repr = die_value_repr(die);
+        layout_build_enum(self, die, enumerator_count);
+        break;
+    case DW_TAG_pointer_type: {
+        self->kind = die_is_c_string(die) ? LAYOUT_STRING : LAYOUT_POINTER;
+        self->repr = REFLECT_REPR_POINTER;
+        self->size = sizeof(void*);
+
+        Dwarf_Die target;
+        if (die_type(die, &target) != NULL)
+        {
+            self->target = domain_dieoffset(domain, &target);
+        }
+        break;
+    }
+    case DW_TAG_array_type: {
+        self->kind = LAYOUT_ARRAY;
+
+        Dwarf_Die element;
+        if (die_type(die, &element) != NULL)
+        {
+            self->target = domain_dieoffset(domain, &element);
+        }
+
+        Dwarf_Die child;
+        if (dim_count == 0 || dwarf_child(die, &child) != 0)
+        {
+            break;
+        }
+
+        do
+        {
+            if (dwarf_tag(&child) != DW_TAG_subrange_type)
+            {
+                continue;
+            }
+
+            // Flexible array members and VLAs have no constant bound and are left empty.
+            Dwarf_Word count;
+            Dwarf_Word upper_bound;
+            if (die_udata(&child, DW_AT_count, &count) == 0)
+            {
+                self->dims[self->dim_count] = count;
+            }
+            else if (die_udata(&child, DW_AT_upper_bound, &upper_bound) == 0)
+            {
+                self->dims[self->dim_count] = upper_bound + 1;
+            }
+            self->dim_count++;
+        } while (dwarf_siblingof(&child, &child) == 0);
+        break;
+    }
+    case DW_TAG_structure_type: {
+        self->kind = LAYOUT_STRUCT;
+
+        Dwarf_Die child;
+        if (field_count == 0 || dwarf_child(die, &child) != 0)
+        {
+            break;
+        }
+
+        do
+        {
+            if (dwarf_tag(&child) != DW_TAG_member)
+            {
+                continue;
+            }
+
+            struct layout_field* field = &self->fields[self->field_count];
+
+            Dwarf_Die type;
+            Dwarf_Word bit_offset;
+            Dwarf_Word bit_size;
+            if (die_type(&child, &type) == NULL ||
+                member_bit_location(&child, &bit_offset, &bit_size) != 0)
+            {
+                continue;
+            }
+
+            field->name = dwarf_diename(&child);
+            field->type = domain_dieoffset(domain, &type);
+            field->offset = bit_offset / 8;
+
+            if (bit_size != 0)
+            {
+                Dwarf_Die peeled;
+                reflect_repr_t repr = dwarf_peel_type(&type, &peeled) == 0
+                                          ? die_value_repr(&peeled)
+                                          : REFLECT_REPR_UNKNOWN;
+                bool is_signed = repr == REFLECT_REPR_INT || repr == REFLECT_REPR_SCHAR;
+
+                // Bitfields wider than 64 bits, of __int128 members, cannot be loaded. Failing the
+                // layout makes its users report an error instead of leaving the member out.
+                if (!field_set_bits(field, bit_offset, bit_size, is_signed))
+                {
+                    return NULL;
+                }
+            }
+
+            self->field_count++;
+        } while (dwarf_siblingof(&child, &child) == 0);
+        break;
+    }
+    default:
+        self->kind = LAYOUT_UNKNOWN;
+        break;
+    }
+
+    return self;
+}
+
+// Builds the layout of a type record of a blob. Field types and pointer targets are blob ids, which
+// layout_get() resolves like DIE offsets.
+static struct layout* layout_build_blob(struct domain* domain, uint64_t id)
+{
+    const struct blob_type* type = blob_type_record(domain, id);
+    if (type == NULL || type->kind > LAYOUT_ARRAY)
+    {
+        return NULL;
+    }
+
+    size_t item_size = type->kind == LAYOUT_STRUCT ? sizeof(struct blob_field)
+                       : type->kind == LAYOUT_ENUM ? sizeof(struct blob_enumerator)
+                       : type->kind == LAYOUT_ARRAY ? sizeof(uint64_t)
+                                                    : 0;
+    uint64_t items_offset = (const uint8_t*)type - (const uint8_t*)domain->blob + sizeof(*type);
+    const void* items = blob_at(domain, items_offset, (uint64_t)type->count * item_size);
+    if (items == NULL)
+    {
+        return NULL;
+    }
+
+    struct layout* self = layout_alloc(domain,
+                                       type->kind == LAYOUT_STRUCT ? type->count : 0,
+                                       type->kind == LAYOUT_ENUM ? type->count : 0,
+                                       type->kind == LAYOUT_ARRAY ? type->count : 0);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+
+    self->offset = id;
+    self->name = blob_string(domain, type->name);
+    self->kind = type->kind;
+    self->repr = type->repr;
+    self->size = type->size;
+    self->target = type->target;
+
+    for (size_t i = 0; i < type->count; i++)
+    {
+        switch (self->kind)
+        {
+        case LAYOUT_STRUCT: {
+            const struct blob_field* source = (const struct blob_field*)items + i;
+            struct layout_field* field = &self->fields[self->field_count++];
+            field->name = blob_string(domain, source->name);
+            field->type = source->type;
+            field->offset = source->offset;
+            field->bit_size = source->bit_size;
+            field->load_size =
+                source->load_size > BITS_MAX_LOAD ? BITS_MAX_LOAD : source->load_size;
+            field->shift = source->shift;
+            field->sign_shift = source->sign_shift;
+            field->mask = source->mask;
+            break;
+        }
+        case LAYOUT_ENUM: {
+            const struct blob_enumerator* source = (const struct blob_enumerator*)items + i;
+            struct layout_enumerator* enumerator = &self->enumerators[self->enumerator_count];
+            enumerator->name = blob_string(domain, source->name);
+            enumerator->value = source->value;
+            enumerator->offset = BLOB_ID(BLOB_ENUMERATOR, items_offset + i * sizeof(*source));
+            self->enumerator_count += enumerator->name != NULL;
+            break;
+        }
+        case LAYOUT_ARRAY:
+            self->dims[self->dim_count++] = ((const uint64_t*)items)[i];
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (self->kind == LAYOUT_ENUM)
+    {
+        layout_index_enum(self, type->count);
+    }
+
+    return self;
+}
+
+static struct layout* layout_get_locked(struct domain* domain, Dwarf_Off offset)
+{
+    struct layout* self = table_get(&domain->layouts, offset);
+    if (self != NULL)
+    {
+        return self;
+    }
+
+    // Blob ids always refer to peeled types.
+    if (domain->blob != NULL)
+    {
+        self = layout_build_blob(domain, offset);
+        if (self == NULL || !table_put(&domain->layouts, &domain->arena, offset, self))
+        {
+            return NULL;
+        }
+        domain->layout_count++;
+        return self;
+    }
+
+    Dwarf_Die die;
+    if (domain_offdie(domain, offset, &die) == NULL)
+    {
+        return NULL;
+    }
+
+    // Typedefs and qualifiers share the layout of the type they refer to.
+    Dwarf_Die peeled;
+    if (dwarf_peel_type(&die, &peeled) != 0 || die_definition(&peeled) == NULL)
+    {
+        return NULL;
+    }
+
+    Dwarf_Off key = domain_dieoffset(domain, &peeled);
+    self = table_get(&domain->layouts, key);
+    if (self == NULL)
+    {
+        self = layout_build(domain, &peeled);
+        if (self == NULL || !table_put(&domain->layouts, &domain->arena, key, self))
+        {
+            return NULL;
+        }
+        domain->layout_count++;
+    }
+
+    if (key != offset && !table_put(&domain->layouts, &domain->arena, offset, self))
+    {
+        return NULL;
+    }
+
+    return self;
+}
+
+static struct layout* layout_get(struct domain* domain, Dwarf_Off offset)
+{
+    struct layout* self = table_get(&domain->layouts, offset);
+    if (self != NULL)
+    {
+        return self;
+    }
+
+    pthread_mutex_lock(&domain->lock);
+    self = layout_get_locked(domain, offset);
+    pthread_mutex_unlock(&domain->lock);
+    return self;
+}
+
+// Once a layout is warm its links are final, even when they failed to resolve. This keeps
+// layout_target() and field_layout() from touching libdw or the cache, which makes warm layouts
+// safe to share between threads. The flag is published with a release store after the links.
+static struct layout* layout_target(struct layout* self)
+{
+    struct layout* target = __atomic_load_n(&self->target_layout, __ATOMIC_ACQUIRE);
+    if (target == NULL && self->target != 0 && !__atomic_load_n(&self->warm, __ATOMIC_ACQUIRE))
+    {
+        target = layout_get(self->domain, self->target);
+        __atomic_store_n(&self->target_layout, target, __ATOMIC_RELEASE);
+    }
+
+    return target;
+}
+
+static struct layout* field_layout(struct layout* self, struct layout_field* field)
+{
+    struct layout* layout = __atomic_load_n(&field->layout, __ATOMIC_ACQUIRE);
+    if (layout == NULL && !__atomic_load_n(&self->warm, __ATOMIC_ACQUIRE))
+    {
+        layout = layout_get(self->domain, field->type);
+        __atomic_store_n(&field->layout, layout, __ATOMIC_RELEASE);
+    }
+
+    return layout;
+}
+
+static void layout_warm(struct layout* self)
+{
+    if (self == NULL || __atomic_load_n(&self->warm, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+
+    struct layout* target = layout_target(self);
+    for (size_t i = 0; i < self->field_count; i++)
+    {
+        field_layout(self, &self->fields[i]);
+    }
+
+    // Mark first, the type graph may have cycles.
+    __atomic_store_n(&self->warm, true, __ATOMIC_RELEASE);
+
+    layout_warm(target);
+    for (size_t i = 0; i < self->field_count; i++)
+    {
+        layout_warm(field_layout(self, &self->fields[i]));
+    }
+}
+
+reflect_location_t* reflect_location(reflect_location_t* self, reflect_obj_t* target)
+{
+    NOT_NULL(self);
+    NOT_NULL(target);
+
+    Dwarf_Die die;
+    if (domain_offdie(target->domain, target->offset, &die) == NULL)
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    self->file = dwarf_decl_file(&die);
+
+    if (self->file == NULL || dwarf_decl_line(&die, &self->line) != 0 ||
+        dwarf_decl_column(&die, &self->column) != 0)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    return self;
+}
+
+// TODO: There should be a linked list of domains representing each loaded shared object.
+static struct domain* libreflect_domain;
+
+// Bumped by reflect_init() so that caches outside the domain can tell it was replaced.
+static uint64_t libreflect_generation;
+
+void reflect_set_allocator(const reflect_allocator_t* allocator)
+{
+    libreflect_allocator = allocator == NULL ? libreflect_default_allocator : *allocator;
+}
+
+int reflect_init(int argc, const char* argv[])
+{
+    (void)argc;
+
+    int fd = open(argv[0], O_RDONLY);
+    if (fd == -1)
+    {
+        __libreflect_report_error(EBADF, __func__);
+        return -1;
+    }
+
+    Dwarf* dwarf = dwarf_begin(fd, DWARF_C_READ);
+
+    // The domain lives in its own arena.
+    struct arena arena = {.allocator = libreflect_allocator};
+    struct domain* domain = arena_alloc(&arena, sizeof(struct domain), ARENA_USE_DOMAIN);
+    if (domain == NULL)
+    {
+        close(fd);
+        dwarf_end(dwarf);
+        __libreflect_report_error(ENOMEM, __func__);
+        return -1;
+    }
+
+    // Stripped binaries may carry compact descriptors instead, see reflect_write_descriptors().
+    if (dwarf == NULL && blob_load(domain, &arena, fd) != 0)
+    {
+        close(fd);
+        arena_free(&arena);
+        __libreflect_report_error(EMEDIUMTYPE, __func__);
+        return -1;
+    }
+
+    if (dwarf != NULL)
+    {
+        pubnames_load(&domain->pubnames, &arena, fd, ".debug_gnu_pubnames");
+        pubnames_load(&domain->pubtypes, &arena, fd, ".debug_gnu_pubtypes");
+    }
+    close(fd);
+
+    // Building a layout may resolve others.
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&domain->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+
+    domain->dwarf = dwarf;
+    domain->arena = arena;
+    libreflect_domain = domain;
+    __atomic_add_fetch(&libreflect_generation, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void line_tables_free(struct domain* domain);
+static void record_plans_free(struct domain* domain);
+
+void reflect_fini()
+{
+    if (libreflect_domain == NULL)
+    {
+        return;
+    }
+
+    line_tables_free(libreflect_domain);
+    record_plans_free(libreflect_domain);
+    dwarf_end(libreflect_domain->dwarf);
+    pthread_mutex_destroy(&libreflect_domain->lock);
+    arena_free(&libreflect_domain->arena);
+    libreflect_domain = NULL;
+}
+
+reflect_memory_usage_t* reflect_memory_usage(reflect_memory_usage_t* self)
+{
+    NOT_NULL(self);
+    NOT_NULL(libreflect_domain);
+
+    struct domain* domain = libreflect_domain;
+    struct arena* arena = &domain->arena;
+
+    pthread_mutex_lock(&domain->lock);
+
+    *self = (reflect_memory_usage_t){
+        .reserved = arena->reserved,
+        .chunks = arena->chunk_count,
+        .layouts = arena->used[ARENA_USE_LAYOUTS],
+        .indexes = arena->used[ARENA_USE_INDEXES],
+        .layout_count = domain->layout_count,
+        .lines = domain->lines_resident,
+        .line_units = domain->lines_count,
+        .line_evictions = domain->lines_evictions,
+        .line_redecodes = domain->lines_redecodes,
+    };
+
+    for (size_t i = 0; i < ARENA_USE_COUNT; i++)
+    {
+        self->used += arena->used[i];
+    }
+
+    pthread_mutex_unlock(&domain->lock);
+    return self;
+}
+
+struct reflect_arena
+{
+    struct arena arena;
+};
+
+reflect_arena_t* reflect_arena_create(const reflect_allocator_t* allocator)
+{
+    // Like the domain, the arena lives in its first chunk.
+    struct arena arena = {.allocator = allocator == NULL ? libreflect_allocator : *allocator};
+    reflect_arena_t* self = arena_alloc(&arena, sizeof(reflect_arena_t), ARENA_USE_DOMAIN);
+    if (self == NULL)
+    {
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    self->arena = arena;
+    return self;
+}
+
+void* reflect_arena_alloc(reflect_arena_t* self, size_t size)
+{
+    NOT_NULL(self);
+
+    void* memory = arena_alloc(&self->arena, size, ARENA_USE_OBJECTS);
+    if (memory == NULL)
+    {
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    return memory;
+}
+
+size_t reflect_arena_used(const reflect_arena_t* self)
+{
+    NOT_NULL(self);
+    return self->arena.used[ARENA_USE_OBJECTS];
+}
+
+void reflect_arena_reset(reflect_arena_t* self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+
+    struct arena* arena = &self->arena;
+    struct arena_chunk* home = NULL;
+
+    struct arena_chunk* chunk = arena->chunks;
+    while (chunk != NULL)
+    {
+        struct arena_chunk* next = chunk->next;
+        if ((uint8_t*)self >= chunk->data && (uint8_t*)self < chunk->data + chunk->size)
+        {
+            home = chunk;
+        }
+        else
+        {
+            arena->allocator.release(
+                chunk, chunk->size + sizeof(struct arena_chunk), arena->allocator.context);
+        }
+        chunk = next;
+    }
+
+    // Everything after the arena itself is handed out again.
+    home->next = NULL;
+    home->used = (size_t)((uint8_t*)(self + 1) - home->data);
+    arena->chunks = home;
+    arena->chunk_count = 1;
+    arena->reserved = home->size + sizeof(struct arena_chunk);
+    arena->used[ARENA_USE_OBJECTS] = 0;
+}
+
+void reflect_arena_free(reflect_arena_t* self)
+{
+    if (self != NULL)
+    {
+        arena_free(&self->arena);
+    }
+}
+
+bool reflect_type_is_typedef(reflect_type_t* self)
+{
+    NOT_NULL(self);
+    return obj_is(&self->_impl, DW_TAG_typedef);
+}
+
+bool reflect_type_is_array(reflect_type_t* self)
+{
+    NOT_NULL(self);
+    return obj_is(&self->_impl, DW_TAG_array_type);
+}
+
+bool reflect_type_is_builtin(reflect_type_t* self)
+{
+    NOT_NULL(self);
+    return obj_is(&self->_impl, DW_TAG_base_type);
+}
+
+bool reflect_type_is_union(reflect_type_t* self)
+{
+    NOT_NULL(self);
+    return obj_is(&self->_impl, DW_TAG_union_type);
+}
+
+bool reflect_type_is_struct(reflect_type_t* self)
+{
+    NOT_NULL(self);
+    return obj_is(&self->_impl, DW_TAG_structure_type);
+}
+
+bool reflect_type_is_enum(reflect_type_t* self)
+{
+    NOT_NULL(self);
+    return obj_is(&self->_impl, DW_TAG_enumeration_type);
+}
+
+bool reflect_type_is_pointer(reflect_type_t* self)
+{
+    NOT_NULL(self);
+    return obj_is(&self->_impl, DW_TAG_pointer_type);
+}
+
+bool reflect_type_is_c_string(reflect_type_t* self)
+{
+    NOT_NULL(self);
+
+    if (DOMAIN_BLOB(self->_impl.domain) != NULL)
+    {
+        const struct blob_type* type = blob_type_record(self->_impl.domain, self->_impl.offset);
+        return type != NULL && type->kind == LAYOUT_STRING;
+    }
+
+    Dwarf_Die type;
+    REFLECT_OBJ_TO_DIE(self, &type);
+
+    return die_is_c_string(&type);
+}
+
+size_t reflect_type_size(reflect_type_t* self)
+{
+    NOT_NULL(self);
+
+    if (DOMAIN_BLOB(self->_impl.domain) != NULL)
+    {
+        const struct blob_type* type = blob_type_record(self->_impl.domain, self->_impl.offset);
+        if (type == NULL)
+        {
+            REFLECT_RAISE(EINVAL);
+        }
+        return type->size;
+    }
+
+    Dwarf_Die type;
+    REFLECT_OBJ_TO_DIE(self, &type);
+
+    Dwarf_Word size;
+    if (dwarf_aggregate_size(&type, &size) != 0)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    return (size_t)size;
+}
+
+const char* reflect_type_name(reflect_type_t* self)
+{
+    NOT_NULL(self);
+
+    if (reflect_type_is_c_string(self))
+    {
+        return "const char*";
+    }
+
+    // TODO: very generic
+    if (reflect_type_is_pointer(self))
+    {
+        return "void*";
+    }
+
+    // TODO: very generic
+    if (reflect_type_is_array(self))
+    {
+        return "void[]";
+    }
+
+    CHECK_NULL(get_name(&self->_impl));
+}
+
+reflect_repr_t reflect_type_repr(reflect_type_t* self)
+{
+    NOT_NULL(self);
+
+    if (DOMAIN_BLOB(self->_impl.domain) != NULL)
+    {
+        const struct blob_type* type = blob_type_record(self->_impl.domain, self->_impl.offset);
+        if (type == NULL || type->tag != DW_TAG_base_type)
+        {
+            REFLECT_RAISE(type == NULL ? EINVAL : ENODATA);
+        }
+        return type->repr;
+    }
+
+    Dwarf_Die type;
+    REFLECT_OBJ_TO_DIE(self, &type);
+
+    if (!dwarf_hasattr(&type, DW_AT_encoding))
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    return die_repr(&type);
+}
+
+int reflect_try_type(reflect_type_t* self, const char* name)
+{
+    return name_lookup(libreflect_domain, BLOB_TYPE, name, self == NULL ? NULL : &self->_impl);
+}
+
+reflect_type_t* reflect_type(reflect_type_t* self, const char* name)
+{
+    int error = reflect_try_type(self, name);
+    if (error != 0)
+    {
+        REFLECT_RAISE(error);
+    }
+
+    return self;
+}
+
+reflect_member_t* reflect_type_member_by_index(reflect_type_t* self,
+                                               size_t index,
+                                               reflect_member_t* out)
+{
+    NOT_NULL(self);
+    NOT_NULL(out);
+
+    CHECK_NULL(child_by_index(&self->_impl, DW_TAG_member, index, &out->_impl));
+}
+
+reflect_member_t* reflect_type_member_by_name(reflect_type_t* self,
+                                              const char* name,
+                                              reflect_member_t* out)
+{
+    NOT_NULL(self);
+    NOT_NULL(out);
+
+    CHECK_NULL(child_by_name(&self->_impl, DW_TAG_member, name, &out->_impl));
+}
+
+static struct layout* type_enum_layout(reflect_type_t* self)
+{
+    struct layout* layout = layout_get(self->_impl.domain, self->_impl.offset);
+    if (layout == NULL || layout->kind != LAYOUT_ENUM)
+    {
+        return NULL;
+    }
+
+    return layout;
+}
+
+size_t reflect_type_const_count(reflect_type_t* self)
+{
+    NOT_NULL(self);
+
+    struct layout* layout = type_enum_layout(self);
+    if (layout == NULL)
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    return layout->enumerator_count;
+}
+
+reflect_const_t* reflect_type_const_by_index(reflect_type_t* self,
+                                             size_t index,
+                                             reflect_const_t* out)
+{
+    NOT_NULL(self);
+    NOT_NULL(out);
+
+    CHECK_NULL(child_by_index(&self->_impl, DW_TAG_enumerator, index, &out->_impl));
+}
+
+reflect_const_t* reflect_type_const_by_name(reflect_type_t* self,
+                                            const char* name,
+                                            reflect_const_t* out)
+{
+    NOT_NULL(self);
+    NOT_NULL(name);
+    NOT_NULL(out);
+
+    struct layout* layout = type_enum_layout(self);
+    if (layout == NULL)
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    struct layout_enumerator* enumerator = layout_enumerator_by_name(layout, name);
+    if (enumerator == NULL)
+    {
+        REFLECT_RAISE(ESRCH);
+    }
+
+    out->_impl.domain = layout->domain;
+    out->_impl.offset = enumerator->offset;
+    return out;
+}
+
+reflect_const_t* reflect_type_const_by_value(reflect_type_t* self,
+                                             long value,
+                                             reflect_const_t* out)
+{
+    NOT_NULL(self);
+    NOT_NULL(out);
+
+    struct layout* layout = type_enum_layout(self);
+    if (layout == NULL)
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    struct layout_enumerator* enumerator = layout_enumerator_by_value(layout, value);
+    if (enumerator == NULL)
+    {
+        REFLECT_RAISE(ESRCH);
+    }
+
+    out->_impl.domain = layout->domain;
+    out->_impl.offset = enumerator->offset;
+    return out;
+}
+
+const char* reflect_const_name(reflect_const_t* self)
+{
+    NOT_NULL(self);
+
+    CHECK_NULL(get_name(&self->_impl));
+}
+
+long reflect_const_value(reflect_const_t* self)
+{
+    NOT_NULL(self);
+
+    if (DOMAIN_BLOB(self->_impl.domain) != NULL)
+    {
+        const struct blob_enumerator* enumerator =
+            BLOB_ID_KIND(self->_impl.offset) == BLOB_ENUMERATOR
+                ? blob_record(self->_impl.domain, self->_impl.offset)
+                : NULL;
+        if (enumerator == NULL)
+        {
+            REFLECT_RAISE(EINVAL);
+        }
+        return enumerator->value;
+    }
+
+    Dwarf_Die die;
+    REFLECT_OBJ_TO_DIE(self, &die);
+
+    int64_t value;
+    if (die_const_value(&die, &value) != 0)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    return value;
+}
+
+reflect_type_t* reflect_member_type(reflect_member_t* self, reflect_type_t* out)
+{
+    NOT_NULL(self);
+    NOT_NULL(out);
+
+    CHECK_NULL(peel_type((reflect_type_t*)get_type(&self->_impl, &out->_impl)));
+}
+
+const char* reflect_member_name(reflect_member_t* self)
+{
+    NOT_NULL(self);
+
+    CHECK_NULL(get_name(&self->_impl));
+}
+
+ptrdiff_t reflect_member_offset(reflect_member_t* self)
+{
+    NOT_NULL(self);
+
+    Dwarf_Die die;
+    REFLECT_OBJ_TO_DIE(self, &die);
+
+    Dwarf_Word bit_offset;
+    Dwarf_Word bit_size;
+    if (member_bit_location(&die, &bit_offset, &bit_size) != 0)
+    {
+        REFLECT_RAISE(ENODATA) - 1;
+    }
+
+    return bit_offset / 8;
+}
+
+ptrdiff_t reflect_member_bit_offset(reflect_member_t* self)
+{
+    NOT_NULL(self);
+
+    Dwarf_Die die;
+    REFLECT_OBJ_TO_DIE(self, &die);
+
+    Dwarf_Word bit_offset;
+    Dwarf_Word bit_size;
+    if (member_bit_location(&die, &bit_offset, &bit_size) != 0)
+    {
+        REFLECT_RAISE(ENODATA) - 1;
+    }
+
+    return bit_offset;
+}
+
+size_t reflect_member_bit_size(reflect_member_t* self)
+{
+    NOT_NULL(self);
+
+    Dwarf_Die die;
+    REFLECT_OBJ_TO_DIE(self, &die);
+
+    Dwarf_Word bit_offset;
+    Dwarf_Word bit_size;
+    if (member_bit_location(&die, &bit_offset, &bit_size) != 0)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    return bit_size;
+}
+
+bool reflect_member_is_bitfield(reflect_member_t* self)
+{
+    NOT_NULL(self);
+
+    Dwarf_Die die;
+    REFLECT_OBJ_TO_DIE(self, &die);
+
+    return dwarf_hasattr(&die, DW_AT_bit_size);
+}
+
+reflect_type_t* reflect_typedef_type(reflect_type_t* self, reflect_type_t* out)
+{
+    NOT_NULL(self);
+    NOT_NULL(out);
+
+    CHECK_NULL(peel_type((reflect_type_t*)get_type(&self->_impl, &out->_impl)));
+}
+
+bool reflect_fn_is_extern(reflect_fn_t* self)
+{
+    NOT_NULL(self);
+
+    Dwarf_Die fn;
+    REFLECT_OBJ_TO_DIE(self, &fn);
+
+    Dwarf_Attribute attr;
+    bool value;
+
+    if (dwarf_attr(&fn, DW_AT_external, &attr) == NULL)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    if (dwarf_formflag(&attr, &value) != 0)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    return value;
+}
+
+reflect_var_t* reflect_fn_var_by_index(reflect_fn_t* self, size_t index, reflect_var_t* out)
+{
+    NOT_NULL(self);
+    NOT_NULL(out);
+
+    CHECK_NULL(child_by_index(&self->_impl, DW_TAG_variable, index, &out->_impl));
+}
+
+reflect_var_t* reflect_fn_var_by_name(reflect_fn_t* self, const char* name, reflect_var_t* out)
+{
+    NOT_NULL(self);
+    NOT_NULL(out);
+
+    CHECK_NULL(child_by_name(&self->_impl, DW_TAG_variable, name, &out->_impl));
+}
+
+reflect_var_t* reflect_fn_param_by_index(reflect_fn_t* self, size_t index, reflect_var_t* out)
+{
+    NOT_NULL(self);
+    NOT_NULL(out);
+
+    CHECK_NULL(child_by_index(&self->_impl, DW_TAG_formal_parameter, index, &out->_impl));
+}
+
+reflect_var_t* reflect_fn_param_by_name(reflect_fn_t* self, const char* name, reflect_var_t* out)
+{
+    NOT_NULL(self);
+    NOT_NULL(out);
+
+    CHECK_NULL(child_by_name(&self->_impl, DW_TAG_formal_parameter, name, &out->_impl));
+}
+
+reflect_type_t* reflect_fn_ret_type(reflect_fn_t* self, reflect_type_t* out)
+{
+    NOT_NULL(self);
+    NOT_NULL(out);
+
+    CHECK_NULL(peel_type((reflect_type_t*)get_type(&self->_impl, &out->_impl)));
+}
+
+reflect_type_t* reflect_var_type(reflect_var_t* self, reflect_type_t* out)
+{
+    NOT_NULL(self);
+    NOT_NULL(out);
+
+    CHECK_NULL(peel_type((reflect_type_t*)get_type(&self->_impl, &out->_impl)));
+}
+
+const char* reflect_var_name(reflect_var_t* self)
+{
+    NOT_NULL(self);
+
+    CHECK_NULL(get_name(&self->_impl));
+}
+
+int reflect_try_fn(reflect_fn_t* self, const char* name)
+{
+    return name_lookup(libreflect_domain, BLOB_FUNCTION, name, self == NULL ? NULL : &self->_impl);
+}
+
+reflect_fn_t* reflect_fn(reflect_fn_t* self, const char* name)
+{
+    int error = reflect_try_fn(self, name);
+    if (error != 0)
+    {
+        REFLECT_RAISE(error);
+    }
+
+    return self;
+}
+
+const char* reflect_fn_name(reflect_fn_t* self)
+{
+    NOT_NULL(self);
+
+    CHECK_NULL(get_name(&self->_impl));
+}
+
+int reflect_try_var(reflect_var_t* self, const char* name)
+{
+    return name_lookup(libreflect_domain, BLOB_VARIABLE, name, self == NULL ? NULL : &self->_impl);
+}
+
+reflect_var_t* reflect_var(reflect_var_t* self, const char* name)
+{
+    int error = reflect_try_var(self, name);
+    if (error != 0)
+    {
+        REFLECT_RAISE(error);
+    }
+
+    return self;
+}
+
+// Enums whose value matches an enumerator are written symbolically, anything else as a number. The
+// size differs from layout->size for values extracted from bitfields.
+static FILE* serialize_enum(const reflect_serializer_t* self,
+                            void* object,
+                            size_t size,
+                            struct layout* layout,
+                            FILE* output)
+{
+    bool is_signed = layout->repr == REFLECT_REPR_INT || layout->repr == REFLECT_REPR_SCHAR;
+    int64_t value = load_int(object, size, is_signed);
+
+    struct layout_enumerator* enumerator = layout_enumerator_by_value(layout, value);
+    if (enumerator != NULL)
+    {
+        self->serialize(&enumerator->name, REFLECT_REPR_ENUMERATOR, sizeof(char*), output);
+    }
+    else
+    {
+        self->serialize(object, layout->repr, size, output);
+    }
+
+    return output;
+}
+
+static FILE* serialize_layout(const reflect_serializer_t* self,
+                              void* object,
+                              struct layout* layout,
+                              FILE* output);
+static char* output_strndup(const char* s, size_t len, FILE* output, bool* owned);
+
+// Serializers without the array hooks get arrays as structs with one member per element, named
+// after its index.
+static bool serializer_has_arrays(const reflect_serializer_t* self)
+{
+    return self->begin_array != NULL && self->begin_element != NULL &&
+           self->end_element != NULL && self->end_array != NULL;
+}
+
+static void serialize_array_begin(const reflect_serializer_t* self, const char* name, FILE* output)
+{
+    if (serializer_has_arrays(self))
+    {
+        self->begin_array(name, output);
+    }
+    else
+    {
+        self->begin_struct(name, output);
+    }
+}
+
+static void serialize_array_end(const reflect_serializer_t* self, const char* name, FILE* output)
+{
+    if (serializer_has_arrays(self))
+    {
+        self->end_array(name, output);
+    }
+    else
+    {
+        self->end_struct(name, output);
+    }
+}
+
+static void serialize_element_begin(const reflect_serializer_t* self, size_t index, FILE* output)
+{
+    if (serializer_has_arrays(self))
+    {
+        self->begin_element(index, output);
+    }
+    else
+    {
+        char name[24];
+        snprintf(name, sizeof(name), "%zu", index);
+        self->begin_member(name, output);
+    }
+}
+
+static void serialize_element_end(const reflect_serializer_t* self,
+                                  size_t index,
+                                  FILE* output,
+                                  bool is_last)
+{
+    if (serializer_has_arrays(self))
+    {
+        self->end_element(index, output, is_last);
+    }
+    else
+    {
+        char name[24];
+        snprintf(name, sizeof(name), "%zu", index);
+        self->end_member(name, output, is_last);
+    }
+}
+
+static FILE* serialize_array(const reflect_serializer_t* self,
+                             void* object,
+                             struct layout* element,
+                             const size_t* dims,
+                             size_t dim_count,
+                             FILE* output)
+{
+    if (element == NULL)
+    {
+        return NULL;
+    }
+
+    // char[N] is written as a string, up to the first NUL.
+    if (dim_count == 1 && element->kind == LAYOUT_SCALAR && element->size == 1 &&
+        (element->repr == REFLECT_REPR_SCHAR || element->repr == REFLECT_REPR_UCHAR))
+    {
+        const char* s = object;
+        size_t len = strnlen(s, dims[0]);
+        if (len == dims[0])
+        {
+            bool owned;
+            char* copy = output_strndup(s, len, output, &owned);
+            if (copy == NULL)
+            {
+                return NULL;
+            }
+            self->serialize(&copy, REFLECT_REPR_STRING, sizeof(char*), output);
+            if (owned)
+            {
+                free(copy);
+            }
+        }
+        else
+        {
+            self->serialize(&s, REFLECT_REPR_STRING, sizeof(char*), output);
+        }
+        return output;
+    }
+
+    size_t stride = element->size;
+    for (size_t i = 1; i < dim_count; i++)
+    {
+        stride *= dims[i];
+    }
+
+    serialize_array_begin(self, element->name, output);
+
+    for (size_t i = 0; i < dims[0]; i++)
+    {
+        uint8_t* item = (uint8_t*)object + i * stride;
+
+        serialize_element_begin(self, i, output);
+
+        if (dim_count > 1)
+        {
+            serialize_array(self, item, element, dims + 1, dim_count - 1, output);
+        }
+        else
+        {
+            serialize_layout(self, item, element, output);
+        }
+
+        serialize_element_end(self, i, output, i + 1 == dims[0]);
+    }
+
+    serialize_array_end(self, element->name, output);
+    return output;
+}
+
+static FILE* serialize_layout(const reflect_serializer_t* self,
+                              void* object,
+                              struct layout* layout,
+                              FILE* output)
+{
+    switch (layout->kind)
+    {
+    case LAYOUT_SCALAR:
+        self->serialize(object, layout->repr, layout->size, output);
+        return output;
+    case LAYOUT_ENUM:
+        return serialize_enum(self, object, layout->size, layout, output);
+    case LAYOUT_STRING:
+        if (*(void**)object == NULL)
+        {
+            self->serialize(object, REFLECT_REPR_POINTER, sizeof(void*), output);
+        }
+        else
+        {
+            self->serialize(object, REFLECT_REPR_STRING, sizeof(void*), output);
+        }
+        return output;
+    case LAYOUT_POINTER: {
+        struct layout* target = layout_target(layout);
+        if (*(void**)object == NULL || target == NULL)
+        {
+            self->serialize(object, REFLECT_REPR_POINTER, sizeof(void*), output);
+            return output;
+        }
+
+        return serialize_layout(self, *(void**)object, target, output);
+    }
+    case LAYOUT_STRUCT:
+        self->begin_struct(layout->name, output);
+
+        for (size_t i = 0; i < layout->field_count; i++)
+        {
+            struct layout_field* field = &layout->fields[i];
+            struct layout* type = field_layout(layout, field);
+            if (type == NULL)
+            {
+                // TODO: error
+                continue;
+            }
+
+            self->begin_member(field->name, output);
+
+            if (field->bit_size != 0)
+            {
+                uint64_t value = field_load(field, object);
+                if (type->kind == LAYOUT_ENUM)
+                {
+                    serialize_enum(self, &value, sizeof(value), type, output);
+                }
+                else
+                {
+                    self->serialize(&value, type->repr, sizeof(value), output);
+                }
+            }
+            else
+            {
+                serialize_layout(self, (uint8_t*)object + field->offset, type, output);
+            }
+
+            // This is really dumb. Some formats, cough cough JSON, need special handling for the
+            // last member. We have to provide this info to the user.
+            self->end_member(field->name, output, i + 1 == layout->field_count);
+        }
+
+        self->end_struct(layout->name, output);
+        return output;
+    case LAYOUT_ARRAY:
+        return serialize_array(
+            self, object, layout_target(layout), layout->dims, layout->dim_count, output);
+    default:
+        // TODO
+        return NULL;
+    }
+}
+
+/*
+ * Scatter-gather output
+ *
+ * reflect_serialize_iov() hands the serializers a FILE* created with fopencookie(). Everything
+ * written through it is appended to a chain of scratch blocks, while output_span() references
+ * long runs of source strings in place. Scratch blocks are never reallocated, so iovec entries
+ * pointing into them stay valid until reflect_iovec_free().
+ */
+
+// Spans shorter than this are copied, an iovec entry costs more than the copy.
+#define IOV_MIN_REFERENCE 64
+#define IOV_SCRATCH_SIZE  4096
+
+struct scratch_block
+{
+    struct scratch_block* next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+static __thread reflect_iovec_t* libreflect_iov;
+static __thread FILE* libreflect_iov_file;
+
+static bool iov_push(reflect_iovec_t* self, const void* base, size_t len)
+{
+    if (self->count != 0)
+    {
+        struct iovec* last = &self->iov[self->count - 1];
+        if ((const char*)last->iov_base + last->iov_len == base)
+        {
+            last->iov_len += len;
+            return true;
+        }
+    }
+
+    if (self->count == self->_impl.capacity)
+    {
+        size_t capacity = self->_impl.capacity == 0 ? 16 : self->_impl.capacity * 2;
+        struct iovec* iov = realloc(self->iov, capacity * sizeof(struct iovec));
+        if (iov == NULL)
+        {
+            return false;
+        }
+
+        self->iov = iov;
+        self->_impl.capacity = capacity;
+    }
+
+    self->iov[self->count++] = (struct iovec){
+        .iov_base = (void*)base,
+        .iov_len = len,
+    };
+    return true;
+}
+
+static ssize_t iov_cookie_write(void* cookie, const char* buf, size_t size)
+{
+    reflect_iovec_t* self = cookie;
+    struct scratch_block* block = self->_impl.scratch;
+
+    if (block == NULL || block->size - block->used < size)
+    {
+        size_t block_size = size > IOV_SCRATCH_SIZE ? size : IOV_SCRATCH_SIZE;
+        block = malloc(sizeof(struct scratch_block) + block_size);
+        if (block == NULL)
+        {
+            return -1;
+        }
+
+        block->next = self->_impl.scratch;
+        block->size = block_size;
+        block->used = 0;
+        self->_impl.scratch = block;
+    }
+
+    char* data = block->data + block->used;
+    memcpy(data, buf, size);
+    if (!iov_push(self, data, size))
+    {
+        return -1;
+    }
+
+    block->used += size;
+    return size;
+}
+
+// Writes part of a source string.
+static void output_span(const char* s, size_t len, FILE* output)
+{
+    if (len >= IOV_MIN_REFERENCE && output == libreflect_iov_file)
+    {
+        // Whatever is buffered precedes the span.
+        if (fflush(output) == 0 && iov_push(libreflect_iov, s, len))
+        {
+            return;
+        }
+    }
+
+    fwrite(s, 1, len, output);
+}
+
+// Copies a string that has no NUL within len bytes. The copy of a string written to the FILE of
+// reflect_serialize_iov() belongs to its scratch blocks, since output_span() may reference it
+// until reflect_iovec_free(). Other copies are freed by the caller, *owned tells which.
+static char* output_strndup(const char* s, size_t len, FILE* output, bool* owned)
+{
+    *owned = output != libreflect_iov_file;
+    if (*owned)
+    {
+        return strndup(s, len);
+    }
+
+    struct scratch_block* block = malloc(sizeof(struct scratch_block) + len + 1);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+
+    block->size = len + 1;
+    block->used = len + 1;
+    memcpy(block->data, s, len);
+    block->data[len] = '\0';
+
+    // Behind the block being written to, which stays first.
+    struct scratch_block* head = libreflect_iov->_impl.scratch;
+    block->next = head == NULL ? NULL : head->next;
+    if (head == NULL)
+    {
+        libreflect_iov->_impl.scratch = block;
+    }
+    else
+    {
+        head->next = block;
+    }
+
+    return block->data;
+}
+
+/*
+ * String escaping
+ *
+ * Strings are scanned for the first byte that needs attention (a character that must be escaped,
+ * a control character, non-ASCII or the terminator) 16 or 32 bytes at a time. Everything before
+ * it is written in bulk. Non-ASCII bytes are validated as UTF-8 on the spot and stay part of the
+ * clean run when valid. The loads are aligned, so reading past the terminator never crosses into
+ * another page.
+ */
+
+#define UTF8_REPLACEMENT "\xEF\xBF\xBD"
+
+struct escaper
+{
+    // Characters besides control characters and non-ASCII bytes that need escaping. Unused slots
+    // repeat a previous character.
+    char special[5];
+
+    // Same information as above, used by the scalar scanner.
+    uint8_t table[256];
+
+    // Writes a control character or one of the special characters.
+    void (*escape)(unsigned char c, FILE* output);
+
+    // Writes a byte that is not part of a valid UTF-8 sequence.
+    void (*invalid)(unsigned char c, FILE* output);
+
+    // The number of bytes escape() writes for the characters in table, or invalid() for bytes from
+    // 0x80 up, and the largest of these.
+    uint8_t lengths[256];
+    uint8_t widest;
+};
+
+static void json_escape(unsigned char c, FILE* output)
+{
+    switch (c)
+    {
+    case '"':
+        fputs("\\\"", output);
+        break;
+    case '\\':
+        fputs("\\\\", output);
+        break;
+    case '\b':
+        fputs("\\b", output);
+        break;
+    case '\f':
+        fputs("\\f", output);
+        break;
+    case '\n':
+        fputs("\\n", output);
+        break;
+    case '\r':
+        fputs("\\r", output);
+        break;
+    case '\t':
+        fputs("\\t", output);
+        break;
+    default:
+        fprintf(output, "\\u%04x", c);
+        break;
+    }
+}
+
+static void xml_escape(unsigned char c, FILE* output)
+{
+    switch (c)
+    {
+    case '<':
+        fputs("&#60;", output);
+        break;
+    case '&':
+        fputs("&#38;", output);
+        break;
+    case '>':
+        fputs("&#62;", output);
+        break;
+    case '\'':
+        fputs("&#39;", output);
+        break;
+    case '"':
+        fputs("&#34;", output);
+        break;
+    case '\t':
+    case '\n':
+    case '\r':
+        fputc(c, output);
+        break;
+    default:
+        // Other control characters are not allowed in XML 1.0, even as references.
+        fputs(UTF8_REPLACEMENT, output);
+        break;
+    }
+}
+
+static void c_escape(unsigned char c, FILE* output)
+{
+    switch (c)
+    {
+    case '"':
+        fputs("\\\"", output);
+        break;
+    case '\\':
+        fputs("\\\\", output);
+        break;
+    case '\a':
+        fputs("\\a", output);
+        break;
+    case '\b':
+        fputs("\\b", output);
+        break;
+    case '\f':
+        fputs("\\f", output);
+        break;
+    case '\n':
+        fputs("\\n", output);
+        break;
+    case '\r':
+        fputs("\\r", output);
+        break;
+    case '\t':
+        fputs("\\t", output);
+        break;
+    case '\v':
+        fputs("\\v", output);
+        break;
+    default:
+        // Always 3 digits, so that a following digit is not taken as part of the escape.
+        fprintf(output, "\\%03o", c);
+        break;
+    }
+}
+
+static void utf8_replace(unsigned char c, FILE* output)
+{
+    fputs(UTF8_REPLACEMENT, output);
+    (void)c;
+}
+
+#define ESCAPE_TABLE_COMMON [0 ... 0x1F] = 1, [0x80 ... 0xFF] = 1
+
+static const struct escaper escaper_json = {
+    .special = {'"', '\\', '\\', '\\', '\\'},
+    .table = {ESCAPE_TABLE_COMMON, ['"'] = 1, ['\\'] = 1},
+    .escape = json_escape,
+    .invalid = utf8_replace,
+    .lengths = {[0 ... 7] = 6, [8 ... 10] = 2, [11] = 6, [12 ... 13] = 2, [14 ... 0x1F] = 6,
+                ['"'] = 2, ['\\'] = 2, [0x80 ... 0xFF] = 3},
+    .widest = 6,
+};
+
+static const struct escaper escaper_xml = {
+    .special = {'<', '&', '>', '\'', '"'},
+    .table = {ESCAPE_TABLE_COMMON, ['<'] = 1, ['&'] = 1, ['>'] = 1, ['\''] = 1, ['"'] = 1},
+    .escape = xml_escape,
+    .invalid = utf8_replace,
+    .lengths = {[0 ... 8] = 3, [9 ... 10] = 1, [11 ... 12] = 3, [13] = 1, [14 ... 0x1F] = 3,
+                ['<'] = 5, ['&'] = 5, ['>'] = 5, ['\''] = 5, ['"'] = 5, [0x80 ... 0xFF] = 3},
+    .widest = 5,
+};
+
+static const struct escaper escaper_c = {
+    .special = {'"', '\\', '\\', '\\', '\\'},
+    .table = {ESCAPE_TABLE_COMMON, ['"'] = 1, ['\\'] = 1},
+    .escape = c_escape,
+    // C string literals can hold arbitrary bytes.
+    .invalid = c_escape,
+    .lengths = {[0 ... 6] = 4, [7 ... 13] = 2, [14 ... 0x1F] = 4, ['"'] = 2, ['\\'] = 2,
+                [0x80 ... 0xFF] = 4},
+    .widest = 4,
+};
+
+static const char* escape_scan_scalar(const char* s, const struct escaper* escaper)
+{
+    const unsigned char* p = (const unsigned char*)s;
+    for (;; p += 4)
+    {
+        if (escaper->table[p[0]])
+        {
+            return (const char*)p;
+        }
+        if (escaper->table[p[1]])
+        {
+            return (const char*)p + 1;
+        }
+        if (escaper->table[p[2]])
+        {
+            return (const char*)p + 2;
+        }
+        if (escaper->table[p[3]])
+        {
+            return (const char*)p + 3;
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// The vector scanners load whole aligned blocks, which may start before the string and end past
+// its terminator. An aligned block never crosses a page boundary, so the loads cannot fault, but
+// the sanitizers would report the bytes read outside the string. Only the bytes from the start of
+// the string up to its terminator are ever used.
+#define ESCAPE_SCAN_UNCHECKED __attribute__((no_sanitize("address", "thread")))
+
+static inline unsigned escape_mask_sse2(__m128i v, const struct escaper* escaper)
+{
+    // Signed comparison, so bytes >= 0x80 count as less than 0x20 too. This also catches the
+    // terminator.
+    __m128i m = _mm_cmplt_epi8(v, _mm_set1_epi8(0x20));
+    for (size_t i = 0; i < sizeof(escaper->special); i++)
+    {
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(escaper->special[i])));
+    }
+    return (unsigned)_mm_movemask_epi8(m);
+}
+
+ESCAPE_SCAN_UNCHECKED static const char* escape_scan_sse2(const char* s,
+                                                         const struct escaper* escaper)
+{
+    size_t misalign = (uintptr_t)s & 15;
+    const char* p = s - misalign;
+
+    unsigned mask = escape_mask_sse2(_mm_load_si128((const __m128i*)p), escaper);
+    mask &= 0xFFFFu << misalign;
+
+    while (mask == 0)
+    {
+        p += 16;
+        mask = escape_mask_sse2(_mm_load_si128((const __m128i*)p), escaper);
+    }
+
+    return p + __builtin_ctz(mask);
+}
+
+__attribute__((target("avx2"))) static inline uint32_t escape_mask_avx2(
+    __m256i v, const struct escaper* escaper)
+{
+    __m256i m = _mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), v);
+    for (size_t i = 0; i < sizeof(escaper->special); i++)
+    {
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(escaper->special[i])));
+    }
+    return (uint32_t)_mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2"))) ESCAPE_SCAN_UNCHECKED static const char* escape_scan_avx2(
+    const char* s, const struct escaper* escaper)
+{
+    size_t misalign = (uintptr_t)s & 31;
+    const char* p = s - misalign;
+
+    uint32_t mask = escape_mask_avx2(_mm256_load_si256((const __m256i*)p), escaper);
+    mask &= UINT32_MAX << misalign;
+
+    while (mask == 0)
+    {
+        p += 32;
+        mask = escape_mask_avx2(_mm256_load_si256((const __m256i*)p), escaper);
+    }
+
+    return p + __builtin_ctz(mask);
+}
+#endif
+
+static const char* escape_scan_select(const char* s, const struct escaper* escaper);
+
+static const char* (*escape_scan)(const char*, const struct escaper*) = escape_scan_select;
+
+static void escape_scan_init()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        escape_scan = escape_scan_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        escape_scan = escape_scan_sse2;
+    }
+    else
+    {
+        escape_scan = escape_scan_scalar;
+    }
+#else
+    escape_scan = escape_scan_scalar;
+#endif
+}
+
+static const char* escape_scan_select(const char* s, const struct escaper* escaper)
+{
+    escape_scan_init();
+    return escape_scan(s, escaper);
+}
+
+// Returns the length of the valid UTF-8 sequence starting at s, or 0 if there is none. Overlong
+// encodings, surrogates and code points past U+10FFFF are rejected.
+static size_t utf8_sequence(const unsigned char* s)
+{
+    unsigned char c = s[0];
+
+    if (c >= 0xC2 && c <= 0xDF)
+    {
+        return (s[1] & 0xC0) == 0x80 ? 2 : 0;
+    }
+
+    if (c >= 0xE0 && c <= 0xEF)
+    {
+        unsigned char low = c == 0xE0 ? 0xA0 : 0x80;
+        unsigned char high = c == 0xED ? 0x9F : 0xBF;
+        return s[1] >= low && s[1] <= high && (s[2] & 0xC0) == 0x80 ? 3 : 0;
+    }
+
+    if (c >= 0xF0 && c <= 0xF4)
+    {
+        unsigned char low = c == 0xF0 ? 0x90 : 0x80;
+        unsigned char high = c == 0xF4 ? 0x8F : 0xBF;
+        return s[1] >= low && s[1] <= high && (s[2] & 0xC0) == 0x80 && (s[3] & 0xC0) == 0x80 ? 4
+                                                                                            : 0;
+    }
+
+    return 0;
+}
+
+static void output_escaped(const char* s, const struct escaper* escaper, FILE* output)
+{
+    const char* span = s;
+
+    for (;;)
+    {
+        s = escape_scan(s, escaper);
+        unsigned char c = *s;
+
+        if (c >= 0x80)
+        {
+            size_t len = utf8_sequence((const unsigned char*)s);
+            if (len != 0)
+            {
+                s += len;
+                continue;
+            }
+        }
+
+        output_span(span, s - span, output);
+
+        if (c == '\0')
+        {
+            return;
+        }
+
+        if (c >= 0x80)
+        {
+            escaper->invalid(c, output);
+        }
+        else
+        {
+            escaper->escape(c, output);
+        }
+
+        span = ++s;
+    }
+}
+
+static void serialize_int(void* object, size_t size, FILE* output)
+{
+    switch (size)
+    {
+    case 1:
+        fprintf(output, "%" PRIi8, *(int8_t*)object);
+        break;
+    case 2:
+        fprintf(output, "%" PRIi16, *(int16_t*)object);
+        break;
+    case 4:
+        fprintf(output, "%" PRIi32, *(int32_t*)object);
+        break;
+    case 8:
+        fprintf(output, "%" PRIi64, *(int64_t*)object);
+        break;
+    default:
+        // TODO
+        break;
+    }
+}
+
+static void serialize_uint(void* object, size_t size, FILE* output)
+{
+    switch (size)
+    {
+    case 1:
+        fprintf(output, "%" PRIu8, *(uint8_t*)object);
+        break;
+    case 2:
+        fprintf(output, "%" PRIu16, *(uint16_t*)object);
+        break;
+    case 4:
+        fprintf(output, "%" PRIu32, *(uint32_t*)object);
+        break;
+    case 8:
+        fprintf(output, "%" PRIu64, *(uint64_t*)object);
+        break;
+    default:
+        // TODO
+        break;
+    }
+}
+
+static void serialize_float(void* object, size_t size, FILE* output)
+{
+    switch (size)
+    {
+    case 4:
+        fprintf(output, "%f", *(float*)object);
+        break;
+    case 8:
+        fprintf(output, "%lf", *(double*)object);
+        break;
+    case 16:
+        fprintf(output, "%Lf", *(long double*)object);
+    default:
+        // TODO
+        break;
+    }
+}
+
+static void json_serialize(void* object, reflect_repr_t repr, size_t size, FILE* output)
+{
+    switch (repr)
+    {
+    case REFLECT_REPR_FLOAT:
+        serialize_float(object, size, output);
+        break;
+    case REFLECT_REPR_INT:
+        serialize_int(object, size, output);
+        break;
+    case REFLECT_REPR_UINT:
+        serialize_uint(object, size, output);
+        break;
+    case REFLECT_REPR_POINTER:
+        serialize_uint(object, sizeof(void*), output);
+        break;
+    case REFLECT_REPR_BOOLEAN:
+        fputs((*(bool*)object) ? "true" : "false", output);
+        break;
+    case REFLECT_REPR_SCHAR:
+    case REFLECT_REPR_UCHAR: {
+        unsigned char c = *(unsigned char*)object;
+        fputc('"', output);
+        if (c >= 0x80)
+        {
+            // A lone byte is not valid UTF-8, write it as the Latin-1 code point.
+            fprintf(output, "\\u%04x", c);
+        }
+        else if (escaper_json.table[c])
+        {
+            escaper_json.escape(c, output);
+        }
+        else
+        {
+            fputc(c, output);
+        }
+        fputc('"', output);
+        break;
+    }
+    case REFLECT_REPR_ENUMERATOR:
+        fprintf(output, "\"%s\"", *(const char**)object);
+        break;
+    case REFLECT_REPR_STRING:
+        fputc('"', output);
+        output_escaped(*(const char**)object, &escaper_json, output);
+        fputc('"', output);
+        break;
+    default:
+        // TODO
+        break;
+    }
+}
+
+static void json_begin_member(const char* name, FILE* output)
+{
+    fprintf(output, "\"%s\":", name);
+}
+
+static void json_end_member(const char* name, FILE* output, bool is_last_member)
+{
+    if (!is_last_member)
+    {
+        fprintf(output, ",");
+    }
+
+    (void)name;
+}
+
+static void json_begin_struct(const char* name, FILE* output)
+{
+    fprintf(output, "{");
+    (void)name;
+}
+
+static void json_end_struct(const char* name, FILE* output)
+{
+    fprintf(output, "}");
+    (void)name;
+}
+
+static void json_begin_array(const char* name, FILE* output)
+{
+    fputc('[', output);
+    (void)name;
+}
+
+static void json_begin_element(size_t index, FILE* output)
+{
+    (void)index;
+    (void)output;
+}
+
+static void json_end_element(size_t index, FILE* output, bool is_last_element)
+{
+    if (!is_last_element)
+    {
+        fputc(',', output);
+    }
+
+    (void)index;
+}
+
+static void json_end_array(const char* name, FILE* output)
+{
+    fputc(']', output);
+    (void)name;
+}
+
+static void xml_serialize(void* object, reflect_repr_t repr, size_t size, FILE* output)
+{
+    switch (repr)
+    {
+    case REFLECT_REPR_FLOAT:
+        serialize_float(object, size, output);
+        break;
+    case REFLECT_REPR_INT:
+        serialize_int(object, size, output);
+        break;
+    case REFLECT_REPR_UINT:
+        serialize_uint(object, size, output);
+        break;
+    case REFLECT_REPR_POINTER:
+        serialize_uint(object, sizeof(void*), output);
+        break;
+    case REFLECT_REPR_BOOLEAN:
+        fputs((*(bool*)object) ? "true" : "false", output);
+        break;
+    case REFLECT_REPR_SCHAR:
+    case REFLECT_REPR_UCHAR: {
+        unsigned char c = *(unsigned char*)object;
+        if (c >= 0x80)
+        {
+            // A lone byte is not valid UTF-8, write the Latin-1 code point instead.
+            fprintf(output, "&#%d;", c);
+        }
+        else if (escaper_xml.table[c])
+        {
+            escaper_xml.escape(c, output);
+        }
+        else
+        {
+            fputc(c, output);
+        }
+        break;
+    }
+    case REFLECT_REPR_ENUMERATOR:
+        fputs(*(const char**)object, output);
+        break;
+    case REFLECT_REPR_STRING:
+        output_escaped(*(const char**)object, &escaper_xml, output);
+        break;
+    default:
+        // TODO
+        break;
+    }
+}
+
+static void xml_begin_member(const char* name, FILE* output)
+{
+    fprintf(output, "<%s>", name);
+}
+
+static void xml_end_member(const char* name, FILE* output, bool is_last_member)
+{
+    fprintf(output, "</%s>", name);
+    (void)is_last_member;
+}
+
+static void xml_begin_struct(const char* name, FILE* output)
+{
+    (void)name;
+    (void)output;
+}
+
+static void xml_end_struct(const char* name, FILE* output)
+{
+    (void)name;
+    (void)output;
+}
+
+static void xml_begin_array(const char* name, FILE* output)
+{
+    (void)name;
+    (void)output;
+}
+
+static void xml_begin_element(size_t index, FILE* output)
+{
+    fputs("<item>", output);
+    (void)index;
+}
+
+static void xml_end_element(size_t index, FILE* output, bool is_last_element)
+{
+    fputs("</item>", output);
+    (void)index;
+    (void)is_last_element;
+}
+
+static void xml_end_array(const char* name, FILE* output)
+{
+    (void)name;
+    (void)output;
+}
+
+static void c_serialize(void* object, reflect_repr_t repr, size_t size, FILE* output)
+{
+    switch (repr)
+    {
+    case REFLECT_REPR_SCHAR:
+    case REFLECT_REPR_UCHAR: {
+        unsigned char c = *(unsigned char*)object;
+        fputc('\'', output);
+        if (c == '\'')
+        {
+            fputs("\\'", output);
+        }
+        else if (escaper_c.table[c])
+        {
+            escaper_c.escape(c, output);
+        }
+        else
+        {
+            fputc(c, output);
+        }
+        fputc('\'', output);
+        break;
+    }
+    case REFLECT_REPR_ENUMERATOR:
+        fputs(*(const char**)object, output);
+        break;
+    case REFLECT_REPR_STRING:
+        fputc('"', output);
+        output_escaped(*(const char**)object, &escaper_c, output);
+        fputc('"', output);
+        break;
+    default:
+        json_serialize(object, repr, size, output);
+        break;
+    }
+}
+
+static void c_begin_member(const char* name, FILE* output)
+{
+    fprintf(output, ".%s = ", name);
+}
+
+static void c_end_member(const char* name, FILE* output, bool is_last_member)
+{
+    fprintf(output, ",\n");
+    (void)name;
+    (void)is_last_member;
+}
+
+static void c_begin_struct(const char* name, FILE* output)
+{
+    fprintf(output, "{\n");
+    (void)name;
+}
+
+static void c_end_struct(const char* name, FILE* output)
+{
+    fprintf(output, "}");
+    (void)name;
+}
+
+static void c_begin_array(const char* name, FILE* output)
+{
+    fputc('{', output);
+    (void)name;
+}
+
+static void c_end_element(size_t index, FILE* output, bool is_last_element)
+{
+    if (!is_last_element)
+    {
+        fputs(", ", output);
+    }
+
+    (void)index;
+}
+
+static void c_end_array(const char* name, FILE* output)
+{
+    fputc('}', output);
+    (void)name;
+}
+
+static const reflect_serializer_t libreflect_serializer_json = {
+    .serialize = json_serialize,
+    .begin_member = json_begin_member,
+    .end_member = json_end_member,
+    .begin_struct = json_begin_struct,
+    .end_struct = json_end_struct,
+    .begin_array = json_begin_array,
+    .begin_element = json_begin_element,
+    .end_element = json_end_element,
+    .end_array = json_end_array,
+};
+
+static const reflect_serializer_t libreflect_serializer_xml = {
+    .serialize = xml_serialize,
+    .begin_member = xml_begin_member,
+    .end_member = xml_end_member,
+    .begin_struct = xml_begin_struct,
+    .end_struct = xml_end_struct,
+    .begin_array = xml_begin_array,
+    .begin_element = xml_begin_element,
+    .end_element = xml_end_element,
+    .end_array = xml_end_array,
+};
+
+static const reflect_serializer_t libreflect_serializer_c = {
+    .serialize = c_serialize,
+    .begin_member = c_begin_member,
+    .end_member = c_end_member,
+    .begin_struct = c_begin_struct,
+    .end_struct = c_end_struct,
+    .begin_array = c_begin_array,
+    .begin_element = json_begin_element,
+    .end_element = c_end_element,
+    .end_array = c_end_array,
+};
+
+static const reflect_serializer_t* serializer_resolve(const reflect_serializer_t* self)
+{
+    switch ((uintptr_t)self)
+    {
+    case 1:
+        return &libreflect_serializer_json;
+    case 2:
+        return &libreflect_serializer_xml;
+    case 3:
+        return &libreflect_serializer_c;
+    default:
+        return self;
+    }
+}
+
+FILE* reflect_serialize(const reflect_serializer_t* self,
+                        void* object,
+                        reflect_type_t* type,
+                        FILE* output)
+{
+    NOT_NULL(self);
+    NOT_NULL(object);
+    NOT_NULL(type);
+    NOT_NULL(output);
+
+    self = serializer_resolve(self);
+
+    struct layout* layout = layout_get(type->_impl.domain, type->_impl.offset);
+    if (layout == NULL)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    return serialize_layout(self, object, layout, output);
+}
+
+// Serializes elements [first, last) of an array of count elements, without the enclosing
+// begin_array/end_array.
+static FILE* serialize_elements(const reflect_serializer_t* self,
+                                void* base,
+                                size_t first,
+                                size_t last,
+                                size_t count,
+                                struct layout* layout,
+                                FILE* output)
+{
+    for (size_t i = first; i < last; i++)
+    {
+        serialize_element_begin(self, i, output);
+
+        if (serialize_layout(self, (uint8_t*)base + i * layout->size, layout, output) == NULL)
+        {
+            return NULL;
+        }
+
+        serialize_element_end(self, i, output, i + 1 == count);
+    }
+
+    return output;
+}
+
+FILE* reflect_serialize_array(const reflect_serializer_t* self,
+                              void* base,
+                              size_t count,
+                              reflect_type_t* type,
+                              FILE* output)
+{
+    NOT_NULL(self);
+    NOT_NULL(base);
+    NOT_NULL(type);
+    NOT_NULL(output);
+
+    self = serializer_resolve(self);
+
+    struct layout* layout = layout_get(type->_impl.domain, type->_impl.offset);
+    if (layout == NULL)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    serialize_array_begin(self, layout->name, output);
+
+    if (serialize_elements(self, base, 0, count, count, layout, output) == NULL)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    serialize_array_end(self, layout->name, output);
+    return output;
+}
+
+// Below this many elements per thread, starting threads costs more than it saves.
+#define PARALLEL_MIN_ELEMENTS 256
+
+struct serialize_job
+{
+    const reflect_serializer_t* serializer;
+    struct layout* layout;
+    void* base;
+    size_t first;
+    size_t last;
+    size_t count;
+    char* buffer;
+    size_t size;
+    bool failed;
+};
+
+static void* serialize_job_run(void* arg)
+{
+    struct serialize_job* job = arg;
+
+    FILE* output = open_memstream(&job->buffer, &job->size);
+    if (output == NULL)
+    {
+        job->failed = true;
+        return NULL;
+    }
+
+    job->failed = serialize_elements(job->serializer,
+                                     job->base,
+                                     job->first,
+                                     job->last,
+                                     job->count,
+                                     job->layout,
+                                     output) == NULL;
+
+    fclose(output);
+    return NULL;
+}
+
+FILE* reflect_serialize_array_parallel(const reflect_serializer_t* self,
+                                       void* base,
+                                       size_t count,
+                                       reflect_type_t* type,
+                                       FILE* output,
+                                       size_t threads)
+{
+    NOT_NULL(self);
+    NOT_NULL(base);
+    NOT_NULL(type);
+    NOT_NULL(output);
+
+    self = serializer_resolve(self);
+
+    struct layout* layout = layout_get(type->_impl.domain, type->_impl.offset);
+    if (layout == NULL)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    if (threads == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (size_t)cpus : 1;
+    }
+
+    if (threads > count / PARALLEL_MIN_ELEMENTS)
+    {
+        threads = count / PARALLEL_MIN_ELEMENTS;
+    }
+
+    if (threads <= 1)
+    {
+        return reflect_serialize_array(self, base, count, type, output);
+    }
+
+    // Workers only read the layouts, so everything they can reach must be resolved up front.
+    layout_warm(layout);
+    escape_scan_init();
+
+    struct serialize_job* jobs = calloc(threads, sizeof(struct serialize_job));
+    pthread_t* workers = calloc(threads, sizeof(pthread_t));
+    if (jobs == NULL || workers == NULL)
+    {
+        free(jobs);
+        free(workers);
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    size_t started = 0;
+    for (; started < threads; started++)
+    {
+        jobs[started] = (struct serialize_job){
+            .serializer = self,
+            .layout = layout,
+            .base = base,
+            .first = count * started / threads,
+            .last = count * (started + 1) / threads,
+            .count = count,
+        };
+
+        if (pthread_create(&workers[started], NULL, serialize_job_run, &jobs[started]) != 0)
+        {
+            break;
+        }
+    }
+
+    // Whatever could not be handed to a thread is done here.
+    if (started < threads)
+    {
+        jobs[started].last = count;
+        serialize_job_run(&jobs[started]);
+    }
+
+    serialize_array_begin(self, layout->name, output);
+
+    bool failed = false;
+    for (size_t i = 0; i <= started && i < threads; i++)
+    {
+        if (i < started)
+        {
+            pthread_join(workers[i], NULL);
+        }
+
+        failed |= jobs[i].failed;
+        if (!failed)
+        {
+            fwrite(jobs[i].buffer, 1, jobs[i].size, output);
+        }
+        free(jobs[i].buffer);
+    }
+
+    free(jobs);
+    free(workers);
+
+    if (failed)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    serialize_array_end(self, layout->name, output);
+    return output;
+}
+
+reflect_iovec_t* reflect_serialize_iov(const reflect_serializer_t* self,
+                                       void* object,
+                                       reflect_type_t* type,
+                                       reflect_iovec_t* output)
+{
+    NOT_NULL(output);
+
+    cookie_io_functions_t functions = {
+        .write = iov_cookie_write,
+    };
+
+    FILE* file = fopencookie(output, "w", functions);
+    if (file == NULL)
+    {
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    setvbuf(file, NULL, _IOFBF, IOV_SCRATCH_SIZE);
+
+    reflect_iovec_t* previous_iov = libreflect_iov;
+    FILE* previous_file = libreflect_iov_file;
+    libreflect_iov = output;
+    libreflect_iov_file = file;
+
+    FILE* result = reflect_serialize(self, object, type, file);
+
+    libreflect_iov = previous_iov;
+    libreflect_iov_file = previous_file;
+
+    // reflect_serialize() already reported its own error, so only a failed flush is ours.
+    if (fclose(file) != 0 && result != NULL)
+    {
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    return result != NULL ? output : NULL;
+}
+
+size_t reflect_iovec_size(const reflect_iovec_t* self)
+{
+    NOT_NULL(self);
+
+    size_t size = 0;
+    for (size_t i = 0; i < self->count; i++)
+    {
+        size += self->iov[i].iov_len;
+    }
+
+    return size;
+}
+
+ssize_t reflect_iovec_write(const reflect_iovec_t* self, int fd)
+{
+    if (self == NULL)
+    {
+        REFLECT_RAISE(EFAULT) - 1;
+    }
+
+    struct iovec batch[256];
+    size_t index = 0;
+    size_t skip = 0;
+    ssize_t total = 0;
+
+    while (index < self->count)
+    {
+        size_t count = self->count - index;
+        if (count > sizeof(batch) / sizeof(batch[0]))
+        {
+            count = sizeof(batch) / sizeof(batch[0]);
+        }
+
+        memcpy(batch, &self->iov[index], count * sizeof(struct iovec));
+        batch[0].iov_base = (char*)batch[0].iov_base + skip;
+        batch[0].iov_len -= skip;
+
+        ssize_t written = writev(fd, batch, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        total += written;
+
+        // Advance past whatever was written, possibly stopping in the middle of an entry.
+        size_t remaining = written + skip;
+        while (index < self->count && remaining >= self->iov[index].iov_len)
+        {
+            remaining -= self->iov[index].iov_len;
+            index++;
+        }
+        skip = remaining;
+    }
+
+    return total;
+}
+
+void reflect_iovec_free(reflect_iovec_t* self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+
+    struct scratch_block* block = self->_impl.scratch;
+    while (block != NULL)
+    {
+        struct scratch_block* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(self->iov);
+    self->iov = NULL;
+    self->count = 0;
+    self->_impl.capacity = 0;
+    self->_impl.scratch = NULL;
+}
+
+/*
+ * Measuring serialized output
+ *
+ * The built-in formats are measured without formatting anything but floats: integers by counting
+ * digits, strings with the escape length tables. Bounds only read strings, enumerators and
+ * pointers, so the bound of a layout without strings or pointers is computed once per format and
+ * kept in the layout. Other serializers are run against a stream that only counts.
+ */
+
+struct serializer_metrics
+{
+    const reflect_serializer_t* serializer;
+
+    // The length of a value written by serializer->serialize(). Unless exact, an upper bound that
+    // only reads strings and enumerators.
+    size_t (*measure)(void* object, reflect_repr_t repr, size_t size, bool exact);
+
+    // Bytes around a member besides its name, which is written member_names times, and after
+    // each member but the last.
+    size_t member;
+    size_t member_names;
+    size_t member_separator;
+
+    // Bytes around a struct, an array and an array element, and after each element but the last.
+    size_t structure;
+    size_t array;
+    size_t element;
+    size_t element_separator;
+};
+
+static size_t measure_decimal(uint64_t value)
+{
+    size_t digits = 1;
+    for (uint64_t power = 10; digits < 20 && value >= power; power *= 10)
+    {
+        digits++;
+    }
+    return digits;
+}
+
+static size_t measure_int(void* object, size_t size, bool is_signed, bool exact)
+{
+    if (size != 1 && size != 2 && size != 4 && size != 8)
+    {
+        return 0;
+    }
+
+    if (!exact)
+    {
+        uint64_t max = size == 8 ? UINT64_MAX : (UINT64_C(1) << (size * 8)) - 1;
+        return is_signed ? 1 + measure_decimal(max / 2 + 1) : measure_decimal(max);
+    }
+
+    int64_t value = load_int(object, size, is_signed);
+    if (is_signed && value < 0)
+    {
+        return 1 + measure_decimal(-(uint64_t)value);
+    }
+    return measure_decimal((uint64_t)value);
+}
+
+// %f has no exponent, the widest output is the most negative finite value: a sign, one digit more
+// than the largest decimal exponent, the point and 6 decimals.
+#define FLOAT_WIDTH(max_10_exp) (1 + (max_10_exp) + 1 + 1 + 6)
+
+static size_t measure_float(void* object, size_t size, bool exact)
+{
+    char buffer[64];
+
+    switch (size)
+    {
+    case 4:
+        return exact ? (size_t)snprintf(buffer, sizeof(buffer), "%f", *(float*)object)
+                     : FLOAT_WIDTH(FLT_MAX_10_EXP);
+    case 8:
+        return exact ? (size_t)snprintf(buffer, sizeof(buffer), "%lf", *(double*)object)
+                     : FLOAT_WIDTH(DBL_MAX_10_EXP);
+    case 16:
+        return exact ? (size_t)snprintf(buffer, sizeof(buffer), "%Lf", *(long double*)object)
+                     : FLOAT_WIDTH(LDBL_MAX_10_EXP);
+    default:
+        return 0;
+    }
+}
+
+// Mirrors output_escaped().
+static size_t measure_escaped(const char* s, const struct escaper* escaper, bool exact)
+{
+    if (!exact)
+    {
+        return strlen(s) * escaper->widest;
+    }
+
+    const char* start = s;
+    size_t extra = 0;
+
+    for (;;)
+    {
+        s = escape_scan(s, escaper);
+        unsigned char c = *s;
+
+        if (c == '\0')
+        {
+            return s - start + extra;
+        }
+
+        if (c >= 0x80)
+        {
+            size_t len = utf8_sequence((const unsigned char*)s);
+            if (len != 0)
+            {
+                s += len;
+                continue;
+            }
+        }
+
+        extra += escaper->lengths[c] - 1;
+        s++;
+    }
+}
+
+static size_t json_measure(void* object, reflect_repr_t repr, size_t size, bool exact)
+{
+    switch (repr)
+    {
+    case REFLECT_REPR_FLOAT:
+        return measure_float(object, size, exact);
+    case REFLECT_REPR_INT:
+        return measure_int(object, size, true, exact);
+    case REFLECT_REPR_UINT:
+        return measure_int(object, size, false, exact);
+    case REFLECT_REPR_POINTER:
+        return measure_int(object, sizeof(void*), false, exact);
+    case REFLECT_REPR_BOOLEAN:
+        return exact && *(bool*)object ? strlen("true") : strlen("false");
+    case REFLECT_REPR_SCHAR:
+    case REFLECT_REPR_UCHAR: {
+        if (!exact)
+        {
+            return 2 + strlen("\\u00ff");
+        }
+        unsigned char c = *(unsigned char*)object;
+        return 2 + (c >= 0x80                ? strlen("\\u00ff")
+                    : escaper_json.table[c] ? escaper_json.lengths[c]
+                                             : 1);
+    }
+    case REFLECT_REPR_ENUMERATOR:
+        return 2 + strlen(*(const char**)object);
+    case REFLECT_REPR_STRING:
+        return 2 + measure_escaped(*(const char**)object, &escaper_json, exact);
+    default:
+        return 0;
+    }
+}
+
+static size_t xml_measure(void* object, reflect_repr_t repr, size_t size, bool exact)
+{
+    switch (repr)
+    {
+    case REFLECT_REPR_SCHAR:
+    case REFLECT_REPR_UCHAR: {
+        if (!exact)
+        {
+            return strlen("&#255;");
+        }
+        unsigned char c = *(unsigned char*)object;
+        return c >= 0x80 ? strlen("&#255;") : escaper_xml.table[c] ? escaper_xml.lengths[c] : 1;
+    }
+    case REFLECT_REPR_ENUMERATOR:
+        return strlen(*(const char**)object);
+    case REFLECT_REPR_STRING:
+        return measure_escaped(*(const char**)object, &escaper_xml, exact);
+    default:
+        return json_measure(object, repr, size, exact);
+    }
+}
+
+static size_t c_measure(void* object, reflect_repr_t repr, size_t size, bool exact)
+{
+    switch (repr)
+    {
+    case REFLECT_REPR_SCHAR:
+    case REFLECT_REPR_UCHAR: {
+        if (!exact)
+        {
+            return 2 + escaper_c.widest;
+        }
+        unsigned char c = *(unsigned char*)object;
+        return 2 + (c == '\''           ? 2
+                    : escaper_c.table[c] ? escaper_c.lengths[c]
+                                         : 1);
+    }
+    case REFLECT_REPR_ENUMERATOR:
+        return strlen(*(const char**)object);
+    case REFLECT_REPR_STRING:
+        return 2 + measure_escaped(*(const char**)object, &escaper_c, exact);
+    default:
+        return json_measure(object, repr, size, exact);
+    }
+}
+
+// Indexed like layout->serialized_bounds.
+static const struct serializer_metrics serializer_metrics[] = {
+    {
+        .serializer = &libreflect_serializer_json,
+        .measure = json_measure,
+        .member = 3,
+        .member_names = 1,
+        .member_separator = 1,
+        .structure = 2,
+        .array = 2,
+        .element = 0,
+        .element_separator = 1,
+    },
+    {
+        .serializer = &libreflect_serializer_xml,
+        .measure = xml_measure,
+        .member = 5,
+        .member_names = 2,
+        .member_separator = 0,
+        .structure = 0,
+        .array = 0,
+        .element = 13,
+        .element_separator = 0,
+    },
+    {
+        .serializer = &libreflect_serializer_c,
+        .measure = c_measure,
+        .member = 6,
+        .member_names = 1,
+        .member_separator = 0,
+        .structure = 3,
+        .array = 2,
+        .element = 0,
+        .element_separator = 2,
+    },
+};
+
+static size_t measure_member(const struct serializer_metrics* self,
+                             const struct layout* layout,
+                             size_t index)
+{
+    // The built-in serializers write anonymous members with printf("%s"), which glibc makes
+    // "(null)".
+    const char* name = layout->fields[index].name;
+    size_t size = self->member + self->member_names * (name != NULL ? strlen(name) : 6);
+    return index + 1 == layout->field_count ? size : size + self->member_separator;
+}
+
+// Mirrors serialize_enum().
+static size_t measure_enum(const struct serializer_metrics* self,
+                           void* object,
+                           size_t size,
+                           struct layout* layout,
+                           bool exact)
+{
+    if (!exact)
+    {
+        size_t bound = self->measure(NULL, layout->repr, size, false);
+        for (size_t i = 0; i < layout->enumerator_count; i++)
+        {
+            size_t name = self->measure(
+                &layout->enumerators[i].name, REFLECT_REPR_ENUMERATOR, sizeof(char*), false);
+            bound = name > bound ? name : bound;
+        }
+        return bound;
+    }
+
+    bool is_signed = layout->repr == REFLECT_REPR_INT || layout->repr == REFLECT_REPR_SCHAR;
+    struct layout_enumerator* enumerator =
+        layout_enumerator_by_value(layout, load_int(object, size, is_signed));
+    if (enumerator != NULL)
+    {
+        return self->measure(&enumerator->name, REFLECT_REPR_ENUMERATOR, sizeof(char*), true);
+    }
+
+    return self->measure(object, layout->repr, size, true);
+}
+
+static bool is_char_array(const struct layout* element, size_t dim_count)
+{
+    return dim_count == 1 && element->kind == LAYOUT_SCALAR && element->size == 1 &&
+           (element->repr == REFLECT_REPR_SCHAR || element->repr == REFLECT_REPR_UCHAR);
+}
+
+static size_t measure_bound(const struct serializer_metrics* self, struct layout* layout);
+
+// The bound of an array whose elements have a bound, SIZE_MAX otherwise.
+static size_t measure_array_bound(const struct serializer_metrics* self,
+                                  struct layout* element,
+                                  const size_t* dims,
+                                  size_t dim_count)
+{
+    if (element == NULL)
+    {
+        return SIZE_MAX;
+    }
+
+    if (is_char_array(element, dim_count))
+    {
+        const char* empty = "";
+        return self->measure(&empty, REFLECT_REPR_STRING, sizeof(char*), false) +
+               dims[0] * self->measure(NULL, element->repr, 1, false);
+    }
+
+    size_t item = dim_count > 1 ? measure_array_bound(self, element, dims + 1, dim_count - 1)
+                                : measure_bound(self, element);
+    if (item == SIZE_MAX)
+    {
+        return SIZE_MAX;
+    }
+
+    size_t count = dims[0];
+    size_t separators = count == 0 ? 0 : (count - 1) * self->element_separator;
+    return self->array + count * (self->element + item) + separators;
+}
+
+// The bound of a layout without strings or pointers, SIZE_MAX for any other.
+static size_t measure_bound(const struct serializer_metrics* self, struct layout* layout)
+{
+    size_t* slot = &layout->serialized_bounds[self - serializer_metrics];
+    size_t cached = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    if (cached != 0)
+    {
+        return cached == SIZE_MAX ? SIZE_MAX : cached - 1;
+    }
+
+    size_t bound = 0;
+    switch (layout->kind)
+    {
+    case LAYOUT_SCALAR:
+        bound = self->measure(NULL, layout->repr, layout->size, false);
+        break;
+    case LAYOUT_ENUM:
+        bound = measure_enum(self, NULL, layout->size, layout, false);
+        break;
+    case LAYOUT_STRING:
+    case LAYOUT_POINTER:
+        bound = SIZE_MAX;
+        break;
+    case LAYOUT_STRUCT:
+        bound = self->structure;
+        for (size_t i = 0; i < layout->field_count && bound != SIZE_MAX; i++)
+        {
+            struct layout_field* field = &layout->fields[i];
+            struct layout* type = field_layout(layout, field);
+            if (type == NULL)
+            {
+                continue;
+            }
+
+            size_t member = field->bit_size == 0 ? measure_bound(self, type)
+                            : type->kind == LAYOUT_ENUM
+                                ? measure_enum(self, NULL, sizeof(uint64_t), type, false)
+                                : self->measure(NULL, type->repr, sizeof(uint64_t), false);
+            bound = member == SIZE_MAX ? SIZE_MAX
+                                       : bound + measure_member(self, layout, i) + member;
+        }
+        break;
+    case LAYOUT_ARRAY:
+        bound = measure_array_bound(self, layout_target(layout), layout->dims, layout->dim_count);
+        break;
+    default:
+        break;
+    }
+
+    // Computing the same value twice is harmless, no lock is needed.
+    __atomic_store_n(slot, bound == SIZE_MAX ? SIZE_MAX : bound + 1, __ATOMIC_RELAXED);
+    return bound;
+}
+
+static bool measure_layout(const struct serializer_metrics* self,
+                           void* object,
+                           struct layout* layout,
+                           bool exact,
+                           size_t* size);
+
+// Mirrors serialize_array().
+static bool measure_array(const struct serializer_metrics* self,
+                          void* object,
+                          struct layout* element,
+                          const size_t* dims,
+                          size_t dim_count,
+                          bool exact,
+                          size_t* size)
+{
+    if (element == NULL)
+    {
+        return false;
+    }
+
+    if (!exact)
+    {
+        size_t bound = measure_array_bound(self, element, dims, dim_count);
+        if (bound != SIZE_MAX)
+        {
+            *size += bound;
+            return true;
+        }
+    }
+
+    if (is_char_array(element, dim_count))
+    {
+        const char* s = object;
+        size_t len = strnlen(s, dims[0]);
+        if (len == dims[0])
+        {
+            char* copy = strndup(s, len);
+            if (copy == NULL)
+            {
+                return false;
+            }
+            *size += self->measure(&copy, REFLECT_REPR_STRING, sizeof(char*), true);
+            free(copy);
+        }
+        else
+        {
+            *size += self->measure(&s, REFLECT_REPR_STRING, sizeof(char*), true);
+        }
+        return true;
+    }
+
+    size_t stride = element->size;
+    for (size_t i = 1; i < dim_count; i++)
+    {
+        stride *= dims[i];
+    }
+
+    *size += self->array + dims[0] * self->element;
+    if (dims[0] != 0)
+    {
+        *size += (dims[0] - 1) * self->element_separator;
+    }
+
+    for (size_t i = 0; i < dims[0]; i++)
+    {
+        uint8_t* item = (uint8_t*)object + i * stride;
+
+        if (dim_count > 1)
+        {
+            measure_array(self, item, element, dims + 1, dim_count - 1, exact, size);
+        }
+        else
+        {
+            measure_layout(self, item, element, exact, size);
+        }
+    }
+
+    return true;
+}
+
+// Mirrors serialize_layout(), adding the length of its output to size.
+static bool measure_layout(const struct serializer_metrics* self,
+                           void* object,
+                           struct layout* layout,
+                           bool exact,
+                           size_t* size)
+{
+    if (!exact)
+    {
+        size_t bound = measure_bound(self, layout);
+        if (bound != SIZE_MAX)
+        {
+            *size += bound;
+            return true;
+        }
+    }
+
+    switch (layout->kind)
+    {
+    case LAYOUT_SCALAR:
+        *size += self->measure(object, layout->repr, layout->size, exact);
+        return true;
+    case LAYOUT_ENUM:
+        *size += measure_enum(self, object, layout->size, layout, exact);
+        return true;
+    case LAYOUT_STRING:
+        *size += self->measure(object,
+                               *(void**)object == NULL ? REFLECT_REPR_POINTER : REFLECT_REPR_STRING,
+                               sizeof(void*),
+                               exact);
+        return true;
+    case LAYOUT_POINTER: {
+        struct layout* target = layout_target(layout);
+        if (*(void**)object == NULL || target == NULL)
+        {
+            *size += self->measure(object, REFLECT_REPR_POINTER, sizeof(void*), exact);
+            return true;
+        }
+
+        return measure_layout(self, *(void**)object, target, exact, size);
+    }
+    case LAYOUT_STRUCT:
+        *size += self->structure;
+
+        for (size_t i = 0; i < layout->field_count; i++)
+        {
+            struct layout_field* field = &layout->fields[i];
+            struct layout* type = field_layout(layout, field);
+            if (type == NULL)
+            {
+                continue;
+            }
+
+            *size += measure_member(self, layout, i);
+
+            if (field->bit_size != 0)
+            {
+                uint64_t value = field_load(field, object);
+                *size += type->kind == LAYOUT_ENUM
+                             ? measure_enum(self, &value, sizeof(value), type, exact)
+                             : self->measure(&value, type->repr, sizeof(value), exact);
+            }
+            else
+            {
+                measure_layout(self, (uint8_t*)object + field->offset, type, exact, size);
+            }
+        }
+
+        return true;
+    case LAYOUT_ARRAY:
+        return measure_array(
+            self, object, layout_target(layout), layout->dims, layout->dim_count, exact, size);
+    default:
+        return false;
+    }
+}
+
+static ssize_t count_cookie_write(void* cookie, const char* buffer, size_t size)
+{
+    *(size_t*)cookie += size;
+    (void)buffer;
+    return size;
+}
+
+size_t reflect_serialized_size(const reflect_serializer_t* self,
+                               void* object,
+                               reflect_type_t* type,
+                               reflect_size_mode_t mode)
+{
+    NOT_NULL(self);
+    NOT_NULL(object);
+    NOT_NULL(type);
+
+    self = serializer_resolve(self);
+
+    struct layout* layout = layout_get(type->_impl.domain, type->_impl.offset);
+    if (layout == NULL)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    size_t size = 0;
+    bool exact = mode == REFLECT_SIZE_EXACT;
+
+    for (size_t i = 0; i < sizeof(serializer_metrics) / sizeof(serializer_metrics[0]); i++)
+    {
+        if (serializer_metrics[i].serializer == self)
+        {
+            if (!measure_layout(&serializer_metrics[i], object, layout, exact, &size))
+            {
+                REFLECT_RAISE(ENODATA);
+            }
+            return size;
+        }
+    }
+
+    cookie_io_functions_t functions = {
+        .write = count_cookie_write,
+    };
+
+    FILE* file = fopencookie(&size, "w", functions);
+    if (file == NULL)
+    {
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    FILE* result = serialize_layout(self, object, layout, file);
+    if (fclose(file) != 0 || result == NULL)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    return size;
+}
+
+/*
+ * Columnar export
+ *
+ * Arrays of structs are flattened into one column per scalar member, nested structs and fixed size
+ * arrays included. For the binary format every column is gathered into its own buffer, a block of
+ * rows at a time so that a block stays in cache while all of its columns are copied out.
+ */
+
+#define COLUMNS_MAGIC      "RCOLUMN1"
+#define COLUMNS_BLOCK_ROWS 256
+
+enum column_flags
+{
+    COLUMN_ENUM = 1,
+    COLUMN_BITFIELD = 2,
+};
+
+struct column
+{
+    char* name;
+
+    // Offset of the value in a row. For bitfields, offset of the struct containing the field.
+    size_t offset;
+    size_t size;
+    reflect_repr_t repr;
+
+    // The enum of enum columns, the pointee of pointer columns.
+    struct layout* layout;
+    const struct layout_field* field;
+
+    // LAYOUT_SCALAR or LAYOUT_ENUM, unless references are collected.
+    enum layout_kind kind;
+};
+
+struct column_set
+{
+    struct column* columns;
+    size_t count;
+    size_t capacity;
+
+    // Also collect strings, pointers and one dimensional char arrays as a whole, for views.
+    bool references;
+};
+
+static void column_set_free(struct column_set* self)
+{
+    for (size_t i = 0; i < self->count; i++)
+    {
+        free(self->columns[i].name);
+    }
+    free(self->columns);
+}
+
+static bool column_push(struct column_set* self, struct column column)
+{
+    if (column.name == NULL)
+    {
+        return false;
+    }
+
+    if (self->count == self->capacity)
+    {
+        size_t capacity = self->capacity == 0 ? 16 : self->capacity * 2;
+        struct column* columns = realloc(self->columns, capacity * sizeof(struct column));
+        if (columns == NULL)
+        {
+            free(column.name);
+            return false;
+        }
+        self->columns = columns;
+        self->capacity = capacity;
+    }
+
+    self->columns[self->count++] = column;
+    return true;
+}
+
+// Scalars that fit a fixed size column. Pointers and strings are not exported.
+static bool column_repr_supported(reflect_repr_t repr, size_t size)
+{
+    switch (repr)
+    {
+    case REFLECT_REPR_FLOAT:
+        return size == 4 || size == 8 || size == 16;
+    case REFLECT_REPR_INT:
+    case REFLECT_REPR_UINT:
+    case REFLECT_REPR_BOOLEAN:
+    case REFLECT_REPR_UCHAR:
+    case REFLECT_REPR_SCHAR:
+        return size == 1 || size == 2 || size == 4 || size == 8;
+    default:
+        return false;
+    }
+}
+
+static char* column_name(const char* prefix, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static char* column_name(const char* prefix, const char* format, ...)
+{
+    char* suffix;
+    va_list args;
+    va_start(args, format);
+    int length = vasprintf(&suffix, format, args);
+    va_end(args);
+    if (length < 0)
+    {
+        return NULL;
+    }
+
+    char* name;
+    if (asprintf(&name, "%s%s", prefix, suffix) < 0)
+    {
+        name = NULL;
+    }
+    free(suffix);
+    return name;
+}
+
+static bool columns_collect(struct column_set* self,
+                            struct layout* layout,
+                            size_t offset,
+                            const char* name);
+
+static bool columns_collect_array(struct column_set* self,
+                                  struct layout* layout,
+                                  size_t offset,
+                                  const char* name)
+{
+    struct layout* element = layout_target(layout);
+    if (element == NULL || element->size == 0 || layout->dim_count == 0)
+    {
+        return true;
+    }
+
+    if (self->references && layout->dim_count == 1 && element->kind == LAYOUT_SCALAR &&
+        element->size == 1 &&
+        (element->repr == REFLECT_REPR_SCHAR || element->repr == REFLECT_REPR_UCHAR))
+    {
+        return column_push(self,
+                           (struct column){
+                               .name = strdup(name),
+                               .offset = offset,
+                               .size = layout->dims[0],
+                               .repr = element->repr,
+                               .kind = LAYOUT_ARRAY,
+                           });
+    }
+
+    size_t count = 1;
+    for (size_t i = 0; i < layout->dim_count; i++)
+    {
+        count *= layout->dims[i];
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        // Row-major indexes, one per dimension.
+        char* element_name = strdup(name);
+        for (size_t dim = 0, rest = i; element_name != NULL && dim < layout->dim_count; dim++)
+        {
+            size_t below = 1;
+            for (size_t j = dim + 1; j < layout->dim_count; j++)
+            {
+                below *= layout->dims[j];
+            }
+
+            char* next = column_name(element_name, "[%zu]", rest / below);
+            free(element_name);
+            element_name = next;
+            rest %= below;
+        }
+
+        bool ok = element_name != NULL &&
+                  columns_collect(self, element, offset + i * element->size, element_name);
+        free(element_name);
+        if (!ok)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool columns_collect(struct column_set* self,
+                            struct layout* layout,
+                            size_t offset,
+                            const char* name)
+{
+    switch (layout->kind)
+    {
+    case LAYOUT_SCALAR:
+    case LAYOUT_ENUM:
+        if (!column_repr_supported(layout->repr, layout->size))
+        {
+            return true;
+        }
+        return column_push(self,
+                           (struct column){
+                               .name = strdup(name),
+                               .offset = offset,
+                               .size = layout->size,
+                               .repr = layout->repr,
+                               .layout = layout->kind == LAYOUT_ENUM ? layout : NULL,
+                               .kind = layout->kind,
+                           });
+    case LAYOUT_STRING:
+    case LAYOUT_POINTER:
+        if (!self->references)
+        {
+            return true;
+        }
+        return column_push(self,
+                           (struct column){
+                               .name = strdup(name),
+                               .offset = offset,
+                               .size = sizeof(void*),
+                               .repr = layout->kind == LAYOUT_STRING ? REFLECT_REPR_STRING
+                                                                     : REFLECT_REPR_POINTER,
+                               .layout = layout->kind == LAYOUT_POINTER ? layout_target(layout)
+                                                                        : NULL,
+                               .kind = layout->kind,
+                           });
+    case LAYOUT_ARRAY:
+        return columns_collect_array(self, layout, offset, name);
+    case LAYOUT_STRUCT:
+        break;
+    default:
+        return true;
+    }
+
+    for (size_t i = 0; i < layout->field_count; i++)
+    {
+        struct layout_field* field = &layout->fields[i];
+        struct layout* field_type = field_layout(layout, field);
+        if (field_type == NULL)
+        {
+            continue;
+        }
+
+        // Members of anonymous structs and unions belong to the enclosing struct.
+        char* field_name = field->name == NULL  ? strdup(name)
+                           : name[0] == '\0' ? strdup(field->name)
+                                             : column_name(name, ".%s", field->name);
+
+        // Bitfields are widened to 64 bits.
+        if (field->bit_size != 0)
+        {
+            reflect_repr_t repr = field_type->repr == REFLECT_REPR_BOOLEAN ? REFLECT_REPR_BOOLEAN
+                                  : field->sign_shift != 0                ? REFLECT_REPR_INT
+                                                                          : REFLECT_REPR_UINT;
+            if (!column_push(self,
+                             (struct column){
+                                 .name = field_name,
+                                 .offset = offset,
+                                 .size = sizeof(uint64_t),
+                                 .repr = repr,
+                                 .layout = field_type->kind == LAYOUT_ENUM ? field_type : NULL,
+                                 .field = field,
+                                 .kind = field_type->kind,
+                             }))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        bool ok = field_name != NULL &&
+                  columns_collect(self, field_type, offset + field->offset, field_name);
+        free(field_name);
+        if (!ok)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void column_gather(const struct column* self,
+                          const uint8_t* rows,
+                          size_t stride,
+                          size_t count,
+                          uint8_t* out)
+{
+    const uint8_t* in = rows + self->offset;
+
+    if (self->field != NULL)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t value = field_load(self->field, in + i * stride);
+            memcpy(out + i * sizeof(value), &value, sizeof(value));
+        }
+        return;
+    }
+
+    // Constant sizes turn every copy into a single load and store.
+    switch (self->size)
+    {
+    case 1:
+        for (size_t i = 0; i < count; i++)
+        {
+            out[i] = in[i * stride];
+        }
+        break;
+    case 2:
+        for (size_t i = 0; i < count; i++)
+        {
+            memcpy(out + i * 2, in + i * stride, 2);
+        }
+        break;
+    case 4:
+        for (size_t i = 0; i < count; i++)
+        {
+            memcpy(out + i * 4, in + i * stride, 4);
+        }
+        break;
+    case 8:
+        for (size_t i = 0; i < count; i++)
+        {
+            memcpy(out + i * 8, in + i * stride, 8);
+        }
+        break;
+    default:
+        for (size_t i = 0; i < count; i++)
+        {
+            memcpy(out + i * self->size, in + i * stride, self->size);
+        }
+        break;
+    }
+}
+
+// Returns 0, or the error code.
+static int columns_write_binary(const struct column_set* self,
+                                const uint8_t* base,
+                                size_t count,
+                                size_t stride,
+                                FILE* output)
+{
+    size_t header_size = sizeof(COLUMNS_MAGIC) - 1 + sizeof(uint64_t) + 2 * sizeof(uint32_t);
+    for (size_t i = 0; i < self->count; i++)
+    {
+        header_size += sizeof(uint64_t) + sizeof(uint32_t) + 4 + strlen(self->columns[i].name);
+    }
+
+    uint8_t** buffers = calloc(self->count, sizeof(uint8_t*));
+    bool ok = buffers != NULL;
+    for (size_t i = 0; ok && i < self->count; i++)
+    {
+        buffers[i] = malloc(count * self->columns[i].size + 1);
+        ok = buffers[i] != NULL;
+    }
+
+    for (size_t first = 0; ok && first < count; first += COLUMNS_BLOCK_ROWS)
+    {
+        size_t rows = count - first < COLUMNS_BLOCK_ROWS ? count - first : COLUMNS_BLOCK_ROWS;
+        for (size_t i = 0; i < self->count; i++)
+        {
+            column_gather(&self->columns[i],
+                          base + first * stride,
+                          stride,
+                          rows,
+                          buffers[i] + first * self->columns[i].size);
+        }
+    }
+
+    bool written = ok;
+    if (ok)
+    {
+        uint64_t rows = count;
+        uint32_t columns = self->count;
+        uint32_t header = header_size;
+        written = fwrite(COLUMNS_MAGIC, 1, sizeof(COLUMNS_MAGIC) - 1, output) ==
+                      sizeof(COLUMNS_MAGIC) - 1 &&
+                  fwrite(&rows, sizeof(rows), 1, output) == 1 &&
+                  fwrite(&columns, sizeof(columns), 1, output) == 1 &&
+                  fwrite(&header, sizeof(header), 1, output) == 1;
+
+        uint64_t data = align_up(header_size, 8);
+        for (size_t i = 0; written && i < self->count; i++)
+        {
+            const struct column* column = &self->columns[i];
+            uint32_t name_length = strlen(column->name);
+            uint8_t info[4] = {
+                column->repr,
+                column->size,
+                (column->layout != NULL ? COLUMN_ENUM : 0) |
+                    (column->field != NULL ? COLUMN_BITFIELD : 0),
+            };
+
+            written = fwrite(&data, sizeof(data), 1, output) == 1 &&
+                      fwrite(&name_length, sizeof(name_length), 1, output) == 1 &&
+                      fwrite(info, 1, sizeof(info), output) == sizeof(info) &&
+                      fwrite(column->name, 1, name_length, output) == name_length;
+            data += align_up(count * column->size, 8);
+        }
+
+        static const uint8_t padding[8];
+        size_t padding_size = align_up(header_size, 8) - header_size;
+        written = written && fwrite(padding, 1, padding_size, output) == padding_size;
+
+        for (size_t i = 0; written && i < self->count; i++)
+        {
+            size_t size = count * self->columns[i].size;
+            padding_size = align_up(size, 8) - size;
+            written = fwrite(buffers[i], 1, size, output) == size &&
+                      fwrite(padding, 1, padding_size, output) == padding_size;
+        }
+    }
+
+    for (size_t i = 0; buffers != NULL && i < self->count; i++)
+    {
+        free(buffers[i]);
+    }
+    free(buffers);
+    return !ok ? ENOMEM : !written ? EIO : 0;
+}
+
+// Returns false on a write error.
+static bool column_write_csv(const struct column* self, const uint8_t* row, FILE* output)
+{
+    const uint8_t* value = row + self->offset;
+    bool is_signed = self->repr == REFLECT_REPR_INT || self->repr == REFLECT_REPR_SCHAR;
+    int64_t integer = self->field != NULL ? (int64_t)field_load(self->field, value)
+                                          : load_int(value, self->size, is_signed);
+
+    struct layout_enumerator* enumerator =
+        self->layout != NULL ? layout_enumerator_by_value(self->layout, integer) : NULL;
+    if (enumerator != NULL)
+    {
+        return fputs(enumerator->name, output) != EOF;
+    }
+
+    switch (self->repr)
+    {
+    case REFLECT_REPR_FLOAT:
+        if (self->size == 4)
+        {
+            return fprintf(output, "%.9g", *(const float*)value) >= 0;
+        }
+        else if (self->size == 8)
+        {
+            return fprintf(output, "%.17g", *(const double*)value) >= 0;
+        }
+        return fprintf(output, "%.21Lg", *(const long double*)value) >= 0;
+    case REFLECT_REPR_BOOLEAN:
+        return fputs(integer != 0 ? "true" : "false", output) != EOF;
+    default:
+        return fprintf(output, is_signed ? "%" PRIi64 : "%" PRIu64, integer) >= 0;
+    }
+}
+
+// Returns 0, or the error code.
+static int columns_write_csv(const struct column_set* self,
+                             const uint8_t* base,
+                             size_t count,
+                             size_t stride,
+                             FILE* output)
+{
+    bool written = true;
+    for (size_t i = 0; written && i < self->count; i++)
+    {
+        written = fprintf(output, i == 0 ? "%s" : ",%s", self->columns[i].name) >= 0;
+    }
+    written = written && fputc('\n', output) != EOF;
+
+    for (size_t row = 0; written && row < count; row++)
+    {
+        for (size_t i = 0; written && i < self->count; i++)
+        {
+            written = (i == 0 || fputc(',', output) != EOF) &&
+                      column_write_csv(&self->columns[i], base + row * stride, output);
+        }
+        written = written && fputc('\n', output) != EOF;
+    }
+
+    return written ? 0 : EIO;
+}
+
+FILE* reflect_export_columns(void* base,
+                             size_t count,
+                             reflect_type_t* type,
+                             reflect_columns_format_t format,
+                             FILE* output)
+{
+    NOT_NULL(base);
+    NOT_NULL(type);
+    NOT_NULL(output);
+
+    if (format != REFLECT_COLUMNS_BINARY && format != REFLECT_COLUMNS_CSV)
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    struct layout* layout = layout_get(type->_impl.domain, type->_impl.offset);
+    if (layout == NULL || layout->size == 0)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    // A scalar type makes a single column named after it.
+    struct column_set columns = {0};
+    const char* name = layout->kind == LAYOUT_STRUCT || layout->name == NULL ? "" : layout->name;
+    if (!columns_collect(&columns, layout, 0, name))
+    {
+        column_set_free(&columns);
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    if (columns.count == 0)
+    {
+        column_set_free(&columns);
+        REFLECT_RAISE(ENODATA);
+    }
+
+    int error = format == REFLECT_COLUMNS_BINARY
+                    ? columns_write_binary(&columns, base, count, layout->size, output)
+                    : columns_write_csv(&columns, base, count, layout->size, output);
+
+    column_set_free(&columns);
+    if (error != 0)
+    {
+        REFLECT_RAISE(error);
+    }
+
+    return output;
+}
+
+/*
+ * Record streams
+ *
+ * reflect_write_records() writes records as they are in memory, after a header that names their
+ * members the way the columnar export does. A stream is read into the current version of a type
+ * by matching the members of its header with those of the type by name, once per header: the
+ * match is compiled into a record plan of copies and conversions, and reading only runs the plan
+ * on each record. Members the header does not have keep defaults. Plans are cached in the domain
+ * by header and layout, in a fixed number of slots, so that streams with ever new headers cannot
+ * grow the cache. Readers run a copy of their plan, which the cache may evict meanwhile.
+ */
+
+#define RECORDS_MAGIC      "RRECORD1"
+#define RECORDS_FIXED_SIZE (sizeof(RECORDS_MAGIC) - 1 + sizeof(uint64_t) + 2 * sizeof(uint32_t))
+#define RECORDS_MAX_HEADER (16 << 20)
+#define RECORDS_BLOCK_SIZE 65536
+
+// Plans cached per domain. A header and layout may go in any slot of one set of RECORDS_PLAN_WAYS,
+// the least recently used plan of the set is evicted.
+#define RECORDS_PLAN_SLOTS 64
+#define RECORDS_PLAN_WAYS  4
+
+enum record_op_kind
+{
+    RECORD_COPY,
+    RECORD_CONVERT,
+};
+
+struct record_value
+{
+    size_t offset;
+    size_t size;
+    reflect_repr_t repr;
+
+    // Bitfields only. The value is loaded as size bytes at offset, then shifted right.
+    uint8_t bit_size;
+    uint8_t shift;
+};
+
+struct record_op
+{
+    enum record_op_kind kind;
+
+    // RECORD_COPY copies from.size bytes.
+    struct record_value from;
+    struct record_value to;
+};
+
+struct record_plan
+{
+    // The layout and the header the plan was built for, without the magic. Copies run by readers
+    // have no header.
+    struct layout* layout;
+    uint64_t hash;
+    size_t header_size;
+    const uint8_t* header;
+
+    // The value of record_plans_clock when the plan was last used.
+    uint64_t used;
+
+    size_t record_size;
+    size_t count;
+    struct record_op ops[];
+};
+
+struct record_builder
+{
+    struct record_op* ops;
+    size_t count;
+    size_t capacity;
+};
+
+struct reflect_records
+{
+    FILE* input;
+    struct layout* layout;
+    struct record_plan* plan;
+    const void* defaults;
+
+    // Raw records are read a block at a time.
+    uint8_t* block;
+    size_t block_records;
+};
+
+// A member as described by a header.
+struct record_member
+{
+    const char* name;
+    size_t name_length;
+    struct record_value value;
+    uint8_t flags;
+};
+
+static bool record_is_integer(reflect_repr_t repr)
+{
+    return repr == REFLECT_REPR_INT || repr == REFLECT_REPR_UINT || repr == REFLECT_REPR_BOOLEAN ||
+           repr == REFLECT_REPR_UCHAR || repr == REFLECT_REPR_SCHAR;
+}
+
+static bool record_is_signed(reflect_repr_t repr)
+{
+    return repr == REFLECT_REPR_INT || repr == REFLECT_REPR_SCHAR;
+}
+
+// Whether a column of the writer can be converted to one of the reader. Integers convert to
+// integers and floating point, floating point only to floating point.
+static bool record_convertible(reflect_repr_t from, reflect_repr_t to)
+{
+    return to == REFLECT_REPR_FLOAT ? from == REFLECT_REPR_FLOAT || record_is_integer(from)
+                                    : record_is_integer(from) && record_is_integer(to);
+}
+
+// Extracts bit_size bits from size bytes at value, starting shift bits in. Little-endian only,
+// like field_load().
+static int64_t load_bits(const uint8_t* value,
+                         size_t size,
+                         uint8_t shift,
+                         uint8_t bit_size,
+                         bool is_signed)
+{
+    int unused = 64 - bit_size;
+    uint64_t word = bits_load(value, size, shift) << unused;
+    return is_signed ? (int64_t)word >> unused : (int64_t)(word >> unused);
+}
+
+static struct record_value record_value_of_column(const struct column* column)
+{
+    if (column->field == NULL)
+    {
+        return (struct record_value){
+            .offset = column->offset,
+            .size = column->size,
+            .repr = column->repr,
+        };
+    }
+
+    return (struct record_value){
+        .offset = column->offset + column->field->offset,
+        .size = column->field->load_size,
+        .repr = column->repr,
+        .bit_size = column->field->bit_size,
+        .shift = column->field->shift,
+    };
+}
+
+static bool record_push(struct record_builder* self, struct record_op op)
+{
+    // Members that are laid out alike on both sides merge into one copy.
+    if (op.kind == RECORD_COPY && self->count != 0)
+    {
+        struct record_op* last = &self->ops[self->count - 1];
+        if (last->kind == RECORD_COPY && last->from.offset + last->from.size == op.from.offset &&
+            last->to.offset + last->from.size == op.to.offset)
+        {
+            last->from.size += op.from.size;
+            return true;
+        }
+    }
+
+    if (self->count == self->capacity)
+    {
+        size_t capacity = self->capacity == 0 ? 16 : self->capacity * 2;
+        struct record_op* ops = realloc(self->ops, capacity * sizeof(struct record_op));
+        if (ops == NULL)
+        {
+            return false;
+        }
+        self->ops = ops;
+        self->capacity = capacity;
+    }
+
+    self->ops[self->count++] = op;
+    return true;
+}
+
+// Reads the member at *position of a header and advances past it. Returns false if the header is
+// malformed.
+static bool record_member_next(const uint8_t** position,
+                               const uint8_t* end,
+                               size_t record_size,
+                               struct record_member* out)
+{
+    uint64_t offset;
+    uint32_t name_length;
+    uint8_t info[8];
+    if ((size_t)(end - *position) < sizeof(offset) + sizeof(name_length) + sizeof(info))
+    {
+        return false;
+    }
+
+    memcpy(&offset, *position, sizeof(offset));
+    memcpy(&name_length, *position + sizeof(offset), sizeof(name_length));
+    memcpy(info, *position + sizeof(offset) + sizeof(name_length), sizeof(info));
+    *position += sizeof(offset) + sizeof(name_length) + sizeof(info);
+    if ((size_t)(end - *position) < name_length)
+    {
+        return false;
+    }
+
+    *out = (struct record_member){
+        .name = (const char*)*position,
+        .name_length = name_length,
+        .value =
+            {
+                .offset = offset,
+                .size = info[1],
+                .repr = info[0],
+                .bit_size = info[3],
+                .shift = info[4],
+            },
+        .flags = info[2],
+    };
+    *position += name_length;
+
+    // Bitfields are loaded from up to BITS_MAX_LOAD bytes.
+    const struct record_value* value = &out->value;
+    bool valid = value->bit_size == 0 ? column_repr_supported(value->repr, value->size)
+                                      : record_is_integer(value->repr) &&
+                                            value->size <= BITS_MAX_LOAD &&
+                                            value->shift + value->bit_size <= value->size * 8;
+    return valid && offset <= record_size && value->size <= record_size - offset;
+}
+
+static int record_column_compare(const void* a, const void* b)
+{
+    return strcmp((*(const struct column* const*)a)->name, (*(const struct column* const*)b)->name);
+}
+
+static const struct column* record_column_find(struct column** sorted,
+                                               size_t count,
+                                               const struct record_member* member)
+{
+    size_t low = 0;
+    size_t high = count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        const char* name = sorted[middle]->name;
+        int order = strncmp(name, member->name, member->name_length);
+        if (order == 0)
+        {
+            order = name[member->name_length] != '\0';
+        }
+
+        if (order == 0)
+        {
+            return sorted[middle];
+        }
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return NULL;
+}
+
+// Emits the ops for the members of a header, in the order of the header.
+static int record_plan_emit(struct record_builder* self,
+                            struct layout* layout,
+                            const uint8_t* header,
+                            size_t header_size,
+                            size_t record_size,
+                            size_t member_count)
+{
+    struct column_set columns = {0};
+    const char* name = layout->kind == LAYOUT_STRUCT || layout->name == NULL ? "" : layout->name;
+    struct column** sorted = NULL;
+    if (!columns_collect(&columns, layout, 0, name) ||
+        (sorted = calloc(columns.count + 1, sizeof(struct column*))) == NULL)
+    {
+        column_set_free(&columns);
+        return ENOMEM;
+    }
+
+    for (size_t i = 0; i < columns.count; i++)
+    {
+        sorted[i] = &columns.columns[i];
+    }
+    qsort(sorted, columns.count, sizeof(struct column*), record_column_compare);
+
+    int error = 0;
+    const uint8_t* position = header;
+    for (size_t i = 0; error == 0 && i < member_count; i++)
+    {
+        struct record_member member;
+        if (!record_member_next(&position, header + header_size, record_size, &member))
+        {
+            error = EINVAL;
+            break;
+        }
+
+        const struct column* column = record_column_find(sorted, columns.count, &member);
+        if (column == NULL || !record_convertible(member.value.repr, column->repr))
+        {
+            continue;
+        }
+
+        struct record_op op = {
+            .kind = RECORD_CONVERT,
+            .from = member.value,
+            .to = record_value_of_column(column),
+        };
+
+        // Booleans are stored as 0 or 1 whatever the writer had.
+        bool same_class =
+            op.from.repr == op.to.repr ||
+            (record_is_integer(op.from.repr) && record_is_integer(op.to.repr) &&
+             op.from.repr != REFLECT_REPR_BOOLEAN && op.to.repr != REFLECT_REPR_BOOLEAN);
+        if (same_class && op.from.size == op.to.size && op.from.bit_size == 0 &&
+            op.to.bit_size == 0)
+        {
+            op.kind = RECORD_COPY;
+        }
+
+        if (!record_push(self, op))
+        {
+            error = ENOMEM;
+        }
+    }
+
+    free(sorted);
+    column_set_free(&columns);
+    return error;
+}
+
+static struct record_plan* record_plan_build(struct layout* layout,
+                                             const uint8_t* header,
+                                             size_t header_size,
+                                             uint64_t hash,
+                                             int* error)
+{
+    uint64_t record_size;
+    uint32_t member_count;
+    memcpy(&record_size, header, sizeof(record_size));
+    memcpy(&member_count, header + sizeof(record_size), sizeof(member_count));
+
+    size_t members_offset = sizeof(record_size) + 2 * sizeof(uint32_t);
+    struct record_builder builder = {0};
+    *error = record_size == 0 ? EINVAL
+                              : record_plan_emit(&builder,
+                                                 layout,
+                                                 header + members_offset,
+                                                 header_size - members_offset,
+                                                 record_size,
+                                                 member_count);
+
+    // The header is kept behind the ops.
+    struct record_plan* plan = NULL;
+    size_t ops_size = builder.count * sizeof(struct record_op);
+    if (*error == 0 &&
+        (plan = malloc(sizeof(struct record_plan) + ops_size + header_size)) == NULL)
+    {
+        *error = ENOMEM;
+    }
+
+    if (*error == 0)
+    {
+        uint8_t* copy = (uint8_t*)plan->ops + ops_size;
+        memcpy(copy, header, header_size);
+        plan->layout = layout;
+        plan->hash = hash;
+        plan->header_size = header_size;
+        plan->header = copy;
+        plan->record_size = record_size;
+        plan->count = builder.count;
+        memcpy(plan->ops, builder.ops, ops_size);
+    }
+
+    free(builder.ops);
+    return *error == 0 ? plan : NULL;
+}
+
+static struct record_plan* record_plan_copy(const struct record_plan* self)
+{
+    size_t size = sizeof(struct record_plan) + self->count * sizeof(struct record_op);
+    struct record_plan* copy = malloc(size);
+    if (copy != NULL)
+    {
+        memcpy(copy, self, size);
+        copy->header = NULL;
+        copy->header_size = 0;
+    }
+    return copy;
+}
+
+static void record_plans_free(struct domain* domain)
+{
+    for (size_t i = 0; domain->record_plans != NULL && i < RECORDS_PLAN_SLOTS; i++)
+    {
+        free(domain->record_plans[i]);
+    }
+    free(domain->record_plans);
+}
+
+// Returns a copy of the plan for a header, the part after the magic, building the plan unless it
+// is cached. The copy is freed by the caller. Returns NULL and sets *error on failure.
+static struct record_plan* record_plan_get(struct layout* layout,
+                                           const uint8_t* header,
+                                           size_t header_size,
+                                           int* error)
+{
+    struct domain* domain = layout->domain;
+    uint64_t hash = hash_bytes(0, header, header_size);
+    size_t set = hash_bytes(hash, (const uint8_t*)&layout, sizeof(layout)) %
+                 (RECORDS_PLAN_SLOTS / RECORDS_PLAN_WAYS) * RECORDS_PLAN_WAYS;
+
+    pthread_mutex_lock(&domain->lock);
+    if (domain->record_plans == NULL)
+    {
+        domain->record_plans = calloc(RECORDS_PLAN_SLOTS, sizeof(struct record_plan*));
+    }
+
+    struct record_plan** slots = domain->record_plans == NULL ? NULL : domain->record_plans + set;
+    struct record_plan* plan = NULL;
+    size_t victim = 0;
+    for (size_t i = 0; slots != NULL && i < RECORDS_PLAN_WAYS; i++)
+    {
+        struct record_plan* slot = slots[i];
+        if (slot != NULL && slot->layout == layout && slot->hash == hash &&
+            slot->header_size == header_size && memcmp(slot->header, header, header_size) == 0)
+        {
+            plan = slot;
+            break;
+        }
+
+        // An empty slot, or else the least recently used plan.
+        if (slots[victim] != NULL && (slot == NULL || slot->used < slots[victim]->used))
+        {
+            victim = i;
+        }
+    }
+
+    if (plan == NULL)
+    {
+        plan = record_plan_build(layout, header, header_size, hash, error);
+        if (plan != NULL && slots != NULL)
+        {
+            free(slots[victim]);
+            slots[victim] = plan;
+        }
+    }
+
+    struct record_plan* copy = NULL;
+    if (plan != NULL)
+    {
+        plan->used = ++domain->record_plans_clock;
+        copy = record_plan_copy(plan);
+        *error = copy == NULL ? ENOMEM : 0;
+
+        // Plans that could not be cached only serve this call.
+        if (slots == NULL)
+        {
+            free(plan);
+        }
+    }
+    pthread_mutex_unlock(&domain->lock);
+    return copy;
+}
+
+static void record_convert(const struct record_op* op, const uint8_t* in, uint8_t* out)
+{
+    const struct record_value* from = &op->from;
+    const struct record_value* to = &op->to;
+
+    long double real = 0;
+    int64_t integer = 0;
+    if (from->repr == REFLECT_REPR_FLOAT)
+    {
+        // Offsets come from the header, so the values may be misaligned.
+        switch (from->size)
+        {
+        case 4: {
+            float value;
+            memcpy(&value, in + from->offset, sizeof(value));
+            real = value;
+            break;
+        }
+        case 8: {
+            double value;
+            memcpy(&value, in + from->offset, sizeof(value));
+            real = value;
+            break;
+        }
+        default: {
+            long double value;
+            memcpy(&value, in + from->offset, sizeof(value));
+            real = value;
+            break;
+        }
+        }
+    }
+    else if (from->bit_size != 0)
+    {
+        bool is_signed = record_is_signed(from->repr);
+        integer = load_bits(in + from->offset, from->size, from->shift, from->bit_size, is_signed);
+    }
+    else
+    {
+        integer = load_int(in + from->offset, from->size, record_is_signed(from->repr));
+    }
+
+    if (to->repr == REFLECT_REPR_FLOAT)
+    {
+        if (from->repr != REFLECT_REPR_FLOAT)
+        {
+            real = record_is_signed(from->repr) ? (long double)integer
+                                                : (long double)(uint64_t)integer;
+        }
+
+        switch (to->size)
+        {
+        case 4: {
+            float value = real;
+            memcpy(out + to->offset, &value, sizeof(value));
+            break;
+        }
+        case 8: {
+            double value = real;
+            memcpy(out + to->offset, &value, sizeof(value));
+            break;
+        }
+        default:
+            memcpy(out + to->offset, &real, sizeof(real));
+            break;
+        }
+        return;
+    }
+
+    if (to->repr == REFLECT_REPR_BOOLEAN)
+    {
+        integer = integer != 0;
+    }
+
+    // Narrower integers keep the low bytes, little-endian like field_load().
+    if (to->bit_size != 0)
+    {
+        bits_store(out + to->offset, to->size, to->shift, to->bit_size, (uint64_t)integer);
+    }
+    else
+    {
+        memcpy(out + to->offset, &integer, to->size);
+    }
+}
+
+static void record_plan_run(const struct record_plan* self, const uint8_t* in, uint8_t* out)
+{
+    for (size_t i = 0; i < self->count; i++)
+    {
+        const struct record_op* op = &self->ops[i];
+        if (op->kind == RECORD_COPY)
+        {
+            memcpy(out + op->to.offset, in + op->from.offset, op->from.size);
+        }
+        else
+        {
+            record_convert(op, in, out);
+        }
+    }
+}
+
+FILE* reflect_write_records(const void* base, size_t count, reflect_type_t* type, FILE* output)
+{
+    NOT_NULL(type);
+    NOT_NULL(output);
+    if (base == NULL && count != 0)
+    {
+        REFLECT_RAISE(EFAULT);
+    }
+
+    struct layout* layout = layout_get(type->_impl.domain, type->_impl.offset);
+    if (layout == NULL || layout->size == 0)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    struct column_set columns = {0};
+    const char* name = layout->kind == LAYOUT_STRUCT || layout->name == NULL ? "" : layout->name;
+    if (!columns_collect(&columns, layout, 0, name))
+    {
+        column_set_free(&columns);
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    size_t header_size = RECORDS_FIXED_SIZE;
+    for (size_t i = 0; i < columns.count; i++)
+    {
+        header_size += sizeof(uint64_t) + sizeof(uint32_t) + 8 + strlen(columns.columns[i].name);
+    }
+
+    // Readers refuse larger headers.
+    if (header_size > RECORDS_MAX_HEADER)
+    {
+        column_set_free(&columns);
+        REFLECT_RAISE(E2BIG);
+    }
+
+    uint64_t record_size = layout->size;
+    uint32_t member_count = columns.count;
+    uint32_t header = header_size;
+    bool written = fwrite(RECORDS_MAGIC, 1, sizeof(RECORDS_MAGIC) - 1, output) ==
+                       sizeof(RECORDS_MAGIC) - 1 &&
+                   fwrite(&record_size, sizeof(record_size), 1, output) == 1 &&
+                   fwrite(&member_count, sizeof(member_count), 1, output) == 1 &&
+                   fwrite(&header, sizeof(header), 1, output) == 1;
+
+    for (size_t i = 0; written && i < columns.count; i++)
+    {
+        const struct column* column = &columns.columns[i];
+        struct record_value value = record_value_of_column(column);
+        uint64_t offset = value.offset;
+        uint32_t name_length = strlen(column->name);
+        uint8_t info[8] = {
+            value.repr,
+            value.size,
+            (column->layout != NULL ? COLUMN_ENUM : 0) |
+                (column->field != NULL ? COLUMN_BITFIELD : 0),
+            value.bit_size,
+            value.shift,
+        };
+
+        written = fwrite(&offset, sizeof(offset), 1, output) == 1 &&
+                  fwrite(&name_length, sizeof(name_length), 1, output) == 1 &&
+                  fwrite(info, 1, sizeof(info), output) == sizeof(info) &&
+                  fwrite(column->name, 1, name_length, output) == name_length;
+    }
+
+    static const uint8_t padding[8];
+    size_t padding_size = align_up(header_size, 8) - header_size;
+    written = written && fwrite(padding, 1, padding_size, output) == padding_size &&
+              fwrite(base, layout->size, count, output) == count;
+
+    column_set_free(&columns);
+    if (!written)
+    {
+        REFLECT_RAISE(EIO);
+    }
+
+    return output;
+}
+
+reflect_records_t* reflect_records_open(FILE* input, reflect_type_t* type, const void* defaults)
+{
+    NOT_NULL(input);
+    NOT_NULL(type);
+
+    struct layout* layout = layout_get(type->_impl.domain, type->_impl.offset);
+    if (layout == NULL || layout->size == 0)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    uint8_t fixed[RECORDS_FIXED_SIZE];
+    uint32_t header_size = 0;
+    if (fread(fixed, 1, sizeof(fixed), input) == sizeof(fixed) &&
+        memcmp(fixed, RECORDS_MAGIC, sizeof(RECORDS_MAGIC) - 1) == 0)
+    {
+        memcpy(&header_size, fixed + sizeof(fixed) - sizeof(header_size), sizeof(header_size));
+    }
+    if (header_size < sizeof(fixed) || header_size > RECORDS_MAX_HEADER)
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    // The plan is looked up by the header as read, padding aside.
+    size_t padded_size = align_up(header_size, 8);
+    uint8_t* header = malloc(padded_size);
+    if (header == NULL)
+    {
+        REFLECT_RAISE(ENOMEM);
+    }
+    memcpy(header, fixed, sizeof(fixed));
+
+    int error = 0;
+    struct record_plan* plan = NULL;
+    if (fread(header + sizeof(fixed), 1, padded_size - sizeof(fixed), input) !=
+        padded_size - sizeof(fixed))
+    {
+        error = EINVAL;
+    }
+    else
+    {
+        size_t skip = sizeof(RECORDS_MAGIC) - 1;
+        plan = record_plan_get(layout, header + skip, header_size - skip, &error);
+    }
+    free(header);
+    if (plan == NULL)
+    {
+        REFLECT_RAISE(error);
+    }
+
+    reflect_records_t* self = calloc(1, sizeof(reflect_records_t));
+    size_t block_records =
+        plan->record_size < RECORDS_BLOCK_SIZE ? RECORDS_BLOCK_SIZE / plan->record_size : 1;
+    if (self == NULL || (self->block = malloc(block_records * plan->record_size)) == NULL)
+    {
+        free(self);
+        free(plan);
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    self->input = input;
+    self->layout = layout;
+    self->plan = plan;
+    self->defaults = defaults;
+    self->block_records = block_records;
+    return self;
+}
+
+size_t reflect_records_read(reflect_records_t* self, void* out, size_t count)
+{
+    NOT_NULL(self);
+    if (out == NULL && count != 0)
+    {
+        REFLECT_RAISE(EFAULT);
+    }
+
+    const struct record_plan* plan = self->plan;
+    size_t size = self->layout->size;
+    size_t done = 0;
+    while (done < count)
+    {
+        size_t wanted = count - done < self->block_records ? count - done : self->block_records;
+        size_t got = fread(self->block, plan->record_size, wanted, self->input);
+
+        for (size_t i = 0; i < got; i++)
+        {
+            uint8_t* record = (uint8_t*)out + (done + i) * size;
+            if (self->defaults != NULL)
+            {
+                memcpy(record, self->defaults, size);
+            }
+            else
+            {
+                memset(record, 0, size);
+            }
+            record_plan_run(plan, self->block + i * plan->record_size, record);
+        }
+
+        done += got;
+        if (got < wanted)
+        {
+            break;
+        }
+    }
+
+    return done;
+}
+
+void reflect_records_close(reflect_records_t* self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+
+    free(self->block);
+    free(self->plan);
+    free(self);
+}
+
+/*
+ * Hashing and comparison
+ *
+ * Objects are compared by running a compare plan: a flat list of operations at absolute offsets,
+ * with nested structures inlined. Every layout has two plans, built on first use. The equality
+ * plan, which is also used for hashing, merges adjacent plain members into byte runs that stop at
+ * padding. The order plan keeps one operation per member so that integers compare by value.
+ */
+
+// Pointers are followed this deep, then compared by address.
+#define COMPARE_MAX_DEPTH 256
+
+// Arrays with plans shorter than this are unrolled into the plan of the enclosing type.
+#define COMPARE_MAX_UNROLL 16
+
+enum compare_kind
+{
+    COMPARE_BYTES,
+    COMPARE_INT,
+    COMPARE_UINT,
+    COMPARE_FLOAT,
+    COMPARE_BITFIELD,
+    COMPARE_STRING,
+    COMPARE_CHARS,
+    COMPARE_POINTER,
+    COMPARE_ARRAY,
+};
+
+struct compare_op
+{
+    enum compare_kind kind;
+    size_t offset;
+
+    // Bytes covered. The capacity for COMPARE_CHARS, the element size for COMPARE_ARRAY.
+    size_t size;
+
+    // COMPARE_ARRAY only.
+    size_t count;
+
+    // The pointee for COMPARE_POINTER (NULL to compare addresses), the element for COMPARE_ARRAY.
+    struct layout* layout;
+
+    // COMPARE_BITFIELD only. Its offset is relative to the offset of the op.
+    const struct layout_field* field;
+};
+
+struct compare_plan
+{
+    size_t count;
+    struct compare_op ops[];
+};
+
+struct compare_builder
+{
+    struct compare_op* ops;
+    size_t count;
+    size_t capacity;
+    bool order;
+};
+
+// Pointers currently being compared or hashed, used to stop at cycles.
+struct compare_path
+{
+    size_t depth;
+    const void* a[COMPARE_MAX_DEPTH];
+    const void* b[COMPARE_MAX_DEPTH];
+};
+
+// Only the first depth entries are ever read. Zeroing the rest would cost more than a comparison
+// of a small key.
+static void compare_path_init(struct compare_path* self, const void* a, const void* b)
+{
+    self->depth = 1;
+    self->a[0] = a;
+    self->b[0] = b;
+}
+
+static struct compare_plan* compare_plan_get(struct layout* layout, bool order);
+
+static bool compare_push(struct compare_builder* self, struct compare_op op)
+{
+    if (op.kind == COMPARE_BYTES && op.size == 0)
+    {
+        return true;
+    }
+
+    // Merging runs is what skips padding, members are never tested one by one.
+    if (op.kind == COMPARE_BYTES && self->count != 0)
+    {
+        struct compare_op* last = &self->ops[self->count - 1];
+        if (last->kind == COMPARE_BYTES && last->offset + last->size == op.offset)
+        {
+            last->size += op.size;
+            return true;
+        }
+    }
+
+    if (self->count == self->capacity)
+    {
+        size_t capacity = self->capacity == 0 ? 8 : self->capacity * 2;
+        struct compare_op* ops = realloc(self->ops, capacity * sizeof(struct compare_op));
+        if (ops == NULL)
+        {
+            return false;
+        }
+        self->ops = ops;
+        self->capacity = capacity;
+    }
+
+    self->ops[self->count++] = op;
+    return true;
+}
+
+static bool compare_emit_scalar(struct compare_builder* self,
+                                reflect_repr_t repr,
+                                size_t offset,
+                                size_t size)
+{
+    bool is_float = size == sizeof(float) || size == sizeof(double) || size == sizeof(long double);
+    bool is_int = size == 1 || size == 2 || size == 4 || size == 8;
+
+    switch (repr)
+    {
+    case REFLECT_REPR_FLOAT:
+    case REFLECT_REPR_IMAGINARY:
+        if (is_float)
+        {
+            return compare_push(
+                self, (struct compare_op){.kind = COMPARE_FLOAT, .offset = offset, .size = size});
+        }
+        break;
+    case REFLECT_REPR_COMPLEX:
+        if (size % 2 == 0 && compare_emit_scalar(self, REFLECT_REPR_FLOAT, offset, size / 2))
+        {
+            return compare_emit_scalar(self, REFLECT_REPR_FLOAT, offset + size / 2, size / 2);
+        }
+        break;
+    case REFLECT_REPR_INT:
+    case REFLECT_REPR_SCHAR:
+        if (self->order && is_int)
+        {
+            return compare_push(
+                self, (struct compare_op){.kind = COMPARE_INT, .offset = offset, .size = size});
+        }
+        break;
+    case REFLECT_REPR_UINT:
+    case REFLECT_REPR_UCHAR:
+    case REFLECT_REPR_BOOLEAN:
+    case REFLECT_REPR_POINTER:
+        if (self->order && is_int)
+        {
+            return compare_push(
+                self, (struct compare_op){.kind = COMPARE_UINT, .offset = offset, .size = size});
+        }
+        break;
+    default:
+        break;
+    }
+
+    return compare_push(self,
+                        (struct compare_op){.kind = COMPARE_BYTES, .offset = offset, .size = size});
+}
+
+static bool compare_emit(struct compare_builder* self, struct layout* layout, size_t offset)
+{
+    switch (layout->kind)
+    {
+    case LAYOUT_SCALAR:
+    case LAYOUT_ENUM:
+        return compare_emit_scalar(self, layout->repr, offset, layout->size);
+    case LAYOUT_STRING:
+        return compare_push(
+            self,
+            (struct compare_op){.kind = COMPARE_STRING, .offset = offset, .size = sizeof(char*)});
+    case LAYOUT_POINTER:
+        return compare_push(self,
+                            (struct compare_op){.kind = COMPARE_POINTER,
+                                                .offset = offset,
+                                                .size = sizeof(void*),
+                                                .layout = layout_target(layout)});
+    case LAYOUT_STRUCT:
+        for (size_t i = 0; i < layout->field_count; i++)
+        {
+            struct layout_field* field = &layout->fields[i];
+            struct layout* type = field_layout(layout, field);
+            if (type == NULL)
+            {
+                continue;
+            }
+
+            bool ok = field->bit_size != 0
+                          ? compare_push(self,
+                                         (struct compare_op){.kind = COMPARE_BITFIELD,
+                                                             .offset = offset,
+                                                             .field = field})
+                          : compare_emit(self, type, offset + field->offset);
+            if (!ok)
+            {
+                return false;
+            }
+        }
+        return true;
+    case LAYOUT_ARRAY: {
+        struct layout* element = layout_target(layout);
+        if (element == NULL || element->size == 0 || layout->dim_count == 0)
+        {
+            return true;
+        }
+
+        size_t count = 1;
+        for (size_t i = 0; i < layout->dim_count; i++)
+        {
+            count *= layout->dims[i];
+        }
+
+        // Like the serializers, treat each row of a char array as a string.
+        if (element->kind == LAYOUT_SCALAR && element->size == 1 &&
+            (element->repr == REFLECT_REPR_SCHAR || element->repr == REFLECT_REPR_UCHAR))
+        {
+            size_t width = layout->dims[layout->dim_count - 1];
+            for (size_t i = 0; width != 0 && i < count / width; i++)
+            {
+                if (!compare_push(self,
+                                  (struct compare_op){.kind = COMPARE_CHARS,
+                                                      .offset = offset + i * width,
+                                                      .size = width}))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        struct compare_plan* plan = compare_plan_get(element, self->order);
+        if (plan == NULL)
+        {
+            return false;
+        }
+
+        // Elements without padding are one run.
+        if (plan->count == 1 && plan->ops[0].kind == COMPARE_BYTES &&
+            plan->ops[0].size == element->size)
+        {
+            return compare_push(self,
+                                (struct compare_op){.kind = COMPARE_BYTES,
+                                                    .offset = offset,
+                                                    .size = count * element->size});
+        }
+
+        if (count * plan->count > COMPARE_MAX_UNROLL)
+        {
+            return compare_push(self,
+                                (struct compare_op){.kind = COMPARE_ARRAY,
+                                                    .offset = offset,
+                                                    .size = element->size,
+                                                    .count = count,
+                                                    .layout = element});
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            for (size_t j = 0; j < plan->count; j++)
+            {
+                struct compare_op op = plan->ops[j];
+                op.offset += offset + i * element->size;
+                if (!compare_push(self, op))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    default:
+        // Unions and anything else that cannot be looked into.
+        return compare_push(
+            self,
+            (struct compare_op){.kind = COMPARE_BYTES, .offset = offset, .size = layout->size});
+    }
+}
+
+static struct compare_plan* compare_plan_build(struct layout* layout, bool order)
+{
+    struct compare_builder builder = {.order = order};
+    struct compare_plan* plan = NULL;
+
+    if (compare_emit(&builder, layout, 0))
+    {
+        plan = arena_alloc(&layout->domain->arena,
+                           sizeof(struct compare_plan) + builder.count * sizeof(struct compare_op),
+                           ARENA_USE_LAYOUTS);
+        if (plan != NULL && builder.count != 0)
+        {
+            plan->count = builder.count;
+            memcpy(plan->ops, builder.ops, builder.count * sizeof(struct compare_op));
+        }
+    }
+
+    free(builder.ops);
+    return plan;
+}
+
+static struct compare_plan* compare_plan_get(struct layout* layout, bool order)
+{
+    struct compare_plan** slot = order ? &layout->order_plan : &layout->equality_plan;
+    struct compare_plan* plan = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (plan != NULL)
+    {
+        return plan;
+    }
+
+    pthread_mutex_lock(&layout->domain->lock);
+    plan = *slot;
+    if (plan == NULL)
+    {
+        plan = compare_plan_build(layout, order);
+        __atomic_store_n(slot, plan, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&layout->domain->lock);
+    return plan;
+}
+
+static bool bytes_equal(const uint8_t* a, const uint8_t* b, size_t size)
+{
+    if (size <= 16)
+    {
+        // Two overlapping loads cover everything from 4 to 16 bytes.
+        if (size >= 8)
+        {
+            uint64_t w, x, y, z;
+            memcpy(&w, a, 8);
+            memcpy(&x, b, 8);
+            memcpy(&y, a + size - 8, 8);
+            memcpy(&z, b + size - 8, 8);
+            return ((w ^ x) | (y ^ z)) == 0;
+        }
+        if (size >= 4)
+        {
+            uint32_t w, x, y, z;
+            memcpy(&w, a, 4);
+            memcpy(&x, b, 4);
+            memcpy(&y, a + size - 4, 4);
+            memcpy(&z, b + size - 4, 4);
+            return ((w ^ x) | (y ^ z)) == 0;
+        }
+        for (size_t i = 0; i < size; i++)
+        {
+            if (a[i] != b[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+#if defined(__SSE2__)
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i m = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)),
+                                   _mm_loadu_si128((const __m128i*)(b + i)));
+        if (_mm_movemask_epi8(m) != 0xFFFF)
+        {
+            return false;
+        }
+    }
+
+    if (i == size)
+    {
+        return true;
+    }
+
+    // The last chunk overlaps the one before it.
+    __m128i m = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + size - 16)),
+                               _mm_loadu_si128((const __m128i*)(b + size - 16)));
+    return _mm_movemask_epi8(m) == 0xFFFF;
+#else
+    return memcmp(a, b, size) == 0;
+#endif
+}
+
+static long double load_float(const void* object, size_t size)
+{
+    if (size == sizeof(float))
+    {
+        float value;
+        memcpy(&value, object, sizeof(value));
+        return value;
+    }
+    if (size == sizeof(double))
+    {
+        double value;
+        memcpy(&value, object, sizeof(value));
+        return value;
+    }
+
+    long double value;
+    memcpy(&value, object, sizeof(value));
+    return value;
+}
+
+// A total order: -0.0 equals 0.0 and NaN is greater than everything but NaN.
+static int float_compare(long double a, long double b)
+{
+    bool a_nan = isnan(a);
+    bool b_nan = isnan(b);
+    if (a_nan || b_nan)
+    {
+        return (int)a_nan - (int)b_nan;
+    }
+
+    return (a > b) - (a < b);
+}
+
+static int compare_addresses(const void* a, const void* b)
+{
+    return ((uintptr_t)a > (uintptr_t)b) - ((uintptr_t)a < (uintptr_t)b);
+}
+
+static int compare_run(const struct compare_plan* plan,
+                       const uint8_t* a,
+                       const uint8_t* b,
+                       struct compare_path* path,
+                       bool order);
+
+static int compare_pointers(const struct compare_op* op,
+                            const void* a,
+                            const void* b,
+                            struct compare_path* path,
+                            bool order)
+{
+    if (a == b)
+    {
+        return 0;
+    }
+    if (a == NULL || b == NULL)
+    {
+        return a == NULL ? -1 : 1;
+    }
+    if (op->layout == NULL || path->depth == COMPARE_MAX_DEPTH)
+    {
+        return compare_addresses(a, b);
+    }
+
+    // A pair that is already being compared further up is assumed equal, which ends cycles.
+    for (size_t i = 0; i < path->depth; i++)
+    {
+        if (path->a[i] == a && path->b[i] == b)
+        {
+            return 0;
+        }
+    }
+
+    struct compare_plan* plan = compare_plan_get(op->layout, order);
+    if (plan == NULL)
+    {
+        return compare_addresses(a, b);
+    }
+
+    path->a[path->depth] = a;
+    path->b[path->depth] = b;
+    path->depth++;
+    int result = compare_run(plan, a, b, path, order);
+    path->depth--;
+    return result;
+}
+
+static int compare_run(const struct compare_plan* plan,
+                       const uint8_t* a,
+                       const uint8_t* b,
+                       struct compare_path* path,
+                       bool order)
+{
+    for (size_t i = 0; i < plan->count; i++)
+    {
+        const struct compare_op* op = &plan->ops[i];
+        const uint8_t* x = a + op->offset;
+        const uint8_t* y = b + op->offset;
+        int result = 0;
+
+        switch (op->kind)
+        {
+        case COMPARE_BYTES:
+            result = order ? memcmp(x, y, op->size) : !bytes_equal(x, y, op->size);
+            break;
+        case COMPARE_INT: {
+            int64_t v = load_int(x, op->size, true);
+            int64_t w = load_int(y, op->size, true);
+            result = (v > w) - (v < w);
+            break;
+        }
+        case COMPARE_UINT: {
+            uint64_t v = (uint64_t)load_int(x, op->size, false);
+            uint64_t w = (uint64_t)load_int(y, op->size, false);
+            result = (v > w) - (v < w);
+            break;
+        }
+        case COMPARE_FLOAT:
+            result = float_compare(load_float(x, op->size), load_float(y, op->size));
+            break;
+        case COMPARE_BITFIELD: {
+            uint64_t v = field_load(op->field, x);
+            uint64_t w = field_load(op->field, y);
+            if (op->field->sign_shift != 0)
+            {
+                result = ((int64_t)v > (int64_t)w) - ((int64_t)v < (int64_t)w);
+            }
+            else
+            {
+                result = (v > w) - (v < w);
+            }
+            break;
+        }
+        case COMPARE_STRING: {
+            const char* s = *(const char* const*)x;
+            const char* t = *(const char* const*)y;
+            if (s != t)
+            {
+                result = s == NULL ? -1 : t == NULL ? 1 : strcmp(s, t);
+            }
+            break;
+        }
+        case COMPARE_CHARS:
+            result = strncmp((const char*)x, (const char*)y, op->size);
+            break;
+        case COMPARE_POINTER:
+            result =
+                compare_pointers(op, *(const void* const*)x, *(const void* const*)y, path, order);
+            break;
+        case COMPARE_ARRAY: {
+            struct compare_plan* element = compare_plan_get(op->layout, order);
+            if (element == NULL)
+            {
+                result = memcmp(x, y, op->count * op->size);
+                break;
+            }
+            for (size_t j = 0; result == 0 && j < op->count; j++)
+            {
+                result = compare_run(element, x + j * op->size, y + j * op->size, path, order);
+            }
+            break;
+        }
+        }
+
+        if (result != 0)
+        {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+#define HASH_SEED 0x243F6A8885A308D3ull
+#define HASH_K0   0xA0761D6478BD642Full
+#define HASH_K1   0xE7037ED1A0B428DBull
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b)
+{
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static inline uint64_t hash_word(uint64_t hash, uint64_t word)
+{
+    return hash_mix(hash ^ word ^ HASH_K0, HASH_K1);
+}
+
+static uint64_t hash_bytes(uint64_t hash, const uint8_t* data, size_t size)
+{
+    for (; size >= 8; data += 8, size -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        hash = hash_word(hash, word);
+    }
+
+    // The length of the tail goes into the top byte, which the tail never reaches.
+    uint64_t tail = (uint64_t)size << 56;
+    memcpy(&tail, data, size);
+    return hash_word(hash, tail);
+}
+
+static uint64_t hash_run(const struct compare_plan* plan,
+                         const uint8_t* object,
+                         uint64_t hash,
+                         struct compare_path* path);
+
+static uint64_t hash_pointer(const struct compare_op* op,
+                             const void* object,
+                             uint64_t hash,
+                             struct compare_path* path)
+{
+    if (object == NULL)
+    {
+        return hash_word(hash, 0);
+    }
+    if (op->layout == NULL || path->depth == COMPARE_MAX_DEPTH)
+    {
+        return hash_word(hash, (uintptr_t)object);
+    }
+
+    for (size_t i = 0; i < path->depth; i++)
+    {
+        if (path->a[i] == object)
+        {
+            return hash_word(hash, i);
+        }
+    }
+
+    struct compare_plan* plan = compare_plan_get(op->layout, false);
+    if (plan == NULL)
+    {
+        return hash_word(hash, (uintptr_t)object);
+    }
+
+    path->a[path->depth++] = object;
+    hash = hash_run(plan, object, hash, path);
+    path->depth--;
+    return hash;
+}
+
+static uint64_t hash_run(const struct compare_plan* plan,
+                         const uint8_t* object,
+                         uint64_t hash,
+                         struct compare_path* path)
+{
+    for (size_t i = 0; i < plan->count; i++)
+    {
+        const struct compare_op* op = &plan->ops[i];
+        const uint8_t* x = object + op->offset;
+
+        switch (op->kind)
+        {
+        case COMPARE_BYTES:
+            hash = hash_bytes(hash, x, op->size);
+            break;
+        case COMPARE_INT:
+        case COMPARE_UINT:
+            hash = hash_word(hash, (uint64_t)load_int(x, op->size, op->kind == COMPARE_INT));
+            break;
+        case COMPARE_FLOAT: {
+            // Adding 0.0 turns -0.0 into 0.0.
+            long double value = load_float(x, op->size);
+            double normal = isnan(value) ? NAN : (double)value + 0.0;
+            uint64_t word;
+            memcpy(&word, &normal, sizeof(word));
+            hash = hash_word(hash, word);
+            break;
+        }
+        case COMPARE_BITFIELD:
+            hash = hash_word(hash, field_load(op->field, x));
+            break;
+        case COMPARE_STRING: {
+            const char* s = *(const char* const*)x;
+            hash = s == NULL ? hash_word(hash, 0) : hash_bytes(hash, (const uint8_t*)s, strlen(s));
+            break;
+        }
+        case COMPARE_CHARS:
+            hash = hash_bytes(hash, x, strnlen((const char*)x, op->size));
+            break;
+        case COMPARE_POINTER:
+            hash = hash_pointer(op, *(const void* const*)x, hash, path);
+            break;
+        case COMPARE_ARRAY: {
+            struct compare_plan* element = compare_plan_get(op->layout, false);
+            if (element == NULL)
+            {
+                hash = hash_bytes(hash, x, op->count * op->size);
+                break;
+            }
+            for (size_t j = 0; j < op->count; j++)
+            {
+                hash = hash_run(element, x + j * op->size, hash, path);
+            }
+            break;
+        }
+        }
+    }
+
+    return hash;
+}
+
+static struct compare_plan* type_compare_plan(reflect_type_t* type, bool order)
+{
+    struct layout* layout = layout_get(type->_impl.domain, type->_impl.offset);
+    if (layout == NULL)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    struct compare_plan* plan = compare_plan_get(layout, order);
+    if (plan == NULL)
+    {
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    return plan;
+}
+
+uint64_t reflect_hash(const void* object, reflect_type_t* type)
+{
+    NOT_NULL(object);
+    NOT_NULL(type);
+
+    struct compare_plan* plan = type_compare_plan(type, false);
+    if (plan == NULL)
+    {
+        return 0;
+    }
+
+    struct compare_path path;
+    compare_path_init(&path, object, NULL);
+    return hash_mix(hash_run(plan, object, HASH_SEED, &path) ^ HASH_K1, HASH_K0);
+}
+
+bool reflect_equals(const void* a, const void* b, reflect_type_t* type)
+{
+    NOT_NULL(a);
+    NOT_NULL(b);
+    NOT_NULL(type);
+
+    struct compare_plan* plan = type_compare_plan(type, false);
+    if (plan == NULL)
+    {
+        return false;
+    }
+
+    if (a == b)
+    {
+        return true;
+    }
+
+    struct compare_path path;
+    compare_path_init(&path, a, b);
+    return compare_run(plan, a, b, &path, false) == 0;
+}
+
+int reflect_compare(const void* a, const void* b, reflect_type_t* type)
+{
+    NOT_NULL(a);
+    NOT_NULL(b);
+    NOT_NULL(type);
+
+    struct compare_plan* plan = type_compare_plan(type, true);
+    if (plan == NULL || a == b)
+    {
+        return 0;
+    }
+
+    struct compare_path path;
+    compare_path_init(&path, a, b);
+    int result = compare_run(plan, a, b, &path, true);
+    return (result > 0) - (result < 0);
+}
+
+/*
+ * Cloning
+ *
+ * A clone starts as a copy of the whole object, which takes care of every scalar at once. The
+ * pointers are then found through the equality plan of the type and replaced by clones of what
+ * they point to, breadth first, so that related objects end up next to each other in the arena.
+ */
+
+#define CLONE_INLINE_CAPACITY 32
+
+// Source object and layout to clone.
+struct clone_entry
+{
+    const void* source;
+    const struct layout* layout;
+    void* clone;
+};
+
+// An open addressing map from source objects to their clones, which keeps shared objects shared
+// and ends cycles. The same address seen with a different type is cloned again.
+struct clone_map
+{
+    struct clone_entry* entries;
+    size_t capacity;
+    size_t count;
+    struct clone_entry inline_entries[CLONE_INLINE_CAPACITY];
+};
+
+// Clones whose pointers have not been replaced yet.
+struct clone_work
+{
+    void* clone;
+    const struct compare_plan* plan;
+};
+
+struct clone_queue
+{
+    struct clone_work* items;
+    size_t head;
+    size_t count;
+    size_t capacity;
+    struct clone_work inline_items[CLONE_INLINE_CAPACITY];
+};
+
+struct cloner
+{
+    struct arena* arena;
+    struct clone_map map;
+    struct clone_queue queue;
+};
+
+static size_t clone_map_slot(const struct clone_entry* entries,
+                             size_t capacity,
+                             const void* source,
+                             const struct layout* layout)
+{
+    size_t i = table_hash((uintptr_t)source ^ ((uintptr_t)layout << 16));
+    for (;; i++)
+    {
+        const struct clone_entry* entry = &entries[i & (capacity - 1)];
+        if (entry->source == NULL || (entry->source == source && entry->layout == layout))
+        {
+            return i & (capacity - 1);
+        }
+    }
+}
+
+static bool clone_map_put(struct clone_map* self,
+                          const void* source,
+                          const struct layout* layout,
+                          void* clone)
+{
+    if ((self->count + 1) * 4 > self->capacity * 3)
+    {
+        size_t capacity = self->capacity * 2;
+        struct clone_entry* entries = calloc(capacity, sizeof(struct clone_entry));
+        if (entries == NULL)
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < self->capacity; i++)
+        {
+            struct clone_entry* entry = &self->entries[i];
+            if (entry->source != NULL)
+            {
+                entries[clone_map_slot(entries, capacity, entry->source, entry->layout)] = *entry;
+            }
+        }
+
+        if (self->entries != self->inline_entries)
+        {
+            free(self->entries);
+        }
+        self->entries = entries;
+        self->capacity = capacity;
+    }
+
+    self->entries[clone_map_slot(self->entries, self->capacity, source, layout)] =
+        (struct clone_entry){source, layout, clone};
+    self->count++;
+    return true;
+}
+
+static void clone_map_init(struct clone_map* self)
+{
+    self->entries = self->inline_entries;
+    self->capacity = CLONE_INLINE_CAPACITY;
+}
+
+static void clone_map_free(struct clone_map* self)
+{
+    if (self->entries != self->inline_entries)
+    {
+        free(self->entries);
+    }
+}
+
+static void* clone_map_get(const struct clone_map* self, const void* source, const void* layout)
+{
+    const struct clone_entry* entry =
+        &self->entries[clone_map_slot(self->entries, self->capacity, source, layout)];
+    return entry->source != NULL ? entry->clone : NULL;
+}
+
+static bool clone_queue_push(struct clone_queue* self, void* clone, const struct compare_plan* plan)
+{
+    if (self->count == self->capacity)
+    {
+        // Drop the finished prefix before growing.
+        size_t pending = self->count - self->head;
+        size_t capacity = pending * 2 > self->capacity ? self->capacity * 2 : self->capacity;
+
+        struct clone_work* items = self->items;
+        if (capacity != self->capacity)
+        {
+            items = malloc(capacity * sizeof(struct clone_work));
+            if (items == NULL)
+            {
+                return false;
+            }
+        }
+
+        memmove(items, self->items + self->head, pending * sizeof(struct clone_work));
+        if (items != self->items && self->items != self->inline_items)
+        {
+            free(self->items);
+        }
+
+        self->items = items;
+        self->capacity = capacity;
+        self->head = 0;
+        self->count = pending;
+    }
+
+    self->items[self->count++] = (struct clone_work){clone, plan};
+    return true;
+}
+
+// Types have no alignment of their own here, but it always divides the size.
+static size_t clone_alignment(size_t size)
+{
+    size_t alignment = size & -size;
+    return alignment == 0 || alignment > ARENA_ALIGNMENT ? ARENA_ALIGNMENT : alignment;
+}
+
+static void* clone_object(struct cloner* self, const void* source, struct layout* layout)
+{
+    size_t slot = clone_map_slot(self->map.entries, self->map.capacity, source, layout);
+    if (self->map.entries[slot].source != NULL)
+    {
+        return self->map.entries[slot].clone;
+    }
+
+    struct compare_plan* plan = compare_plan_get(layout, false);
+    void* clone = arena_alloc_aligned(
+        self->arena, layout->size, clone_alignment(layout->size), ARENA_USE_OBJECTS);
+    if (plan == NULL || clone == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(clone, source, layout->size);
+
+    if (!clone_map_put(&self->map, source, layout, clone) ||
+        (plan->count != 0 && !clone_queue_push(&self->queue, clone, plan)))
+    {
+        return NULL;
+    }
+
+    return clone;
+}
+
+static char* clone_string(struct cloner* self, const char* source)
+{
+    size_t slot = clone_map_slot(self->map.entries, self->map.capacity, source, NULL);
+    if (self->map.entries[slot].source != NULL)
+    {
+        return self->map.entries[slot].clone;
+    }
+
+    size_t size = strlen(source) + 1;
+    char* clone = arena_alloc_aligned(self->arena, size, 1, ARENA_USE_OBJECTS);
+    if (clone == NULL || !clone_map_put(&self->map, source, NULL, clone))
+    {
+        return NULL;
+    }
+
+    memcpy(clone, source, size);
+    return clone;
+}
+
+// Replaces the pointers in a clone, which still point into the source.
+static bool clone_fixup(struct cloner* self, uint8_t* clone, const struct compare_plan* plan)
+{
+    for (size_t i = 0; i < plan->count; i++)
+    {
+        const struct compare_op* op = &plan->ops[i];
+        void** pointer = (void**)(clone + op->offset);
+
+        switch (op->kind)
+        {
+        case COMPARE_STRING:
+            if (*pointer != NULL && (*pointer = clone_string(self, *pointer)) == NULL)
+            {
+                return false;
+            }
+            break;
+        case COMPARE_POINTER:
+            // Pointers to void and to incomplete types are copied as they are.
+            if (*pointer != NULL && op->layout != NULL && op->layout->size != 0 &&
+                (*pointer = clone_object(self, *pointer, op->layout)) == NULL)
+            {
+                return false;
+            }
+            break;
+        case COMPARE_ARRAY: {
+            struct compare_plan* element = compare_plan_get(op->layout, false);
+            if (element == NULL)
+            {
+                return false;
+            }
+            for (size_t j = 0; j < op->count; j++)
+            {
+                if (!clone_fixup(self, clone + op->offset + j * op->size, element))
+                {
+                    return false;
+                }
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    return true;
+}
+
+void* reflect_clone(const void* object, reflect_type_t* type, reflect_arena_t* arena)
+{
+    NOT_NULL(object);
+    NOT_NULL(type);
+    NOT_NULL(arena);
+
+    struct layout* layout = layout_get(type->_impl.domain, type->_impl.offset);
+    if (layout == NULL || layout->size == 0)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    struct cloner cloner = {.arena = &arena->arena};
+    clone_map_init(&cloner.map);
+    cloner.queue.items = cloner.queue.inline_items;
+    cloner.queue.capacity = CLONE_INLINE_CAPACITY;
+
+    void* clone = clone_object(&cloner, object, layout);
+
+    while (clone != NULL && cloner.queue.head != cloner.queue.count)
+    {
+        struct clone_work work = cloner.queue.items[cloner.queue.head++];
+        if (!clone_fixup(&cloner, work.clone, work.plan))
+        {
+            clone = NULL;
+        }
+    }
+
+    clone_map_free(&cloner.map);
+    if (cloner.queue.items != cloner.queue.inline_items)
+    {
+        free(cloner.queue.items);
+    }
+
+    if (clone == NULL)
+    {
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    return clone;
+}
+
+/*
+ * Memory footprint
+ *
+ * reflect_footprint() walks the objects reachable from a root the way reflect_clone() copies them,
+ * through the equality plans and breadth first, and adds up their sizes per type. The clone map
+ * keeps the objects seen, by address and type so that an object reached through pointers of
+ * several types is still looked into with each, and by address alone so that its bytes are only
+ * counted once.
+ */
+
+struct footprinter
+{
+    struct clone_map map;
+    struct clone_queue queue;
+
+    // Rows by layout in rows_by_layout, whose clones are row indexes plus one. Strings share the
+    // row string_row, plus one, 0 before the first string.
+    struct clone_map rows_by_layout;
+    reflect_footprint_entry_t* rows;
+    size_t row_count;
+    size_t row_capacity;
+    size_t string_row;
+};
+
+// Returns the row of a layout or, for NULL, the row of strings.
+static reflect_footprint_entry_t* footprint_row(struct footprinter* self, struct layout* layout)
+{
+    size_t index = layout != NULL ? (uintptr_t)clone_map_get(&self->rows_by_layout, layout, NULL)
+                                  : self->string_row;
+    if (index != 0)
+    {
+        return &self->rows[index - 1];
+    }
+
+    if (self->row_count == self->row_capacity)
+    {
+        size_t capacity = self->row_capacity == 0 ? 16 : self->row_capacity * 2;
+        reflect_footprint_entry_t* rows =
+            realloc(self->rows, capacity * sizeof(reflect_footprint_entry_t));
+        if (rows == NULL)
+        {
+            return NULL;
+        }
+        self->rows = rows;
+        self->row_capacity = capacity;
+    }
+
+    index = ++self->row_count;
+    if (layout != NULL)
+    {
+        if (!clone_map_put(&self->rows_by_layout, layout, NULL, (void*)index))
+        {
+            self->row_count--;
+            return NULL;
+        }
+    }
+    else
+    {
+        self->string_row = index;
+    }
+
+    self->rows[index - 1] =
+        (reflect_footprint_entry_t){.name = layout != NULL ? layout->name : "string"};
+    return &self->rows[index - 1];
+}
+
+// Counts size bytes at address for a row, unless the address was counted before.
+static bool footprint_count(struct footprinter* self,
+                            const void* address,
+                            struct layout* layout,
+                            size_t size)
+{
+    if (clone_map_get(&self->map, address, NULL) != NULL)
+    {
+        return true;
+    }
+
+    reflect_footprint_entry_t* row = footprint_row(self, layout);
+    if (row == NULL || !clone_map_put(&self->map, address, NULL, (void*)address))
+    {
+        return false;
+    }
+
+    row->objects++;
+    row->bytes += size;
+    return true;
+}
+
+static bool footprint_object(struct footprinter* self, const void* object, struct layout* layout)
+{
+    if (clone_map_get(&self->map, object, layout) != NULL)
+    {
+        return true;
+    }
+
+    struct compare_plan* plan = compare_plan_get(layout, false);
+    return plan != NULL && clone_map_put(&self->map, object, layout, (void*)object) &&
+           footprint_count(self, object, layout, layout->size) &&
+           (plan->count == 0 || clone_queue_push(&self->queue, (void*)object, plan));
+}
+
+static bool footprint_follow(struct footprinter* self,
+                             const uint8_t* object,
+                             const struct compare_plan* plan)
+{
+    for (size_t i = 0; i < plan->count; i++)
+    {
+        const struct compare_op* op = &plan->ops[i];
+        const void* pointer = *(const void* const*)(object + op->offset);
+
+        switch (op->kind)
+        {
+        case COMPARE_STRING:
+            if (pointer != NULL && !footprint_count(self, pointer, NULL, strlen(pointer) + 1))
+            {
+                return false;
+            }
+            break;
+        case COMPARE_POINTER:
+            // Pointers to void and to incomplete types lead nowhere known.
+            if (pointer != NULL && op->layout != NULL && op->layout->size != 0 &&
+                !footprint_object(self, pointer, op->layout))
+            {
+                return false;
+            }
+            break;
+        case COMPARE_ARRAY: {
+            struct compare_plan* element = compare_plan_get(op->layout, false);
+            if (element == NULL)
+            {
+                return false;
+            }
+            for (size_t j = 0; j < op->count; j++)
+            {
+                if (!footprint_follow(self, object + op->offset + j * op->size, element))
+                {
+                    return false;
+                }
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    return true;
+}
+
+static int footprint_entry_compare(const void* a, const void* b)
+{
+    const reflect_footprint_entry_t* x = a;
+    const reflect_footprint_entry_t* y = b;
+    if (x->bytes != y->bytes)
+    {
+        return x->bytes > y->bytes ? -1 : 1;
+    }
+    if (x->name == NULL || y->name == NULL)
+    {
+        return (x->name == NULL) - (y->name == NULL);
+    }
+    return strcmp(x->name, y->name);
+}
+
+// The same struct declared in several compilation units has a layout for each, but one row.
+static size_t footprint_merge(reflect_footprint_entry_t* rows, size_t count)
+{
+    size_t merged = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t j = 0;
+        while (j < merged && (rows[i].name == NULL || rows[j].name == NULL ||
+                              strcmp(rows[i].name, rows[j].name) != 0))
+        {
+            j++;
+        }
+
+        if (j == merged)
+        {
+            rows[merged++] = rows[i];
+        }
+        else
+        {
+            rows[j].objects += rows[i].objects;
+            rows[j].bytes += rows[i].bytes;
+        }
+    }
+    return merged;
+}
+
+reflect_footprint_t* reflect_footprint(const void* object,
+                                       reflect_type_t* type,
+                                       reflect_footprint_t* out)
+{
+    NOT_NULL(object);
+    NOT_NULL(type);
+    NOT_NULL(out);
+
+    struct layout* layout = layout_get(type->_impl.domain, type->_impl.offset);
+    if (layout == NULL || layout->size == 0)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    struct footprinter footprinter = {0};
+    clone_map_init(&footprinter.map);
+    clone_map_init(&footprinter.rows_by_layout);
+    footprinter.queue.items = footprinter.queue.inline_items;
+    footprinter.queue.capacity = CLONE_INLINE_CAPACITY;
+
+    bool ok = footprint_object(&footprinter, object, layout);
+    while (ok && footprinter.queue.head != footprinter.queue.count)
+    {
+        struct clone_work work = footprinter.queue.items[footprinter.queue.head++];
+        ok = footprint_follow(&footprinter, work.clone, work.plan);
+    }
+
+    clone_map_free(&footprinter.map);
+    clone_map_free(&footprinter.rows_by_layout);
+    if (footprinter.queue.items != footprinter.queue.inline_items)
+    {
+        free(footprinter.queue.items);
+    }
+
+    if (!ok)
+    {
+        free(footprinter.rows);
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    *out = (reflect_footprint_t){
+        .entry_count = footprint_merge(footprinter.rows, footprinter.row_count),
+        .entries = footprinter.rows,
+    };
+    qsort(out->entries,
+          out->entry_count,
+          sizeof(reflect_footprint_entry_t),
+          footprint_entry_compare);
+
+    for (size_t i = 0; i < out->entry_count; i++)
+    {
+        out->objects += out->entries[i].objects;
+        out->bytes += out->entries[i].bytes;
+    }
+
+    return out;
+}
+
+void reflect_footprint_free(reflect_footprint_t* self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+
+    free(self->entries);
+    self->entries = NULL;
+    self->entry_count = 0;
+}
+
+FILE* reflect_footprint_print(const reflect_footprint_t* self, FILE* output)
+{
+    NOT_NULL(self);
+    NOT_NULL(output);
+
+    fprintf(output, "%12s %10s %6s  %s\n", "bytes", "objects", "share", "type");
+    for (size_t i = 0; i < self->entry_count; i++)
+    {
+        const reflect_footprint_entry_t* entry = &self->entries[i];
+        fprintf(output,
+                "%12zu %10zu %5.1f%%  %s\n",
+                entry->bytes,
+                entry->objects,
+                100.0 * entry->bytes / self->bytes,
+                entry->name != NULL ? entry->name : "<anonymous>");
+    }
+    fprintf(output, "%12zu %10zu %5.1f%%  total\n", self->bytes, self->objects, 100.0);
+
+    return output;
+}
+
+/*
+ * Views
+ *
+ * reflect_write_view() lays out an object and everything it points to in one buffer: each object
+ * as it is in memory, with the pointers and strings the layouts know of replaced by offsets into
+ * the buffer, then a table per type listing its members the way the columnar export names them.
+ * A reflect_view_t reads members straight out of the buffer through those tables. Looking a member
+ * up by name is a binary search in the table, after which reading it is a bounds check and a load,
+ * whatever the number of members.
+ */
+
+#define VIEW_MAGIC "RVIEW001"
+
+enum view_kind
+{
+    VIEW_SCALAR,
+    VIEW_ENUM,
+    VIEW_BITFIELD,
+    VIEW_STRING,
+    VIEW_POINTER,
+    VIEW_CHARS,
+};
+
+struct view_header
+{
+    char magic[8];
+    uint64_t size;
+
+    // The root object and the table of its type.
+    uint64_t root;
+    uint64_t root_type;
+};
+
+// Followed by the members, sorted by name.
+struct view_table
+{
+    // Identifies the members, see view_table_hash().
+    uint64_t hash;
+    uint64_t size;
+    uint64_t member_count;
+};
+
+struct view_member
+{
+    // For bitfields, of the bytes the value is loaded from.
+    uint64_t offset;
+    uint64_t name;
+
+    // The table of the target of a pointer, 0 if no object of that type was written.
+    uint64_t target;
+
+    uint32_t size;
+    uint8_t kind;
+    uint8_t repr;
+    uint8_t bit_size;
+    uint8_t shift;
+};
+
+// Bytes of an object that no table describes, such as a union.
+struct view_hole
+{
+    size_t offset;
+    size_t size;
+};
+
+struct view_type
+{
+    struct layout* layout;
+
+    // Sorted by name.
+    struct column_set columns;
+    uint64_t table;
+
+    // Cleared in every object written, so that the pointers they may hold do not leak.
+    struct view_hole* holes;
+    size_t hole_count;
+    size_t hole_capacity;
+};
+
+// An object written whose pointers still point into the source.
+struct view_pending
+{
+    uint64_t offset;
+    size_t type;
+};
+
+struct view_writer
+{
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+
+    // Offsets of objects and strings written, by address and layout, in clones.
+    struct clone_map objects;
+
+    // Types by layout in types_by_layout, whose clones are indexes in types plus one.
+    struct clone_map types_by_layout;
+    struct view_type* types;
+    size_t type_count;
+    size_t type_capacity;
+
+    struct view_pending* pending;
+    size_t pending_count;
+    size_t pending_capacity;
+};
+
+static bool view_grow(void** items, size_t* capacity, size_t count, size_t item_size)
+{
+    if (count < *capacity)
+    {
+        return true;
+    }
+
+    size_t new_capacity = *capacity == 0 ? 16 : *capacity * 2;
+    void* new_items = realloc(*items, new_capacity * item_size);
+    if (new_items == NULL)
+    {
+        return false;
+    }
+
+    *items = new_items;
+    *capacity = new_capacity;
+    return true;
+}
+
+// Appends size zeroed bytes at the given alignment.
+static bool view_reserve(struct view_writer* self, size_t size, size_t alignment, uint64_t* offset)
+{
+    size_t start = align_up(self->size, alignment);
+    if (start + size > self->capacity)
+    {
+        size_t capacity = self->capacity == 0 ? 4096 : self->capacity;
+        while (capacity < start + size)
+        {
+            capacity *= 2;
+        }
+
+        uint8_t* data = realloc(self->data, capacity);
+        if (data == NULL)
+        {
+            return false;
+        }
+        self->data = data;
+        self->capacity = capacity;
+    }
+
+    memset(self->data + self->size, 0, start + size - self->size);
+    self->size = start + size;
+    *offset = start;
+    return true;
+}
+
+static int view_column_compare(const void* a, const void* b)
+{
+    return strcmp(((const struct column*)a)->name, ((const struct column*)b)->name);
+}
+
+// Adds the unions and other members of unknown layout in an object to the holes of its type.
+static bool view_holes_collect(struct view_type* self, struct layout* layout, size_t offset)
+{
+    switch (layout->kind)
+    {
+    case LAYOUT_UNKNOWN:
+        if (layout->size == 0 ||
+            !view_grow((void**)&self->holes,
+                       &self->hole_capacity,
+                       self->hole_count,
+                       sizeof(struct view_hole)))
+        {
+            return layout->size == 0;
+        }
+        self->holes[self->hole_count++] = (struct view_hole){offset, layout->size};
+        return true;
+    case LAYOUT_ARRAY: {
+        struct layout* element = layout_target(layout);
+        if (element == NULL || element->size == 0 || element->kind == LAYOUT_SCALAR)
+        {
+            return true;
+        }
+
+        size_t count = 1;
+        for (size_t i = 0; i < layout->dim_count; i++)
+        {
+            count *= layout->dims[i];
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!view_holes_collect(self, element, offset + i * element->size))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    case LAYOUT_STRUCT:
+        for (size_t i = 0; i < layout->field_count; i++)
+        {
+            struct layout_field* field = &layout->fields[i];
+            struct layout* field_type = field_layout(layout, field);
+            if (field->bit_size == 0 && field_type != NULL &&
+                !view_holes_collect(self, field_type, offset + field->offset))
+            {
+                return false;
+            }
+        }
+        return true;
+    default:
+        return true;
+    }
+}
+
+static void view_type_free(struct view_type* self)
+{
+    column_set_free(&self->columns);
+    free(self->holes);
+}
+
+// Returns the index of the type of a layout plus one, or 0 on failure.
+static size_t view_type_get(struct view_writer* self, struct layout* layout)
+{
+    size_t index = (uintptr_t)clone_map_get(&self->types_by_layout, layout, NULL);
+    if (index != 0)
+    {
+        return index;
+    }
+
+    if (!view_grow((void**)&self->types,
+                   &self->type_capacity,
+                   self->type_count,
+                   sizeof(struct view_type)))
+    {
+        return 0;
+    }
+
+    struct view_type* type = &self->types[self->type_count];
+    *type = (struct view_type){.layout = layout, .columns = {.references = true}};
+
+    const char* name = layout->kind == LAYOUT_STRUCT || layout->name == NULL ? "" : layout->name;
+    if (!columns_collect(&type->columns, layout, 0, name) || !view_holes_collect(type, layout, 0))
+    {
+        view_type_free(type);
+        return 0;
+    }
+    qsort(type->columns.columns, type->columns.count, sizeof(struct column), view_column_compare);
+
+    index = ++self->type_count;
+    return clone_map_put(&self->types_by_layout, layout, NULL, (void*)(uintptr_t)index) ? index : 0;
+}
+
+// Returns the offset of the copy of an object, or 0 on failure. The header is at offset 0.
+static uint64_t view_object(struct view_writer* self, const void* source, struct layout* layout)
+{
+    uint64_t offset = (uintptr_t)clone_map_get(&self->objects, source, layout);
+    if (offset != 0)
+    {
+        return offset;
+    }
+
+    size_t type = view_type_get(self, layout);
+    if (type == 0 || !view_reserve(self, layout->size, clone_alignment(layout->size), &offset))
+    {
+        return 0;
+    }
+
+    memcpy(self->data + offset, source, layout->size);
+
+    const struct view_type* written = &self->types[type - 1];
+    for (size_t i = 0; i < written->hole_count; i++)
+    {
+        memset(self->data + offset + written->holes[i].offset, 0, written->holes[i].size);
+    }
+
+    if (!clone_map_put(&self->objects, source, layout, (void*)(uintptr_t)offset) ||
+        !view_grow((void**)&self->pending,
+                   &self->pending_capacity,
+                   self->pending_count,
+                   sizeof(struct view_pending)))
+    {
+        return 0;
+    }
+
+    self->pending[self->pending_count++] = (struct view_pending){offset, type - 1};
+    return offset;
+}
+
+static uint64_t view_string(struct view_writer* self, const char* source)
+{
+    uint64_t offset = (uintptr_t)clone_map_get(&self->objects, source, NULL);
+    if (offset != 0)
+    {
+        return offset;
+    }
+
+    size_t size = strlen(source) + 1;
+    if (!view_reserve(self, size, 1, &offset) ||
+        !clone_map_put(&self->objects, source, NULL, (void*)(uintptr_t)offset))
+    {
+        return 0;
+    }
+
+    memcpy(self->data + offset, source, size);
+    return offset;
+}
+
+// Replaces the pointers of an object written with offsets. Pointers to void and to incomplete
+// types become 0. view_object() already cleared the unions, whose pointers no table describes.
+static bool view_fixup(struct view_writer* self, uint64_t object, size_t type)
+{
+    for (size_t i = 0; i < self->types[type].columns.count; i++)
+    {
+        // Writing objects moves the types, the column is copied first.
+        struct column column = self->types[type].columns.columns[i];
+        if (column.kind != LAYOUT_STRING && column.kind != LAYOUT_POINTER)
+        {
+            continue;
+        }
+
+        const void* pointer;
+        memcpy(&pointer, self->data + object + column.offset, sizeof(pointer));
+
+        uintptr_t offset = 0;
+        if (pointer != NULL && column.kind == LAYOUT_STRING)
+        {
+            offset = view_string(self, pointer);
+        }
+        else if (pointer != NULL && column.layout != NULL && column.layout->size != 0)
+        {
+            offset = view_object(self, pointer, column.layout);
+        }
+        else
+        {
+            pointer = NULL;
+        }
+
+        if (pointer != NULL && offset == 0)
+        {
+            return false;
+        }
+
+        memcpy(self->data + object + column.offset, &offset, sizeof(offset));
+    }
+
+    return true;
+}
+
+static struct view_member view_member_of_column(const struct column* column)
+{
+    struct view_member member = {
+        .offset = column->offset,
+        .size = column->size,
+        .repr = column->repr,
+    };
+
+    if (column->field != NULL)
+    {
+        member.offset += column->field->offset;
+        member.size = column->field->load_size;
+        member.kind = VIEW_BITFIELD;
+        member.bit_size = column->field->bit_size;
+        member.shift = column->field->shift;
+        return member;
+    }
+
+    switch (column->kind)
+    {
+    case LAYOUT_ENUM:
+        member.kind = VIEW_ENUM;
+        break;
+    case LAYOUT_STRING:
+        member.kind = VIEW_STRING;
+        break;
+    case LAYOUT_POINTER:
+        member.kind = VIEW_POINTER;
+        break;
+    case LAYOUT_ARRAY:
+        member.kind = VIEW_CHARS;
+        break;
+    default:
+        member.kind = VIEW_SCALAR;
+        break;
+    }
+    return member;
+}
+
+// Hashes what the members are rather than where their names and targets were written, so that
+// members compiled for one buffer work with every buffer written for the type by the same build.
+static uint64_t view_table_hash(const struct view_type* type)
+{
+    uint64_t hash = hash_word(0, type->layout->size);
+    for (size_t i = 0; i < type->columns.count; i++)
+    {
+        const struct column* column = &type->columns.columns[i];
+        struct view_member member = view_member_of_column(column);
+        hash = hash_bytes(hash, (const uint8_t*)column->name, strlen(column->name) + 1);
+        hash = hash_bytes(hash, (const uint8_t*)&member, sizeof(member));
+    }
+    return hash;
+}
+
+// Writes a table per type, then points the pointer members at the tables of their targets.
+static bool view_write_tables(struct view_writer* self)
+{
+    for (size_t i = 0; i < self->type_count; i++)
+    {
+        struct view_type* type = &self->types[i];
+        size_t count = type->columns.count;
+        struct view_table table = {
+            .hash = view_table_hash(type),
+            .size = type->layout->size,
+            .member_count = count,
+        };
+
+        if (!view_reserve(self,
+                          sizeof(struct view_table) + count * sizeof(struct view_member),
+                          sizeof(uint64_t),
+                          &type->table))
+        {
+            return false;
+        }
+        memcpy(self->data + type->table, &table, sizeof(table));
+
+        for (size_t j = 0; j < count; j++)
+        {
+            const struct column* column = &type->columns.columns[j];
+            struct view_member member = view_member_of_column(column);
+            size_t length = strlen(column->name) + 1;
+            if (!view_reserve(self, length, 1, &member.name))
+            {
+                return false;
+            }
+            memcpy(self->data + member.name, column->name, length);
+
+            uint64_t slot = type->table + sizeof(struct view_table) + j * sizeof(member);
+            memcpy(self->data + slot, &member, sizeof(member));
+        }
+    }
+
+    for (size_t i = 0; i < self->type_count; i++)
+    {
+        const struct view_type* type = &self->types[i];
+        for (size_t j = 0; j < type->columns.count; j++)
+        {
+            const struct column* column = &type->columns.columns[j];
+            if (column->kind != LAYOUT_POINTER || column->layout == NULL)
+            {
+                continue;
+            }
+
+            size_t target = (uintptr_t)clone_map_get(&self->types_by_layout, column->layout, NULL);
+            if (target == 0)
+            {
+                continue;
+            }
+
+            uint64_t slot = type->table + sizeof(struct view_table) +
+                            j * sizeof(struct view_member) + offsetof(struct view_member, target);
+            memcpy(self->data + slot, &self->types[target - 1].table, sizeof(uint64_t));
+        }
+    }
+
+    return true;
+}
+
+FILE* reflect_write_view(const void* object, reflect_type_t* type, FILE* output)
+{
+    NOT_NULL(object);
+    NOT_NULL(type);
+    NOT_NULL(output);
+
+    struct layout* layout = layout_get(type->_impl.domain, type->_impl.offset);
+    if (layout == NULL || layout->size == 0)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    struct view_writer writer = {0};
+    clone_map_init(&writer.objects);
+    clone_map_init(&writer.types_by_layout);
+
+    uint64_t header_offset;
+    uint64_t root = 0;
+    if (view_reserve(&writer, sizeof(struct view_header), sizeof(uint64_t), &header_offset))
+    {
+        root = view_object(&writer, object, layout);
+    }
+
+    // Breadth first, objects are written after those pointing to them.
+    for (size_t i = 0; root != 0 && i < writer.pending_count; i++)
+    {
+        if (!view_fixup(&writer, writer.pending[i].offset, writer.pending[i].type))
+        {
+            root = 0;
+        }
+    }
+
+    bool ok = root != 0 && view_write_tables(&writer);
+    if (ok)
+    {
+        struct view_header header = {
+            .magic = VIEW_MAGIC,
+            .size = writer.size,
+            .root = root,
+            .root_type = writer.types[0].table,
+        };
+        memcpy(writer.data + header_offset, &header, sizeof(header));
+        fwrite(writer.data, 1, writer.size, output);
+    }
+
+    for (size_t i = 0; i < writer.type_count; i++)
+    {
+        view_type_free(&writer.types[i]);
+    }
+    free(writer.types);
+    free(writer.pending);
+    free(writer.data);
+    clone_map_free(&writer.types_by_layout);
+    clone_map_free(&writer.objects);
+
+    if (!ok)
+    {
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    return output;
+}
+
+static reflect_view_t* view_init(reflect_view_t* self,
+                                 const uint8_t* blob,
+                                 size_t size,
+                                 uint64_t object,
+                                 uint64_t table)
+{
+    struct view_table header;
+    if (table > size || size - table < sizeof(header))
+    {
+        return NULL;
+    }
+
+    memcpy(&header, blob + table, sizeof(header));
+    size_t room = (size - table - sizeof(header)) / sizeof(struct view_member);
+    if (header.member_count > room || object > size || header.size > size - object)
+    {
+        return NULL;
+    }
+
+    self->_impl.blob = blob;
+    self->_impl.size = size;
+    self->_impl.object = object;
+    self->_impl.object_size = header.size;
+    self->_impl.table = table;
+    self->_impl.schema = header.hash;
+    self->_impl.member_count = header.member_count;
+    return self;
+}
+
+static void view_member_at(const reflect_view_t* self, size_t index, struct view_member* out)
+{
+    memcpy(out,
+           self->_impl.blob + self->_impl.table + sizeof(struct view_table) + index * sizeof(*out),
+           sizeof(*out));
+}
+
+// The value of a member, NULL if the member was compiled for another type or lies outside the
+// object.
+static const uint8_t* view_value(const reflect_view_t* self, const reflect_view_member_t* member)
+{
+    uint64_t offset = member->_impl.offset;
+    if (member->_impl.schema != self->_impl.schema || offset > self->_impl.object_size ||
+        member->_impl.size > self->_impl.object_size - offset)
+    {
+        return NULL;
+    }
+
+    return self->_impl.blob + self->_impl.object + offset;
+}
+
+// Reads an offset stored in place of a pointer, 0 for NULL. Returns false if it is out of bounds.
+static bool view_reference(const reflect_view_t* self, const uint8_t* value, uint64_t* out)
+{
+    uintptr_t offset;
+    memcpy(&offset, value, sizeof(offset));
+    *out = offset;
+    return offset < self->_impl.size;
+}
+
+reflect_view_t* reflect_view_open(reflect_view_t* self, const void* buffer, size_t size)
+{
+    NOT_NULL(self);
+    NOT_NULL(buffer);
+
+    struct view_header header;
+    if (size < sizeof(header))
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    memcpy(&header, buffer, sizeof(header));
+    if (memcmp(header.magic, VIEW_MAGIC, sizeof(header.magic)) != 0 || header.size > size ||
+        view_init(self, buffer, header.size, header.root, header.root_type) == NULL)
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    return self;
+}
+
+reflect_view_member_t* reflect_view_member(const reflect_view_t* self,
+                                           const char* path,
+                                           reflect_view_member_t* out)
+{
+    NOT_NULL(self);
+    NOT_NULL(path);
+    NOT_NULL(out);
+
+    size_t low = 0;
+    size_t high = self->_impl.member_count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        struct view_member member;
+        view_member_at(self, middle, &member);
+
+        size_t room = member.name < self->_impl.size ? self->_impl.size - member.name : 0;
+        const char* name = (const char*)self->_impl.blob + member.name;
+        if (room == 0 || strnlen(name, room) == room)
+        {
+            REFLECT_RAISE(EINVAL);
+        }
+
+        int order = strcmp(name, path);
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else if (order > 0)
+        {
+            high = middle;
+        }
+        else
+        {
+            out->_impl.schema = self->_impl.schema;
+            out->_impl.offset = member.offset;
+            out->_impl.index = middle;
+            out->_impl.size = member.size;
+            out->_impl.kind = member.kind;
+            out->_impl.repr = member.repr;
+            out->_impl.bit_size = member.bit_size;
+            out->_impl.shift = member.shift;
+            return out;
+        }
+    }
+
+    REFLECT_RAISE(ESRCH);
+}
+
+int64_t reflect_view_int(const reflect_view_t* self, const reflect_view_member_t* member)
+{
+    NOT_NULL(self);
+    NOT_NULL(member);
+
+    const uint8_t* value = view_value(self, member);
+    uint8_t kind = member->_impl.kind;
+    size_t size = member->_impl.size;
+    bool is_signed = record_is_signed(member->_impl.repr);
+    if (value == NULL || (kind != VIEW_SCALAR && kind != VIEW_ENUM && kind != VIEW_BITFIELD) ||
+        !record_is_integer(member->_impl.repr) ||
+        size > (kind == VIEW_BITFIELD ? BITS_MAX_LOAD : sizeof(uint64_t)))
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    if (kind != VIEW_BITFIELD)
+    {
+        return load_int(value, size, is_signed);
+    }
+
+    uint8_t bit_size = member->_impl.bit_size;
+    uint8_t shift = member->_impl.shift;
+    if (bit_size == 0 || shift + bit_size > size * 8)
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    return load_bits(value, size, shift, bit_size, is_signed);
+}
+
+double reflect_view_float(const reflect_view_t* self, const reflect_view_member_t* member)
+{
+    NOT_NULL(self);
+    NOT_NULL(member);
+
+    if (member->_impl.kind != VIEW_SCALAR || member->_impl.repr != REFLECT_REPR_FLOAT)
+    {
+        int64_t integer = reflect_view_int(self, member);
+        return record_is_signed(member->_impl.repr) ? (double)integer : (double)(uint64_t)integer;
+    }
+
+    const uint8_t* value = view_value(self, member);
+    if (value == NULL)
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    switch (member->_impl.size)
+    {
+    case 4: {
+        float real;
+        memcpy(&real, value, sizeof(real));
+        return real;
+    }
+    case 8: {
+        double real;
+        memcpy(&real, value, sizeof(real));
+        return real;
+    }
+    case 16: {
+        long double real;
+        memcpy(&real, value, sizeof(real));
+        return real;
+    }
+    default:
+        REFLECT_RAISE(EINVAL);
+    }
+}
+
+const char* reflect_view_string(const reflect_view_t* self,
+                                const reflect_view_member_t* member,
+                                size_t* length)
+{
+    NOT_NULL(self);
+    NOT_NULL(member);
+
+    const uint8_t* value = view_value(self, member);
+    if (value == NULL ||
+        (member->_impl.kind != VIEW_STRING && member->_impl.kind != VIEW_CHARS))
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    const char* s = (const char*)value;
+    size_t room = member->_impl.size;
+    if (member->_impl.kind == VIEW_STRING)
+    {
+        uint64_t offset;
+        if (!view_reference(self, value, &offset))
+        {
+            REFLECT_RAISE(EINVAL);
+        }
+
+        if (offset == 0)
+        {
+            s = NULL;
+            room = 0;
+        }
+        else
+        {
+            s = (const char*)self->_impl.blob + offset;
+            room = self->_impl.size - offset;
+        }
+    }
+
+    // Strings end inside the buffer, char arrays may fill their member.
+    size_t size = s == NULL ? 0 : strnlen(s, room);
+    if (member->_impl.kind == VIEW_STRING && s != NULL && size == room)
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    if (length != NULL)
+    {
+        *length = size;
+    }
+    return s;
+}
+
+reflect_view_t* reflect_view_child(const reflect_view_t* self,
+                                   const reflect_view_member_t* member,
+                                   reflect_view_t* out)
+{
+    NOT_NULL(self);
+    NOT_NULL(member);
+    NOT_NULL(out);
+
+    const uint8_t* value = view_value(self, member);
+    uint64_t offset;
+    if (value == NULL || member->_impl.kind != VIEW_POINTER ||
+        member->_impl.index >= self->_impl.member_count || !view_reference(self, value, &offset))
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    if (offset == 0)
+    {
+        return NULL;
+    }
+
+    // Writers leave pointers without a target table NULL, so a buffer that has one is corrupt.
+    struct view_member record;
+    view_member_at(self, member->_impl.index, &record);
+    if (record.target == 0 ||
+        view_init(out, self->_impl.blob, self->_impl.size, offset, record.target) == NULL)
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    return out;
+}
+
+/*
+ * Deferred logging
+ *
+ * reflect_log() copies an object, and the strings it points to, into a ring owned by the calling
+ * thread, and a background thread formats the copies. Each ring has one producer and one
+ * consumer, so its head and tail are all they share: the producer publishes entries with a release
+ * store of the head and the consumer hands space back with a release store of the tail.
+ */
+
+#define LOG_DEFAULT_RING_SIZE (1024 * 1024)
+#define LOG_MIN_RING_SIZE     4096
+#define LOG_IDLE_WAIT_NS      1000000
+#define LOG_BLOCKED_WAIT_NS   50000
+
+// Entries are 16 byte aligned. A skip entry fills the end of the ring when the next entry does not
+// fit there.
+struct log_entry
+{
+    uint32_t size;
+    uint32_t skip;
+    struct layout* layout;
+    uint8_t data[];
+};
+
+struct log_ring
+{
+    struct log_ring* next;
+    uint8_t* buffer;
+    size_t mask;
+    size_t head;
+    size_t tail;
+
+    // Set when the thread that owns the ring exits. The background thread frees it once empty.
+    bool abandoned;
+};
+
+struct logger
+{
+    const reflect_serializer_t* serializer;
+    FILE* output;
+    size_t ring_size;
+    reflect_log_policy_t policy;
+    uint64_t generation;
+
+    pthread_t thread;
+    bool stopping;
+
+    // Protects the list of rings. The background thread waits on wake when it has nothing to do.
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct log_ring* rings;
+    size_t ring_count;
+
+    size_t logged;
+    size_t written;
+    size_t dropped;
+    size_t oversized;
+    size_t blocked;
+};
+
+static struct logger* libreflect_logger;
+static uint64_t libreflect_log_generation;
+
+// Held by reflect_log_stop() while it takes the logger away, so that threads exiting meanwhile
+// either mark their ring before the rings are freed or find no logger.
+static pthread_mutex_t libreflect_log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The ring of the calling thread, valid while the generation matches that of the logger.
+static __thread struct log_ring* log_ring_local;
+static __thread uint64_t log_ring_generation;
+
+static pthread_key_t log_ring_key;
+static pthread_once_t log_ring_key_once = PTHREAD_ONCE_INIT;
+
+static void log_ring_abandon(void* ring)
+{
+    pthread_mutex_lock(&libreflect_log_lock);
+    struct logger* logger = __atomic_load_n(&libreflect_logger, __ATOMIC_ACQUIRE);
+    if (logger != NULL && log_ring_generation == logger->generation)
+    {
+        __atomic_store_n(&((struct log_ring*)ring)->abandoned, true, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&libreflect_log_lock);
+}
+
+static void log_ring_key_create()
+{
+    pthread_key_create(&log_ring_key, log_ring_abandon);
+}
+
+static void log_ring_free(struct log_ring* self)
+{
+    free(self->buffer);
+    free(self);
+}
+
+static struct log_ring* log_ring_get(struct logger* logger)
+{
+    if (log_ring_local != NULL && log_ring_generation == logger->generation)
+    {
+        return log_ring_local;
+    }
+
+    struct log_ring* self = calloc(1, sizeof(struct log_ring));
+    if (self == NULL || (self->buffer = aligned_alloc(16, logger->ring_size)) == NULL)
+    {
+        free(self);
+        return NULL;
+    }
+    self->mask = logger->ring_size - 1;
+
+    pthread_mutex_lock(&logger->lock);
+    self->next = logger->rings;
+    __atomic_store_n(&logger->rings, self, __ATOMIC_RELEASE);
+    logger->ring_count++;
+    pthread_mutex_unlock(&logger->lock);
+
+    pthread_once(&log_ring_key_once, log_ring_key_create);
+    pthread_setspecific(log_ring_key, self);
+    log_ring_local = self;
+    log_ring_generation = logger->generation;
+    return self;
+}
+
+enum
+{
+    LOG_CAPTURE_STRINGS = 1,
+    LOG_CAPTURE_POINTERS = 2,
+};
+
+static unsigned log_plan_captures(const struct compare_plan* plan)
+{
+    unsigned captures = 0;
+    for (size_t i = 0; i < plan->count; i++)
+    {
+        const struct compare_op* op = &plan->ops[i];
+        if (op->kind == COMPARE_STRING)
+        {
+            captures |= LOG_CAPTURE_STRINGS;
+        }
+        else if (op->kind == COMPARE_POINTER)
+        {
+            captures |= LOG_CAPTURE_POINTERS;
+        }
+        else if (op->kind == COMPARE_ARRAY)
+        {
+            struct compare_plan* element = compare_plan_get(op->layout, false);
+            captures |= element == NULL ? 0 : log_plan_captures(element);
+        }
+    }
+
+    return captures;
+}
+
+// Returns the size of an entry for a layout before its strings, 0 on error, and whether copies
+// have strings or pointers for log_capture(). Both are worked out once per layout.
+static size_t log_entry_size(struct layout* layout, unsigned* captures)
+{
+    size_t size = __atomic_load_n(&layout->log_size, __ATOMIC_ACQUIRE);
+    if (size == 0)
+    {
+        struct compare_plan* plan = compare_plan_get(layout, false);
+        if (plan == NULL)
+        {
+            return 0;
+        }
+
+        __atomic_store_n(&layout->log_captures, log_plan_captures(plan), __ATOMIC_RELAXED);
+        size = sizeof(struct log_entry) + layout->size;
+        __atomic_store_n(&layout->log_size, size, __ATOMIC_RELEASE);
+    }
+
+    *captures = __atomic_load_n(&layout->log_captures, __ATOMIC_RELAXED);
+    return size;
+}
+
+// Measures the strings an object points to or, given a copy of the object, copies them to strings
+// and points the copy at them. Other pointers are cleared in the copy: their targets are not
+// captured and may be gone by the time the entry is formatted.
+static size_t log_capture(const struct compare_plan* plan,
+                          const uint8_t* object,
+                          uint8_t* copy,
+                          char* strings)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < plan->count; i++)
+    {
+        const struct compare_op* op = &plan->ops[i];
+        switch (op->kind)
+        {
+        case COMPARE_STRING: {
+            const char* string = *(const char* const*)(object + op->offset);
+            if (string == NULL)
+            {
+                break;
+            }
+
+            size_t length = strlen(string) + 1;
+            if (copy != NULL)
+            {
+                char* target = memcpy(strings + size, string, length);
+                memcpy(copy + op->offset, &target, sizeof(target));
+            }
+            size += length;
+            break;
+        }
+        case COMPARE_POINTER:
+            if (copy != NULL)
+            {
+                memset(copy + op->offset, 0, sizeof(void*));
+            }
+            break;
+        case COMPARE_ARRAY: {
+            struct compare_plan* element = compare_plan_get(op->layout, false);
+            for (size_t j = 0; element != NULL && j < op->count; j++)
+            {
+                size_t offset = op->offset + j * op->size;
+                size += log_capture(element,
+                                    object + offset,
+                                    copy == NULL ? NULL : copy + offset,
+                                    copy == NULL ? NULL : strings + size);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    return size;
+}
+
+// Returns room for an entry of size bytes, or NULL when the ring is full and the policy is to drop.
+// The entry is published by advancing the head to *head.
+static struct log_entry* log_reserve(struct logger* logger,
+                                     struct log_ring* ring,
+                                     size_t size,
+                                     size_t* head)
+{
+    bool blocked = false;
+    for (;;)
+    {
+        size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        size_t offset = ring->head & ring->mask;
+        size_t contiguous = logger->ring_size - offset;
+        size_t needed = contiguous < size ? contiguous + size : size;
+
+        if (logger->ring_size - (ring->head - tail) >= needed)
+        {
+            if (contiguous < size)
+            {
+                struct log_entry* skip = (struct log_entry*)(ring->buffer + offset);
+                skip->size = contiguous;
+                skip->skip = true;
+                offset = 0;
+            }
+
+            *head = ring->head + needed;
+            return (struct log_entry*)(ring->buffer + offset);
+        }
+
+        if (logger->policy == REFLECT_LOG_DROP)
+        {
+            __atomic_add_fetch(&logger->dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+
+        if (!blocked)
+        {
+            __atomic_add_fetch(&logger->blocked, 1, __ATOMIC_RELAXED);
+            blocked = true;
+        }
+
+        pthread_cond_signal(&logger->wake);
+        nanosleep(&(struct timespec){.tv_nsec = LOG_BLOCKED_WAIT_NS}, NULL);
+    }
+}
+
+// Formats the entries of a ring, handing the space of each back as soon as it is written.
+static size_t log_drain(struct logger* self, struct log_ring* ring)
+{
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t tail = ring->tail;
+    size_t count = 0;
+
+    while (tail != head)
+    {
+        struct log_entry* entry = (struct log_entry*)(ring->buffer + (tail & ring->mask));
+        if (!entry->skip)
+        {
+            serialize_layout(self->serializer, entry->data, entry->layout, self->output);
+            fputc('\n', self->output);
+            count++;
+        }
+
+        tail += entry->size;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    __atomic_add_fetch(&self->written, count, __ATOMIC_RELAXED);
+    return count;
+}
+
+// Frees the rings of threads that exited once everything they logged is written.
+static void log_collect_rings(struct logger* self)
+{
+    pthread_mutex_lock(&self->lock);
+    for (struct log_ring** link = &self->rings; *link != NULL;)
+    {
+        struct log_ring* ring = *link;
+        if (__atomic_load_n(&ring->abandoned, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail)
+        {
+            *link = ring->next;
+            self->ring_count--;
+            log_ring_free(ring);
+        }
+        else
+        {
+            link = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&self->lock);
+}
+
+static void* log_thread(void* arg)
+{
+    struct logger* self = arg;
+
+    for (;;)
+    {
+        // Entries published before stopping was set are found by the pass that follows.
+        bool stopping = __atomic_load_n(&self->stopping, __ATOMIC_ACQUIRE);
+
+        size_t count = 0;
+        for (struct log_ring* ring = __atomic_load_n(&self->rings, __ATOMIC_ACQUIRE); ring != NULL;
+             ring = ring->next)
+        {
+            count += log_drain(self, ring);
+        }
+
+        log_collect_rings(self);
+
+        if (count != 0)
+        {
+            fflush(self->output);
+            continue;
+        }
+
+        if (stopping)
+        {
+            return NULL;
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOG_IDLE_WAIT_NS;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&self->lock);
+        if (!__atomic_load_n(&self->stopping, __ATOMIC_ACQUIRE))
+        {
+            pthread_cond_timedwait(&self->wake, &self->lock, &deadline);
+        }
+        pthread_mutex_unlock(&self->lock);
+    }
+}
+
+int reflect_log_start(const reflect_serializer_t* serializer,
+                      FILE* output,
+                      const reflect_log_options_t* options)
+{
+    if (serializer == NULL || output == NULL)
+    {
+        __libreflect_report_error(EFAULT, __func__);
+        return -1;
+    }
+
+    if (__atomic_load_n(&libreflect_logger, __ATOMIC_ACQUIRE) != NULL)
+    {
+        __libreflect_report_error(EBUSY, __func__);
+        return -1;
+    }
+
+    struct logger* self = calloc(1, sizeof(struct logger));
+    if (self == NULL)
+    {
+        __libreflect_report_error(ENOMEM, __func__);
+        return -1;
+    }
+
+    size_t ring_size = options == NULL || options->ring_size == 0 ? LOG_DEFAULT_RING_SIZE
+                                                                  : options->ring_size;
+    self->ring_size = LOG_MIN_RING_SIZE;
+    while (self->ring_size < ring_size && self->ring_size <= SIZE_MAX / 4)
+    {
+        self->ring_size *= 2;
+    }
+
+    self->serializer = serializer_resolve(serializer);
+    self->output = output;
+    self->policy = options == NULL ? REFLECT_LOG_DROP : options->policy;
+    self->generation = __atomic_add_fetch(&libreflect_log_generation, 1, __ATOMIC_RELAXED);
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->wake, NULL);
+
+    if (pthread_create(&self->thread, NULL, log_thread, self) != 0)
+    {
+        pthread_cond_destroy(&self->wake);
+        pthread_mutex_destroy(&self->lock);
+        free(self);
+        __libreflect_report_error(EAGAIN, __func__);
+        return -1;
+    }
+
+    __atomic_store_n(&libreflect_logger, self, __ATOMIC_RELEASE);
+    return 0;
+}
+
+bool reflect_log(const void* object, reflect_type_t* type)
+{
+    NOT_NULL(object);
+    NOT_NULL(type);
+
+    struct logger* logger = __atomic_load_n(&libreflect_logger, __ATOMIC_ACQUIRE);
+    if (logger == NULL)
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    unsigned captures = 0;
+    struct layout* layout = layout_get(type->_impl.domain, type->_impl.offset);
+    size_t size = layout == NULL ? 0 : log_entry_size(layout, &captures);
+    if (size == 0)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    struct log_ring* ring = log_ring_get(logger);
+    if (ring == NULL)
+    {
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    // The plan is built by now, so this only loads it.
+    struct compare_plan* plan = captures == 0 ? NULL : compare_plan_get(layout, false);
+    if (captures & LOG_CAPTURE_STRINGS)
+    {
+        size += log_capture(plan, object, NULL, NULL);
+    }
+
+    // Half a ring at most, so that an entry always fits once the ring is empty.
+    size = align_up(size, sizeof(struct log_entry));
+    if (size > logger->ring_size / 2 || size > UINT32_MAX)
+    {
+        __atomic_add_fetch(&logger->oversized, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    size_t head;
+    struct log_entry* entry = log_reserve(logger, ring, size, &head);
+    if (entry == NULL)
+    {
+        return false;
+    }
+
+    entry->size = size;
+    entry->skip = false;
+    entry->layout = layout;
+    memcpy(entry->data, object, layout->size);
+    if (plan != NULL)
+    {
+        log_capture(plan, object, entry->data, (char*)entry->data + layout->size);
+    }
+
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&logger->logged, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+static void log_stats(struct logger* self, reflect_log_stats_t* out)
+{
+    *out = (reflect_log_stats_t){
+        .logged = __atomic_load_n(&self->logged, __ATOMIC_RELAXED),
+        .written = __atomic_load_n(&self->written, __ATOMIC_RELAXED),
+        .dropped = __atomic_load_n(&self->dropped, __ATOMIC_RELAXED),
+        .oversized = __atomic_load_n(&self->oversized, __ATOMIC_RELAXED),
+        .blocked = __atomic_load_n(&self->blocked, __ATOMIC_RELAXED),
+        .rings = __atomic_load_n(&self->ring_count, __ATOMIC_RELAXED),
+    };
+}
+
+reflect_log_stats_t* reflect_log_stats(reflect_log_stats_t* out)
+{
+    NOT_NULL(out);
+
+    struct logger* logger = __atomic_load_n(&libreflect_logger, __ATOMIC_ACQUIRE);
+    if (logger == NULL)
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    log_stats(logger, out);
+    return out;
+}
+
+void reflect_log_stop(reflect_log_stats_t* stats)
+{
+    pthread_mutex_lock(&libreflect_log_lock);
+    struct logger* self = __atomic_exchange_n(&libreflect_logger, NULL, __ATOMIC_ACQ_REL);
+    pthread_mutex_unlock(&libreflect_log_lock);
+    if (self == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&self->lock);
+    __atomic_store_n(&self->stopping, true, __ATOMIC_RELEASE);
+    pthread_cond_signal(&self->wake);
+    pthread_mutex_unlock(&self->lock);
+    pthread_join(self->thread, NULL);
+
+    if (stats != NULL)
+    {
+        log_stats(self, stats);
+    }
+
+    while (self->rings != NULL)
+    {
+        struct log_ring* ring = self->rings;
+        self->rings = ring->next;
+        log_ring_free(ring);
+    }
+
+    pthread_cond_destroy(&self->wake);
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+/*
+ * Layout analysis
+ *
+ * A pahole-style look at how a struct uses its bytes. Offsets come from the layout, alignments
+ * straight from the DWARF since layouts do not need them.
+ */
+
+#define CACHE_LINE_SIZE 64
+
+static size_t die_alignment(Dwarf_Die* die)
+{
+    Dwarf_Word alignment;
+    if (die_udata(die, DW_AT_alignment, &alignment) == 0 && alignment != 0)
+    {
+        return alignment;
+    }
+
+    Dwarf_Die type;
+    if (dwarf_peel_type(die, &type) != 0)
+    {
+        return 1;
+    }
+
+    if (die_udata(&type, DW_AT_alignment, &alignment) == 0 && alignment != 0)
+    {
+        return alignment;
+    }
+
+    Dwarf_Die child;
+    size_t result = 1;
+
+    switch (dwarf_tag(&type))
+    {
+    case DW_TAG_structure_type:
+    case DW_TAG_union_type:
+        if (dwarf_child(&type, &child) != 0)
+        {
+            return 1;
+        }
+        do
+        {
+            Dwarf_Die member;
+            if (dwarf_tag(&child) == DW_TAG_member && die_type(&child, &member) != NULL)
+            {
+                size_t member_alignment = die_alignment(&member);
+                result = member_alignment > result ? member_alignment : result;
+            }
+        } while (dwarf_siblingof(&child, &child) == 0);
+        return result;
+    case DW_TAG_array_type:
+        return die_type(&type, &child) != NULL ? die_alignment(&child) : 1;
+    default: {
+        // Scalars are aligned to their size, complex numbers to the size of their parts.
+        Dwarf_Word size;
+        Dwarf_Word encoding;
+        if (dwarf_aggregate_size(&type, &size) != 0 || size == 0)
+        {
+            return 1;
+        }
+        if (die_udata(&type, DW_AT_encoding, &encoding) == 0 && encoding == DW_ATE_complex_float)
+        {
+            size /= 2;
+        }
+        while (result * 2 <= size && result < 16)
+        {
+            result *= 2;
+        }
+        return result;
+    }
+    }
+}
+
+// Atomics and locks are what other members should not share a cache line with.
+static bool die_is_sync(Dwarf_Die* die)
+{
+    Dwarf_Die type = *die;
+
+    for (;;)
+    {
+        int tag = dwarf_tag(&type);
+        if (tag == DW_TAG_atomic_type)
+        {
+            return true;
+        }
+
+        const char* name = dwarf_diename(&type);
+        if (tag == DW_TAG_typedef && name != NULL &&
+            (strcmp(name, "pthread_mutex_t") == 0 || strcmp(name, "pthread_spinlock_t") == 0 ||
+             strcmp(name, "pthread_rwlock_t") == 0 || strcmp(name, "pthread_cond_t") == 0))
+        {
+            return true;
+        }
+
+        if ((tag != DW_TAG_typedef && tag != DW_TAG_const_type && tag != DW_TAG_volatile_type) ||
+            die_type(&type, &type) == NULL)
+        {
+            return false;
+        }
+    }
+}
+
+// The bytes occupied by a member. Bitfields occupy the bytes their bits touch.
+static size_t field_size(struct layout* self, struct layout_field* field)
+{
+    if (field->bit_size != 0)
+    {
+        return (field->shift + field->bit_size + 7) / 8;
+    }
+
+    struct layout* type = field_layout(self, field);
+    return type == NULL ? 0 : type->size;
+}
+
+// A member, or a run of bitfields sharing bytes, placed as a whole when reordering.
+struct layout_unit
+{
+    size_t first;
+    size_t count;
+    size_t size;
+    size_t alignment;
+};
+
+static int layout_unit_compare(const void* a, const void* b)
+{
+    const struct layout_unit* x = a;
+    const struct layout_unit* y = b;
+
+    if (x->alignment != y->alignment)
+    {
+        return x->alignment > y->alignment ? -1 : 1;
+    }
+    if (x->size != y->size)
+    {
+        return x->size > y->size ? -1 : 1;
+    }
+
+    // Keep declaration order otherwise, qsort is not stable.
+    return x->first < y->first ? -1 : x->first > y->first;
+}
+
+// Sorting by decreasing alignment leaves no holes except where sizes are not multiples of
+// alignments, which is as good as it gets without splitting members.
+static bool layout_suggest_order(reflect_layout_report_t* self)
+{
+    struct layout_unit* units = calloc(self->member_count, sizeof(struct layout_unit));
+    self->suggested_order = calloc(self->member_count, sizeof(size_t));
+    if (units == NULL || self->suggested_order == NULL)
+    {
+        free(units);
+        return false;
+    }
+
+    size_t unit_count = 0;
+    for (size_t i = 0; i < self->member_count; i++)
+    {
+        reflect_layout_member_t* member = &self->members[i];
+        struct layout_unit* last = unit_count == 0 ? NULL : &units[unit_count - 1];
+        reflect_layout_member_t* previous = i == 0 ? NULL : &self->members[i - 1];
+
+        if (last != NULL && member->bit_size != 0 && previous->bit_size != 0 &&
+            member->offset < previous->offset + previous->size)
+        {
+            size_t end = member->offset + member->size;
+            size_t last_end = self->members[last->first].offset + last->size;
+            last->size += end > last_end ? end - last_end : 0;
+            last->count++;
+            continue;
+        }
+
+        size_t alignment = member->alignment;
+        if (member->bit_size != 0)
+        {
+            // A bitfield run need not be aligned more than its size allows.
+            while (alignment > 1 && alignment > member->size)
+            {
+                alignment /= 2;
+            }
+        }
+
+        units[unit_count++] = (struct layout_unit){i, 1, member->size, alignment};
+    }
+
+    qsort(units, unit_count, sizeof(struct layout_unit), layout_unit_compare);
+
+    size_t offset = 0;
+    size_t index = 0;
+    for (size_t i = 0; i < unit_count; i++)
+    {
+        offset = align_up(offset, units[i].alignment) + units[i].size;
+        for (size_t j = 0; j < units[i].count; j++)
+        {
+            self->suggested_order[index++] = units[i].first + j;
+        }
+    }
+
+    self->optimal_size = align_up(offset, self->alignment);
+    if (self->optimal_size >= self->size)
+    {
+        self->optimal_size = self->size;
+        for (size_t i = 0; i < self->member_count; i++)
+        {
+            self->suggested_order[i] = i;
+        }
+    }
+
+    free(units);
+    return true;
+}
+
+static reflect_layout_report_t* layout_analyze(struct domain* domain,
+                                               Dwarf_Off offset,
+                                               const char* name,
+                                               reflect_layout_report_t* out)
+{
+    *out = (reflect_layout_report_t){0};
+
+    struct layout* layout = layout_get(domain, offset);
+    Dwarf_Die die;
+    if (layout == NULL || layout->kind != LAYOUT_STRUCT ||
+        domain_offdie(domain, layout->offset, &die) == NULL)
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    // Anonymous structs go by the name of the typedef they were looked up through.
+    Dwarf_Die named;
+    if (name == NULL && domain_offdie(domain, offset, &named) != NULL)
+    {
+        name = dwarf_diename(&named);
+    }
+
+    out->name = name;
+    out->size = layout->size;
+    out->alignment = die_alignment(&die);
+    out->member_count = layout->field_count;
+    out->cache_lines = (layout->size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE;
+    out->members = calloc(layout->field_count, sizeof(reflect_layout_member_t));
+    if (out->members == NULL && layout->field_count != 0)
+    {
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    size_t end = 0;
+    for (size_t i = 0; i < layout->field_count; i++)
+    {
+        struct layout_field* field = &layout->fields[i];
+        reflect_layout_member_t* member = &out->members[i];
+
+        Dwarf_Die type;
+        bool has_type = domain_offdie(domain, field->type, &type) != NULL;
+
+        member->name = field->name;
+        member->offset = field->offset;
+        member->size = field_size(layout, field);
+        member->alignment = has_type ? die_alignment(&type) : 1;
+        member->bit_offset = field->shift;
+        member->bit_size = field->bit_size;
+        member->is_sync = has_type && die_is_sync(&type);
+
+        size_t member_end = member->offset + member->size;
+        if (member->size != 0 &&
+            member->offset / CACHE_LINE_SIZE != (member_end - 1) / CACHE_LINE_SIZE)
+        {
+            member->straddles_cache_line = true;
+            out->straddles++;
+        }
+
+        // The hole is charged to the member before it.
+        if (i != 0 && member->offset > end)
+        {
+            out->members[i - 1].hole = member->offset - end;
+            out->holes++;
+            out->padding += member->offset - end;
+        }
+
+        end = member_end > end ? member_end : end;
+    }
+
+    out->tail_padding = out->size > end ? out->size - end : 0;
+    out->wasted = out->padding + out->tail_padding;
+
+    // A lock or atomic risks false sharing when any other member touches one of its lines.
+    for (size_t i = 0; i < out->member_count; i++)
+    {
+        reflect_layout_member_t* sync = &out->members[i];
+        if (!sync->is_sync || sync->size == 0)
+        {
+            continue;
+        }
+
+        size_t first_line = sync->offset / CACHE_LINE_SIZE;
+        size_t last_line = (sync->offset + sync->size - 1) / CACHE_LINE_SIZE;
+        for (size_t j = 0; j < out->member_count && !sync->false_sharing; j++)
+        {
+            reflect_layout_member_t* other = &out->members[j];
+            if (j == i || other->size == 0)
+            {
+                continue;
+            }
+
+            sync->false_sharing = other->offset / CACHE_LINE_SIZE <= last_line &&
+                                  (other->offset + other->size - 1) / CACHE_LINE_SIZE >= first_line;
+        }
+        out->false_sharing += sync->false_sharing;
+    }
+
+    if (!layout_suggest_order(out))
+    {
+        reflect_layout_report_free(out);
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    return out;
+}
+
+reflect_layout_report_t* reflect_layout_analyze(reflect_type_t* type, reflect_layout_report_t* out)
+{
+    NOT_NULL(type);
+    NOT_NULL(out);
+
+    return layout_analyze(type->_impl.domain, type->_impl.offset, NULL, out);
+}
+
+void reflect_layout_report_free(reflect_layout_report_t* self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+
+    free(self->members);
+    free(self->suggested_order);
+    self->members = NULL;
+    self->suggested_order = NULL;
+}
+
+struct layout_candidate
+{
+    const char* name;
+    Dwarf_Off offset;
+    Dwarf_Word size;
+};
+
+static int layout_candidate_compare(const void* a, const void* b)
+{
+    const struct layout_candidate* x = a;
+    const struct layout_candidate* y = b;
+
+    int result = strcmp(x->name, y->name);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    return x->size < y->size ? -1 : x->size > y->size;
+}
+
+static int layout_report_rank(const void* a, const void* b)
+{
+    const reflect_layout_report_t* x = a;
+    const reflect_layout_report_t* y = b;
+
+    if (x->wasted != y->wasted)
+    {
+        return x->wasted > y->wasted ? -1 : 1;
+    }
+
+    return strcmp(x->name, y->name);
+}
+
+reflect_layout_report_t* reflect_layout_rank(size_t* count)
+{
+    NOT_NULL(count);
+    NOT_NULL(libreflect_domain);
+
+    *count = 0;
+
+    struct layout_candidate* candidates = NULL;
+    size_t candidate_count = 0;
+    size_t capacity = 0;
+
+    // Every named struct at file scope. Anonymous structs go by the name of their typedef.
+    Dwarf_Die cu_die;
+    Dwarf_CU* cu = NULL;
+    while (unit_next(libreflect_domain, &cu, &cu_die) == 0)
+    {
+        Dwarf_Die die;
+        if (dwarf_child(&cu_die, &die) != 0)
+        {
+            continue;
+        }
+
+        do
+        {
+            Dwarf_Die target = die;
+            const char* name = dwarf_diename(&die);
+            if (dwarf_tag(&die) == DW_TAG_typedef &&
+                (die_type(&die, &target) == NULL || dwarf_diename(&target) != NULL))
+            {
+                continue;
+            }
+
+            Dwarf_Word size;
+            if (name == NULL || dwarf_tag(&target) != DW_TAG_structure_type ||
+                dwarf_hasattr(&target, DW_AT_declaration) ||
+                dwarf_aggregate_size(&target, &size) != 0)
+            {
+                continue;
+            }
+
+            if (candidate_count == capacity)
+            {
+                capacity = capacity == 0 ? 256 : capacity * 2;
+                struct layout_candidate* grown =
+                    realloc(candidates, capacity * sizeof(struct layout_candidate));
+                if (grown == NULL)
+                {
+                    free(candidates);
+                    REFLECT_RAISE(ENOMEM);
+                }
+                candidates = grown;
+            }
+
+            candidates[candidate_count++] =
+                (struct layout_candidate){name, domain_dieoffset(libreflect_domain, &target), size};
+        } while (dwarf_siblingof(&die, &die) == 0);
+    }
+
+    // Headers repeat the same struct in every unit that includes them.
+    qsort(candidates, candidate_count, sizeof(struct layout_candidate), layout_candidate_compare);
+
+    reflect_layout_report_t* reports = calloc(candidate_count + 1, sizeof(reflect_layout_report_t));
+    if (reports == NULL)
+    {
+        free(candidates);
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    for (size_t i = 0; i < candidate_count; i++)
+    {
+        if (i != 0 && layout_candidate_compare(&candidates[i - 1], &candidates[i]) == 0)
+        {
+            continue;
+        }
+
+        if (layout_analyze(libreflect_domain,
+                           candidates[i].offset,
+                           candidates[i].name,
+                           &reports[*count]) != NULL)
+        {
+            (*count)++;
+        }
+    }
+
+    free(candidates);
+    qsort(reports, *count, sizeof(reflect_layout_report_t), layout_report_rank);
+    return reports;
+}
+
+void reflect_layout_rank_free(reflect_layout_report_t* reports, size_t count)
+{
+    for (size_t i = 0; reports != NULL && i < count; i++)
+    {
+        reflect_layout_report_free(&reports[i]);
+    }
+
+    free(reports);
+}
+
+FILE* reflect_layout_print(const reflect_layout_report_t* self, FILE* output)
+{
+    NOT_NULL(self);
+    NOT_NULL(output);
+
+    fprintf(output, "struct %s {\n", self->name != NULL ? self->name : "<anonymous>");
+
+    size_t line = 0;
+    for (size_t i = 0; i < self->member_count; i++)
+    {
+        const reflect_layout_member_t* member = &self->members[i];
+
+        if (member->offset / CACHE_LINE_SIZE != line)
+        {
+            line = member->offset / CACHE_LINE_SIZE;
+            fprintf(output,
+                    "\t/* --- cacheline %zu boundary (%zu bytes) --- */\n",
+                    line,
+                    line * CACHE_LINE_SIZE);
+        }
+
+        const char* name = member->name != NULL ? member->name : "<anonymous>";
+        if (member->bit_size != 0)
+        {
+            fprintf(output,
+                    "\t%-32s /* %5zu:%zu %4zu bits */\n",
+                    name,
+                    member->offset,
+                    member->bit_offset,
+                    member->bit_size);
+        }
+        else
+        {
+            fprintf(output,
+                    "\t%-32s /* %5zu %5zu, align %zu */\n",
+                    name,
+                    member->offset,
+                    member->size,
+                    member->alignment);
+        }
+
+        if (member->straddles_cache_line)
+        {
+            fprintf(output, "\t/* XXX straddles a cache line boundary */\n");
+        }
+        if (member->false_sharing)
+        {
+            fprintf(output, "\t/* XXX lock or atomic shares a cache line with other members */\n");
+        }
+        if (member->hole != 0)
+        {
+            fprintf(output, "\t/* XXX %zu bytes hole */\n", member->hole);
+        }
+    }
+
+    fprintf(output,
+            "\n\t/* size: %zu, cachelines: %zu, members: %zu */\n"
+            "\t/* holes: %zu, sum holes: %zu, padding: %zu, wasted: %zu */\n",
+            self->size,
+            self->cache_lines,
+            self->member_count,
+            self->holes,
+            self->padding,
+            self->tail_padding,
+            self->wasted);
+
+    if (self->optimal_size < self->size)
+    {
+        fprintf(output, "\t/* reordered size: %zu, saves %zu:", self->optimal_size,
+                self->size - self->optimal_size);
+        for (size_t i = 0; i < self->member_count; i++)
+        {
+            const char* name = self->members[self->suggested_order[i]].name;
+            fprintf(output, "%s %s", i == 0 ? "" : ",", name != NULL ? name : "<anonymous>");
+        }
+        fprintf(output, " */\n");
+    }
+
+    fprintf(output, "};\n");
+    return output;
+}
+
+/*
+ * Address lookup
+ *
+ * Functions, global variables and compilation units are indexed by address in flat tables sorted
+ * by start address, built on first use. Addresses in the tables are link-time addresses; runtime
+ * addresses are translated by subtracting the load bias of the program.
+ */
+
+struct addr_range
+{
+    Dwarf_Addr low;
+    Dwarf_Addr high;
+    Dwarf_Off offset;
+};
+
+struct addr_index
+{
+    size_t count;
+    struct addr_range ranges[];
+};
+
+struct addr_builder
+{
+    struct domain* domain;
+    struct addr_range* ranges;
+    size_t count;
+    size_t capacity;
+};
+
+static bool addr_push(struct addr_builder* self, Dwarf_Addr low, Dwarf_Addr high, Dwarf_Off offset)
+{
+    if (self->count == self->capacity)
+    {
+        size_t capacity = self->capacity == 0 ? 256 : self->capacity * 2;
+        struct addr_range* ranges = realloc(self->ranges, capacity * sizeof(struct addr_range));
+        if (ranges == NULL)
+        {
+            return false;
+        }
+        self->ranges = ranges;
+        self->capacity = capacity;
+    }
+
+    self->ranges[self->count++] = (struct addr_range){low, high, offset};
+    return true;
+}
+
+static int addr_range_compare(const void* a, const void* b)
+{
+    const struct addr_range* x = a;
+    const struct addr_range* y = b;
+    return x->low < y->low ? -1 : x->low > y->low;
+}
+
+static int load_bias_callback(struct dl_phdr_info* info, size_t size, void* data)
+{
+    (void)size;
+
+    // The program itself comes first.
+    *(uintptr_t*)data = info->dlpi_addr;
+    return 1;
+}
+
+static uintptr_t domain_bias(struct domain* self)
+{
+    if (!__atomic_load_n(&self->bias_known, __ATOMIC_ACQUIRE))
+    {
+        uintptr_t bias = 0;
+        dl_iterate_phdr(load_bias_callback, &bias);
+        self->bias = bias;
+        __atomic_store_n(&self->bias_known, true, __ATOMIC_RELEASE);
+    }
+
+    return self->bias;
+}
+
+// The link-time address of a variable with a static location: DW_OP_addr or DW_OP_addrx, possibly
+// offset by constants. Variables in registers, in thread-local storage or optimized into values
+// have none.
+static int die_static_address(Dwarf_Die* die, Dwarf_Addr* out)
+{
+    Dwarf_Attribute attr;
+    Dwarf_Op* expr;
+    size_t len;
+    if (dwarf_attr(die, DW_AT_location, &attr) == NULL ||
+        dwarf_getlocation(&attr, &expr, &len) != 0)
+    {
+        return -1;
+    }
+
+    Dwarf_Addr stack[4];
+    size_t depth = 0;
+    bool has_address = false;
+    for (size_t i = 0; i < len; i++)
+    {
+        const Dwarf_Op* op = &expr[i];
+        Dwarf_Attribute address;
+        switch (op->atom)
+        {
+        case DW_OP_addr:
+            has_address = true;
+            stack[depth] = op->number;
+            break;
+        case DW_OP_addrx:
+        case DW_OP_GNU_addr_index:
+            has_address = true;
+            if (dwarf_getlocation_attr(&attr, op, &address) != 0 ||
+                dwarf_formaddr(&address, &stack[depth]) != 0)
+            {
+                return -1;
+            }
+            break;
+        case DW_OP_const1u:
+        case DW_OP_const1s:
+        case DW_OP_const2u:
+        case DW_OP_const2s:
+        case DW_OP_const4u:
+        case DW_OP_const4s:
+        case DW_OP_const8u:
+        case DW_OP_const8s:
+        case DW_OP_constu:
+        case DW_OP_consts:
+            // libdw sign extends the signed forms.
+            stack[depth] = op->number;
+            break;
+        case DW_OP_plus_uconst:
+            if (depth == 0)
+            {
+                return -1;
+            }
+            stack[depth - 1] += op->number;
+            continue;
+        case DW_OP_plus:
+        case DW_OP_minus:
+            if (depth < 2)
+            {
+                return -1;
+            }
+            depth--;
+            stack[depth - 1] = op->atom == DW_OP_plus ? stack[depth - 1] + stack[depth]
+                                                      : stack[depth - 1] - stack[depth];
+            continue;
+        default:
+            if (op->atom >= DW_OP_lit0 && op->atom <= DW_OP_lit31)
+            {
+                stack[depth] = op->atom - DW_OP_lit0;
+                break;
+            }
+            return -1;
+        }
+
+        // Every operation that gets here pushed a value.
+        if (++depth == sizeof(stack) / sizeof(stack[0]))
+        {
+            return -1;
+        }
+    }
+
+    if (depth != 1 || !has_address)
+    {
+        return -1;
+    }
+
+    *out = stack[0];
+    return 0;
+}
+
+static bool addr_collect(struct addr_builder* self, Dwarf_Die* die, int tag)
+{
+    if (tag != DW_TAG_variable)
+    {
+        // Covers DW_AT_low_pc/DW_AT_high_pc as well as DW_AT_ranges.
+        Dwarf_Addr base;
+        Dwarf_Addr start;
+        Dwarf_Addr end;
+        ptrdiff_t offset = 0;
+        while ((offset = dwarf_ranges(die, offset, &base, &start, &end)) > 0)
+        {
+            if (start < end && !addr_push(self, start, end, domain_dieoffset(self->domain, die)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Dwarf_Addr address;
+    Dwarf_Die type;
+    Dwarf_Word size = 1;
+    if (die_static_address(die, &address) != 0)
+    {
+        return true;
+    }
+
+    // A variable of unknown or zero size still covers its first byte.
+    if (die_type(die, &type) != NULL && dwarf_aggregate_size(&type, &size) == 0 && size == 0)
+    {
+        size = 1;
+    }
+
+    return addr_push(self, address, address + size, domain_dieoffset(self->domain, die));
+}
+
+// Functions and variables of a blob. A blob has no compilation units.
+static bool addr_collect_blob(struct addr_builder* self, struct domain* domain, int tag)
+{
+    const struct blob_header* header = domain->blob;
+
+    for (size_t i = 0; tag == DW_TAG_subprogram && i < header->function_count; i++)
+    {
+        const struct blob_function* function = blob_record(domain, BLOB_ID(BLOB_FUNCTION, i + 1));
+        if (function->low < function->high &&
+            !addr_push(self, function->low, function->high, BLOB_ID(BLOB_FUNCTION, i + 1)))
+        {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; tag == DW_TAG_variable && i < header->variable_count; i++)
+    {
+        const struct blob_variable* variable = blob_record(domain, BLOB_ID(BLOB_VARIABLE, i + 1));
+        uint64_t size = variable->size == 0 ? 1 : variable->size;
+        if (!addr_push(
+                self, variable->address, variable->address + size, BLOB_ID(BLOB_VARIABLE, i + 1)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static struct addr_index* addr_index_build(struct domain* domain, int tag)
+{
+    struct addr_builder builder = {.domain = domain};
+
+    if (domain->blob != NULL && !addr_collect_blob(&builder, domain, tag))
+    {
+        free(builder.ranges);
+        return NULL;
+    }
+
+    // Skeleton units have the address ranges of their split units, which are only opened for
+    // their functions and variables.
+    Dwarf_Die cu_die;
+    Dwarf_Die content;
+    Dwarf_CU* cu = NULL;
+    while (dwarf_get_units(domain->dwarf, cu, &cu, NULL, NULL, &cu_die, NULL) == 0)
+    {
+        if (tag == DW_TAG_compile_unit)
+        {
+            if (!addr_collect(&builder, &cu_die, tag))
+            {
+                free(builder.ranges);
+                return NULL;
+            }
+            continue;
+        }
+
+        Dwarf_Die die;
+        if (dwarf_child(unit_content(domain, &cu_die, &content), &die) != 0)
+        {
+            continue;
+        }
+
+        do
+        {
+            if (dwarf_tag(&die) == tag && !addr_collect(&builder, &die, tag))
+            {
+                free(builder.ranges);
+                return NULL;
+            }
+        } while (dwarf_siblingof(&die, &die) == 0);
+    }
+
+    if (builder.count != 0)
+    {
+        qsort(builder.ranges, builder.count, sizeof(struct addr_range), addr_range_compare);
+    }
+
+    struct addr_index* index = arena_alloc(&domain->arena,
+                                           sizeof(struct addr_index) +
+                                               builder.count * sizeof(struct addr_range),
+                                           ARENA_USE_INDEXES);
+    if (index != NULL && builder.count != 0)
+    {
+        index->count = builder.count;
+        memcpy(index->ranges, builder.ranges, builder.count * sizeof(struct addr_range));
+    }
+
+    free(builder.ranges);
+    return index;
+}
+
+static struct addr_index* addr_index_get(struct domain* domain, int tag)
+{
+    struct addr_index** slot = tag == DW_TAG_subprogram ? &domain->functions
+                               : tag == DW_TAG_variable ? &domain->variables
+                                                        : &domain->units;
+    struct addr_index* index = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (index != NULL)
+    {
+        return index;
+    }
+
+    pthread_mutex_lock(&domain->lock);
+    index = *slot;
+    if (index == NULL)
+    {
+        index = addr_index_build(domain, tag);
+        __atomic_store_n(slot, index, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&domain->lock);
+    return index;
+}
+
+static const struct addr_range* addr_index_find(const struct addr_index* self, Dwarf_Addr address)
+{
+    // The last range starting at or before the address.
+    size_t low = 0;
+    size_t high = self->count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (self->ranges[middle].low <= address)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    if (low == 0 || address >= self->ranges[low - 1].high)
+    {
+        return NULL;
+    }
+
+    return &self->ranges[low - 1];
+}
+
+static reflect_obj_t* obj_by_addr(reflect_obj_t* self, uintptr_t address, int tag)
+{
+    NOT_NULL(self);
+    NOT_NULL(libreflect_domain);
+
+    struct addr_index* index = addr_index_get(libreflect_domain, tag);
+    if (index == NULL)
+    {
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    const struct addr_range* range =
+        addr_index_find(index, address - domain_bias(libreflect_domain));
+    if (range == NULL)
+    {
+        REFLECT_RAISE(ESRCH);
+    }
+
+    self->domain = libreflect_domain;
+    self->offset = range->offset;
+    return self;
+}
+
+reflect_fn_t* reflect_fn_by_addr(reflect_fn_t* self, uintptr_t address)
+{
+    NOT_NULL(self);
+    return obj_by_addr(&self->_impl, address, DW_TAG_subprogram) == NULL ? NULL : self;
+}
+
+reflect_var_t* reflect_var_by_addr(reflect_var_t* self, uintptr_t address)
+{
+    NOT_NULL(self);
+    return obj_by_addr(&self->_impl, address, DW_TAG_variable) == NULL ? NULL : self;
+}
+
+// The link-time address of a variable. Returns 0 or the error code.
+static int var_link_address(reflect_obj_t* self, Dwarf_Addr* out)
+{
+    if (DOMAIN_BLOB(self->domain) != NULL)
+    {
+        const struct blob_variable* variable = BLOB_ID_KIND(self->offset) == BLOB_VARIABLE
+                                                   ? blob_record(self->domain, self->offset)
+                                                   : NULL;
+        if (variable == NULL)
+        {
+            return EINVAL;
+        }
+        *out = variable->address;
+        return 0;
+    }
+
+    Dwarf_Die die;
+    if (domain_offdie(self->domain, self->offset, &die) == NULL)
+    {
+        return EINVAL;
+    }
+
+    return die_static_address(&die, out) == 0 ? 0 : ENODATA;
+}
+
+static int var_address(reflect_obj_t* self, void** out)
+{
+    Dwarf_Addr address;
+    int error = var_link_address(self, &address);
+    if (error == 0)
+    {
+        *out = (void*)(uintptr_t)(address + domain_bias(self->domain));
+    }
+    return error;
+}
+
+void* reflect_var_address(reflect_var_t* self)
+{
+    NOT_NULL(self);
+
+    void* address;
+    int error = var_address(&self->_impl, &address);
+    if (error != 0)
+    {
+        REFLECT_RAISE(error);
+    }
+
+    return address;
+}
+
+// Finds a global variable of the program by name, with its address and layout. Returns 0 or the
+// error code.
+static int var_resolve(const char* name,
+                       const char** out_name,
+                       void** address,
+                       struct layout** layout)
+{
+    reflect_obj_t var;
+    reflect_obj_t type;
+    int error = name_lookup(libreflect_domain, BLOB_VARIABLE, name, &var);
+    if (error == 0)
+    {
+        error = var_address(&var, address);
+    }
+    if (error != 0)
+    {
+        return error;
+    }
+
+    *layout = get_type(&var, &type) == NULL ? NULL : layout_get(libreflect_domain, type.offset);
+    if (*layout == NULL)
+    {
+        return ENODATA;
+    }
+
+    *out_name = get_name(&var);
+    return 0;
+}
+
+/*
+ * Metrics export
+ *
+ * A background thread samples a fixed list of global variables at a fixed interval, without any
+ * code in the program that owns them. Each sample first copies every variable into a snapshot, a
+ * memcpy each, and only then formats the snapshot, so the variables are read close together and
+ * the formatting does not slow the reads down.
+ */
+
+#define METRICS_DEFAULT_INTERVAL_NS 1000000000
+
+struct metric
+{
+    const char* name;
+    const void* address;
+    struct layout* layout;
+
+    // Where the variable is copied to in the snapshot.
+    size_t offset;
+};
+
+struct metrics
+{
+    const reflect_serializer_t* serializer;
+    FILE* output;
+    uint64_t interval_ns;
+
+    struct metric* metrics;
+    size_t count;
+    uint8_t* snapshot;
+
+    pthread_t thread;
+    bool stopping;
+
+    // The background thread waits on wake between samples.
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+
+    size_t samples;
+    uint64_t read_ns;
+};
+
+static struct metrics* libreflect_metrics;
+
+static uint64_t clock_ns(clockid_t clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void metrics_free(struct metrics* self)
+{
+    free(self->snapshot);
+    free(self->metrics);
+    free(self);
+}
+
+// Resolves the variables and lays out the snapshot. Returns 0 or the error code.
+static int metrics_resolve(struct metrics* self, const char* const* names)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < self->count; i++)
+    {
+        struct metric* metric = &self->metrics[i];
+
+        void* address;
+        int error = var_resolve(names[i], &metric->name, &address, &metric->layout);
+        if (error != 0)
+        {
+            return error;
+        }
+
+        metric->address = address;
+        metric->offset = size;
+        size = align_up(size + metric->layout->size, 16);
+    }
+
+    self->snapshot = aligned_alloc(16, size == 0 ? 16 : size);
+    return self->snapshot == NULL ? ENOMEM : 0;
+}
+
+// Copies the variables. Counters other threads update are read as they are at that moment.
+static void metrics_read(struct metrics* self)
+{
+    uint64_t start = clock_ns(CLOCK_MONOTONIC);
+
+    for (size_t i = 0; i < self->count; i++)
+    {
+        const struct metric* metric = &self->metrics[i];
+        memcpy(self->snapshot + metric->offset, metric->address, metric->layout->size);
+    }
+
+    __atomic_store_n(&self->read_ns, clock_ns(CLOCK_MONOTONIC) - start, __ATOMIC_RELAXED);
+}
+
+// Writes the snapshot as one line: a struct with the time in nanoseconds since the epoch and a
+// member per variable.
+static void metrics_write(struct metrics* self, uint64_t time)
+{
+    const reflect_serializer_t* serializer = self->serializer;
+
+    serializer->begin_struct("metrics", self->output);
+    serializer->begin_member("time", self->output);
+    serializer->serialize(&time, REFLECT_REPR_UINT, sizeof(time), self->output);
+    serializer->end_member("time", self->output, self->count == 0);
+
+    for (size_t i = 0; i < self->count; i++)
+    {
+        const struct metric* metric = &self->metrics[i];
+        serializer->begin_member(metric->name, self->output);
+        serialize_layout(serializer, self->snapshot + metric->offset, metric->layout, self->output);
+        serializer->end_member(metric->name, self->output, i + 1 == self->count);
+    }
+
+    serializer->end_struct("metrics", self->output);
+    fputc('\n', self->output);
+    fflush(self->output);
+}
+
+static void* metrics_thread(void* arg)
+{
+    struct metrics* self = arg;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+
+    pthread_mutex_lock(&self->lock);
+    while (!__atomic_load_n(&self->stopping, __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_unlock(&self->lock);
+
+        uint64_t time = clock_ns(CLOCK_REALTIME);
+        metrics_read(self);
+        metrics_write(self, time);
+        __atomic_add_fetch(&self->samples, 1, __ATOMIC_RELAXED);
+
+        // Deadlines advance by the interval, so samples do not drift by the time they take.
+        deadline.tv_sec += self->interval_ns / 1000000000;
+        deadline.tv_nsec += self->interval_ns % 1000000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&self->lock);
+        int waited = 0;
+        while (waited != ETIMEDOUT && !__atomic_load_n(&self->stopping, __ATOMIC_ACQUIRE))
+        {
+            waited = pthread_cond_timedwait(&self->wake, &self->lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    return NULL;
+}
+
+int reflect_metrics_start(const reflect_serializer_t* serializer,
+                          FILE* output,
+                          const char* const* names,
+                          size_t count,
+                          const reflect_metrics_options_t* options)
+{
+    if (serializer == NULL || output == NULL || (names == NULL && count != 0) ||
+        libreflect_domain == NULL)
+    {
+        __libreflect_report_error(EFAULT, __func__);
+        return -1;
+    }
+
+    if (__atomic_load_n(&libreflect_metrics, __ATOMIC_ACQUIRE) != NULL)
+    {
+        __libreflect_report_error(EBUSY, __func__);
+        return -1;
+    }
+
+    struct metrics* self = calloc(1, sizeof(struct metrics));
+    if (self == NULL || (self->metrics = calloc(count + 1, sizeof(struct metric))) == NULL)
+    {
+        free(self);
+        __libreflect_report_error(ENOMEM, __func__);
+        return -1;
+    }
+
+    self->serializer = serializer_resolve(serializer);
+    self->output = output;
+    self->interval_ns = options == NULL || options->interval_ns == 0 ? METRICS_DEFAULT_INTERVAL_NS
+                                                                     : options->interval_ns;
+    self->count = count;
+
+    int error = metrics_resolve(self, names);
+    if (error != 0)
+    {
+        metrics_free(self);
+        __libreflect_report_error(error, __func__);
+        return -1;
+    }
+
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->wake, NULL);
+
+    if (pthread_create(&self->thread, NULL, metrics_thread, self) != 0)
+    {
+        pthread_cond_destroy(&self->wake);
+        pthread_mutex_destroy(&self->lock);
+        metrics_free(self);
+        __libreflect_report_error(EAGAIN, __func__);
+        return -1;
+    }
+
+    __atomic_store_n(&libreflect_metrics, self, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void metrics_stats(struct metrics* self, reflect_metrics_stats_t* out)
+{
+    *out = (reflect_metrics_stats_t){
+        .samples = __atomic_load_n(&self->samples, __ATOMIC_RELAXED),
+        .read_ns = __atomic_load_n(&self->read_ns, __ATOMIC_RELAXED),
+    };
+}
+
+reflect_metrics_stats_t* reflect_metrics_stats(reflect_metrics_stats_t* out)
+{
+    NOT_NULL(out);
+
+    struct metrics* metrics = __atomic_load_n(&libreflect_metrics, __ATOMIC_ACQUIRE);
+    if (metrics == NULL)
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    metrics_stats(metrics, out);
+    return out;
+}
+
+void reflect_metrics_stop(reflect_metrics_stats_t* stats)
+{
+    struct metrics* self = __atomic_exchange_n(&libreflect_metrics, NULL, __ATOMIC_ACQ_REL);
+    if (self == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&self->lock);
+    __atomic_store_n(&self->stopping, true, __ATOMIC_RELEASE);
+    pthread_cond_signal(&self->wake);
+    pthread_mutex_unlock(&self->lock);
+    pthread_join(self->thread, NULL);
+
+    if (stats != NULL)
+    {
+        metrics_stats(self, stats);
+    }
+
+    pthread_cond_destroy(&self->wake);
+    pthread_mutex_destroy(&self->lock);
+    metrics_free(self);
+}
+
+/*
+ * Remote inspection
+ *
+ * reflect_serialize_remote() copies an object out of another process and serializes the copy. The
+ * copy is made a level of pointers at a time: the strings and pointers of everything copied so far
+ * are found with the equality plans, and all their targets are read with one process_vm_readv()
+ * call, a few more only for long strings. Each (address, layout) is copied once, like in
+ * reflect_clone(), so shared targets are shared in the copy as well. Pointers in the copy are then
+ * redirected to the copies of their targets, so the serializers run unchanged. Targets that cannot
+ * be read or lie deeper than REMOTE_MAX_DEPTH are left NULL, and so are pointers that close a
+ * cycle, since the serializers would follow those forever.
+ */
+
+#define REMOTE_MAX_DEPTH    64
+#define REMOTE_STRING_CHUNK 256
+#define REMOTE_STRING_MAX   65536
+
+struct remote_copy
+{
+    uintptr_t address;
+
+    // NULL for strings, which are read a chunk at a time until their NUL.
+    struct layout* layout;
+    uint8_t* data;
+    size_t size;
+    bool done;
+    bool failed;
+};
+
+// The pointer at offset in the data of one copy, to be pointed at the data of another.
+struct remote_patch
+{
+    size_t copy;
+    size_t offset;
+    size_t target;
+};
+
+struct remote_reader
+{
+    pid_t pid;
+    size_t page_size;
+
+    struct remote_copy* copies;
+    size_t count;
+    size_t capacity;
+
+    struct remote_patch* patches;
+    size_t patch_count;
+    size_t patch_capacity;
+
+    // Index + 1 of the copy of each (address, layout).
+    struct clone_map map;
+};
+
+static bool remote_add(struct remote_reader* self, uintptr_t address, struct layout* layout)
+{
+    if (self->count == self->capacity)
+    {
+        size_t capacity = self->capacity == 0 ? 64 : self->capacity * 2;
+        struct remote_copy* copies = realloc(self->copies, capacity * sizeof(struct remote_copy));
+        if (copies == NULL)
+        {
+            return false;
+        }
+        self->copies = copies;
+        self->capacity = capacity;
+    }
+
+    self->copies[self->count++] = (struct remote_copy){.address = address, .layout = layout};
+    return clone_map_put(&self->map, (void*)address, layout, (void*)(uintptr_t)self->count);
+}
+
+static bool remote_patch(struct remote_reader* self, size_t copy, size_t offset, size_t target)
+{
+    if (self->patch_count == self->patch_capacity)
+    {
+        size_t capacity = self->patch_capacity == 0 ? 64 : self->patch_capacity * 2;
+        struct remote_patch* patches =
+            realloc(self->patches, capacity * sizeof(struct remote_patch));
+        if (patches == NULL)
+        {
+            return false;
+        }
+        self->patches = patches;
+        self->patch_capacity = capacity;
+    }
+
+    self->patches[self->patch_count++] = (struct remote_patch){copy, offset, target};
+    return true;
+}
+
+// Makes room for the next read of a copy. Strings are read up to the end of the page at most, so
+// that a string at the end of a mapping does not fail as a whole.
+static bool remote_prepare(struct remote_reader* self,
+                           struct remote_copy* copy,
+                           struct iovec* local,
+                           struct iovec* remote)
+{
+    size_t size = copy->layout != NULL ? copy->layout->size : REMOTE_STRING_CHUNK;
+    if (copy->layout == NULL)
+    {
+        // Long strings take chunks as large as what is read so far.
+        size = copy->size > size ? copy->size : size;
+        size = REMOTE_STRING_MAX - copy->size < size ? REMOTE_STRING_MAX - copy->size : size;
+        uintptr_t next = copy->address + copy->size;
+        size_t page_left = self->page_size - next % self->page_size;
+        size = page_left < size ? page_left : size;
+    }
+
+    // One more byte for the NUL of a truncated string.
+    uint8_t* data = realloc(copy->data, copy->size + size + 1);
+    if (data == NULL)
+    {
+        return false;
+    }
+    copy->data = data;
+
+    *local = (struct iovec){copy->data + copy->size, size};
+    *remote = (struct iovec){(void*)(copy->address + copy->size), size};
+    return true;
+}
+
+// Reads the copies in [first, last) that are not done, in one call while nothing fails. Returns 0
+// or the error code.
+static int remote_read(struct remote_reader* self, size_t first, size_t last)
+{
+    struct iovec local[IOV_MAX];
+    struct iovec remote[IOV_MAX];
+    size_t indexes[IOV_MAX];
+
+    size_t next = first;
+    while (next < last)
+    {
+        size_t count = 0;
+        for (; next < last && count < IOV_MAX; next++)
+        {
+            struct remote_copy* copy = &self->copies[next];
+            if (copy->done)
+            {
+                continue;
+            }
+            if (!remote_prepare(self, copy, &local[count], &remote[count]))
+            {
+                return ENOMEM;
+            }
+            indexes[count++] = next;
+        }
+
+        // Reads stop at the first element that cannot be read, the ones after it are retried.
+        size_t position = 0;
+        while (position < count)
+        {
+            size_t left = count - position;
+            ssize_t result =
+                process_vm_readv(self->pid, &local[position], left, &remote[position], left, 0);
+            if (result < 0 && errno != EFAULT)
+            {
+                return errno;
+            }
+
+            size_t read = result < 0 ? 0 : result;
+            for (; position < count && read >= local[position].iov_len; position++)
+            {
+                struct remote_copy* copy = &self->copies[indexes[position]];
+                size_t size = local[position].iov_len;
+                read -= size;
+
+                // A string is done at its NUL or at the limit, where it is cut.
+                if (copy->layout == NULL &&
+                    memchr(copy->data + copy->size, '\0', size) == NULL &&
+                    copy->size + size < REMOTE_STRING_MAX)
+                {
+                    copy->size += size;
+                    continue;
+                }
+
+                copy->size += size;
+                copy->data[copy->size] = '\0';
+                copy->done = true;
+            }
+
+            if (position < count)
+            {
+                struct remote_copy* copy = &self->copies[indexes[position++]];
+                copy->failed = copy->layout != NULL || copy->size == 0;
+                copy->data[copy->size] = '\0';
+                copy->done = true;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Queues the targets of the strings and pointers of a copy, or clears the pointers at the last
+// level.
+static bool remote_follow(struct remote_reader* self,
+                          size_t index,
+                          const struct compare_plan* plan,
+                          size_t base,
+                          bool last_level)
+{
+    for (size_t i = 0; i < plan->count; i++)
+    {
+        const struct compare_op* op = &plan->ops[i];
+        if (op->kind == COMPARE_ARRAY)
+        {
+            struct compare_plan* element = compare_plan_get(op->layout, false);
+            for (size_t j = 0; element != NULL && j < op->count; j++)
+            {
+                if (!remote_follow(
+                        self, index, element, base + op->offset + j * op->size, last_level))
+                {
+                    return false;
+                }
+            }
+            continue;
+        }
+
+        // Pointers without a known target are written as addresses, never dereferenced.
+        struct layout* target = op->kind == COMPARE_POINTER ? op->layout : NULL;
+        if (op->kind != COMPARE_STRING && target == NULL)
+        {
+            continue;
+        }
+
+        void** pointer = (void**)(self->copies[index].data + base + op->offset);
+        if (*pointer == NULL)
+        {
+            continue;
+        }
+
+        size_t existing = (uintptr_t)clone_map_get(&self->map, *pointer, target);
+        if (existing != 0)
+        {
+            if (!remote_patch(self, index, base + op->offset, existing - 1))
+            {
+                return false;
+            }
+        }
+        else if (last_level || (target != NULL && target->size == 0))
+        {
+            *pointer = NULL;
+        }
+        else if (!remote_add(self, (uintptr_t)*pointer, target) ||
+                 !remote_patch(self, index, base + op->offset, self->count - 1))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void remote_reader_free(struct remote_reader* self)
+{
+    for (size_t i = 0; i < self->count; i++)
+    {
+        free(self->copies[i].data);
+    }
+    free(self->copies);
+    free(self->patches);
+    clone_map_free(&self->map);
+}
+
+// Cuts the patches that close a cycle, found with a depth-first walk from the first copy. The
+// patches of a copy are contiguous, since copies are followed in order.
+static bool remote_break_cycles(struct remote_reader* self)
+{
+    // The first patch of each copy, and whether the walk entered (1) or left (2) it.
+    size_t* first_patch = malloc((self->count + 1) * sizeof(size_t));
+    uint8_t* state = calloc(self->count, 1);
+    size_t* stack = malloc(self->count * sizeof(size_t));
+    size_t* next_patch = malloc(self->count * sizeof(size_t));
+    if (first_patch == NULL || state == NULL || stack == NULL || next_patch == NULL)
+    {
+        free(first_patch);
+        free(state);
+        free(stack);
+        free(next_patch);
+        return false;
+    }
+
+    size_t patch = 0;
+    for (size_t i = 0; i <= self->count; i++)
+    {
+        while (patch < self->patch_count && self->patches[patch].copy < i)
+        {
+            patch++;
+        }
+        first_patch[i] = patch;
+    }
+
+    size_t depth = 1;
+    stack[0] = 0;
+    next_patch[0] = first_patch[0];
+    state[0] = 1;
+    while (depth > 0)
+    {
+        size_t copy = stack[depth - 1];
+        size_t i = next_patch[depth - 1]++;
+        if (i == first_patch[copy + 1])
+        {
+            state[copy] = 2;
+            depth--;
+            continue;
+        }
+
+        struct remote_patch* edge = &self->patches[i];
+        if (state[edge->target] == 1)
+        {
+            edge->target = SIZE_MAX;
+        }
+        else if (state[edge->target] == 0)
+        {
+            state[edge->target] = 1;
+            stack[depth] = edge->target;
+            next_patch[depth++] = first_patch[edge->target];
+        }
+    }
+
+    free(first_patch);
+    free(state);
+    free(stack);
+    free(next_patch);
+    return true;
+}
+
+// Copies an object and what it points to. Returns 0 or the error code.
+static int remote_copy(struct remote_reader* self, uintptr_t address, struct layout* layout)
+{
+    if (!remote_add(self, address, layout))
+    {
+        return ENOMEM;
+    }
+
+    size_t first = 0;
+    for (size_t depth = 0; first < self->count; depth++)
+    {
+        size_t last = self->count;
+
+        // Strings that did not end in their first chunk take another round.
+        bool pending = true;
+        while (pending)
+        {
+            int error = remote_read(self, first, last);
+            if (error != 0)
+            {
+                return error;
+            }
+
+            pending = false;
+            for (size_t i = first; i < last && !pending; i++)
+            {
+                pending = !self->copies[i].done;
+            }
+        }
+
+        if (self->copies[0].failed)
+        {
+            return EFAULT;
+        }
+
+        for (size_t i = first; i < last; i++)
+        {
+            struct remote_copy* copy = &self->copies[i];
+            struct compare_plan* plan =
+                copy->layout == NULL || copy->failed ? NULL : compare_plan_get(copy->layout, false);
+            if (plan != NULL && !remote_follow(self, i, plan, 0, depth + 1 == REMOTE_MAX_DEPTH))
+            {
+                return ENOMEM;
+            }
+        }
+
+        first = last;
+    }
+
+    if (!remote_break_cycles(self))
+    {
+        return ENOMEM;
+    }
+
+    for (size_t i = 0; i < self->patch_count; i++)
+    {
+        const struct remote_patch* patch = &self->patches[i];
+        const struct remote_copy* target =
+            patch->target == SIZE_MAX ? NULL : &self->copies[patch->target];
+        void* data = target == NULL || target->failed ? NULL : target->data;
+        memcpy(self->copies[patch->copy].data + patch->offset, &data, sizeof(data));
+    }
+
+    return 0;
+}
+
+FILE* reflect_serialize_remote(const reflect_serializer_t* self,
+                               pid_t pid,
+                               uintptr_t address,
+                               reflect_type_t* type,
+                               FILE* output)
+{
+    NOT_NULL(self);
+    NOT_NULL(type);
+    NOT_NULL(output);
+
+    self = serializer_resolve(self);
+
+    struct layout* layout = layout_get(type->_impl.domain, type->_impl.offset);
+    if (layout == NULL)
+    {
+        REFLECT_RAISE(ENODATA);
+    }
+
+    struct remote_reader reader = {.pid = pid, .page_size = sysconf(_SC_PAGESIZE)};
+    clone_map_init(&reader.map);
+    int error = remote_copy(&reader, address, layout);
+    FILE* result =
+        error == 0 ? serialize_layout(self, reader.copies[0].data, layout, output) : NULL;
+    remote_reader_free(&reader);
+
+    if (error != 0)
+    {
+        REFLECT_RAISE(error);
+    }
+
+    return result;
+}
+
+// The load bias of the program of another process: where it put the entry point, less where the
+// binary says it is.
+static int remote_bias(pid_t pid, uintptr_t* out)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/exe", (int)pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    Elf64_Ehdr header;
+    ssize_t size = pread(fd, &header, sizeof(header), 0);
+    close(fd);
+    if (size != sizeof(header) || memcmp(header.e_ident, ELFMAG, SELFMAG) != 0 ||
+        header.e_ident[EI_CLASS] != ELFCLASS64)
+    {
+        return ENOEXEC;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/auxv", (int)pid);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    int error = ENOEXEC;
+    Elf64_auxv_t entry;
+    while (read(fd, &entry, sizeof(entry)) == sizeof(entry) && entry.a_type != AT_NULL)
+    {
+        if (entry.a_type == AT_ENTRY)
+        {
+            *out = entry.a_un.a_val - header.e_entry;
+            error = 0;
+            break;
+        }
+    }
+
+    close(fd);
+    return error;
+}
+
+uintptr_t reflect_var_remote_address(reflect_var_t* self, pid_t pid)
+{
+    NOT_NULL(self);
+
+    Dwarf_Addr address;
+    uintptr_t bias = 0;
+    int error = var_link_address(&self->_impl, &address);
+    if (error == 0)
+    {
+        error = remote_bias(pid, &bias);
+    }
+    if (error != 0)
+    {
+        REFLECT_RAISE(error);
+    }
+
+    return address + bias;
+}
+
+/*
+ * Crash dumps
+ *
+ * reflect_crash_start() resolves a list of global variables and warms their layouts, so that the
+ * signal handler it installs never calls into libdw, the layout cache or malloc(). The handler
+ * formats the variables as JSON into a buffer on its stack and writes it out with write(2).
+ *
+ * The parameters and locals of every function are resolved when starting too. Those whose location
+ * is a single register or frame base plus an offset, or a static address, are found again in the
+ * handler from the registers of the signal context. A frame base that is the CFA is computed from
+ * the rows of the call frame information that cover the function, recorded as register plus
+ * offset when starting, so frames without a frame pointer work as well. Locals kept in registers
+ * or described by location lists, as optimized code does, are written as null.
+ * Pointers are only followed after every page of their target was probed with process_vm_readv()
+ * on the process itself, which fails with EFAULT on unmapped memory instead of faulting again.
+ */
+
+#define CRASH_BUFFER_SIZE 1024
+#define CRASH_MAX_DEPTH   8
+#define CRASH_MAX_FOLLOWS 4096
+#define CRASH_STRING_MAX  4096
+
+static const int crash_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+#define CRASH_SIGNAL_COUNT (sizeof(crash_signals) / sizeof(crash_signals[0]))
+
+struct crash_var
+{
+    const char* name;
+    const void* address;
+    struct layout* layout;
+};
+
+// Where a local is, see crash_local_address().
+enum crash_base
+{
+    CRASH_BASE_NONE,
+    CRASH_BASE_STATIC,
+    CRASH_BASE_REGISTER,
+    CRASH_BASE_CFA,
+};
+
+struct crash_local
+{
+    const char* name;
+    struct layout* layout;
+
+    // The link-time address for CRASH_BASE_STATIC, the register or the CFA plus offset otherwise.
+    enum crash_base base;
+    unsigned reg;
+    int64_t offset;
+};
+
+// A row of the call frame information: from start to end, the CFA is the register plus offset.
+struct crash_cfa
+{
+    Dwarf_Addr start;
+    Dwarf_Addr end;
+    unsigned reg;
+    int64_t offset;
+};
+
+// The locals of the function of a range of the address index, and the rows of the call frame
+// information that cover the range.
+struct crash_frame
+{
+    size_t first_local;
+    size_t local_count;
+    size_t first_cfa;
+    size_t cfa_count;
+};
+
+struct crash_dump
+{
+    int fd;
+    uintptr_t bias;
+    uintptr_t page_size;
+
+    struct crash_var* vars;
+    size_t count;
+
+    // The names of the functions of the address index, by position.
+    const struct addr_index* functions;
+    const char** function_names;
+
+    // By position in the address index too, with the locals and rows they refer to.
+    struct crash_frame* frames;
+    struct crash_local* locals;
+    size_t local_count;
+    size_t local_capacity;
+    struct crash_cfa* cfas;
+    size_t cfa_count;
+    size_t cfa_capacity;
+
+    struct sigaction previous[CRASH_SIGNAL_COUNT];
+
+    // Only the first crash is dumped.
+    bool dumped;
+};
+
+static struct crash_dump* libreflect_crash;
+
+struct crash_writer
+{
+    const struct crash_dump* dump;
+    size_t follows;
+    size_t used;
+    char buffer[CRASH_BUFFER_SIZE];
+};
+
+static void crash_flush(struct crash_writer* self)
+{
+    const char* data = self->buffer;
+    size_t left = self->used;
+    while (left > 0)
+    {
+        ssize_t written = write(self->dump->fd, data, left);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            break;
+        }
+        data += written;
+        left -= written;
+    }
+
+    self->used = 0;
+}
+
+static void crash_write(struct crash_writer* self, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        if (self->used == CRASH_BUFFER_SIZE)
+        {
+            crash_flush(self);
+        }
+
+        size_t chunk = CRASH_BUFFER_SIZE - self->used;
+        chunk = chunk < size ? chunk : size;
+        memcpy(self->buffer + self->used, data, chunk);
+        self->used += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+static void crash_puts(struct crash_writer* self, const char* s)
+{
+    crash_write(self, s, strlen(s));
+}
+
+static void crash_put_uint(struct crash_writer* self, uint64_t value)
+{
+    char digits[20];
+    size_t start = sizeof(digits);
+    do
+    {
+        digits[--start] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    crash_write(self, digits + start, sizeof(digits) - start);
+}
+
+static void crash_put_int(struct crash_writer* self, int64_t value)
+{
+    if (value < 0)
+    {
+        crash_puts(self, "-");
+        crash_put_uint(self, -(uint64_t)value);
+        return;
+    }
+
+    crash_put_uint(self, value);
+}
+
+// Stands in for %f, which is not async-signal-safe. Values whose integer part does not fit 64 bits
+// are written like %e instead, and the digits are only as exact as a double.
+static void crash_put_double(struct crash_writer* self, double value)
+{
+    if (signbit(value))
+    {
+        crash_puts(self, "-");
+        value = -value;
+    }
+
+    if (isnan(value) || isinf(value))
+    {
+        crash_puts(self, isnan(value) ? "nan" : "inf");
+        return;
+    }
+
+    unsigned exponent = 0;
+    if (value >= 1e18)
+    {
+        while (value >= 10)
+        {
+            value /= 10;
+            exponent++;
+        }
+    }
+
+    uint64_t whole = (uint64_t)value;
+    uint64_t fraction = (uint64_t)((value - whole) * 1e6 + 0.5);
+    if (fraction >= 1000000)
+    {
+        whole++;
+        fraction -= 1000000;
+    }
+
+    char decimals[7] = {'.'};
+    for (size_t i = 6; i > 0; i--)
+    {
+        decimals[i] = '0' + fraction % 10;
+        fraction /= 10;
+    }
+
+    crash_put_uint(self, whole);
+    crash_write(self, decimals, sizeof(decimals));
+    if (exponent != 0)
+    {
+        crash_puts(self, "e+");
+        crash_put_uint(self, exponent);
+    }
+}
+
+// Whether size bytes at address can be read, probing a byte of each page they span.
+static bool crash_readable(const struct crash_dump* self, const void* address, size_t size)
+{
+    uintptr_t start = (uintptr_t)address;
+    if (size == 0 || start + size < start)
+    {
+        return size == 0;
+    }
+
+    pid_t pid = getpid();
+    uintptr_t last = (start + size - 1) & ~(self->page_size - 1);
+    for (uintptr_t page = start & ~(self->page_size - 1);; page += self->page_size)
+    {
+        char byte;
+        struct iovec local = {.iov_base = &byte, .iov_len = 1};
+        struct iovec remote = {.iov_base = (void*)(page < start ? start : page), .iov_len = 1};
+        if (process_vm_readv(pid, &local, 1, &remote, 1, 0) != 1)
+        {
+            return false;
+        }
+        if (page == last)
+        {
+            return true;
+        }
+    }
+}
+
+// Mirrors the JSON escaping of output_escaped(), writing invalid UTF-8 as Latin-1 code points.
+static void crash_put_string(struct crash_writer* self, const char* s, size_t max, bool probe)
+{
+    static const char hex[] = "0123456789abcdef";
+    const struct crash_dump* dump = self->dump;
+
+    crash_puts(self, "\"");
+    for (size_t i = 0; i < max;)
+    {
+        // Strings are scanned a page at a time, and cut where they run into unreadable memory.
+        bool page_start = i == 0 || ((uintptr_t)(s + i) & (dump->page_size - 1)) == 0;
+        if (probe && page_start && !crash_readable(dump, s + i, 1))
+        {
+            break;
+        }
+
+        unsigned char c = s[i];
+        if (c == '\0')
+        {
+            break;
+        }
+
+        size_t len = c >= 0x80 ? 0 : 1;
+        if (c >= 0x80 && crash_readable(dump, s + i, 4))
+        {
+            len = utf8_sequence((const unsigned char*)s + i);
+            len = len > max - i ? 0 : len;
+        }
+
+        if (c == '"' || c == '\\')
+        {
+            char escaped[2] = {'\\', c};
+            crash_write(self, escaped, sizeof(escaped));
+        }
+        else if (c < 0x20 || (c >= 0x80 && len == 0))
+        {
+            char escaped[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+            crash_write(self, escaped, sizeof(escaped));
+            len = 1;
+        }
+        else
+        {
+            crash_write(self, s + i, len);
+        }
+
+        i += len;
+    }
+    crash_puts(self, "\"");
+}
+
+// The size differs from that of the layout for values extracted from bitfields.
+static void crash_put_scalar(struct crash_writer* self,
+                             const void* object,
+                             reflect_repr_t repr,
+                             size_t size)
+{
+    switch (repr)
+    {
+    case REFLECT_REPR_FLOAT:
+        crash_put_double(self,
+                         size == 4    ? *(const float*)object
+                         : size == 8  ? *(const double*)object
+                         : size == 16 ? (double)*(const long double*)object
+                                      : NAN);
+        break;
+    case REFLECT_REPR_INT:
+        crash_put_int(self, load_int(object, size, true));
+        break;
+    case REFLECT_REPR_UINT:
+    case REFLECT_REPR_POINTER:
+        crash_put_uint(self, load_int(object, size, false));
+        break;
+    case REFLECT_REPR_BOOLEAN:
+        crash_puts(self, *(const bool*)object ? "true" : "false");
+        break;
+    case REFLECT_REPR_SCHAR:
+    case REFLECT_REPR_UCHAR:
+        crash_put_string(self, object, 1, false);
+        break;
+    default:
+        crash_puts(self, "null");
+        break;
+    }
+}
+
+static void crash_put_enum(struct crash_writer* self,
+                           const void* object,
+                           size_t size,
+                           struct layout* layout)
+{
+    bool is_signed = layout->repr == REFLECT_REPR_INT || layout->repr == REFLECT_REPR_SCHAR;
+    struct layout_enumerator* enumerator =
+        layout_enumerator_by_value(layout, load_int(object, size, is_signed));
+    if (enumerator != NULL)
+    {
+        crash_put_string(self, enumerator->name, SIZE_MAX, false);
+    }
+    else
+    {
+        crash_put_scalar(self, object, layout->repr, size);
+    }
+}
+
+static void crash_put_layout(struct crash_writer* self,
+                             const void* object,
+                             struct layout* layout,
+                             unsigned depth);
+
+static void crash_put_array(struct crash_writer* self,
+                            const void* object,
+                            struct layout* element,
+                            const size_t* dims,
+                            size_t dim_count,
+                            unsigned depth)
+{
+    // char[N] is written as a string, up to the first NUL.
+    if (dim_count == 1 && element->kind == LAYOUT_SCALAR && element->size == 1 &&
+        (element->repr == REFLECT_REPR_SCHAR || element->repr == REFLECT_REPR_UCHAR))
+    {
+        crash_put_string(self, object, dims[0], false);
+        return;
+    }
+
+    size_t stride = element->size;
+    for (size_t i = 1; i < dim_count; i++)
+    {
+        stride *= dims[i];
+    }
+
+    crash_puts(self, "[");
+    for (size_t i = 0; i < dims[0]; i++)
+    {
+        const uint8_t* item = (const uint8_t*)object + i * stride;
+        if (dim_count > 1)
+        {
+            crash_put_array(self, item, element, dims + 1, dim_count - 1, depth);
+        }
+        else
+        {
+            crash_put_layout(self, item, element, depth);
+        }
+        crash_puts(self, i + 1 == dims[0] ? "]" : ",");
+    }
+    if (dims[0] == 0)
+    {
+        crash_puts(self, "]");
+    }
+}
+
+// The object is known to be readable. Pointers are followed CRASH_MAX_DEPTH deep, which also ends
+// cycles, and CRASH_MAX_FOLLOWS times in all. Past that, and when their target cannot be read,
+// they are written as addresses.
+static void crash_put_layout(struct crash_writer* self,
+                             const void* object,
+                             struct layout* layout,
+                             unsigned depth)
+{
+    switch (layout->kind)
+    {
+    case LAYOUT_SCALAR:
+        crash_put_scalar(self, object, layout->repr, layout->size);
+        return;
+    case LAYOUT_ENUM:
+        crash_put_enum(self, object, layout->size, layout);
+        return;
+    case LAYOUT_STRING: {
+        const char* s = *(const char* const*)object;
+        if (s == NULL || !crash_readable(self->dump, s, 1))
+        {
+            crash_put_uint(self, (uintptr_t)s);
+            return;
+        }
+
+        crash_put_string(self, s, CRASH_STRING_MAX, true);
+        return;
+    }
+    case LAYOUT_POINTER: {
+        const void* pointer = *(const void* const*)object;
+        struct layout* target = layout_target(layout);
+        if (pointer == NULL || target == NULL || depth >= CRASH_MAX_DEPTH ||
+            self->follows >= CRASH_MAX_FOLLOWS ||
+            !crash_readable(self->dump, pointer, target->size))
+        {
+            crash_put_uint(self, (uintptr_t)pointer);
+            return;
+        }
+
+        self->follows++;
+        crash_put_layout(self, pointer, target, depth + 1);
+        return;
+    }
+    case LAYOUT_STRUCT: {
+        crash_puts(self, "{");
+
+        bool first = true;
+        for (size_t i = 0; i < layout->field_count; i++)
+        {
+            struct layout_field* field = &layout->fields[i];
+            struct layout* type = field_layout(layout, field);
+            if (type == NULL)
+            {
+                continue;
+            }
+
+            // Anonymous members get the name reflect_serialize() writes for them.
+            if (!first)
+            {
+                crash_puts(self, ",");
+            }
+            crash_put_string(self, field->name != NULL ? field->name : "(null)", SIZE_MAX, false);
+            crash_puts(self, ":");
+            first = false;
+
+            if (field->bit_size != 0)
+            {
+                uint64_t value = field_load(field, object);
+                if (type->kind == LAYOUT_ENUM)
+                {
+                    crash_put_enum(self, &value, sizeof(value), type);
+                }
+                else
+                {
+                    crash_put_scalar(self, &value, type->repr, sizeof(value));
+                }
+            }
+            else
+            {
+                crash_put_layout(self, (const uint8_t*)object + field->offset, type, depth);
+            }
+        }
+
+        crash_puts(self, "}");
+        return;
+    }
+    case LAYOUT_ARRAY: {
+        struct layout* element = layout_target(layout);
+        if (element == NULL)
+        {
+            crash_puts(self, "null");
+            return;
+        }
+
+        crash_put_array(self, object, element, layout->dims, layout->dim_count, depth);
+        return;
+    }
+    default:
+        crash_puts(self, "null");
+        return;
+    }
+}
+
+static void crash_dump_free(struct crash_dump* self)
+{
+    free(self->cfas);
+    free(self->locals);
+    free(self->frames);
+    free(self->function_names);
+    free(self->vars);
+    free(self);
+}
+
+static bool crash_push_local(struct crash_dump* self, const struct crash_local* local)
+{
+    if (self->local_count == self->local_capacity)
+    {
+        size_t capacity = self->local_capacity == 0 ? 256 : self->local_capacity * 2;
+        struct crash_local* locals = realloc(self->locals, capacity * sizeof(struct crash_local));
+        if (locals == NULL)
+        {
+            return false;
+        }
+        self->locals = locals;
+        self->local_capacity = capacity;
+    }
+
+    self->locals[self->local_count++] = *local;
+    return true;
+}
+
+static bool crash_push_cfa(struct crash_dump* self, const struct crash_cfa* cfa)
+{
+    if (self->cfa_count == self->cfa_capacity)
+    {
+        size_t capacity = self->cfa_capacity == 0 ? 256 : self->cfa_capacity * 2;
+        struct crash_cfa* cfas = realloc(self->cfas, capacity * sizeof(struct crash_cfa));
+        if (cfas == NULL)
+        {
+            return false;
+        }
+        self->cfas = cfas;
+        self->cfa_capacity = capacity;
+    }
+
+    self->cfas[self->cfa_count++] = *cfa;
+    return true;
+}
+
+// Decodes a location that is a register plus an offset, or the CFA. Returns false for anything
+// else.
+static bool crash_location(const Dwarf_Op* expr, size_t len, struct crash_local* out)
+{
+    if (len != 1)
+    {
+        return false;
+    }
+
+    // libdw sign extends the offsets.
+    const Dwarf_Op* op = &expr[0];
+    if (op->atom >= DW_OP_breg0 && op->atom <= DW_OP_breg31)
+    {
+        out->base = CRASH_BASE_REGISTER;
+        out->reg = op->atom - DW_OP_breg0;
+        out->offset = (int64_t)op->number;
+        return true;
+    }
+    if (op->atom == DW_OP_bregx)
+    {
+        out->base = CRASH_BASE_REGISTER;
+        out->reg = op->number;
+        out->offset = (int64_t)op->number2;
+        return true;
+    }
+    if (op->atom == DW_OP_call_frame_cfa)
+    {
+        out->base = CRASH_BASE_CFA;
+        out->offset = 0;
+        return true;
+    }
+
+    return false;
+}
+
+// Finds a local the way the handler can: at a static address, or at an offset from a register or
+// from the frame base. Location lists and values in registers are left as CRASH_BASE_NONE.
+static void crash_local_locate(Dwarf_Die* die,
+                               const struct crash_local* frame_base,
+                               struct crash_local* out)
+{
+    Dwarf_Addr address;
+    if (die_static_address(die, &address) == 0)
+    {
+        out->base = CRASH_BASE_STATIC;
+        out->offset = address;
+        return;
+    }
+
+    Dwarf_Attribute attr;
+    Dwarf_Op* expr;
+    size_t len;
+    if (dwarf_attr(die, DW_AT_location, &attr) == NULL ||
+        dwarf_getlocation(&attr, &expr, &len) != 0)
+    {
+        return;
+    }
+
+    if (len == 1 && expr[0].atom == DW_OP_fbreg)
+    {
+        if (frame_base->base != CRASH_BASE_NONE)
+        {
+            out->base = frame_base->base;
+            out->reg = frame_base->reg;
+            out->offset = frame_base->offset + (int64_t)expr[0].number;
+        }
+        return;
+    }
+
+    if (!crash_location(expr, len, out) || out->base == CRASH_BASE_CFA)
+    {
+        out->base = CRASH_BASE_NONE;
+    }
+}
+
+// Records the rows of the call frame information for a range whose CFA is a register plus an
+// offset. Returns false if out of memory.
+static bool crash_cfas_prepare(struct crash_dump* self,
+                               const struct addr_range* range,
+                               Dwarf_CFI* eh_frame,
+                               Dwarf_CFI* debug_frame)
+{
+    Dwarf_Addr pc = range->low;
+    while (pc < range->high)
+    {
+        Dwarf_Frame* row = NULL;
+        if ((eh_frame == NULL || dwarf_cfi_addrframe(eh_frame, pc, &row) != 0) &&
+            (debug_frame == NULL || dwarf_cfi_addrframe(debug_frame, pc, &row) != 0))
+        {
+            return true;
+        }
+
+        struct crash_cfa cfa = {0};
+        dwarf_frame_info(row, &cfa.start, &cfa.end, NULL);
+
+        Dwarf_Op* expr;
+        size_t len;
+        struct crash_local rule = {.base = CRASH_BASE_NONE};
+        if (dwarf_frame_cfa(row, &expr, &len) == 0 && crash_location(expr, len, &rule) &&
+            rule.base == CRASH_BASE_REGISTER)
+        {
+            cfa.reg = rule.reg;
+            cfa.offset = rule.offset;
+            if (!crash_push_cfa(self, &cfa))
+            {
+                free(row);
+                return false;
+            }
+        }
+
+        free(row);
+        if (cfa.end <= pc)
+        {
+            return true;
+        }
+        pc = cfa.end;
+    }
+
+    return true;
+}
+
+// Resolves the locals of the function of a range of the address index. Returns 0 or the error
+// code.
+static int crash_frame_prepare(struct crash_dump* self,
+                               size_t index,
+                               Dwarf_CFI* eh_frame,
+                               Dwarf_CFI* debug_frame)
+{
+    struct domain* domain = libreflect_domain;
+    const struct addr_range* range = &self->functions->ranges[index];
+    struct crash_frame* frame = &self->frames[index];
+    frame->first_local = self->local_count;
+    frame->first_cfa = self->cfa_count;
+
+    Dwarf_Die function;
+    if (domain_offdie(domain, range->offset, &function) == NULL)
+    {
+        return 0;
+    }
+
+    struct crash_local frame_base = {.base = CRASH_BASE_NONE};
+    Dwarf_Attribute attr;
+    Dwarf_Op* expr;
+    size_t len;
+    if (dwarf_attr(&function, DW_AT_frame_base, &attr) == NULL ||
+        dwarf_getlocation(&attr, &expr, &len) != 0 || !crash_location(expr, len, &frame_base))
+    {
+        frame_base.base = CRASH_BASE_NONE;
+    }
+
+    // Only the parameters and the variables at the top of the function, those of nested blocks
+    // may not be in scope at the crash.
+    bool uses_cfa = false;
+    Dwarf_Die child;
+    if (dwarf_child(&function, &child) == 0)
+    {
+        do
+        {
+            int tag = dwarf_tag(&child);
+            Dwarf_Die type;
+            const char* name = dwarf_diename(&child);
+            if ((tag != DW_TAG_formal_parameter && tag != DW_TAG_variable) || name == NULL ||
+                die_type(&child, &type) == NULL)
+            {
+                continue;
+            }
+
+            struct crash_local local = {
+                .name = name,
+                .layout = layout_get(domain, domain_dieoffset(domain, &type)),
+                .base = CRASH_BASE_NONE,
+            };
+            if (local.layout == NULL)
+            {
+                continue;
+            }
+
+            layout_warm(local.layout);
+            crash_local_locate(&child, &frame_base, &local);
+            uses_cfa |= local.base == CRASH_BASE_CFA;
+            if (!crash_push_local(self, &local))
+            {
+                return ENOMEM;
+            }
+        } while (dwarf_siblingof(&child, &child) == 0);
+    }
+    frame->local_count = self->local_count - frame->first_local;
+
+    if (uses_cfa && !crash_cfas_prepare(self, range, eh_frame, debug_frame))
+    {
+        return ENOMEM;
+    }
+    frame->cfa_count = self->cfa_count - frame->first_cfa;
+    return 0;
+}
+
+static int crash_frames_prepare(struct crash_dump* self)
+{
+    struct domain* domain = libreflect_domain;
+    self->frames = calloc(self->functions->count + 1, sizeof(struct crash_frame));
+    if (self->frames == NULL)
+    {
+        return ENOMEM;
+    }
+
+    // .eh_frame is the one unwinders use and is kept by strip, .debug_frame is a fallback.
+    Dwarf_CFI* eh_frame = dwarf_getcfi_elf(dwarf_getelf(domain->dwarf));
+    Dwarf_CFI* debug_frame = dwarf_getcfi(domain->dwarf);
+
+    int error = 0;
+    pthread_mutex_lock(&domain->lock);
+    for (size_t i = 0; i < self->functions->count && error == 0; i++)
+    {
+        error = crash_frame_prepare(self, i, eh_frame, debug_frame);
+    }
+    pthread_mutex_unlock(&domain->lock);
+
+    if (eh_frame != NULL)
+    {
+        dwarf_cfi_end(eh_frame);
+    }
+    return error;
+}
+
+// Resolves everything the handler needs. Returns 0 or the error code.
+static int crash_dump_prepare(struct crash_dump* self, const char* const* names)
+{
+    for (size_t i = 0; i < self->count; i++)
+    {
+        struct crash_var* var = &self->vars[i];
+        void* address;
+        int error = var_resolve(names[i], &var->name, &address, &var->layout);
+        if (error != 0)
+        {
+            return error;
+        }
+
+        var->address = address;
+        layout_warm(var->layout);
+    }
+
+    // Naming the crashing function is best effort, programs without DWARF have no index.
+    self->functions = addr_index_get(libreflect_domain, DW_TAG_subprogram);
+    if (self->functions != NULL)
+    {
+        self->function_names = calloc(self->functions->count + 1, sizeof(const char*));
+        if (self->function_names == NULL)
+        {
+            return ENOMEM;
+        }
+
+        for (size_t i = 0; i < self->functions->count; i++)
+        {
+            reflect_obj_t fn = {
+                .domain = libreflect_domain,
+                .offset = self->functions->ranges[i].offset,
+            };
+            self->function_names[i] = get_name(&fn);
+        }
+
+        // Blobs have no locals.
+        int error = DOMAIN_BLOB(libreflect_domain) == NULL ? crash_frames_prepare(self) : 0;
+        if (error != 0)
+        {
+            return error;
+        }
+    }
+
+    self->bias = domain_bias(libreflect_domain);
+    self->page_size = sysconf(_SC_PAGESIZE);
+    return 0;
+}
+
+static uintptr_t crash_context_pc(const void* context)
+{
+    if (context == NULL)
+    {
+        return 0;
+    }
+#if defined(__x86_64__)
+    return ((const ucontext_t*)context)->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+    return ((const ucontext_t*)context)->uc_mcontext.pc;
+#else
+    return 0;
+#endif
+}
+
+// Reads a register by its DWARF number. Returns false if the context does not have it.
+static bool crash_context_register(const void* context, unsigned reg, uintptr_t* out)
+{
+#if defined(__x86_64__)
+    // DWARF numbers them in another order than the general registers of ucontext_t.
+    static const int registers[] = {
+        REG_RAX, REG_RDX, REG_RCX, REG_RBX, REG_RSI, REG_RDI, REG_RBP, REG_RSP, REG_R8,
+        REG_R9,  REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15, REG_RIP,
+    };
+    if (reg >= sizeof(registers) / sizeof(registers[0]))
+    {
+        return false;
+    }
+    *out = ((const ucontext_t*)context)->uc_mcontext.gregs[registers[reg]];
+    return true;
+#elif defined(__aarch64__)
+    const mcontext_t* mcontext = &((const ucontext_t*)context)->uc_mcontext;
+    if (reg > 31)
+    {
+        return false;
+    }
+    *out = reg == 31 ? mcontext->sp : mcontext->regs[reg];
+    return true;
+#else
+    (void)context;
+    (void)reg;
+    (void)out;
+    return false;
+#endif
+}
+
+// Finds the address of a local of the function the crash happened in. Returns false if the
+// registers of the context cannot tell.
+static bool crash_local_address(const struct crash_dump* dump,
+                                const struct crash_frame* frame,
+                                const struct crash_local* local,
+                                const void* context,
+                                uintptr_t pc,
+                                uintptr_t* out)
+{
+    uintptr_t base;
+    switch (local->base)
+    {
+    case CRASH_BASE_STATIC:
+        *out = local->offset + dump->bias;
+        return true;
+    case CRASH_BASE_REGISTER:
+        if (!crash_context_register(context, local->reg, &base))
+        {
+            return false;
+        }
+        break;
+    case CRASH_BASE_CFA: {
+        const struct crash_cfa* cfa = NULL;
+        for (size_t i = frame->first_cfa; i < frame->first_cfa + frame->cfa_count; i++)
+        {
+            if (dump->cfas[i].start <= pc - dump->bias && pc - dump->bias < dump->cfas[i].end)
+            {
+                cfa = &dump->cfas[i];
+                break;
+            }
+        }
+        if (cfa == NULL || !crash_context_register(context, cfa->reg, &base))
+        {
+            return false;
+        }
+        base += cfa->offset;
+        break;
+    }
+    default:
+        return false;
+    }
+
+    *out = base + local->offset;
+    return true;
+}
+
+static void crash_put_locals(struct crash_writer* self,
+                             const struct crash_frame* frame,
+                             const void* context,
+                             uintptr_t pc)
+{
+    const struct crash_dump* dump = self->dump;
+    crash_puts(self, "{");
+    for (size_t i = 0; i < frame->local_count; i++)
+    {
+        const struct crash_local* local = &dump->locals[frame->first_local + i];
+        if (i != 0)
+        {
+            crash_puts(self, ",");
+        }
+        crash_put_string(self, local->name, SIZE_MAX, false);
+        crash_puts(self, ":");
+
+        uintptr_t address;
+        if (crash_local_address(dump, frame, local, context, pc, &address) &&
+            crash_readable(dump, (const void*)address, local->layout->size))
+        {
+            crash_put_layout(self, (const void*)address, local->layout, 0);
+        }
+        else
+        {
+            crash_puts(self, "null");
+        }
+    }
+    crash_puts(self, "}");
+}
+
+void reflect_crash_dump(int signal, uintptr_t address, const void* context)
+{
+    struct crash_dump* dump = __atomic_load_n(&libreflect_crash, __ATOMIC_ACQUIRE);
+    if (dump == NULL)
+    {
+        return;
+    }
+
+    int saved_errno = errno;
+    uintptr_t pc = crash_context_pc(context);
+
+    struct crash_writer writer;
+    writer.dump = dump;
+    writer.follows = 0;
+    writer.used = 0;
+
+    crash_puts(&writer, "{\"signal\":");
+    crash_put_int(&writer, signal);
+    crash_puts(&writer, ",\"address\":");
+    crash_put_uint(&writer, address);
+    crash_puts(&writer, ",\"pc\":");
+    crash_put_uint(&writer, pc);
+    crash_puts(&writer, ",\"function\":");
+
+    const struct addr_range* range =
+        dump->functions == NULL ? NULL : addr_index_find(dump->functions, pc - dump->bias);
+    const char* function =
+        range == NULL ? NULL : dump->function_names[range - dump->functions->ranges];
+    if (function != NULL)
+    {
+        crash_put_string(&writer, function, SIZE_MAX, false);
+    }
+    else
+    {
+        crash_puts(&writer, "null");
+    }
+
+    crash_puts(&writer, ",\"locals\":");
+    if (range != NULL && dump->frames != NULL && context != NULL)
+    {
+        crash_put_locals(&writer, &dump->frames[range - dump->functions->ranges], context, pc);
+    }
+    else
+    {
+        crash_puts(&writer, "null");
+    }
+
+    crash_puts(&writer, ",\"variables\":{");
+    for (size_t i = 0; i < dump->count; i++)
+    {
+        const struct crash_var* var = &dump->vars[i];
+        if (i != 0)
+        {
+            crash_puts(&writer, ",");
+        }
+        crash_put_string(&writer, var->name, SIZE_MAX, false);
+        crash_puts(&writer, ":");
+        if (crash_readable(dump, var->address, var->layout->size))
+        {
+            crash_put_layout(&writer, var->address, var->layout, 0);
+        }
+        else
+        {
+            crash_puts(&writer, "null");
+        }
+    }
+    crash_puts(&writer, "}}\n");
+    crash_flush(&writer);
+
+    errno = saved_errno;
+}
+
+// Installed with SA_RESETHAND, so the signal takes its default action once the handler returns:
+// a fault happens again, and a signal sent by another process is raised again here.
+static void crash_handler(int signal, siginfo_t* info, void* context)
+{
+    // si_addr is only set for faults, signals sent with kill() or raise() have si_code <= 0.
+    bool sent = info->si_code <= 0;
+
+    struct crash_dump* dump = __atomic_load_n(&libreflect_crash, __ATOMIC_ACQUIRE);
+    if (dump != NULL && !__atomic_exchange_n(&dump->dumped, true, __ATOMIC_ACQ_REL))
+    {
+        uintptr_t address = sent ? 0 : (uintptr_t)info->si_addr;
+        reflect_crash_dump(signal, address, context);
+    }
+
+    if (sent)
+    {
+        raise(signal);
+    }
+}
+
+int reflect_crash_start(int fd, const char* const* names, size_t count)
+{
+    if (fd < 0 || (names == NULL && count != 0) || libreflect_domain == NULL)
+    {
+        __libreflect_report_error(EFAULT, __func__);
+        return -1;
+    }
+
+    if (__atomic_load_n(&libreflect_crash, __ATOMIC_ACQUIRE) != NULL)
+    {
+        __libreflect_report_error(EBUSY, __func__);
+        return -1;
+    }
+
+    struct crash_dump* self = calloc(1, sizeof(struct crash_dump));
+    if (self == NULL || (self->vars = calloc(count + 1, sizeof(struct crash_var))) == NULL)
+    {
+        free(self);
+        __libreflect_report_error(ENOMEM, __func__);
+        return -1;
+    }
+
+    self->fd = fd;
+    self->count = count;
+
+    int error = crash_dump_prepare(self, names);
+    if (error != 0)
+    {
+        crash_dump_free(self);
+        __libreflect_report_error(error, __func__);
+        return -1;
+    }
+
+    __atomic_store_n(&libreflect_crash, self, __ATOMIC_RELEASE);
+
+    struct sigaction action = {
+        .sa_sigaction = crash_handler,
+        .sa_flags = SA_SIGINFO | SA_RESETHAND | SA_ONSTACK,
+    };
+    sigemptyset(&action.sa_mask);
+    for (size_t i = 0; i < CRASH_SIGNAL_COUNT; i++)
+    {
+        sigaction(crash_signals[i], &action, &self->previous[i]);
+    }
+
+    return 0;
+}
+
+void reflect_crash_stop(void)
+{
+    struct crash_dump* self = __atomic_load_n(&libreflect_crash, __ATOMIC_ACQUIRE);
+    if (self == NULL)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < CRASH_SIGNAL_COUNT; i++)
+    {
+        sigaction(crash_signals[i], &self->previous[i], NULL);
+    }
+
+    __atomic_store_n(&libreflect_crash, NULL, __ATOMIC_RELEASE);
+    crash_dump_free(self);
+}
+
+/*
+ * Source locations by address
+ *
+ * The line program of a compilation unit is decoded on first use into a compact table of rows
+ * sorted by address. A row covers the addresses up to the next one, unless it ends a sequence.
+ * Tables are kept in a least recently used list under a memory limit and decoded again when they
+ * are needed after being evicted.
+ *
+ * libdw keeps its own copy of every line program it decoded until its handle is closed, so line
+ * programs are decoded with a handle of their own. It is replaced once the tables decoded through
+ * it exceed the limit, and file names are copied into the domain to outlive it.
+ */
+
+struct line_row
+{
+    Dwarf_Addr address;
+    const char* file;
+    uint32_t line;
+    uint16_t column;
+    bool end_sequence;
+};
+
+struct line_table
+{
+    // Neighbours in the list of resident tables, see line_table_get().
+    struct line_table* newer;
+    struct line_table* older;
+    struct line_unit* unit;
+    size_t pins;
+    size_t size;
+
+    size_t count;
+    struct line_row rows[];
+};
+
+// Outlives the line table of its compilation unit, which may be evicted and decoded again.
+struct line_unit
+{
+    struct line_table* table;
+    size_t decodes;
+};
+
+// The most memory resident line tables may use, see reflect_set_line_cache_limit().
+static size_t libreflect_line_cache_limit = SIZE_MAX;
+
+struct line_file
+{
+    // Names with the same hash.
+    struct line_file* next;
+    char name[];
+};
+
+static const char* line_file_intern(struct domain* domain, const char* name)
+{
+    if (name == NULL)
+    {
+        return NULL;
+    }
+
+    size_t length = strlen(name);
+    uint64_t key = hash_bytes(0, (const uint8_t*)name, length) | 1;
+    struct line_file* head = table_get(&domain->lines_files, key);
+    for (struct line_file* file = head; file != NULL; file = file->next)
+    {
+        if (strcmp(file->name, name) == 0)
+        {
+            return file->name;
+        }
+    }
+
+    struct line_file* file =
+        arena_alloc(&domain->arena, sizeof(struct line_file) + length + 1, ARENA_USE_INDEXES);
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    file->next = head;
+    memcpy(file->name, name, length + 1);
+    return table_put(&domain->lines_files, &domain->arena, key, file) ? file->name : NULL;
+}
+
+// Finds a compilation unit through the handle line programs are decoded with, replacing the handle
+// first if what libdw decoded through it exceeds the limit. Units of split files and type units
+// are left to the shared handles.
+static Dwarf_Die* line_unit_die(struct domain* domain, Dwarf_Off cu_offset, Dwarf_Die* die)
+{
+    if (((cu_offset >> DIE_FILE_SHIFT) & DIE_FILE_MASK) != 0 || (cu_offset & DIE_TYPES_SECTION))
+    {
+        return domain_offdie(domain, cu_offset, die);
+    }
+
+    size_t limit = __atomic_load_n(&libreflect_line_cache_limit, __ATOMIC_RELAXED);
+    if (domain->lines_dwarf != NULL && domain->lines_dwarf_size > limit)
+    {
+        dwarf_end(domain->lines_dwarf);
+        domain->lines_dwarf = NULL;
+        domain->lines_dwarf_size = 0;
+    }
+
+    if (domain->lines_dwarf == NULL)
+    {
+        domain->lines_dwarf = dwarf_begin_elf(dwarf_getelf(domain->dwarf), DWARF_C_READ, NULL);
+    }
+
+    if (domain->lines_dwarf == NULL)
+    {
+        return domain_offdie(domain, cu_offset, die);
+    }
+
+    return dwarf_offdie(domain->lines_dwarf, cu_offset & DIE_OFFSET_MASK, die);
+}
+
+static struct line_table* line_table_build(struct domain* domain, Dwarf_Die* cu_die)
+{
+    Dwarf_Lines* lines;
+    size_t count;
+    if (dwarf_getsrclines(cu_die, &lines, &count) != 0)
+    {
+        count = 0;
+    }
+
+    size_t size = sizeof(struct line_table) + count * sizeof(struct line_row);
+    struct line_table* self = malloc(size);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+
+    *self = (struct line_table){.size = size};
+
+    // Rows mostly share the file of the one before.
+    const char* source = NULL;
+    const char* file = NULL;
+
+    // libdw already sorts the rows by address, with the end of a sequence first.
+    for (size_t i = 0; i < count; i++)
+    {
+        Dwarf_Line* line = dwarf_onesrcline(lines, i);
+        struct line_row* row = &self->rows[self->count];
+
+        int line_number = 0;
+        int column = 0;
+        if (line == NULL || dwarf_lineaddr(line, &row->address) != 0)
+        {
+            continue;
+        }
+
+        dwarf_lineno(line, &line_number);
+        dwarf_linecol(line, &column);
+        dwarf_lineendsequence(line, &row->end_sequence);
+        const char* row_source = dwarf_linesrc(line, NULL, NULL);
+        if (row_source != source)
+        {
+            source = row_source;
+            file = line_file_intern(domain, source);
+        }
+        row->file = file;
+        row->line = line_number;
+        row->column = column;
+        self->count++;
+    }
+
+    if (dwarf_cu_getdwarf(cu_die->cu) == domain->lines_dwarf)
+    {
+        domain->lines_dwarf_size += size;
+    }
+
+    return self;
+}
+
+static void line_table_unlink(struct domain* domain, struct line_table* self)
+{
+    *(self->newer == NULL ? &domain->lines_newest : &self->newer->older) = self->older;
+    *(self->older == NULL ? &domain->lines_oldest : &self->older->newer) = self->newer;
+    self->newer = NULL;
+    self->older = NULL;
+}
+
+static void line_table_link(struct domain* domain, struct line_table* self)
+{
+    self->older = domain->lines_newest;
+    *(self->older == NULL ? &domain->lines_oldest : &self->older->newer) = self;
+    domain->lines_newest = self;
+}
+
+// Evicts unpinned tables, least recently used first, until the resident ones fit the limit.
+static void line_tables_evict(struct domain* domain)
+{
+    size_t limit = __atomic_load_n(&libreflect_line_cache_limit, __ATOMIC_RELAXED);
+    struct line_table* table = domain->lines_oldest;
+    while (domain->lines_resident > limit && table != NULL)
+    {
+        struct line_table* newer = table->newer;
+        if (table->pins == 0)
+        {
+            line_table_unlink(domain, table);
+            table->unit->table = NULL;
+            domain->lines_resident -= table->size;
+            domain->lines_count--;
+            domain->lines_evictions++;
+            free(table);
+        }
+        table = newer;
+    }
+}
+
+static void line_tables_free(struct domain* domain)
+{
+    while (domain->lines_oldest != NULL)
+    {
+        struct line_table* table = domain->lines_oldest;
+        line_table_unlink(domain, table);
+        free(table);
+    }
+
+    dwarf_end(domain->lines_dwarf);
+}
+
+// Returns the line table of a compilation unit, decoding it unless it is resident, and pins it
+// until line_table_release(). Pinned tables are never evicted, so the limit may be exceeded while
+// many are in use.
+static struct line_table* line_table_get(struct domain* domain, Dwarf_Off cu_offset)
+{
+    pthread_mutex_lock(&domain->lock);
+
+    struct line_unit* unit = table_get(&domain->lines, cu_offset);
+    if (unit == NULL)
+    {
+        unit = arena_alloc(&domain->arena, sizeof(struct line_unit), ARENA_USE_INDEXES);
+        if (unit != NULL && !table_put(&domain->lines, &domain->arena, cu_offset, unit))
+        {
+            unit = NULL;
+        }
+    }
+
+    struct line_table* self = unit == NULL ? NULL : unit->table;
+    if (self != NULL)
+    {
+        line_table_unlink(domain, self);
+    }
+
+    Dwarf_Die cu_die;
+    if (unit != NULL && self == NULL && line_unit_die(domain, cu_offset, &cu_die) != NULL)
+    {
+        self = line_table_build(domain, &cu_die);
+        if (self != NULL)
+        {
+            self->unit = unit;
+            unit->table = self;
+            domain->lines_redecodes += unit->decodes++ != 0;
+            domain->lines_resident += self->size;
+            domain->lines_count++;
+        }
+    }
+
+    if (self != NULL)
+    {
+        line_table_link(domain, self);
+        self->pins++;
+        line_tables_evict(domain);
+    }
+
+    pthread_mutex_unlock(&domain->lock);
+    return self;
+}
+
+static void line_table_release(struct domain* domain, struct line_table* self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&domain->lock);
+    self->pins--;
+    line_tables_evict(domain);
+    pthread_mutex_unlock(&domain->lock);
+}
+
+void reflect_set_line_cache_limit(size_t limit)
+{
+    __atomic_store_n(&libreflect_line_cache_limit, limit == 0 ? SIZE_MAX : limit, __ATOMIC_RELAXED);
+
+    struct domain* domain = libreflect_domain;
+    if (domain != NULL)
+    {
+        pthread_mutex_lock(&domain->lock);
+        line_tables_evict(domain);
+        pthread_mutex_unlock(&domain->lock);
+    }
+}
+
+// Finds the row covering an address among rows [first, count). The address must not be below the
+// first of them.
+static const struct line_row* line_table_find(const struct line_table* self,
+                                              size_t first,
+                                              Dwarf_Addr address)
+{
+    size_t low = first;
+    size_t high = self->count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (self->rows[middle].address <= address)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    if (low == first || self->rows[low - 1].end_sequence)
+    {
+        return NULL;
+    }
+
+    return &self->rows[low - 1];
+}
+
+static void location_from_row(reflect_location_t* self, const struct line_row* row)
+{
+    self->file = row->file;
+    self->line = row->line;
+    self->column = row->column;
+}
+
+reflect_location_t* reflect_location_by_addr(reflect_location_t* self, uintptr_t address)
+{
+    NOT_NULL(self);
+    NOT_NULL(libreflect_domain);
+
+    return reflect_locations_by_addr(&address, 1, self) == 1 ? self : NULL;
+}
+
+size_t reflect_locations_by_addr(const uintptr_t* addresses, size_t count, reflect_location_t* out)
+{
+    NOT_NULL(addresses);
+    NOT_NULL(out);
+    NOT_NULL(libreflect_domain);
+
+    struct domain* domain = libreflect_domain;
+    struct addr_index* units = addr_index_get(domain, DW_TAG_compile_unit);
+    if (units == NULL)
+    {
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    uintptr_t bias = domain_bias(domain);
+    const struct addr_range* unit = NULL;
+    struct line_table* table = NULL;
+    size_t last = 0;
+    size_t found = 0;
+
+    // Sorted addresses mostly stay within the unit and move forward through its rows, so the
+    // search resumes where the previous one ended.
+    for (size_t i = 0; i < count; i++)
+    {
+        Dwarf_Addr address = addresses[i] - bias;
+        out[i] = (reflect_location_t){0};
+
+        if (unit == NULL || address < unit->low || address >= unit->high)
+        {
+            line_table_release(domain, table);
+            unit = addr_index_find(units, address);
+            table = unit == NULL ? NULL : line_table_get(domain, unit->offset);
+            last = 0;
+        }
+
+        if (table == NULL)
+        {
+            continue;
+        }
+
+        if (last >= table->count || address < table->rows[last].address)
+        {
+            last = 0;
+        }
+
+        const struct line_row* row = line_table_find(table, last, address);
+        if (row != NULL)
+        {
+            location_from_row(&out[i], row);
+            last = (size_t)(row - table->rows);
+            found++;
+        }
+    }
+
+    line_table_release(domain, table);
+    return found;
+}
+
+// The function an inlined or out-of-line instance is a copy of.
+static Dwarf_Die* die_origin(Dwarf_Die* die, Dwarf_Die* out)
+{
+    Dwarf_Attribute attr;
+    *out = *die;
+    while (dwarf_attr(out, DW_AT_abstract_origin, &attr) != NULL)
+    {
+        if (dwarf_formref_die(&attr, out) == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    return out;
+}
+
+// Collects the inlined subroutines containing pc below a function, outermost first.
+static size_t die_inline_chain(Dwarf_Die* function, Dwarf_Addr pc, Dwarf_Die* chain, size_t max)
+{
+    size_t count = 0;
+    Dwarf_Die die = *function;
+    Dwarf_Die child;
+
+    while (count < max && dwarf_child(&die, &child) == 0)
+    {
+        bool found = false;
+        do
+        {
+            int tag = dwarf_tag(&child);
+            if ((tag == DW_TAG_inlined_subroutine || tag == DW_TAG_lexical_block) &&
+                dwarf_haspc(&child, pc) == 1)
+            {
+                found = true;
+                break;
+            }
+        } while (dwarf_siblingof(&child, &child) == 0);
+
+        if (!found)
+        {
+            break;
+        }
+
+        if (dwarf_tag(&child) == DW_TAG_inlined_subroutine)
+        {
+            chain[count++] = child;
+        }
+        die = child;
+    }
+
+    return count;
+}
+
+size_t reflect_frames_by_addr(uintptr_t address, reflect_frame_t* frames, size_t max)
+{
+    NOT_NULL(frames);
+    NOT_NULL(libreflect_domain);
+
+    if (max == 0)
+    {
+        REFLECT_RAISE(EINVAL);
+    }
+
+    struct domain* domain = libreflect_domain;
+    struct addr_index* functions = addr_index_get(domain, DW_TAG_subprogram);
+    if (functions == NULL)
+    {
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    Dwarf_Addr pc = address - domain_bias(domain);
+    const struct addr_range* range = addr_index_find(functions, pc);
+    Dwarf_Die function;
+    Dwarf_Die cu_die;
+    if (range == NULL || domain_offdie(domain, range->offset, &function) == NULL ||
+        dwarf_diecu(&function, &cu_die, NULL, NULL) == NULL)
+    {
+        REFLECT_RAISE(ESRCH);
+    }
+
+    // The innermost location comes from the line table, every other one from the call site of the
+    // frame inside it.
+    reflect_location_t location = {0};
+    reflect_locations_by_addr(&address, 1, &location);
+
+    pthread_mutex_lock(&domain->lock);
+
+    Dwarf_Files* files = NULL;
+    size_t file_count = 0;
+    dwarf_getsrcfiles(&cu_die, &files, &file_count);
+
+    Dwarf_Die* chain = malloc(max * sizeof(Dwarf_Die));
+    size_t inlined = chain == NULL ? 0 : die_inline_chain(&function, pc, chain, max - 1);
+
+    size_t count = 0;
+    for (size_t i = inlined + 1; i-- > 0;)
+    {
+        Dwarf_Die* die = i == 0 ? &function : &chain[i - 1];
+        Dwarf_Die origin;
+
+        reflect_frame_t* frame = &frames[count++];
+        frame->fn._impl.domain = domain;
+        frame->fn._impl.offset =
+            domain_dieoffset(domain, die_origin(die, &origin) != NULL ? &origin : die);
+        frame->location = location;
+
+        if (i == 0)
+        {
+            break;
         }
-        break;
+
+        Dwarf_Word file = 0;
+        Dwarf_Word line = 0;
+        Dwarf_Word column = 0;
+        die_udata(die, DW_AT_call_file, &file);
+        die_udata(die, DW_AT_call_line, &line);
+        die_udata(die, DW_AT_call_column, &column);
+
+        location.file = files != NULL && file < file_count ? dwarf_filesrc(files, file, NULL, NULL)
+                                                            : NULL;
+        location.line = line;
+        location.column = column;
     }
-    default:
-        // TODO
-        break;
+
+    pthread_mutex_unlock(&domain->lock);
+    free(chain);
+    return count;
+}
+
+/*
+ * Pretty printing
+ *
+ * Each use of reflect_pretty_print() has a static reflect_site_t. The first call at a site looks up
+ * the function, the variable and its type by name and publishes the warm layout with a release
+ * store. Later calls only load it and format.
+ */
+
+// The layout and the type name of a site are published by a release store of its generation, and
+// read only after an acquire load of the generation has matched. A layout read that way belongs
+// to the generation that matched or a later one, never to a domain reflect_fini() released.
+static struct layout* site_resolve(reflect_site_t* site,
+                                   const char* func_name,
+                                   const char* var_name)
+{
+    uint64_t generation = __atomic_load_n(&libreflect_generation, __ATOMIC_ACQUIRE);
+    struct layout* layout = NULL;
+    if (__atomic_load_n(&site->_impl.generation, __ATOMIC_ACQUIRE) == generation)
+    {
+        layout = __atomic_load_n(&site->_impl.layout, __ATOMIC_RELAXED);
+    }
+    if (layout != NULL)
+    {
+        return layout;
+    }
+
+    reflect_fn_t fn;
+    reflect_var_t var;
+    reflect_type_t type;
+    if (reflect_fn(&fn, func_name) == NULL || reflect_fn_var_by_name(&fn, var_name, &var) == NULL ||
+        reflect_var_type(&var, &type) == NULL)
+    {
+        return NULL;
+    }
+
+    layout = layout_get(type._impl.domain, type._impl.offset);
+    if (layout == NULL)
+    {
+        REFLECT_RAISE(ENODATA);
     }
+
+    pthread_mutex_lock(&layout->domain->lock);
+    layout_warm(layout);
+    pthread_mutex_unlock(&layout->domain->lock);
+
+    // Racing threads store the same values.
+    __atomic_store_n(&site->_impl.type_name, reflect_type_name(&type), __ATOMIC_RELAXED);
+    __atomic_store_n(&site->_impl.layout, layout, __ATOMIC_RELAXED);
+    __atomic_store_n(&site->_impl.generation, generation, __ATOMIC_RELEASE);
+    return layout;
 }
 
-static void xml_begin_member(const char* name, FILE* output)
+void _reflect_pretty_print(reflect_site_t* site,
+                           const void* object,
+                           const char* func_name,
+                           const char* var_name,
+                           const reflect_serializer_t* serializer,
+                           FILE* output)
 {
-    fprintf(output, "<%s>", name);
+    struct layout* layout = site_resolve(site, func_name, var_name);
+    if (layout == NULL)
+    {
+        return;
+    }
+
+    // Only C output gets a declaration around the value, other formats must stay parseable.
+    if (serializer == REFLECT_SERIALIZER_C)
+    {
+        fprintf(output, "%s %s = ", site->_impl.type_name, var_name);
+    }
+
+    serialize_layout(serializer_resolve(serializer), (void*)object, layout, output);
+    fputc('\n', output);
 }
 
-static void xml_end_member(const char* name, FILE* output, bool is_last_member)
+/*
+ * Writing compact descriptors
+ *
+ * The writer numbers the layouts of the selected types, and of every type they refer to, in the
+ * order it finds them, then writes them out in the format described under "Compact descriptors".
+ * Strings are interned by address, which is enough to share the names libdw reads from .debug_str.
+ */
+
+struct blob_vector
 {
-    fprintf(output, "</%s>", name);
-    (void)is_last_member;
+    void* items;
+    size_t count;
+    size_t capacity;
+};
+
+struct blob_entry
+{
+    const char* name;
+    uint64_t id;
+};
+
+struct blob_writer
+{
+    struct domain* domain;
+    bool all;
+    int error;
+
+    // Scratch memory for the tables.
+    struct arena arena;
+
+    // Type ids by layout address, and the layouts in id order.
+    struct table ids;
+    struct blob_vector types;
+
+    struct blob_vector names;
+    struct blob_vector variables;
+    struct blob_vector functions;
+
+    // String table offsets plus one by string address.
+    struct table strings;
+    FILE* string_table;
+    char* string_data;
+    size_t string_data_size;
+    size_t string_size;
+};
+
+static void* blob_push(struct blob_writer* self, struct blob_vector* vector, size_t size)
+{
+    if (vector->count == vector->capacity)
+    {
+        size_t capacity = vector->capacity == 0 ? 64 : vector->capacity * 2;
+        void* items = realloc(vector->items, capacity * size);
+        if (items == NULL)
+        {
+            self->error = ENOMEM;
+            return NULL;
+        }
+        vector->items = items;
+        vector->capacity = capacity;
+    }
+
+    return (uint8_t*)vector->items + vector->count++ * size;
 }
 
-static void xml_begin_struct(const char* name, FILE* output)
+static uint32_t blob_intern(struct blob_writer* self, const char* string)
 {
-    (void)name;
-    (void)output;
+    if (string == NULL)
+    {
+        return BLOB_NO_NAME;
+    }
+
+    uintptr_t offset = (uintptr_t)table_get(&self->strings, (uintptr_t)string);
+    if (offset != 0)
+    {
+        return offset - 1;
+    }
+
+    offset = self->string_size;
+    size_t size = strlen(string) + 1;
+    if (fwrite(string, 1, size, self->string_table) != size ||
+        !table_put(&self->strings, &self->arena, (uintptr_t)string, (void*)(offset + 1)))
+    {
+        self->error = ENOMEM;
+        return BLOB_NO_NAME;
+    }
+
+    self->string_size += size;
+    return offset;
 }
 
-static void xml_end_struct(const char* name, FILE* output)
+// Returns the id of a layout, numbering it if it is new. 0 for NULL.
+static uint32_t blob_type_id(struct blob_writer* self, struct layout* layout)
 {
-    (void)name;
-    (void)output;
+    if (layout == NULL)
+    {
+        return 0;
+    }
+
+    uintptr_t id = (uintptr_t)table_get(&self->ids, (uintptr_t)layout);
+    if (id != 0)
+    {
+        return id;
+    }
+
+    struct layout** slot = blob_push(self, &self->types, sizeof(struct layout*));
+    if (slot == NULL)
+    {
+        return 0;
+    }
+
+    *slot = layout;
+    id = self->types.count;
+    if (!table_put(&self->ids, &self->arena, (uintptr_t)layout, (void*)id))
+    {
+        self->error = ENOMEM;
+        return 0;
+    }
+
+    return id;
 }
 
-static void c_begin_member(const char* name, FILE* output)
+static void blob_add_name(struct blob_writer* self, const char* name, uint64_t id)
 {
-    fprintf(output, ".%s = ", name);
+    struct blob_entry* entry = blob_push(self, &self->names, sizeof(struct blob_entry));
+    if (entry != NULL)
+    {
+        *entry = (struct blob_entry){name, id};
+        blob_intern(self, name);
+    }
 }
 
-static void c_end_member(const char* name, FILE* output, bool is_last_member)
+// Numbers every type reachable from the ones numbered so far and interns their strings, so that
+// writing them adds nothing.
+static void blob_close_types(struct blob_writer* self)
 {
-    fprintf(output, ",\n");
-    (void)name;
-    (void)is_last_member;
+    for (size_t i = 0; i < self->types.count; i++)
+    {
+        struct layout* layout = ((struct layout**)self->types.items)[i];
+
+        blob_intern(self, layout->name);
+        blob_type_id(self, layout_target(layout));
+
+        for (size_t j = 0; j < layout->field_count; j++)
+        {
+            blob_intern(self, layout->fields[j].name);
+            blob_type_id(self, field_layout(layout, &layout->fields[j]));
+        }
+
+        for (size_t j = 0; j < layout->enumerator_count; j++)
+        {
+            blob_intern(self, layout->enumerators[j].name);
+        }
+    }
 }
 
-static void c_begin_struct(const char* name, FILE* output)
+static void blob_collect_die(struct blob_writer* self, Dwarf_Die* die)
 {
-    fprintf(output, "{\n");
-    (void)name;
+    const char* name = dwarf_diename(die);
+    int tag = dwarf_tag(die);
+    if (name == NULL || dwarf_hasattr(die, DW_AT_declaration))
+    {
+        return;
+    }
+
+    if (self->all && (tag == DW_TAG_typedef || die_is_type(die)))
+    {
+        uint32_t id =
+            blob_type_id(self, layout_get(self->domain, domain_dieoffset(self->domain, die)));
+        if (id != 0)
+        {
+            blob_add_name(self, name, id);
+        }
+    }
+    else if (tag == DW_TAG_variable)
+    {
+        // With a list of types, only variables of the listed types are described.
+        Dwarf_Addr address;
+        Dwarf_Die type;
+        struct layout* layout;
+        if (die_static_address(die, &address) != 0 || die_type(die, &type) == NULL ||
+            (layout = layout_get(self->domain, domain_dieoffset(self->domain, &type))) == NULL)
+        {
+            return;
+        }
+
+        uint32_t id = self->all ? blob_type_id(self, layout)
+                                : (uintptr_t)table_get(&self->ids, (uintptr_t)layout);
+        struct blob_variable* variable =
+            id == 0 ? NULL : blob_push(self, &self->variables, sizeof(struct blob_variable));
+        if (variable != NULL)
+        {
+            *variable = (struct blob_variable){blob_intern(self, name), id, address, layout->size};
+            blob_add_name(self, name, BLOB_ID(BLOB_VARIABLE, self->variables.count));
+        }
+    }
+    else if (tag == DW_TAG_subprogram)
+    {
+        Dwarf_Addr base;
+        Dwarf_Addr start;
+        Dwarf_Addr end;
+        ptrdiff_t offset = 0;
+        bool named = false;
+        while ((offset = dwarf_ranges(die, offset, &base, &start, &end)) > 0)
+        {
+            struct blob_function* function =
+                start < end ? blob_push(self, &self->functions, sizeof(struct blob_function))
+                            : NULL;
+            if (function == NULL)
+            {
+                continue;
+            }
+
+            *function = (struct blob_function){blob_intern(self, name), 0, start, end};
+            if (!named)
+            {
+                blob_add_name(self, name, BLOB_ID(BLOB_FUNCTION, self->functions.count));
+                named = true;
+            }
+        }
+    }
 }
 
-static void c_end_struct(const char* name, FILE* output)
+static int blob_entry_compare(const void* a, const void* b)
 {
-    fprintf(output, "}");
-    (void)name;
+    const struct blob_entry* x = a;
+    const struct blob_entry* y = b;
+
+    int order = strcmp(x->name, y->name);
+    if (order != 0)
+    {
+        return order;
+    }
+
+    return x->id < y->id ? -1 : x->id > y->id;
 }
 
-static const reflect_serializer_t libreflect_serializer_json = {
-    .serialize = json_serialize,
-    .begin_member = json_begin_member,
-    .end_member = json_end_member,
-    .begin_struct = json_begin_struct,
-    .end_struct = json_end_struct,
-};
+static bool blob_collect(struct blob_writer* self, const char** types, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        reflect_type_t type;
+        if (reflect_type(&type, types[i]) == NULL)
+        {
+            self->error = ESRCH;
+            return false;
+        }
 
-static const reflect_serializer_t libreflect_serializer_xml = {
-    .serialize = xml_serialize,
-    .begin_member = xml_begin_member,
-    .end_member = xml_end_member,
-    .begin_struct = xml_begin_struct,
-    .end_struct = xml_end_struct,
-};
+        uint32_t id = blob_type_id(self, layout_get(self->domain, type._impl.offset));
+        if (id != 0)
+        {
+            blob_add_name(self, types[i], id);
+        }
+    }
 
-static const reflect_serializer_t libreflect_serializer_c = {
-    .serialize = json_serialize,
-    .begin_member = c_begin_member,
-    .end_member = c_end_member,
-    .begin_struct = c_begin_struct,
-    .end_struct = c_end_struct,
-};
+    blob_close_types(self);
 
-FILE* reflect_serialize(const reflect_serializer_t* self,
-                        void* object,
-                        reflect_type_t* type,
-                        FILE* output)
+    Dwarf_Die cu_die;
+    Dwarf_CU* cu = NULL;
+    while (self->error == 0 && unit_next(self->domain, &cu, &cu_die) == 0)
+    {
+        Dwarf_Die die;
+        if (dwarf_child(&cu_die, &die) != 0)
+        {
+            continue;
+        }
+
+        do
+        {
+            blob_collect_die(self, &die);
+        } while (dwarf_siblingof(&die, &die) == 0);
+    }
+
+    blob_close_types(self);
+
+    // The same name may have been found in several compilation units.
+    struct blob_entry* names = self->names.items;
+    if (self->names.count != 0)
+    {
+        qsort(names, self->names.count, sizeof(struct blob_entry), blob_entry_compare);
+    }
+
+    size_t unique = 0;
+    for (size_t i = 0; i < self->names.count; i++)
+    {
+        if (unique == 0 || blob_entry_compare(&names[unique - 1], &names[i]) != 0)
+        {
+            names[unique++] = names[i];
+        }
+    }
+    self->names.count = unique;
+
+    return self->error == 0;
+}
+
+static size_t blob_type_size(const struct layout* layout)
 {
-    NOT_NULL(self);
-    NOT_NULL(object);
-    NOT_NULL(type);
-    NOT_NULL(output);
+    switch (layout->kind)
+    {
+    case LAYOUT_STRUCT:
+        return sizeof(struct blob_type) + layout->field_count * sizeof(struct blob_field);
+    case LAYOUT_ENUM:
+        return sizeof(struct blob_type) +
+               layout->enumerator_count * sizeof(struct blob_enumerator);
+    case LAYOUT_ARRAY:
+        return sizeof(struct blob_type) + layout->dim_count * sizeof(uint64_t);
+    default:
+        return sizeof(struct blob_type);
+    }
+}
 
-    switch ((uintptr_t)self)
+static void blob_write_type(struct blob_writer* self, struct layout* layout, FILE* output)
+{
+    Dwarf_Die die;
+    struct blob_type type = {
+        .name = blob_intern(self, layout->name),
+        .kind = layout->kind,
+        .repr = layout->repr,
+        .tag = domain_offdie(self->domain, layout->offset, &die) ? dwarf_tag(&die) : 0,
+        .target = blob_type_id(self, layout_target(layout)),
+        .size = layout->size,
+    };
+
+    switch (layout->kind)
     {
-    case 1:
-        self = &libreflect_serializer_json;
+    case LAYOUT_STRUCT:
+        type.count = layout->field_count;
         break;
-    case 2:
-        self = &libreflect_serializer_xml;
+    case LAYOUT_ENUM:
+        type.count = layout->enumerator_count;
         break;
-    case 3:
-        self = &libreflect_serializer_c;
+    case LAYOUT_ARRAY:
+        type.count = layout->dim_count;
         break;
     default:
         break;
     }
 
-    return reflect_serialize_inner(self, object, type, output);
+    fwrite(&type, sizeof(type), 1, output);
+
+    for (size_t i = 0; layout->kind == LAYOUT_STRUCT && i < layout->field_count; i++)
+    {
+        struct layout_field* field = &layout->fields[i];
+        struct blob_field record = {
+            .name = blob_intern(self, field->name),
+            .type = blob_type_id(self, field_layout(layout, field)),
+            .offset = field->offset,
+            .mask = field->mask,
+            .bit_size = field->bit_size,
+            .load_size = field->load_size,
+            .shift = field->shift,
+            .sign_shift = field->sign_shift,
+        };
+        fwrite(&record, sizeof(record), 1, output);
+    }
+
+    for (size_t i = 0; layout->kind == LAYOUT_ENUM && i < layout->enumerator_count; i++)
+    {
+        struct blob_enumerator record = {
+            .name = blob_intern(self, layout->enumerators[i].name),
+            .value = layout->enumerators[i].value,
+        };
+        fwrite(&record, sizeof(record), 1, output);
+    }
+
+    for (size_t i = 0; layout->kind == LAYOUT_ARRAY && i < layout->dim_count; i++)
+    {
+        uint64_t dim = layout->dims[i];
+        fwrite(&dim, sizeof(dim), 1, output);
+    }
+}
+
+static size_t blob_write(struct blob_writer* self, FILE* output)
+{
+    struct layout** types = self->types.items;
+    struct blob_entry* names = self->names.items;
+
+    struct blob_header header = {
+        .type_count = self->types.count,
+        .name_count = self->names.count,
+        .variable_count = self->variables.count,
+        .function_count = self->functions.count,
+    };
+    memcpy(header.magic, BLOB_MAGIC, sizeof(header.magic));
+
+    uint64_t offset = sizeof(header);
+    header.types = offset;
+    offset += align_up(self->types.count * sizeof(uint32_t), 8);
+
+    uint64_t records = offset;
+    for (size_t i = 0; i < self->types.count; i++)
+    {
+        offset += blob_type_size(types[i]);
+    }
+
+    header.names = offset;
+    offset += self->names.count * sizeof(struct blob_name);
+    header.variables = offset;
+    offset += self->variables.count * sizeof(struct blob_variable);
+    header.functions = offset;
+    offset += self->functions.count * sizeof(struct blob_function);
+    header.strings = offset;
+    header.strings_size = self->string_size;
+    offset += self->string_size;
+
+    // Offsets in the blob are 32 bits wide.
+    if (offset > UINT32_MAX)
+    {
+        self->error = EFBIG;
+        return 0;
+    }
+
+    if (fflush(self->string_table) != 0)
+    {
+        self->error = ENOMEM;
+        return 0;
+    }
+
+    fwrite(&header, sizeof(header), 1, output);
+
+    for (size_t i = 0; i < self->types.count; i++)
+    {
+        uint32_t record = records;
+        fwrite(&record, sizeof(record), 1, output);
+        records += blob_type_size(types[i]);
+    }
+
+    static const uint8_t padding[8];
+    fwrite(padding,
+           1,
+           align_up(self->types.count * sizeof(uint32_t), 8) - self->types.count * sizeof(uint32_t),
+           output);
+
+    for (size_t i = 0; i < self->types.count; i++)
+    {
+        blob_write_type(self, types[i], output);
+    }
+
+    for (size_t i = 0; i < self->names.count; i++)
+    {
+        struct blob_name record = {blob_intern(self, names[i].name), 0, names[i].id};
+        fwrite(&record, sizeof(record), 1, output);
+    }
+
+    fwrite(self->variables.items, sizeof(struct blob_variable), self->variables.count, output);
+    fwrite(self->functions.items, sizeof(struct blob_function), self->functions.count, output);
+    fwrite(self->string_data, 1, self->string_size, output);
+
+    if (ferror(output))
+    {
+        self->error = EIO;
+        return 0;
+    }
+
+    return offset;
 }
 
-void _reflect_pretty_print(const void* object, const char* func_name, const char* var_name)
+size_t reflect_write_descriptors(FILE* output, const char** types, size_t count)
 {
-    reflect_fn_t* fn = reflect_fn(&(reflect_fn_t){}, func_name);
-    reflect_var_t* var = reflect_fn_var_by_name(fn, var_name, &(reflect_var_t){});
-    reflect_type_t* type = reflect_var_type(var, &(reflect_type_t){});
-    fprintf(stdout, "%s %s = ", reflect_type_name(type), reflect_var_name(var));
-    reflect_serialize(REFLECT_SERIALIZER_C, (void*)object, type, stdout);
-    fputc('\n', stdout);
+    NOT_NULL(output);
+    NOT_NULL(libreflect_domain);
+
+    struct domain* domain = libreflect_domain;
+    if (domain->dwarf == NULL)
+    {
+        REFLECT_RAISE(EMEDIUMTYPE);
+    }
+
+    struct blob_writer writer = {
+        .domain = domain,
+        .all = types == NULL,
+        .arena = {.allocator = libreflect_allocator},
+    };
+
+    writer.string_table = open_memstream(&writer.string_data, &writer.string_data_size);
+    if (writer.string_table == NULL)
+    {
+        REFLECT_RAISE(ENOMEM);
+    }
+
+    // Collecting resolves layouts and both steps read DWARF.
+    pthread_mutex_lock(&domain->lock);
+    size_t size = blob_collect(&writer, types, count) ? blob_write(&writer, output) : 0;
+    pthread_mutex_unlock(&domain->lock);
+
+    fclose(writer.string_table);
+    free(writer.string_data);
+    free(writer.types.items);
+    free(writer.names.items);
+    free(writer.variables.items);
+    free(writer.functions.items);
+    arena_free(&writer.arena);
+
+    if (size == 0)
+    {
+        REFLECT_RAISE(writer.error);
+    }
+
+    return size;
 }
@@ -31,6 +31,8 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 // TODO: Document
 typedef struct reflect_type reflect_type_t;
@@ -41,7 +43,27 @@ typedef struct reflect_const reflect_const_t;
 typedef struct reflect_obj reflect_obj_t;
 typedef struct reflect_location reflect_location_t;
 typedef struct reflect_serializer reflect_serializer_t;
+typedef struct reflect_iovec reflect_iovec_t;
+typedef struct reflect_allocator reflect_allocator_t;
+typedef struct reflect_memory_usage reflect_memory_usage_t;
+typedef struct reflect_arena reflect_arena_t;
+typedef struct reflect_records reflect_records_t;
+typedef struct reflect_view reflect_view_t;
+typedef struct reflect_view_member reflect_view_member_t;
+typedef struct reflect_layout_member reflect_layout_member_t;
+typedef struct reflect_layout_report reflect_layout_report_t;
+typedef struct reflect_footprint_entry reflect_footprint_entry_t;
+typedef struct reflect_footprint reflect_footprint_t;
+typedef struct reflect_site reflect_site_t;
+typedef struct reflect_frame reflect_frame_t;
 typedef enum reflect_repr reflect_repr_t;
+typedef enum reflect_columns_format reflect_columns_format_t;
+typedef enum reflect_size_mode reflect_size_mode_t;
+typedef enum reflect_log_policy reflect_log_policy_t;
+typedef struct reflect_log_options reflect_log_options_t;
+typedef struct reflect_log_stats reflect_log_stats_t;
+typedef struct reflect_metrics_options reflect_metrics_options_t;
+typedef struct reflect_metrics_stats reflect_metrics_stats_t;
 
 struct reflect_location
 {
@@ -65,6 +87,41 @@ enum reflect_repr
     REFLECT_REPR_UCHAR,
     REFLECT_REPR_SCHAR,
     REFLECT_REPR_STRING,
+
+    // The name of an enumerator, passed to reflect_serializer_t::serialize as a const char**.
+    REFLECT_REPR_ENUMERATOR,
+};
+
+enum reflect_columns_format
+{
+    // A header, then each column as a contiguous array in native byte order. The header is the
+    // magic "RCOLUMN1", the row count (uint64_t), the column count and the header size (uint32_t
+    // each), then for each column: the file offset of its data (uint64_t, a multiple of 8), the
+    // length of its name (uint32_t), its reflect_repr_t, the size of a value and flags (1 for
+    // enums, 2 for bitfields widened to 64 bits) as bytes, a zero byte, and the name.
+    REFLECT_COLUMNS_BINARY,
+
+    // A header line with the column names, then one line per row. Enumerators are written by name.
+    REFLECT_COLUMNS_CSV,
+};
+
+enum reflect_size_mode
+{
+    // The exact number of bytes the serializer writes.
+    REFLECT_SIZE_EXACT,
+
+    // An upper bound, computed without formatting values. Only strings and the targets of pointers
+    // are read, so it is cheapest for types without them.
+    REFLECT_SIZE_BOUND,
+};
+
+enum reflect_log_policy
+{
+    // reflect_log drops the entry when the ring of the calling thread is full.
+    REFLECT_LOG_DROP,
+
+    // reflect_log waits for the background thread to make room.
+    REFLECT_LOG_BLOCK,
 };
 
 struct reflect_serializer
@@ -74,12 +131,187 @@ struct reflect_serializer
     void (*end_member)(const char*, FILE*, bool is_last_member);
     void (*begin_struct)(const char*, FILE*);
     void (*end_struct)(const char*, FILE*);
+
+    // Optional. Without them arrays are written as structs with one member per element, named
+    // after its index.
+    void (*begin_array)(const char*, FILE*);
+    void (*begin_element)(size_t index, FILE*);
+    void (*end_element)(size_t index, FILE*, bool is_last_element);
+    void (*end_array)(const char*, FILE*);
+};
+
+struct reflect_layout_member
+{
+    const char* name;
+
+    // Bytes from the start of the struct. For bitfields, of the first byte the bits touch.
+    size_t offset;
+    size_t size;
+    size_t alignment;
+
+    // Bitfields only, the position of the first bit within the byte at offset and the width.
+    size_t bit_offset;
+    size_t bit_size;
+
+    // Padding bytes between this member and the next one.
+    size_t hole;
+
+    // Assuming the struct starts at a cache line boundary.
+    bool straddles_cache_line;
+
+    // Atomics and locks, and whether another member shares one of their cache lines.
+    bool is_sync;
+    bool false_sharing;
+};
+
+struct reflect_layout_report
+{
+    const char* name;
+    size_t size;
+    size_t alignment;
+    size_t cache_lines;
+
+    size_t member_count;
+    reflect_layout_member_t* members;
+
+    // Holes between members, their total size and the padding at the end.
+    size_t holes;
+    size_t padding;
+    size_t tail_padding;
+    size_t wasted;
+
+    // The number of members straddling cache lines and of members at risk of false sharing.
+    size_t straddles;
+    size_t false_sharing;
+
+    // Member indexes in an order that packs the struct into optimal_size bytes. Declaration order
+    // when no order is smaller.
+    size_t optimal_size;
+    size_t* suggested_order;
+};
+
+struct reflect_footprint_entry
+{
+    // The type, "string" for strings and NULL for anonymous types.
+    const char* name;
+    size_t objects;
+    size_t bytes;
+};
+
+struct reflect_footprint
+{
+    size_t objects;
+    size_t bytes;
+
+    // One entry per type, the most bytes first.
+    size_t entry_count;
+    reflect_footprint_entry_t* entries;
 };
 
+struct reflect_log_options
+{
+    // The size of the ring of each logging thread in bytes, rounded up to a power of two. 0 for
+    // 1 MiB.
+    size_t ring_size;
+    reflect_log_policy_t policy;
+};
+
+struct reflect_log_stats
+{
+    // Entries captured, formatted, dropped because a ring was full and rejected for being larger
+    // than half a ring.
+    size_t logged;
+    size_t written;
+    size_t dropped;
+    size_t oversized;
+
+    // Calls to reflect_log that had to wait for room, with REFLECT_LOG_BLOCK.
+    size_t blocked;
+
+    // Rings in use, one per thread that logged and has not exited.
+    size_t rings;
+};
+
+struct reflect_metrics_options
+{
+    // The time between samples in nanoseconds, 0 for one second.
+    uint64_t interval_ns;
+};
+
+struct reflect_metrics_stats
+{
+    // Samples written, and how long reading the variables took for the last one, without
+    // formatting.
+    size_t samples;
+    uint64_t read_ns;
+};
+
+struct reflect_allocator
+{
+    // Returns size bytes of page aligned memory or NULL. Requests are large (64KiB and up).
+    void* (*allocate)(size_t size, void* context);
+    void (*release)(void* memory, size_t size, void* context);
+    void* context;
+};
+
+struct reflect_memory_usage
+{
+    // Bytes obtained from the allocator and the number of chunks they came in.
+    size_t reserved;
+    size_t chunks;
+
+    // Bytes in use, in total and for type layouts and lookup indexes.
+    size_t used;
+    size_t layouts;
+    size_t indexes;
+
+    // The number of distinct types with a cached layout.
+    size_t layout_count;
+
+    // Decoded line tables: bytes and compilation units resident, evictions to stay under the line
+    // cache limit and decodes of units that had been evicted.
+    size_t lines;
+    size_t line_units;
+    size_t line_evictions;
+    size_t line_redecodes;
+};
+
+/**
+ * Sets the allocator used for library-owned metadata.
+ *
+ * Metadata is carved out of large chunks obtained from the allocator and is only released as a
+ * whole by reflect_fini. This should be called before reflect_init; domains keep the allocator
+ * they were created with.
+ *
+ * @param allocator The allocator to use, NULL for the default (mmap).
+ */
+void reflect_set_allocator(const reflect_allocator_t* allocator);
+
+/**
+ * Limits the memory used by decoded line tables.
+ *
+ * Line tables are decoded per compilation unit on first use. Beyond the limit, the least recently
+ * used ones are released and decoded again when needed, so memory tracks the units in use rather
+ * than the size of the program. Takes effect immediately. libdw keeps its own copy of what it
+ * decoded, which is dropped once the tables decoded since the last drop exceed the limit, so both
+ * together stay within about twice the limit.
+ *
+ * Only line tables are limited. Layouts, the results of lookups by name, the address indexes and
+ * the split DWARF files opened so far stay until reflect_fini, see reflect_memory_usage.
+ *
+ * @param limit The limit in bytes, 0 for none (the default).
+ */
+void reflect_set_line_cache_limit(size_t limit);
+
 /**
  * Initializes the library.
  *
- * This should be called before using any of the other reflect_* routines.
+ * This should be called before using any of the other reflect_* routines. Programs without DWARF
+ * are described by the .reflect section written by reflect_write_descriptors, if they have one.
+ *
+ * Programs built with -gsplit-dwarf are supported: each .dwo file is opened when first needed, and
+ * lookups by name only open the files the .debug_gnu_pubnames and .debug_gnu_pubtypes sections
+ * list for the name.
  *
  * @param argc The argc parameter from main.
  * @param argv The argv parameter from main.
@@ -92,6 +324,58 @@ int reflect_init(int argc, const char* argv[]);
  */
 void reflect_fini();
 
+/**
+ * Reports how much memory the library uses for metadata.
+ *
+ * @param self Pointer to the reflect_memory_usage_t object to fill.
+ * @return NULL on error, otherwise self.
+ */
+reflect_memory_usage_t* reflect_memory_usage(reflect_memory_usage_t* self);
+
+/**
+ * Creates an arena for caller data such as the result of reflect_clone.
+ *
+ * Memory is bump-allocated from large chunks and only released as a whole, by reflect_arena_reset
+ * or reflect_arena_free. The arena itself lives in its first chunk, so creating one allocates
+ * nothing else. Arenas are not thread safe.
+ *
+ * @param allocator The allocator to get chunks from, NULL for the one set with
+ * reflect_set_allocator.
+ * @return The arena or NULL on error.
+ */
+reflect_arena_t* reflect_arena_create(const reflect_allocator_t* allocator);
+
+/**
+ * Allocates memory from an arena. The memory is aligned to 16 bytes and not initialized.
+ *
+ * @param self The arena.
+ * @param size The number of bytes to allocate.
+ * @return The memory or NULL on error.
+ */
+void* reflect_arena_alloc(reflect_arena_t* self, size_t size);
+
+/**
+ * Returns the number of bytes allocated from an arena, including alignment.
+ *
+ * @param self The arena.
+ * @return The number of bytes.
+ */
+size_t reflect_arena_used(const reflect_arena_t* self);
+
+/**
+ * Releases everything allocated from an arena but keeps its first chunk for reuse.
+ *
+ * @param self The arena.
+ */
+void reflect_arena_reset(reflect_arena_t* self);
+
+/**
+ * Releases an arena and everything allocated from it.
+ *
+ * @param self The arena.
+ */
+void reflect_arena_free(reflect_arena_t* self);
+
 /**
  * Initializes a reflect_type_t object with information about a type.
  *
@@ -101,6 +385,16 @@ void reflect_fini();
  */
 reflect_type_t* reflect_type(reflect_type_t* self, const char* name);
 
+/**
+ * Like reflect_type, but reports nothing on error. Lookups are cached, names that do not exist
+ * included, so probing for the same optional name repeatedly is cheap.
+ *
+ * @param self Pointer to the reflect_type_t object to initialize.
+ * @param name The name of the type.
+ * @return 0 on success, otherwise an error code: ESRCH if there is no such type.
+ */
+int reflect_try_type(reflect_type_t* self, const char* name);
+
 /**
  * Initializes a reflect_type_t object with information about the underlying type of the typedef
  * represented by another reflect_type_t object.
@@ -151,6 +445,69 @@ reflect_member_t* reflect_type_member_by_name(reflect_type_t* self,
                                               const char* name,
                                               reflect_member_t* out);
 
+/**
+ * Returns the number of constants (enumerators) of an enum type.
+ *
+ * @param self The enum type.
+ * @return The number of constants.
+ */
+size_t reflect_type_const_count(reflect_type_t* self);
+
+/**
+ * Initializes a reflect_const_t object with information about a constant of an enum type, in
+ * declaration order.
+ *
+ * @param self The enum type.
+ * @param index The index of the constant.
+ * @param out Pointer to the reflect_const_t object to initialize.
+ * @return NULL on error, otherwise out.
+ */
+reflect_const_t* reflect_type_const_by_index(reflect_type_t* self,
+                                             size_t index,
+                                             reflect_const_t* out);
+
+/**
+ * Initializes a reflect_const_t object with information about the constant of an enum type with
+ * the given name.
+ *
+ * @param self The enum type.
+ * @param name The name of the constant.
+ * @param out Pointer to the reflect_const_t object to initialize.
+ * @return NULL on error, otherwise out.
+ */
+reflect_const_t* reflect_type_const_by_name(reflect_type_t* self,
+                                            const char* name,
+                                            reflect_const_t* out);
+
+/**
+ * Initializes a reflect_const_t object with information about the constant of an enum type with
+ * the given value. If several constants share the value the first declared one is used.
+ *
+ * @param self The enum type.
+ * @param value The value of the constant.
+ * @param out Pointer to the reflect_const_t object to initialize.
+ * @return NULL on error, otherwise out.
+ */
+reflect_const_t* reflect_type_const_by_value(reflect_type_t* self,
+                                             long value,
+                                             reflect_const_t* out);
+
+/**
+ * Returns the name of a constant.
+ *
+ * @param self The constant.
+ * @return The constant's name.
+ */
+const char* reflect_const_name(reflect_const_t* self);
+
+/**
+ * Returns the value of a constant.
+ *
+ * @param self The constant.
+ * @return The constant's value.
+ */
+long reflect_const_value(reflect_const_t* self);
+
 /**
  * Initializes a reflect_type_t object with information about the type of a member.
  *
@@ -171,11 +528,40 @@ const char* reflect_member_name(reflect_member_t* self);
 /**
  * Returns the offset of a member from the beginning of its parent object.
  *
+ * For bitfields this is the offset of the byte containing the least significant bit of the member.
+ *
  * @param self The member.
  * @return The offset or -1 on error.
  */
 ptrdiff_t reflect_member_offset(reflect_member_t* self);
 
+/**
+ * Returns the offset of a member from the beginning of its parent object in bits.
+ *
+ * For bitfields this is the position of the least significant bit of the member, otherwise it is
+ * 8 times the value returned by reflect_member_offset.
+ *
+ * @param self The member.
+ * @return The offset in bits or -1 on error.
+ */
+ptrdiff_t reflect_member_bit_offset(reflect_member_t* self);
+
+/**
+ * Returns the width of a bitfield member.
+ *
+ * @param self The member.
+ * @return The width in bits or 0 if the member is not a bitfield.
+ */
+size_t reflect_member_bit_size(reflect_member_t* self);
+
+/**
+ * Checks whether a member is a bitfield.
+ *
+ * @param self The member.
+ * @return true if the member is a bitfield, false otherwise.
+ */
+bool reflect_member_is_bitfield(reflect_member_t* self);
+
 /**
  * Initialize a reflect_fn_t object with information about a function.
  *
@@ -185,6 +571,36 @@ ptrdiff_t reflect_member_offset(reflect_member_t* self);
  */
 reflect_fn_t* reflect_fn(reflect_fn_t* self, const char* name);
 
+/**
+ * Like reflect_fn, but reports nothing on error. See reflect_try_type.
+ *
+ * @param self Pointer to the reflect_fn_t object to initialize.
+ * @param name The name of the function.
+ * @return 0 on success, otherwise an error code: ESRCH if there is no such function.
+ */
+int reflect_try_fn(reflect_fn_t* self, const char* name);
+
+/**
+ * Initializes a reflect_fn_t object with information about the function containing a code
+ * address, such as a return address or a sampled program counter.
+ *
+ * Addresses are looked up in a sorted table of function ranges built on first use. Runtime
+ * addresses are accepted, the load bias of position independent executables is subtracted.
+ *
+ * @param self Pointer to the reflect_fn_t object to initialize.
+ * @param address The code address.
+ * @return NULL on error, otherwise self.
+ */
+reflect_fn_t* reflect_fn_by_addr(reflect_fn_t* self, uintptr_t address);
+
+/**
+ * Returns the name of a function.
+ *
+ * @param self The function.
+ * @return The function's name.
+ */
+const char* reflect_fn_name(reflect_fn_t* self);
+
 /**
  * Initialize a reflect_type_t object with information about a function's return type.
  *
@@ -210,6 +626,48 @@ reflect_var_t* reflect_fn_var_by_name(reflect_fn_t* self, const char* name, refl
  */
 reflect_var_t* reflect_var(reflect_var_t* self, const char* name);
 
+/**
+ * Like reflect_var, but reports nothing on error. See reflect_try_type.
+ *
+ * @param self Pointer to the reflect_var_t object to initialize.
+ * @param name The name of the global variable.
+ * @return 0 on success, otherwise an error code: ESRCH if there is no such variable.
+ */
+int reflect_try_var(reflect_var_t* self, const char* name);
+
+/**
+ * Initializes a reflect_var_t object with information about the global variable containing a
+ * data address. Like reflect_fn_by_addr, this uses a sorted table built on first use and accepts
+ * runtime addresses.
+ *
+ * @param self Pointer to the reflect_var_t object to initialize.
+ * @param address The data address.
+ * @return NULL on error, otherwise self.
+ */
+reflect_var_t* reflect_var_by_addr(reflect_var_t* self, uintptr_t address);
+
+/**
+ * Returns the address of a global or static variable in the running program.
+ *
+ * Locations that are an address, possibly offset by constants, are evaluated and the load bias of
+ * position independent executables is added. Variables in registers or thread-local storage and
+ * variables optimized away have no such address.
+ *
+ * @param self The variable.
+ * @return NULL on error, otherwise the address. ENODATA if the variable has no static address.
+ */
+void* reflect_var_address(reflect_var_t* self);
+
+/**
+ * Returns the address of a global or static variable in another process running the program the
+ * library was initialized with, for instance through /proc/PID/exe.
+ *
+ * @param self The variable.
+ * @param pid The process.
+ * @return 0 on error, otherwise the address in the memory of the process.
+ */
+uintptr_t reflect_var_remote_address(reflect_var_t* self, pid_t pid);
+
 /**
  * Initializes a reflect_type_t object with information about the type of a variable.
  *
@@ -237,6 +695,47 @@ const char* reflect_var_name(reflect_var_t* self);
  */
 reflect_location_t* reflect_location(reflect_location_t* self, reflect_obj_t* target);
 
+/**
+ * Initializes a reflect_location_t object with the source location of the code at an address.
+ *
+ * The line table of each compilation unit is decoded on first use and kept. Runtime addresses
+ * are accepted, the load bias of position independent executables is subtracted. For inlined
+ * code this is the location inside the inlined function, see reflect_frames_by_addr.
+ *
+ * @param self Pointer to the reflect_location_t object to initialize.
+ * @param address The code address.
+ * @return NULL on error, otherwise self.
+ */
+reflect_location_t* reflect_location_by_addr(reflect_location_t* self, uintptr_t address);
+
+/**
+ * Looks up the source locations of many code addresses at once.
+ *
+ * This works for any order, but is fastest when the addresses are sorted: each lookup then
+ * resumes where the previous one ended. Addresses without a location get a zeroed
+ * reflect_location_t.
+ *
+ * @param addresses The code addresses.
+ * @param count The number of addresses.
+ * @param out An array of count reflect_location_t objects to initialize.
+ * @return The number of addresses that were found.
+ */
+size_t reflect_locations_by_addr(const uintptr_t* addresses, size_t count, reflect_location_t* out);
+
+/**
+ * Expands a code address into its inlined frames, innermost first.
+ *
+ * The first frame is the function the code was inlined from and the source location of the code.
+ * Each following frame is the function it was inlined into and the location of the call. The
+ * last frame is the function that was actually compiled.
+ *
+ * @param address The code address.
+ * @param frames An array of max reflect_frame_t objects to initialize.
+ * @param max The maximum number of frames.
+ * @return The number of frames, 0 on error.
+ */
+size_t reflect_frames_by_addr(uintptr_t address, reflect_frame_t* frames, size_t max);
+
 #define REFLECT_SERIALIZER_JSON ((reflect_serializer_t*)1)
 #define REFLECT_SERIALIZER_XML  ((reflect_serializer_t*)2)
 #define REFLECT_SERIALIZER_C    ((reflect_serializer_t*)3)
@@ -246,9 +745,607 @@ FILE* reflect_serialize(const reflect_serializer_t* self,
                         reflect_type_t* type,
                         FILE* output);
 
-#define reflect_pretty_print(var) _reflect_pretty_print(&var, __func__, #var)
+/**
+ * Computes the size of the output of reflect_serialize() without writing it, so that a buffer can
+ * be allocated once.
+ *
+ * The built-in serializers are measured without formatting values other than floats. Any other
+ * serializer is run against a stream that counts bytes, which is always exact.
+ *
+ * @param self The serializer.
+ * @param object The object to measure.
+ * @param type The type of the object.
+ * @param mode Whether to compute the exact size or an upper bound.
+ * @return The size in bytes, 0 on error.
+ */
+size_t reflect_serialized_size(const reflect_serializer_t* self,
+                               void* object,
+                               reflect_type_t* type,
+                               reflect_size_mode_t mode);
+
+/**
+ * Serializes an array of objects.
+ *
+ * @param self The serializer.
+ * @param base Pointer to the first element.
+ * @param count The number of elements.
+ * @param type The type of the elements.
+ * @param output The stream to write to.
+ * @return NULL on error, otherwise output.
+ */
+FILE* reflect_serialize_array(const reflect_serializer_t* self,
+                              void* base,
+                              size_t count,
+                              reflect_type_t* type,
+                              FILE* output);
+
+/**
+ * Serializes an array of objects using several threads.
+ *
+ * The array is split into one contiguous slice per thread, each slice is formatted into a
+ * separate buffer and the buffers are written to output in order. The output is identical to
+ * that of reflect_serialize_array. Small arrays are serialized on the calling thread. The
+ * serializer callbacks must be safe to call concurrently on different streams.
+ *
+ * @param self The serializer.
+ * @param base Pointer to the first element.
+ * @param count The number of elements.
+ * @param type The type of the elements.
+ * @param output The stream to write to.
+ * @param threads The number of threads to use, 0 for one per online CPU.
+ * @return NULL on error, otherwise output.
+ */
+FILE* reflect_serialize_array_parallel(const reflect_serializer_t* self,
+                                       void* base,
+                                       size_t count,
+                                       reflect_type_t* type,
+                                       FILE* output,
+                                       size_t threads);
+
+/**
+ * Serializes an object in the memory of another process running the program the library was
+ * initialized with.
+ *
+ * The object and everything it points to are copied with process_vm_readv(2), one call per level
+ * of pointers, and the copy is serialized. The process is not stopped, so an object it modifies
+ * meanwhile may be caught halfway. Pointers that cannot be read, and pointers deeper than 64
+ * levels, are written as NULL. Strings are cut at 64KiB.
+ *
+ * @param self The serializer.
+ * @param pid The process, which the caller must be allowed to ptrace.
+ * @param address The address of the object in the process, see reflect_var_remote_address.
+ * @param type The type of the object.
+ * @param output The stream to write to.
+ * @return NULL on error, otherwise output.
+ */
+FILE* reflect_serialize_remote(const reflect_serializer_t* self,
+                               pid_t pid,
+                               uintptr_t address,
+                               reflect_type_t* type,
+                               FILE* output);
+
+/**
+ * Serializes an object into a list of buffers suitable for writev(2).
+ *
+ * Structure, escape sequences and short strings are copied into scratch memory owned by the
+ * reflect_iovec_t, but long unescaped runs of strings are referenced in place. The object must
+ * therefore outlive the reflect_iovec_t (or at least the last write). Output is appended, so the
+ * same reflect_iovec_t may be used for several objects. A zero initialized reflect_iovec_t is
+ * empty.
+ *
+ * @param self The serializer.
+ * @param object The object to serialize.
+ * @param type The type of the object.
+ * @param output The reflect_iovec_t to append to.
+ * @return NULL on error, otherwise output.
+ */
+reflect_iovec_t* reflect_serialize_iov(const reflect_serializer_t* self,
+                                       void* object,
+                                       reflect_type_t* type,
+                                       reflect_iovec_t* output);
+
+/**
+ * Returns the total number of bytes referenced by a reflect_iovec_t.
+ *
+ * @param self The reflect_iovec_t.
+ * @return The size in bytes.
+ */
+size_t reflect_iovec_size(const reflect_iovec_t* self);
+
+/**
+ * Writes the contents of a reflect_iovec_t to a file descriptor, retrying after short writes.
+ *
+ * @param self The reflect_iovec_t.
+ * @param fd The file descriptor.
+ * @return The number of bytes written or -1 on error.
+ */
+ssize_t reflect_iovec_write(const reflect_iovec_t* self, int fd);
+
+/**
+ * Releases the memory owned by a reflect_iovec_t and leaves it empty.
+ *
+ * @param self The reflect_iovec_t.
+ */
+void reflect_iovec_free(reflect_iovec_t* self);
+
+/**
+ * Exports an array of objects column by column.
+ *
+ * Every scalar member becomes a column, including the members of nested structs (named like
+ * "outer.inner") and the elements of fixed size arrays (named like "values[2]"). Pointers,
+ * strings and unions are left out. The binary format gathers every column into memory first, so
+ * it needs about as much memory as the array itself.
+ *
+ * @param base Pointer to the first element.
+ * @param count The number of elements.
+ * @param type The type of the elements.
+ * @param format The output format.
+ * @param output The stream to write to.
+ * @return NULL on error, otherwise output.
+ */
+FILE* reflect_export_columns(void* base,
+                             size_t count,
+                             reflect_type_t* type,
+                             reflect_columns_format_t format,
+                             FILE* output);
+
+/**
+ * Writes an array of objects as a record stream, which reflect_records_open can read into later
+ * versions of the type.
+ *
+ * The stream starts with a header describing the members that reflect_export_columns would
+ * export: the magic "RRECORD1", the record size (uint64_t), the member count and the header size
+ * (uint32_t each), then for each member: its offset in a record (uint64_t), the length of its
+ * name (uint32_t), its reflect_repr_t, its size, flags (1 for enums, 2 for bitfields), the width
+ * and the shift of bitfields as bytes, three zero bytes, and the name. Bitfields are described by
+ * the bytes they are loaded from. The header is padded to a multiple of 8 bytes and followed by
+ * the objects as they are in memory, so more can be appended with fwrite.
+ *
+ * @param base Pointer to the first element.
+ * @param count The number of elements, 0 to only write the header.
+ * @param type The type of the elements.
+ * @param output The stream to write to.
+ * @return NULL on error, otherwise output.
+ */
+FILE* reflect_write_records(const void* base, size_t count, reflect_type_t* type, FILE* output);
 
-void _reflect_pretty_print(const void*, const char*, const char*);
+/**
+ * Starts reading a record stream written by reflect_write_records, possibly by a build in which
+ * the type had a different layout.
+ *
+ * Members are matched by name, members of nested structs and elements of arrays included.
+ * Integers are widened or narrowed and floating point values converted as needed, integers
+ * convert to floating point too. Members the stream does not have, or has with a type that does
+ * not convert, keep their default values, and members the type no longer has are skipped. The
+ * matching is done once per header and type, and later streams with the same header reuse it
+ * while it stays among the 64 most recently used.
+ *
+ * @param input The stream to read from, positioned at the header.
+ * @param type The type to read records as.
+ * @param defaults An object of the type holding the default values, NULL for zeroes. It must stay
+ * valid until reflect_records_close.
+ * @return NULL on error or if the header is malformed, otherwise the reader to pass to
+ * reflect_records_read and reflect_records_close.
+ */
+reflect_records_t* reflect_records_open(FILE* input, reflect_type_t* type, const void* defaults);
+
+/**
+ * Reads records.
+ *
+ * @param self The reader.
+ * @param out Room for count objects of the type of the reader.
+ * @param count The number of records to read.
+ * @return The number of records read, fewer than count at the end of the stream or on a read
+ * error, see ferror.
+ */
+size_t reflect_records_read(reflect_records_t* self, void* out, size_t count);
+
+/**
+ * Releases a reader. The stream is not closed.
+ *
+ * @param self The reader, NULL is ignored.
+ */
+void reflect_records_close(reflect_records_t* self);
+
+/**
+ * Writes an object, and everything it points to, in a buffer that reflect_view_open reads in
+ * place.
+ *
+ * Objects are written as they are in memory, so members are found at the offsets the type layout
+ * gives them. Pointers and strings hold offsets into the buffer instead of addresses, 0 for NULL
+ * and for pointers to void. Each type written gets a table of its members, named like the columns
+ * of reflect_export_columns, except that strings, pointers and char arrays are members too.
+ * Unions have no members and are written as zeros. The buffer uses the byte order and pointer size
+ * of the writer.
+ *
+ * @param object The object to write.
+ * @param type The type of the object.
+ * @param output The stream to write to.
+ * @return NULL on error, otherwise output.
+ */
+FILE* reflect_write_view(const void* object, reflect_type_t* type, FILE* output);
+
+/**
+ * Opens a view on a buffer written by reflect_write_view, such as a mapped file or a message. The
+ * buffer is not copied or decoded, every read is checked against its bounds.
+ *
+ * @param self Pointer to the reflect_view_t object to fill.
+ * @param buffer The buffer, which must stay valid as long as views on it are used.
+ * @param size The size of the buffer.
+ * @return NULL if the buffer is not a view, otherwise self.
+ */
+reflect_view_t* reflect_view_open(reflect_view_t* self, const void* buffer, size_t size);
+
+/**
+ * Looks up a member of the object of a view by name, with a binary search in the table of its
+ * type.
+ *
+ * The result can be reused with any view of an object of the same type written by the same build,
+ * which makes reading it a bounds check and a load.
+ *
+ * @param self The view.
+ * @param path The name of the member, like "outer.inner" or "values[2]".
+ * @param out Pointer to the reflect_view_member_t object to fill.
+ * @return NULL on error or if there is no such member, otherwise out.
+ */
+reflect_view_member_t* reflect_view_member(const reflect_view_t* self,
+                                           const char* path,
+                                           reflect_view_member_t* out);
+
+/**
+ * Reads an integer, boolean, enum or bitfield member.
+ *
+ * @param self The view.
+ * @param member The member, from reflect_view_member.
+ * @return The value, unsigned values cast to int64_t. 0 on error, or if the member was looked up
+ * for another type.
+ */
+int64_t reflect_view_int(const reflect_view_t* self, const reflect_view_member_t* member);
+
+/**
+ * Reads a floating point member, or an integer member converted to double.
+ *
+ * @param self The view.
+ * @param member The member, from reflect_view_member.
+ * @return The value, 0 on error.
+ */
+double reflect_view_float(const reflect_view_t* self, const reflect_view_member_t* member);
+
+/**
+ * Reads a string or char array member, in place.
+ *
+ * @param self The view.
+ * @param member The member, from reflect_view_member.
+ * @param length Set to the length of the string unless NULL. Char arrays that fill their member
+ * are not NUL-terminated.
+ * @return A pointer into the buffer, NULL on error or for NULL strings.
+ */
+const char* reflect_view_string(const reflect_view_t* self,
+                                const reflect_view_member_t* member,
+                                size_t* length);
+
+/**
+ * Opens a view on the object a pointer member points to.
+ *
+ * @param self The view.
+ * @param member The member, from reflect_view_member.
+ * @param out Pointer to the reflect_view_t object to fill.
+ * @return NULL on error or if the pointer is NULL, otherwise out.
+ */
+reflect_view_t* reflect_view_child(const reflect_view_t* self,
+                                   const reflect_view_member_t* member,
+                                   reflect_view_t* out);
+
+/**
+ * Hashes an object by value.
+ *
+ * Padding is skipped, strings are hashed by contents and pointers by the object they point to, so
+ * objects for which reflect_equals returns true hash the same. Floating point values are
+ * normalized first: 0.0 and -0.0 hash the same, and so do all NaNs. Unions and types that cannot
+ * be reflected are hashed as raw bytes.
+ *
+ * @param object The object to hash.
+ * @param type The type of the object.
+ * @return The hash, 0 on error.
+ */
+uint64_t reflect_hash(const void* object, reflect_type_t* type);
+
+/**
+ * Compares two objects for equality by value.
+ *
+ * Padding is skipped, strings are compared by contents and pointers by the objects they point to.
+ * Two NULL pointers are equal, a NULL and a non-NULL pointer are not. Pointers are followed up to
+ * 256 levels deep, after which they are compared by address. Floating point members compare equal
+ * when they are numerically equal or both NaN.
+ *
+ * @param a The first object.
+ * @param b The second object.
+ * @param type The type of the objects.
+ * @return true if the objects are equal, false if not or on error.
+ */
+bool reflect_equals(const void* a, const void* b, reflect_type_t* type);
+
+/**
+ * Orders two objects member by member, in declaration order.
+ *
+ * Integers and enumerations compare by value, strings with strcmp, floating point values in a
+ * total order where NaN is greater than everything else, and pointers by the objects they point
+ * to, NULL first. Unions compare like memcmp. The order agrees with reflect_equals.
+ *
+ * @param a The first object.
+ * @param b The second object.
+ * @param type The type of the objects.
+ * @return A negative value, zero or a positive value when a is less than, equal to or greater
+ * than b. 0 on error.
+ */
+int reflect_compare(const void* a, const void* b, reflect_type_t* type);
+
+/**
+ * Deep copies an object into an arena.
+ *
+ * Strings and the objects that pointers point to are copied too, recursively, while everything
+ * else is copied as is. An object reachable along several paths is copied once, so sharing and
+ * cycles are preserved. Pointers to void and to incomplete types are not followed, and a pointer
+ * is assumed to point to a single object, not into an array. On error, whatever was copied so far
+ * stays in the arena until it is reset.
+ *
+ * @param object The object to clone.
+ * @param type The type of the object.
+ * @param arena The arena to allocate the clone from.
+ * @return The clone or NULL on error.
+ */
+void* reflect_clone(const void* object, reflect_type_t* type, reflect_arena_t* arena);
+
+/**
+ * Analyzes how a struct uses its bytes: padding holes, members straddling cache lines, locks and
+ * atomics sharing cache lines with other members, and a member order that wastes less space.
+ *
+ * @param type The struct type.
+ * @param out Pointer to the reflect_layout_report_t object to fill. Release it with
+ * reflect_layout_report_free.
+ * @return NULL on error, otherwise out.
+ */
+reflect_layout_report_t* reflect_layout_analyze(reflect_type_t* type, reflect_layout_report_t* out);
+
+/**
+ * Releases the memory owned by a reflect_layout_report_t.
+ *
+ * @param self The report.
+ */
+void reflect_layout_report_free(reflect_layout_report_t* self);
+
+/**
+ * Analyzes every named struct of the program, ranked by wasted bytes, most first.
+ *
+ * @param count Set to the number of reports.
+ * @return An array of reports to release with reflect_layout_rank_free, NULL on error.
+ */
+reflect_layout_report_t* reflect_layout_rank(size_t* count);
+
+/**
+ * Releases an array of reports returned by reflect_layout_rank.
+ *
+ * @param reports The reports.
+ * @param count The number of reports.
+ */
+void reflect_layout_rank_free(reflect_layout_report_t* reports, size_t count);
+
+/**
+ * Prints a report in the style of pahole.
+ *
+ * @param self The report.
+ * @param output The stream to write to.
+ * @return NULL on error, otherwise output.
+ */
+FILE* reflect_layout_print(const reflect_layout_report_t* self, FILE* output);
+
+/**
+ * Measures the memory reachable from an object, per type.
+ *
+ * Pointers are followed like reflect_clone does: strings and pointers to complete types, each
+ * address counted once however often and through whatever types it is reached. An object counts
+ * with the size of its type and a string with its length plus one, so arrays behind pointers count
+ * one element and allocator overhead is not included. Every pointer must be valid.
+ *
+ * @param object The root object, counted as well.
+ * @param type The type of the object.
+ * @param out Pointer to the reflect_footprint_t object to fill, to release with
+ * reflect_footprint_free.
+ * @return NULL on error, otherwise out.
+ */
+reflect_footprint_t* reflect_footprint(const void* object,
+                                       reflect_type_t* type,
+                                       reflect_footprint_t* out);
+
+/**
+ * Releases the entries of a footprint.
+ *
+ * @param self The footprint.
+ */
+void reflect_footprint_free(reflect_footprint_t* self);
+
+/**
+ * Prints a footprint as a table, the types using the most bytes first.
+ *
+ * @param self The footprint.
+ * @param output The stream to write to.
+ * @return NULL on error, otherwise output.
+ */
+FILE* reflect_footprint_print(const reflect_footprint_t* self, FILE* output);
+
+/**
+ * Starts the background thread that formats entries logged with reflect_log.
+ *
+ * @param serializer The serializer to format entries with, one per line.
+ * @param output The stream to write to. Only the background thread writes to it until
+ * reflect_log_stop returns.
+ * @param options The ring size and the policy when a ring is full, NULL for the defaults.
+ * @return 0 on success, -1 on failure or if logging is already started.
+ */
+int reflect_log_start(const reflect_serializer_t* serializer,
+                      FILE* output,
+                      const reflect_log_options_t* options);
+
+/**
+ * Logs an object without formatting it on the calling thread.
+ *
+ * The object and the strings it points to are copied into a ring owned by the calling thread, and
+ * the background thread formats the copy later. Pointers other than strings are logged as NULL,
+ * since what they point to may be gone by then.
+ *
+ * @param object The object to log.
+ * @param type The type of the object.
+ * @return true if the object was logged, false if it was dropped or on error.
+ */
+bool reflect_log(const void* object, reflect_type_t* type);
+
+/**
+ * Reads the counters of the logger.
+ *
+ * @param out Pointer to the reflect_log_stats_t object to fill.
+ * @return NULL on error or if logging is not started, otherwise out.
+ */
+reflect_log_stats_t* reflect_log_stats(reflect_log_stats_t* out);
+
+/**
+ * Formats everything logged so far and stops the background thread.
+ *
+ * No thread may call reflect_log concurrently, and this must be called before reflect_fini.
+ *
+ * @param stats Filled with the final counters unless NULL.
+ */
+void reflect_log_stop(reflect_log_stats_t* stats);
+
+/**
+ * Starts a background thread that periodically writes the values of global variables.
+ *
+ * The variables are found by name when starting. Each sample copies all of them, then writes one
+ * line with a struct holding a time member, in nanoseconds since the epoch, and a member per
+ * variable. Nothing in the program needs to change, but the variables are read without
+ * synchronization: each counter is read whole if it is naturally aligned, but a struct may be
+ * read halfway through an update.
+ *
+ * @param serializer The serializer to format samples with.
+ * @param output The stream to write to. Only the background thread writes to it until
+ * reflect_metrics_stop returns.
+ * @param names The names of the variables.
+ * @param count The number of names.
+ * @param options The interval between samples, NULL for the defaults.
+ * @return 0 on success, -1 on failure, if a variable has no static address or if the export is
+ * already started.
+ */
+int reflect_metrics_start(const reflect_serializer_t* serializer,
+                          FILE* output,
+                          const char* const* names,
+                          size_t count,
+                          const reflect_metrics_options_t* options);
+
+/**
+ * Reads the counters of the metrics export.
+ *
+ * @param out Pointer to the reflect_metrics_stats_t object to fill.
+ * @return NULL on error or if the export is not started, otherwise out.
+ */
+reflect_metrics_stats_t* reflect_metrics_stats(reflect_metrics_stats_t* out);
+
+/**
+ * Stops the metrics export. This must be called before reflect_fini.
+ *
+ * @param stats Filled with the final counters unless NULL.
+ */
+void reflect_metrics_stop(reflect_metrics_stats_t* stats);
+
+/**
+ * Installs handlers for SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT that write the values of
+ * global variables to a file descriptor when the program crashes.
+ *
+ * The variables are found by name and their types resolved when starting, so the handlers only
+ * format memory and call async-signal-safe functions. They write one line of JSON with the signal,
+ * the faulting address, the program counter, the name of the function it is in, its parameters and
+ * locals, and a member per variable, then let the signal take its default action. Pointers are
+ * followed a few levels deep, and only when the memory they point to can be read. The handlers run
+ * on the alternate signal stack if one is set up with sigaltstack, which a stack overflow needs.
+ *
+ * The parameters and the locals at the top of every function are resolved when starting as well,
+ * which takes longer the larger the program. Only those at a fixed offset from a register or the
+ * frame base, or at a static address, have values in the dump, others are null. Optimized code
+ * mostly keeps them in registers, so they are best read from code compiled with -O0 or -Og.
+ *
+ * @param fd The file descriptor to write to. It must stay open until reflect_crash_stop.
+ * @param names The names of the variables.
+ * @param count The number of names.
+ * @return 0 on success, -1 on failure, if a variable has no static address or if the handlers
+ * are already installed.
+ */
+int reflect_crash_start(int fd, const char* const* names, size_t count);
+
+/**
+ * Writes the crash dump, for signal handlers of the program that replace those of
+ * reflect_crash_start. This is async-signal-safe, and does nothing unless reflect_crash_start
+ * succeeded.
+ *
+ * @param signal The signal number.
+ * @param address The faulting address, si_addr, or 0.
+ * @param context The ucontext_t the handler got as its third argument, or NULL. The program
+ * counter and the locals of the crashing function are read from it.
+ */
+void reflect_crash_dump(int signal, uintptr_t address, const void* context);
+
+/**
+ * Restores the previous signal handlers. This must be called before reflect_fini, and not while
+ * a handler may run.
+ */
+void reflect_crash_stop(void);
+
+/**
+ * Writes compact descriptors of the types, global variables and functions of the program.
+ *
+ * The output is meant to be added to a stripped copy of the program as a section named .reflect,
+ * for example with objcopy --add-section .reflect=FILE, which is what reflect-embed does.
+ * reflect_init falls back to that section when the program has no DWARF. Lookups of types,
+ * global variables and functions by name or address, enumerators, serialization, comparison and
+ * cloning then work as usual, except that typedef names resolve to the types they name. Members,
+ * locals, parameters, source locations and layout analysis still need DWARF.
+ *
+ * @param output The stream to write to.
+ * @param types The names of the types to describe, along with the types they refer to and the
+ * global variables of those types. NULL describes every named type and every global variable.
+ * @param count The number of names in types.
+ * @return The number of bytes written, 0 on error.
+ */
+size_t reflect_write_descriptors(FILE* output, const char** types, size_t count);
+
+/**
+ * Prints a local variable or parameter of the calling function as C to stdout.
+ *
+ * The variable is looked up by name the first time a call site runs and cached in a static slot
+ * at that site, so later calls only format the value.
+ *
+ * @param var The variable.
+ */
+#define reflect_pretty_print(var) reflect_pretty_print_to(var, REFLECT_SERIALIZER_C, stdout)
+
+/**
+ * Like reflect_pretty_print, but with any serializer and stream. Only the C serializer prints
+ * the type and name of the variable before its value.
+ *
+ * @param var The variable.
+ * @param serializer The serializer.
+ * @param output The stream to write to.
+ */
+#define reflect_pretty_print_to(var, serializer, output)                                           \
+    do                                                                                             \
+    {                                                                                              \
+        static reflect_site_t _reflect_site;                                                       \
+        _reflect_pretty_print(&_reflect_site, &(var), __func__, #var, (serializer), (output));     \
+    } while (0)
+
+void _reflect_pretty_print(reflect_site_t* site,
+                           const void* object,
+                           const char* func_name,
+                           const char* var_name,
+                           const reflect_serializer_t* serializer,
+                           FILE* output);
 
 struct reflect_obj
 {
@@ -276,4 +1373,66 @@ struct reflect_var
     reflect_obj_t _impl;
 };
 
+struct reflect_const
+{
+    reflect_obj_t _impl;
+};
+
+struct reflect_frame
+{
+    reflect_fn_t fn;
+    reflect_location_t location;
+};
+
+struct reflect_site
+{
+    struct
+    {
+        void* layout;
+        const char* type_name;
+        uint64_t generation;
+    } _impl;
+};
+
+struct reflect_iovec
+{
+    struct iovec* iov;
+    size_t count;
+
+    struct
+    {
+        size_t capacity;
+        void* scratch;
+    } _impl;
+};
+
+struct reflect_view
+{
+    struct
+    {
+        const uint8_t* blob;
+        size_t size;
+        uint64_t object;
+        uint64_t object_size;
+        uint64_t table;
+        uint64_t schema;
+        uint64_t member_count;
+    } _impl;
+};
+
+struct reflect_view_member
+{
+    struct
+    {
+        uint64_t schema;
+        uint64_t offset;
+        uint32_t index;
+        uint32_t size;
+        uint8_t kind;
+        uint8_t repr;
+        uint8_t bit_size;
+        uint8_t shift;
+    } _impl;
+};
+
 #endif // REFLECT_H